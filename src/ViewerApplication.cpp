@@ -1,7 +1,13 @@
 #include "ViewerApplication.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <numeric>
+#include <set>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
@@ -10,11 +16,89 @@
 
 #include "utils/cameras.hpp"
 #include "utils/gltf.hpp"
+#include "utils/gpu_timers.hpp"
 #include "utils/images.hpp"
+#include "utils/instancing.hpp"
+#include "utils/ktx2.hpp"
+#include "utils/material_table.hpp"
+#include "utils/memory_usage.hpp"
+#include "utils/mipmaps.hpp"
+#include "utils/multi_draw.hpp"
+#include "utils/node_table.hpp"
+#include "utils/orm_textures.hpp"
+#include "utils/render_queue.hpp"
+#include "utils/scene_cache.hpp"
+#include "utils/texture_budget.hpp"
+#include "utils/uniform_buffers.hpp"
 
 #include <stb_image_write.h>
 #include <tiny_gltf.h>
 
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+// From GL_EXT_texture_compression_s3tc, which glad is not generated with
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+// From GL_EXT_texture_sRGB, part of core since 2.1 but not its S3TC formats
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+// From GL_NVX_gpu_memory_info and GL_ATI_meminfo, in kilobytes
+#ifndef GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+namespace
+{
+
+// Share of the free video memory given to textures by autoTextureBudget, the
+// rest is left to geometry, framebuffers and other applications
+const double autoTextureBudgetShare = 0.75;
+
+// Pages of virtual textures copied to the page cache per frame, so that a
+// sudden change of view does not stall a frame
+const size_t maxVirtualPageLoads = 32;
+
+// With lowMipsFirst, size of the first level of streamed textures
+const int coarseMipSize = 32;
+
+// Color images only get BC1 or BC7, the formats with sRGB variants
+GLenum compressedInternalFormat(BlockFormat format, bool srgb)
+{
+  switch (format) {
+  case BlockFormat::BC1:
+    return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+                : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case BlockFormat::BC4:
+    return GL_COMPRESSED_RED_RGTC1;
+  case BlockFormat::BC5:
+    return GL_COMPRESSED_RG_RGTC2;
+  case BlockFormat::BC7:
+    return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+                : GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+  return GL_COMPRESSED_RGBA_BPTC_UNORM;
+}
+
+// Convert 16 bits pixels to 8 bits in place, for formats without a 16 bits
+// variant
+void convertTo8Bits(tinygltf::Image &image)
+{
+  const auto count = image.image.size() / 2;
+  for (size_t i = 0; i < count; ++i) {
+    uint16_t value;
+    std::memcpy(&value, image.image.data() + 2 * i, sizeof(value));
+    image.image[i] = (unsigned char)((value * 255u + 32767u) / 65535u);
+  }
+  image.image.resize(count);
+  image.bits = 8;
+  image.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+}
+
+} // namespace
+
 void keyCallback(
     GLFWwindow *window, int key, int scancode, int action, int mods)
 {
@@ -25,6 +109,7 @@ void keyCallback(
 
 int ViewerApplication::run()
 {
+  const auto runStart = glfwGetTime();
 
   // Setup OpenGL state for rendering
   glEnable(GL_DEPTH_TEST);
@@ -34,16 +119,54 @@ int ViewerApplication::run()
   bool render_with_ssao = false;
   int render_gbuffer_id = 0;
 
-  const auto glslProgram = compileProgram({m_ShadersRootPath / m_vertexShader,
-      m_ShadersRootPath / m_fragmentShader});
+  auto shadersPhase = m_startupReport.phase("shaders");
+
+  // With srgbTextures, shader variants skip the gamma conversions done by the
+  // texture units and, if the default framebuffer is sRGB capable, by the
+  // framebuffer. Rendering to an image keeps encoding in the shaders.
+  bool srgbFramebuffer = false;
+  std::vector<std::string> colorDefines;
+  if (m_options.srgbTextures) {
+    colorDefines.push_back("SRGB_TEXTURES");
+    if (m_OutputPath.empty()) {
+      GLint encoding = GL_LINEAR;
+      glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT,
+          GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING, &encoding);
+      srgbFramebuffer = encoding == GL_SRGB;
+    }
+    if (srgbFramebuffer) {
+      colorDefines.push_back("SRGB_FRAMEBUFFER");
+    } else {
+      std::clog << "No sRGB framebuffer, shaders encode their output"
+                << std::endl;
+    }
+  }
+  // Materials are packed once loaded, and their occlusion read from the red
+  // channel of their metallic-roughness texture
+  if (m_options.ormTextures) {
+    colorDefines.push_back("ORM_TEXTURES");
+  }
+  // Matrices are read from per instance attributes instead of uniforms
+  if (m_options.instancing) {
+    for (const auto &define : InstanceBuffer::shaderDefines()) {
+      colorDefines.push_back(define);
+    }
+  }
+
+  const auto glslProgram = compileProgram(
+      {m_ShadersRootPath / m_vertexShader,
+          m_ShadersRootPath / m_fragmentShader},
+      colorDefines);
 
   const auto glslProgramdGeometry =
       compileProgram({m_ShadersRootPath / m_vertexShaderGBuffer,
-          m_ShadersRootPath / m_fragmentShaderGBuffer});
+                         m_ShadersRootPath / m_fragmentShaderGBuffer},
+          colorDefines);
 
   const auto glslProgramdShading =
       compileProgram({m_ShadersRootPath / m_vertexShaderDShading,
-          m_ShadersRootPath / m_fragmentShaderDShading});
+                         m_ShadersRootPath / m_fragmentShaderDShading},
+          colorDefines);
 
   const auto glslProgramdSsao =
       compileProgram({m_ShadersRootPath / m_vertexShaderSsao,
@@ -68,32 +191,57 @@ int ViewerApplication::run()
   Locations locationSsaoBlur;
   loadLocations(glslProgramdSsaoBlur.glId(), locationSsaoBlur);
 
+  shadersPhase.end();
+
   tinygltf::Model model;
-  if (!loadGltfFile(model)) {
-    return -1;
-  }
+  GltfBuffers buffers;
   glm::vec3 bboxMin, bboxMax;
-  computeSceneBounds(model, bboxMin, bboxMax);
 
-  // Build projection matrix
-  const auto diag = bboxMax - bboxMin;
-  auto maxDistance = glm::length(diag);
-  const auto projMatrix =
-      glm::perspective(70.f, float(m_nWindowWidth) / m_nWindowHeight,
-          0.001f * maxDistance, 1.5f * maxDistance);
+  // In progressive mode the model is parsed in the background and streamed to
+  // the GPU a few pieces per frame, while the render loop is already running.
+  // Otherwise everything is loaded before the first frame.
+  const auto progressive = m_options.progressive && m_OutputPath.empty();
+  std::future<bool> sceneLoading;
+  bool sceneLoaded = false;   // model can be read by the render loop
+  bool sceneStreamed = false; // All GPU objects of model are created
+  bool cacheHit = false;
+  if (progressive) {
+    sceneLoading = m_threadPool.submit([&]() {
+      return loadGltfFile(model, buffers, bboxMin, bboxMax, cacheHit);
+    });
+  } else {
+    if (!loadGltfFile(model, buffers, bboxMin, bboxMax, cacheHit)) {
+      return -1;
+    }
+    sceneLoaded = true;
+  }
 
+  glm::mat4 projMatrix(1);
+  float maxDistance = 1.f;
   std::unique_ptr<CameraController> cameraController =
       std::make_unique<TrackballCameraController>(
           m_GLFWHandle.window(), 0.5f * maxDistance);
-  if (m_hasUserCamera) {
-    cameraController->setCamera(m_userCamera);
-  } else {
-    const auto center = 0.5f * (bboxMax + bboxMin);
-    const auto up = glm::vec3(0, 1, 0);
-    const auto eye =
-        diag.z > 0 ? center + diag : center + 2.f * glm::cross(diag, up);
-    cameraController->setCamera(Camera{eye, center, up});
-  }
+
+  const auto setupCamera = [&]() {
+    // Build projection matrix
+    const auto diag = bboxMax - bboxMin;
+    maxDistance = glm::length(diag);
+    projMatrix =
+        glm::perspective(70.f, float(m_nWindowWidth) / m_nWindowHeight,
+            0.001f * maxDistance, 1.5f * maxDistance);
+
+    cameraController = std::make_unique<TrackballCameraController>(
+        m_GLFWHandle.window(), 0.5f * maxDistance);
+    if (m_hasUserCamera) {
+      cameraController->setCamera(m_userCamera);
+    } else {
+      const auto center = 0.5f * (bboxMax + bboxMin);
+      const auto up = glm::vec3(0, 1, 0);
+      const auto eye =
+          diag.z > 0 ? center + diag : center + 2.f * glm::cross(diag, up);
+      cameraController->setCamera(Camera{eye, center, up});
+    }
+  };
 
   // Init light parameters
   glm::vec3 lightDirection(1, 1, 1);
@@ -101,8 +249,15 @@ int ViewerApplication::run()
   bool lightFromCamera = false;
   bool applyOcclusion = true;
 
-  // Load textures
-  const auto textureObjects = createTextureObjects(model);
+  if (m_options.uploadRingSize > 0) {
+    try {
+      m_pixelUploadRing =
+          std::make_unique<PixelUploadRing>(m_options.uploadRingSize);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what() << ", uploading textures from client memory"
+                << std::endl;
+    }
+  }
 
   GLuint whiteTexture = 0;
 
@@ -118,19 +273,299 @@ int ViewerApplication::run()
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_REPEAT);
   glBindTexture(GL_TEXTURE_2D, 0);
 
-  const auto bufferObjects = createBufferObjects(model);
-
+  // GPU objects of the scene. While streaming, objects not uploaded yet are 0
+  std::vector<GLuint> textureObjects; // Per image, shared by identical images
+  std::vector<int> imageSources;      // See uniqueImages()
+  std::vector<GLuint> samplerObjects; // Per sampler, then the default sampler
+  std::vector<GLuint> bufferObjects;
   std::vector<VaoRange> meshToVertexArrays;
-  const auto vertexArrayObjects =
-      createVertexArrayObjects(model, bufferObjects, meshToVertexArrays);
+  std::vector<GLuint> vertexArrayObjects;
+  SceneStreamingState streaming;
+  // Nodes of the default scene with their world matrices, drawn in order
+  NodeTable nodeTable;
+  // World matrices recomputed at the start of the frame, after nodes are
+  // edited in the GUI
+  size_t updatedWorldMatrices = 0;
+  // Center of each primitive, in the order of vertexArrayObjects, for the
+  // depth of its draws
+  std::vector<glm::vec3> primitiveCenters;
+
+  // Material buffer path, set up once the scene is fully uploaded. Until then,
+  // or if it cannot be set up, draws bind the textures of their material.
+  std::unique_ptr<MaterialTable> materialTable;
+  std::unique_ptr<GLProgram> materialProgram;
+  std::unique_ptr<GLProgram> materialProgramGeometry;
+  Locations materialLocation;
+  Locations materialLocationGBuffer;
+  // Virtual textures read by the material table, and the program of their
+  // feedback pass
+  std::unique_ptr<VirtualTextureCache> virtualTextures;
+  std::unique_ptr<GLProgram> feedbackProgram;
+  Locations feedbackLocation;
+  GLint feedbackFrameLocation = -1;
+  // With the material buffer, the scene packed for multi-draw indirect calls,
+  // or the buffers replacing the uniforms of draws
+  std::unique_ptr<MultiDrawScene> multiDraw;
+  std::unique_ptr<UniformBuffers> uniformBuffers;
+  const auto setupMaterialTable = [&]() {
+    const auto mode = m_bindlessSupported && !m_options.textureArrays
+                          ? MaterialTable::TextureMode::Bindless
+                          : MaterialTable::TextureMode::TextureArrays;
+    GLint textureUnits = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &textureUnits);
+    try {
+      std::unique_ptr<VirtualTextureCache> cache;
+      std::unique_ptr<MaterialTable> table;
+      auto defines = colorDefines;
+      if (m_options.virtualTextureBudget > 0) {
+        std::vector<int> virtualImages;
+        cache = createVirtualTextures(model, imageSources, virtualImages);
+        table = std::make_unique<MaterialTable>(model, virtualImages, *cache);
+        // The page cache is not in an sRGB format
+        defines.erase(std::remove(begin(defines), end(defines),
+                          std::string("SRGB_TEXTURES")),
+            end(defines));
+      } else {
+        table = std::make_unique<MaterialTable>(
+            model, textureObjects, samplerObjects, mode, size_t(textureUnits));
+      }
+      for (const auto &define : table->shaderDefines()) {
+        defines.push_back(define);
+      }
+      // Packed before finishSceneUpload() may release the buffers, and drawn
+      // per primitive if it cannot be
+      std::unique_ptr<MultiDrawScene> scene;
+      std::vector<std::string> feedbackDefines;
+      if (m_options.multiDraw && !m_drawParametersSupported) {
+        std::cerr << "GL_ARB_shader_draw_parameters is not supported, drawing "
+                     "per primitive"
+                  << std::endl;
+      } else if (m_options.multiDraw) {
+        try {
+          scene = std::make_unique<MultiDrawScene>(
+              model, buffers.bytes, nodeTable, table->defaultMaterial());
+          for (const auto &define : MultiDrawScene::shaderDefines()) {
+            defines.push_back(define);
+          }
+        } catch (const std::runtime_error &e) {
+          std::cerr << e.what() << ", drawing per primitive" << std::endl;
+        }
+      }
+      std::unique_ptr<UniformBuffers> uniforms;
+      if (m_options.uniformBuffers && !scene) {
+        uniforms = std::make_unique<UniformBuffers>(nodeTable);
+        // Matrices are read from the objects of draws instead
+        defines.erase(std::remove(begin(defines), end(defines),
+                          std::string("INSTANCING")),
+            end(defines));
+        for (const auto &define : UniformBuffers::shaderDefines()) {
+          defines.push_back(define);
+        }
+      }
+      if (scene) {
+        feedbackDefines = MultiDrawScene::shaderDefines();
+      } else if (uniforms) {
+        feedbackDefines = UniformBuffers::shaderDefines();
+      } else if (m_options.instancing) {
+        feedbackDefines = InstanceBuffer::shaderDefines();
+      }
+      auto program = std::make_unique<GLProgram>(
+          compileProgram({m_ShadersRootPath / m_vertexShader,
+                             m_ShadersRootPath / m_fragmentShader},
+              defines));
+      auto programGeometry = std::make_unique<GLProgram>(
+          compileProgram({m_ShadersRootPath / m_vertexShaderGBuffer,
+                             m_ShadersRootPath / m_fragmentShaderGBuffer},
+              defines));
+      loadLocations(program->glId(), materialLocation);
+      loadLocations(programGeometry->glId(), materialLocationGBuffer);
+      // Uniform buffers shaders read the material of each draw from its data,
+      // multi-draw shaders the matrices only
+      const auto indexLocation = [&](const Locations &location) {
+        return scene ? std::min(location.uDrawOffset, location.uMaterialIndex)
+                     : uniforms ? location.aDrawIndices
+                                : location.uMaterialIndex;
+      };
+      if (indexLocation(materialLocation) < 0 ||
+          indexLocation(materialLocationGBuffer) < 0) {
+        throw std::runtime_error(
+            std::string("Shaders do not read ") +
+            (scene ? "uDrawOffset and uMaterialIndex"
+                   : uniforms ? "aDrawIndices" : "uMaterialIndex"));
+      }
+      table->setupProgram(program->glId());
+      table->setupProgram(programGeometry->glId());
+      if (scene) {
+        scene->setupProgram(program->glId());
+        scene->setupProgram(programGeometry->glId());
+      }
+      if (uniforms) {
+        uniforms->setupProgram(program->glId());
+        uniforms->setupProgram(programGeometry->glId());
+      }
+      if (cache) {
+        // Same vertex shader as the geometry pass, so that the depth test
+        // keeps the pages of visible surfaces
+        feedbackProgram = std::make_unique<GLProgram>(
+            compileProgram({m_ShadersRootPath / m_vertexShaderGBuffer,
+                               m_ShadersRootPath /
+                                   "virtual_texture_feedback.fs.glsl"},
+                feedbackDefines));
+        loadLocations(feedbackProgram->glId(), feedbackLocation);
+        table->setupProgram(feedbackProgram->glId());
+        if (scene) {
+          scene->setupProgram(feedbackProgram->glId());
+        }
+        if (uniforms) {
+          uniforms->setupProgram(feedbackProgram->glId());
+        }
+        feedbackFrameLocation =
+            glGetUniformLocation(feedbackProgram->glId(), "uFrame");
+        glProgramUniform1f(feedbackProgram->glId(),
+            glGetUniformLocation(feedbackProgram->glId(), "uFeedbackLodBias"),
+            -std::log2(float(VirtualTextureCache::feedbackScale)));
+      }
+      virtualTextures = std::move(cache);
+      materialTable = std::move(table);
+      multiDraw = std::move(scene);
+      uniformBuffers = std::move(uniforms);
+      materialProgram = std::move(program);
+      materialProgramGeometry = std::move(programGeometry);
+    } catch (const std::runtime_error &e) {
+      std::cerr << e.what()
+                << (m_options.virtualTextureBudget > 0
+                           ? ", drawing without textures"
+                           : ", binding textures per draw")
+                << std::endl;
+      return;
+    }
+
+    if (virtualTextures) {
+      const auto toMB = [](size_t bytes) { return bytes / (1024. * 1024.); };
+      std::clog << "Material buffer: " << model.materials.size()
+                << " materials, " << virtualTextures->imageCount()
+                << " virtual textures of " << virtualTextures->pageCount()
+                << " pages, cached in " << virtualTextures->tileCount()
+                << " tiles (" << toMB(virtualTextures->cacheBytes())
+                << " MB of video memory)" << std::endl;
+    } else if (materialTable->textureMode() ==
+               MaterialTable::TextureMode::Bindless) {
+      std::clog << "Material buffer: " << model.materials.size()
+                << " materials, bindless textures" << std::endl;
+    } else {
+      // Texture arrays hold copies of the textures, which are not read anymore
+      std::set<GLuint> copiedTextures(
+          begin(textureObjects), end(textureObjects));
+      copiedTextures.erase(0);
+      for (const auto textureObject : copiedTextures) {
+        glDeleteTextures(1, &textureObject);
+      }
+      std::fill(begin(textureObjects), end(textureObjects), 0);
+      std::clog << "Material buffer: " << model.materials.size()
+                << " materials, " << materialTable->textureLayerCount()
+                << " textures in " << materialTable->textureArrayCount()
+                << " texture arrays" << std::endl;
+    }
+    if (multiDraw) {
+      std::clog << "Multi-draw: " << multiDraw->drawCount() << " draws in "
+                << multiDraw->callCount() << " calls of "
+                << multiDraw->groupCount() << " vertex formats, "
+                << multiDraw->geometryBytes() / (1024. * 1024.)
+                << " MB of packed geometry" << std::endl;
+    }
+    if (uniformBuffers) {
+      std::clog << "Uniform buffers: " << uniformBuffers->objectCount()
+                << " objects" << std::endl;
+    }
+  };
+
+  if (sceneLoaded) {
+    setupCamera();
+    nodeTable = NodeTable(model, buffers.bytes);
+    primitiveCenters = computePrimitiveCenters(model);
+
+    // Load textures
+    const auto texturesStart = glfwGetTime();
+    {
+      auto phase = m_startupReport.phase("textures");
+      textureObjects = createTextureObjects(model, imageSources);
+      samplerObjects = createSamplerObjects(model);
+      for (const auto &image : model.images) {
+        phase.addBytes(image.image.size());
+      }
+    }
+    std::set<GLuint> uniqueTextures(begin(textureObjects), end(textureObjects));
+    uniqueTextures.erase(0);
+    std::clog << "Created " << uniqueTextures.size() << " textures in "
+              << 1000. * (glfwGetTime() - texturesStart) << " ms" << std::endl;
+
+    {
+      auto phase = m_startupReport.phase("buffers");
+      bufferObjects = createBufferObjects(buffers.bytes);
+      for (const auto &buffer : buffers.bytes) {
+        phase.addBytes(buffer.size);
+      }
+    }
+
+    {
+      const auto phase = m_startupReport.phase("vertex_arrays");
+      vertexArrayObjects =
+          createVertexArrayObjects(model, bufferObjects, meshToVertexArrays);
+    }
+
+    // Virtual textures copy the decoded images, which may be released
+    if (m_options.materialBuffer) {
+      setupMaterialTable();
+    }
+    finishSceneUpload(model, buffers, bboxMin, bboxMax, cacheHit);
+    sceneStreamed = true;
+  }
 
+  auto gbufferPhase = m_startupReport.phase("gbuffer_ssao");
   // G buffer preparation
   createGBuffer();
   // SSAO preparation
   ssaoPrepare();
+  gbufferPhase.end();
+
+  // Written once the first frame is presented and the scene fully uploaded
+  bool startupReportWritten = !m_startupReport.enabled();
+  const auto writeStartupReport = [&]() {
+    if (!m_startupReport.write(m_options.startupReportPath)) {
+      std::cerr << "Unable to write startup report "
+                << m_options.startupReportPath << std::endl;
+    }
+    startupReportWritten = true;
+  };
+
+  // Bind the texture object of the image of textureIndex and the sampler object
+  // of the texture to unit, or fallback if there is none (yet)
+  const auto bindTexture = [&](GLuint unit, int textureIndex,
+                               GLuint fallback) {
+    auto textureObject = fallback;
+    auto samplerObject = 0u;
+    if (textureIndex >= 0) {
+      const auto &texture = model.textures[textureIndex];
+      if (texture.source >= 0 && textureObjects[texture.source]) {
+        textureObject = textureObjects[texture.source];
+        samplerObject = samplerObjects[texture.sampler >= 0
+                                           ? size_t(texture.sampler)
+                                           : model.samplers.size()];
+      }
+    }
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, textureObject);
+    glBindSampler(unit, samplerObject);
+  };
 
   const auto bindMaterial = [&](const auto materialIndex,
                                 const Locations &location) {
+    if (materialTable && location.uMaterialIndex >= 0) {
+      glUniform1i(location.uMaterialIndex,
+          materialIndex >= 0 ? int(materialIndex)
+                             : materialTable->defaultMaterial());
+      return;
+    }
     if (materialIndex >= 0) {
       const auto &material = model.materials[materialIndex];
       const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
@@ -142,17 +577,8 @@ int ViewerApplication::run()
             (float)pbrMetallicRoughness.baseColorFactor[3]);
       }
       if (location.uBaseColorTexture >= 0) {
-        auto textureObject = whiteTexture;
-        if (pbrMetallicRoughness.baseColorTexture.index >= 0) {
-          const auto &texture =
-              model.textures[pbrMetallicRoughness.baseColorTexture.index];
-          if (texture.source >= 0) {
-            textureObject = textureObjects[texture.source];
-          }
-        }
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, textureObject);
+        bindTexture(
+            0, pbrMetallicRoughness.baseColorTexture.index, whiteTexture);
         glUniform1i(location.uBaseColorTexture, 0);
       }
       if (location.uMetallicFactor >= 0) {
@@ -164,18 +590,7 @@ int ViewerApplication::run()
             (float)pbrMetallicRoughness.roughnessFactor);
       }
       if (location.uMetallicRoughnessTexture >= 0) {
-        auto textureObject = 0u;
-        if (pbrMetallicRoughness.metallicRoughnessTexture.index >= 0) {
-          const auto &texture =
-              model.textures[pbrMetallicRoughness.metallicRoughnessTexture
-                                 .index];
-          if (texture.source >= 0) {
-            textureObject = textureObjects[texture.source];
-          }
-        }
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, textureObject);
+        bindTexture(1, pbrMetallicRoughness.metallicRoughnessTexture.index, 0);
         glUniform1i(location.uMetallicRoughnessTexture, 1);
       }
       if (location.uEmissiveFactor >= 0) {
@@ -184,16 +599,7 @@ int ViewerApplication::run()
             (float)material.emissiveFactor[2]);
       }
       if (location.uEmissiveTexture >= 0) {
-        auto textureObject = 0u;
-        if (material.emissiveTexture.index >= 0) {
-          const auto &texture = model.textures[material.emissiveTexture.index];
-          if (texture.source >= 0) {
-            textureObject = textureObjects[texture.source];
-          }
-        }
-
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, textureObject);
+        bindTexture(2, material.emissiveTexture.index, 0);
         glUniform1i(location.uEmissiveTexture, 2);
       }
       if (location.uOcclusionStrength >= 0) {
@@ -201,16 +607,7 @@ int ViewerApplication::run()
             (float)material.occlusionTexture.strength);
       }
       if (location.uOcclusionTexture >= 0) {
-        auto textureObject = whiteTexture;
-        if (material.occlusionTexture.index >= 0) {
-          const auto &texture = model.textures[material.occlusionTexture.index];
-          if (texture.source >= 0) {
-            textureObject = textureObjects[texture.source];
-          }
-        }
-
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, textureObject);
+        bindTexture(3, material.occlusionTexture.index, whiteTexture);
         glUniform1i(location.uOcclusionTexture, 3);
       }
     } else {
@@ -221,8 +618,7 @@ int ViewerApplication::run()
         glUniform4f(location.uBaseColorFactor, 1, 1, 1, 1);
       }
       if (location.uBaseColorTexture >= 0) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, whiteTexture);
+        bindTexture(0, -1, whiteTexture);
         glUniform1i(location.uBaseColorTexture, 0);
       }
       if (location.uMetallicFactor >= 0) {
@@ -232,41 +628,39 @@ int ViewerApplication::run()
         glUniform1f(location.uRoughnessFactor, 1.f);
       }
       if (location.uMetallicRoughnessTexture >= 0) {
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        bindTexture(1, -1, 0);
         glUniform1i(location.uMetallicRoughnessTexture, 1);
       }
       if (location.uEmissiveFactor >= 0) {
         glUniform3f(location.uEmissiveFactor, 0.f, 0.f, 0.f);
       }
       if (location.uEmissiveTexture >= 0) {
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        bindTexture(2, -1, 0);
         glUniform1i(location.uEmissiveTexture, 2);
       }
       if (location.uOcclusionStrength >= 0) {
         glUniform1f(location.uOcclusionStrength, 0.f);
       }
       if (location.uOcclusionTexture >= 0) {
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        bindTexture(3, -1, 0);
         glUniform1i(location.uOcclusionTexture, 3);
       }
     }
   };
 
-  const auto drawLight = [&](const Camera &camera, const Locations &location) {
-    const auto viewMatrix = camera.getViewMatrix();
+  const auto lightDirectionInViewSpace = [&](const Camera &camera) {
+    if (lightFromCamera) {
+      return glm::vec3(0, 0, 1);
+    }
+    return glm::normalize(
+        glm::vec3(camera.getViewMatrix() * glm::vec4(lightDirection, 0.)));
+  };
 
+  const auto drawLight = [&](const Camera &camera, const Locations &location) {
     if (location.uLightDirection >= 0) {
-      if (lightFromCamera) {
-        glUniform3f(location.uLightDirection, 0, 0, 1);
-      } else {
-        const auto lightDirectionInViewSpace = glm::normalize(
-            glm::vec3(viewMatrix * glm::vec4(lightDirection, 0.)));
-        glUniform3f(location.uLightDirection, lightDirectionInViewSpace[0],
-            lightDirectionInViewSpace[1], lightDirectionInViewSpace[2]);
-      }
+      const auto direction = lightDirectionInViewSpace(camera);
+      glUniform3f(
+          location.uLightDirection, direction[0], direction[1], direction[2]);
     }
 
     if (location.uLightIntensity >= 0) {
@@ -279,85 +673,247 @@ int ViewerApplication::run()
     }
   };
 
-  // Lambda function to draw the scene
+  // Draw items of the last drawScene() call, sorted unless disabled in the
+  // GUI, and the state changes of all calls of a frame, sorted and in scene
+  // order
+  std::vector<DrawItem> drawItems;
+  std::vector<DrawItem> drawItemsScratch;
+  bool sortDraws = true;
+  DrawStats drawStats;
+  DrawStats unsortedDrawStats;
+  DrawStats lastFrameDrawStats;
+  DrawStats lastFrameUnsortedDrawStats;
+  // Matrices of the draws of the last drawScene() call with an INSTANCING
+  // program
+  std::vector<InstanceData> instances;
+  InstanceBuffer instanceBuffer;
+  // Per instance attributes enabled in each vertex array
+  enum class InstanceInputs
+  {
+    None,
+    Matrices,   // Of InstanceBuffer
+    DrawIndices // Of UniformBuffers
+  };
+  std::vector<InstanceInputs> vertexArrayInputs;
+  // Objects and materials of the draws of the last drawScene() call with a
+  // UNIFORM_BUFFERS program
+  std::vector<DrawIndices> drawIndices;
+
+  // Lambda function to draw the scene in the framebuffer bound and cleared by
+  // the caller
   const auto drawScene = [&](const Camera &camera, const Locations &location,
                              bool light = true) {
-    glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
     const auto viewMatrix = camera.getViewMatrix();
 
     if (light)
       drawLight(camera, location);
 
-    // The recursive function that should draw a node
-    // We use a std::function because a simple lambda cannot be recursive
-    const std::function<void(int, const glm::mat4 &)> drawNode =
-        [&](int nodeIdx, const glm::mat4 &parentMatrix) {
-          const auto &node = model.nodes[nodeIdx];
-          const auto modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
-
-          // If the node references a mesh (a node can also reference a
-          // camera, or a light)
-          if (node.mesh >= 0) {
-            const auto mvMatrix =
-                viewMatrix * modelMatrix; // Also called localToCamera matrix
-            const auto mvpMatrix =
-                projMatrix * mvMatrix; // Also called localToScreen matrix
-            // Normal matrix is necessary to maintain normal vectors
-            // orthogonal to tangent vectors
-            // https://www.lighthouse3d.com/tutorials/glsl-12-tutorial/the-normal-matrix/
-            const auto normalMatrix = glm::transpose(glm::inverse(mvMatrix));
-
-            if (location.uModelMatrix >= 0)
-              glUniformMatrix4fv(location.uModelMatrix, 1, GL_FALSE,
-                  glm::value_ptr(modelMatrix));
-            if (location.uModelViewProjMatrix >= 0)
-              glUniformMatrix4fv(location.uModelViewProjMatrix, 1, GL_FALSE,
-                  glm::value_ptr(mvpMatrix));
-            if (location.uModelViewMatrix >= 0)
-              glUniformMatrix4fv(location.uModelViewMatrix, 1, GL_FALSE,
-                  glm::value_ptr(mvMatrix));
-            if (location.uNormalMatrix >= 0)
-              glUniformMatrix4fv(location.uNormalMatrix, 1, GL_FALSE,
-                  glm::value_ptr(normalMatrix));
-
-            const auto &mesh = model.meshes[node.mesh];
-            const auto &vaoRange = meshToVertexArrays[node.mesh];
-            for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-              const auto vao = vertexArrayObjects[vaoRange.begin + pIdx];
-              const auto &primitive = mesh.primitives[pIdx];
-
-              bindMaterial(primitive.material, location);
-
-              glBindVertexArray(vao);
-              if (primitive.indices >= 0) {
-                const auto &accessor = model.accessors[primitive.indices];
-                const auto &bufferView = model.bufferViews[accessor.bufferView];
-                const auto byteOffset =
-                    accessor.byteOffset + bufferView.byteOffset;
-                glDrawElements(primitive.mode, GLsizei(accessor.count),
-                    accessor.componentType, (const GLvoid *)byteOffset);
-              } else {
-                // Take first accessor to get the count
-                const auto accessorIdx = (*begin(primitive.attributes)).second;
-                const auto &accessor = model.accessors[accessorIdx];
-                glDrawArrays(primitive.mode, 0, GLsizei(accessor.count));
-              }
-            }
-          }
+    const auto readsUniformBuffers =
+        uniformBuffers && location.aDrawIndices >= 0;
+    const auto readsMaterialTable =
+        materialTable &&
+        (location.uMaterialIndex >= 0 || location.uDrawOffset >= 0 ||
+            readsUniformBuffers);
+    if (readsMaterialTable) {
+      materialTable->bind();
+    }
+
+    // The whole scene in one call per vertex format and material, with the
+    // matrices of each draw read from the buffer of multiDraw
+    if (multiDraw && location.uDrawOffset >= 0) {
+      glUniformMatrix4fv(
+          location.uViewMatrix, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+      glUniformMatrix4fv(
+          location.uProjMatrix, 1, GL_FALSE, glm::value_ptr(projMatrix));
+      multiDraw->draw(location.uDrawOffset, location.uMaterialIndex);
+      drawStats.drawCalls += multiDraw->callCount();
+      drawStats.vertexArrayChanges += multiDraw->groupCount();
+      materialTable->unbind();
+      return;
+    }
 
-          // Draw children
-          for (const auto childNodeIdx : node.children) {
-            drawNode(childNodeIdx, modelMatrix);
+    // Collect the primitives of the meshes of the scene referenced by gltf
+    // file, and sort them by state (see render_queue.hpp)
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    const auto farDistance = 1.5f * maxDistance; // Far plane of projMatrix
+    drawItems.clear();
+    for (const auto entry : nodeTable.meshEntries()) {
+      const auto &mesh = model.meshes[nodeTable.mesh(entry)];
+      const auto &vaoRange = meshToVertexArrays[nodeTable.mesh(entry)];
+      for (size_t instance = 0; instance < nodeTable.instanceCount(entry);
+           ++instance) {
+        const auto mvMatrix =
+            viewMatrix * nodeTable.instanceWorldMatrix(entry, instance);
+        for (auto pIdx = vaoRange.begin;
+             pIdx < vaoRange.begin + vaoRange.count; ++pIdx) {
+          if (!vertexArrayObjects[pIdx]) {
+            continue; // Not streamed yet
           }
-        };
+          const auto &primitive = mesh.primitives[pIdx - vaoRange.begin];
+          const auto depth =
+              -(mvMatrix * glm::vec4(primitiveCenters[pIdx], 1)).z /
+              farDistance;
+          // Primitives without material get 0
+          drawItems.push_back({makeSortKey(uint32_t(program),
+                                   uint32_t(primitive.material + 1),
+                                   uint32_t(pIdx), depth),
+              entry, uint32_t(pIdx), uint32_t(instance),
+              int32_t(primitive.material)});
+        }
+      }
+    }
+    // INSTANCING and UNIFORM_BUFFERS programs draw each run of items of the
+    // same primitive at once, which sorting by vertex array makes as long as
+    // possible
+    const auto instanced = readsUniformBuffers || location.uViewMatrix >= 0;
+    const auto readsInstances = instanced && !readsUniformBuffers;
+    const auto passInputs = readsUniformBuffers
+                                ? InstanceInputs::DrawIndices
+                                : readsInstances ? InstanceInputs::Matrices
+                                                 : InstanceInputs::None;
+    vertexArrayInputs.resize(vertexArrayObjects.size(), InstanceInputs::None);
+    const auto sceneOrderStats = countStateChanges(drawItems, instanced);
+    if (sortDraws) {
+      radixSortDrawItems(drawItems, drawItemsScratch);
+    }
+    unsortedDrawStats += sceneOrderStats;
+    drawStats += sortDraws ? countStateChanges(drawItems, instanced)
+                           : sceneOrderStats;
+
+    if (readsUniformBuffers) {
+      // Matrices are already in the objects buffer, the camera and light in
+      // the frame buffer
+      drawIndices.resize(drawItems.size());
+      for (size_t i = 0; i < drawItems.size(); ++i) {
+        const auto &item = drawItems[i];
+        const auto meshIdx = nodeTable.mesh(item.nodeEntry);
+        const auto material =
+            model.meshes[meshIdx]
+                .primitives[item.primitive - meshToVertexArrays[meshIdx].begin]
+                .material;
+        drawIndices[i] = {
+            uniformBuffers->objectIndex(item.nodeEntry, item.instance),
+            material >= 0 ? material : materialTable->defaultMaterial()};
+      }
+      uniformBuffers->uploadDraws(drawIndices);
+      uniformBuffers->bind();
+    } else if (instanced) {
+      instances.resize(drawItems.size());
+      for (size_t i = 0; i < drawItems.size(); ++i) {
+        const auto &modelMatrix = nodeTable.instanceWorldMatrix(
+            drawItems[i].nodeEntry, drawItems[i].instance);
+        instances[i] = {modelMatrix,
+            glm::transpose(glm::inverse(glm::mat3(modelMatrix)))};
+      }
+      instanceBuffer.upload(instances);
+      glUniformMatrix4fv(
+          location.uViewMatrix, 1, GL_FALSE, glm::value_ptr(viewMatrix));
+      glUniformMatrix4fv(
+          location.uProjMatrix, 1, GL_FALSE, glm::value_ptr(projMatrix));
+    }
+
+    // Only change state between items that differ
+    auto previousEntry = std::numeric_limits<uint32_t>::max();
+    auto previousInstance = std::numeric_limits<uint32_t>::max();
+    auto previousMaterial = std::numeric_limits<int32_t>::min();
+    GLuint previousVertexArray = 0;
+    for (size_t itemIdx = 0; itemIdx < drawItems.size();) {
+      const auto &item = drawItems[itemIdx];
+      auto runEnd = itemIdx + 1;
+      while (instanced && runEnd < drawItems.size() &&
+             drawItems[runEnd].primitive == item.primitive) {
+        ++runEnd;
+      }
+      const auto instanceCount = GLsizei(runEnd - itemIdx);
+      const auto entry = item.nodeEntry;
+      const auto meshIdx = nodeTable.mesh(entry);
+      const auto &primitive =
+          model.meshes[meshIdx]
+              .primitives[item.primitive - meshToVertexArrays[meshIdx].begin];
+
+      if (!instanced &&
+          (entry != previousEntry || item.instance != previousInstance)) {
+        previousEntry = entry;
+        previousInstance = item.instance;
+        const auto &modelMatrix =
+            nodeTable.instanceWorldMatrix(entry, item.instance);
+        const auto mvMatrix =
+            viewMatrix * modelMatrix; // Also called localToCamera matrix
+        const auto mvpMatrix =
+            projMatrix * mvMatrix; // Also called localToScreen matrix
+        // Normal matrix is necessary to maintain normal vectors
+        // orthogonal to tangent vectors
+        // https://www.lighthouse3d.com/tutorials/glsl-12-tutorial/the-normal-matrix/
+        const auto normalMatrix = glm::transpose(glm::inverse(mvMatrix));
+
+        if (location.uModelMatrix >= 0)
+          glUniformMatrix4fv(location.uModelMatrix, 1, GL_FALSE,
+              glm::value_ptr(modelMatrix));
+        if (location.uModelViewProjMatrix >= 0)
+          glUniformMatrix4fv(location.uModelViewProjMatrix, 1, GL_FALSE,
+              glm::value_ptr(mvpMatrix));
+        if (location.uModelViewMatrix >= 0)
+          glUniformMatrix4fv(location.uModelViewMatrix, 1, GL_FALSE,
+              glm::value_ptr(mvMatrix));
+        if (location.uNormalMatrix >= 0)
+          glUniformMatrix4fv(location.uNormalMatrix, 1, GL_FALSE,
+              glm::value_ptr(normalMatrix));
+      }
+
+      if (item.material != previousMaterial && !readsUniformBuffers) {
+        previousMaterial = item.material;
+        bindMaterial(primitive.material, location);
+      }
 
-    // Draw the scene referenced by gltf file
-    if (model.defaultScene >= 0) {
-      for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
-        drawNode(nodeIdx, glm::mat4(1));
+      // Each primitive has its own vertex array, only kept bound when the
+      // same primitive is drawn for several nodes in a row
+      const auto vao = vertexArrayObjects[item.primitive];
+      if (vao != previousVertexArray) {
+        previousVertexArray = vao;
+        glBindVertexArray(vao);
+        // Per instance attributes are only enabled for the programs reading
+        // them, which bind their buffer below
+        auto &inputs = vertexArrayInputs[item.primitive];
+        if (inputs != passInputs) {
+          inputs = passInputs;
+          InstanceBuffer::enableVertexArray(
+              passInputs == InstanceInputs::Matrices);
+          UniformBuffers::enableVertexArray(
+              passInputs == InstanceInputs::DrawIndices);
+        }
+      }
+      if (readsUniformBuffers) {
+        uniformBuffers->bindDraws(itemIdx);
+      } else if (readsInstances) {
+        instanceBuffer.bind(itemIdx);
+      }
+      if (primitive.indices >= 0) {
+        const auto &accessor = model.accessors[primitive.indices];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+        glDrawElementsInstanced(primitive.mode, GLsizei(accessor.count),
+            accessor.componentType, (const GLvoid *)byteOffset,
+            instanceCount);
+      } else {
+        // Take first accessor to get the count
+        const auto accessorIdx = (*begin(primitive.attributes)).second;
+        const auto &accessor = model.accessors[accessorIdx];
+        glDrawArraysInstanced(
+            primitive.mode, 0, GLsizei(accessor.count), instanceCount);
       }
+      itemIdx = runEnd;
+    }
+
+    // Later passes sample their textures with their own parameters
+    for (GLuint unit = 0; unit < 4; ++unit) {
+      glBindSampler(unit, 0);
+    }
+    if (readsUniformBuffers) {
+      uniformBuffers->unbind();
+    }
+    if (readsMaterialTable) {
+      materialTable->unbind();
     }
   };
 
@@ -381,22 +937,137 @@ int ViewerApplication::run()
     stbi_write_png(
         strPath.c_str(), m_nWindowWidth, m_nWindowHeight, 3, pixels.data(), 0);
 
+    if (!startupReportWritten) {
+      writeStartupReport();
+    }
+
     return 0; // Exit, in that mode we don't want to run interactive viewer
   }
 
+  // GPU time of each render pass, shown in the GUI and logged on exit
+  enum RenderPass
+  {
+    FeedbackPass,
+    GeometryPass,
+    SsaoPass,
+    SsaoBlurPass,
+    ShadingPass,
+    ForwardPass
+  };
+  GpuPassTimers gpuTimers(
+      {"feedback", "geometry", "ssao", "ssao_blur", "shading", "forward"});
+
+  auto firstFramePhase = m_startupReport.phase("first_frame");
+  StartupReport::Phase streamPhase;
+  bool texturesShown = false; // Every mesh and texture can be drawn
+
   // Loop until the user closes the window
   for (auto iterationCount = 0u; !m_GLFWHandle.shouldClose();
        ++iterationCount) {
     const auto seconds = glfwGetTime();
 
+    if (sceneLoading.valid() && sceneLoading.wait_for(std::chrono::seconds(
+                                    0)) == std::future_status::ready) {
+      if (!sceneLoading.get()) {
+        return -1;
+      }
+      setupCamera();
+      nodeTable = NodeTable(model, buffers.bytes);
+      primitiveCenters = computePrimitiveCenters(model);
+      streamPhase = m_startupReport.phase("stream");
+      for (const auto &buffer : buffers.bytes) {
+        streamPhase.addBytes(buffer.size);
+      }
+      startSceneStreaming(model, buffers, streaming, bufferObjects,
+          meshToVertexArrays, vertexArrayObjects, textureObjects);
+      samplerObjects = createSamplerObjects(model);
+      sceneLoaded = true;
+    }
+    if (sceneLoaded && !sceneStreamed) {
+      sceneStreamed = streamSceneObjects(model, buffers,
+          m_options.uploadBudgetMs / 1000., streaming, bufferObjects,
+          meshToVertexArrays, vertexArrayObjects, textureObjects);
+      if (m_options.lowMipsFirst && !texturesShown &&
+          streaming.nextMesh == model.meshes.size() &&
+          streaming.pendingImages.empty()) {
+        std::clog << "All textures shown, at their coarse levels, after "
+                  << 1000. * (glfwGetTime() - runStart) << " ms" << std::endl;
+        texturesShown = true;
+      }
+      if (sceneStreamed) {
+        for (const auto &image : model.images) {
+          streamPhase.addBytes(image.image.size());
+        }
+        streamPhase.end();
+        logTextureMemory(streaming.textureMemory);
+        imageSources = streaming.imageSources;
+        // Failed images are left out as if no texture referenced them
+        for (const auto failedIdx : streaming.failedImages) {
+          std::replace(begin(imageSources), end(imageSources), int(failedIdx),
+              -1);
+        }
+        if (m_options.materialBuffer) {
+          setupMaterialTable();
+        }
+        finishSceneUpload(model, buffers, bboxMin, bboxMax, cacheHit);
+        std::clog << "Scene streamed after "
+                  << 1000. * (glfwGetTime() - runStart) << " ms" << std::endl;
+      }
+    }
+
+    // Only subtrees whose local matrices changed (nodes edited in the GUI)
+    // are updated, none for a static scene
+    updatedWorldMatrices = nodeTable.updateWorldMatrices();
+    if (updatedWorldMatrices > 0) {
+      if (multiDraw) {
+        multiDraw->updateDrawData(nodeTable);
+      }
+      if (uniformBuffers) {
+        uniformBuffers->updateObjects(nodeTable);
+      }
+    }
+
+    lastFrameDrawStats = drawStats;
+    lastFrameUnsortedDrawStats = unsortedDrawStats;
+    drawStats = DrawStats();
+    unsortedDrawStats = DrawStats();
+
     const auto camera = cameraController->getCamera();
-    if (deferred_rendering) {
+    if (uniformBuffers) {
+      uniformBuffers->updateFrame({camera.getViewMatrix(), projMatrix,
+          glm::vec4(lightDirectionInViewSpace(camera), 0), lightIntensity,
+          applyOcclusion});
+    }
+    gpuTimers.beginFrame();
+    if (virtualTextures) {
+      // Load pages requested by the feedback of a previous frame, then write
+      // the pages this frame samples
+      virtualTextures->update(maxVirtualPageLoads);
+      gpuTimers.begin(FeedbackPass);
+      virtualTextures->beginFeedback(m_nWindowWidth, m_nWindowHeight);
+      feedbackProgram->use();
+      glUniform1ui(feedbackFrameLocation, GLuint(iterationCount));
+      drawScene(camera, feedbackLocation, false);
+      virtualTextures->endFeedback();
+      gpuTimers.end();
+    }
+    glViewport(0, 0, m_nWindowWidth, m_nWindowHeight);
+    if (!sceneLoaded) {
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    } else if (deferred_rendering) {
       // Geometry pass
+      gpuTimers.begin(GeometryPass);
       glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuffer);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      glslProgramdGeometry.use();
-      drawScene(camera, locationgbuffer, false);
+      if (materialTable) {
+        materialProgramGeometry->use();
+        drawScene(camera, materialLocationGBuffer, false);
+      } else {
+        glslProgramdGeometry.use();
+        drawScene(camera, locationgbuffer, false);
+      }
       glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+      gpuTimers.end();
 
       //
       if (render_gbuffer_content) {
@@ -417,6 +1088,7 @@ int ViewerApplication::run()
         // Do shading calculations on gbuffer and render the results
         if (render_with_ssao) {
           glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+          gpuTimers.begin(SsaoPass);
           glBindFramebuffer(GL_FRAMEBUFFER, ssaoFBO);
           glslProgramdSsao.use();
           // Send kernel + rotation
@@ -448,8 +1120,10 @@ int ViewerApplication::run()
           glBindTexture(GL_TEXTURE_2D, noiseTexture);
           renderQuad();
           glBindFramebuffer(GL_FRAMEBUFFER, 0);
+          gpuTimers.end();
 
           // 3. blur SSAO texture to remove noise
+          gpuTimers.begin(SsaoBlurPass);
           glBindFramebuffer(GL_FRAMEBUFFER, ssaoBlurFBO);
           glClear(GL_COLOR_BUFFER_BIT);
           glslProgramdSsaoBlur.use();
@@ -460,6 +1134,7 @@ int ViewerApplication::run()
           glBindTexture(GL_TEXTURE_2D, ssaoColorBuffer); // <- Error Here
           renderQuad();
           glBindFramebuffer(GL_FRAMEBUFFER, 0);
+          gpuTimers.end();
 
           glslProgramdShading.use();
           glUniform1i(glGetUniformLocation(
@@ -468,6 +1143,7 @@ int ViewerApplication::run()
           glActiveTexture(GL_TEXTURE6);
           glBindTexture(GL_TEXTURE_2D, ssaoColorBufferBlur);
         }
+        gpuTimers.begin(ShadingPass);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glslProgramdShading.use();
         glUniform1i(
@@ -498,7 +1174,12 @@ int ViewerApplication::run()
             glGetUniformLocation(glslProgramdShading.glId(), "with_ssao"),
             (int)render_with_ssao);
         drawLight(camera, locationDShading);
+        if (srgbFramebuffer) {
+          glEnable(GL_FRAMEBUFFER_SRGB);
+        }
         renderQuad(); // render the scene on the screen
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        gpuTimers.end();
 
         glBindFramebuffer(GL_READ_FRAMEBUFFER, gbuffer);
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
@@ -508,8 +1189,20 @@ int ViewerApplication::run()
       }
     } else {
       // forward render
-      glslProgram.use();
-      drawScene(camera, location);
+      gpuTimers.begin(ForwardPass);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      if (srgbFramebuffer) {
+        glEnable(GL_FRAMEBUFFER_SRGB);
+      }
+      if (materialTable) {
+        materialProgram->use();
+        drawScene(camera, materialLocation);
+      } else {
+        glslProgram.use();
+        drawScene(camera, location);
+      }
+      glDisable(GL_FRAMEBUFFER_SRGB);
+      gpuTimers.end();
     }
 
     // GUI code:
@@ -519,6 +1212,46 @@ int ViewerApplication::run()
       ImGui::Begin("GUI");
       ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
           1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+      for (size_t pass = 0; pass < gpuTimers.passCount(); ++pass) {
+        if (gpuTimers.frameCount(pass) > 0) {
+          ImGui::Text("GPU %s: %.3f ms", gpuTimers.passName(pass).c_str(),
+              gpuTimers.recentMs(pass));
+        }
+      }
+      if (!sceneLoaded) {
+        ImGui::Text(
+            "Loading %s...", m_gltfFilePath.filename().string().c_str());
+      } else if (!sceneStreamed) {
+        ImGui::Text("Streaming: buffers %zu/%zu, meshes %zu/%zu, textures "
+                    "%zu/%zu (%zu without their finer levels)",
+            streaming.nextBuffer, bufferObjects.size(), streaming.nextMesh,
+            model.meshes.size(),
+            streaming.uniqueImageCount - streaming.pendingImages.size(),
+            streaming.uniqueImageCount, streaming.refiningImages.size());
+      }
+      if (virtualTextures) {
+        ImGui::Text("Virtual textures: %zu/%zu tiles, %zu pages requested, "
+                    "%zu loaded",
+            virtualTextures->residentPageCount(), virtualTextures->tileCount(),
+            virtualTextures->requestedPageCount(),
+            virtualTextures->loadedPageCount());
+      }
+      if (multiDraw) {
+        ImGui::Text("Multi-draw: %zu draws per pass in %zu calls",
+            multiDraw->drawCount(), multiDraw->callCount());
+      } else {
+        ImGui::Checkbox("sort draws", &sortDraws);
+        ImGui::Text("Draw calls %zu, material changes %zu, vertex array "
+                    "binds %zu, matrix uploads %zu",
+            lastFrameDrawStats.drawCalls, lastFrameDrawStats.materialChanges,
+            lastFrameDrawStats.vertexArrayChanges,
+            lastFrameDrawStats.matrixChanges);
+        ImGui::Text("In scene order: material changes %zu, vertex array "
+                    "binds %zu, matrix uploads %zu",
+            lastFrameUnsortedDrawStats.materialChanges,
+            lastFrameUnsortedDrawStats.vertexArrayChanges,
+            lastFrameUnsortedDrawStats.matrixChanges);
+      }
       if (ImGui::CollapsingHeader("Camera", ImGuiTreeNodeFlags_DefaultOpen)) {
         ImGui::Text("eye: %.3f %.3f %.3f", camera.eye().x, camera.eye().y,
             camera.eye().z);
@@ -558,6 +1291,51 @@ int ViewerApplication::run()
           cameraController->setCamera(currentCamera);
         }
       }
+      if (nodeTable.size() > 0 && ImGui::CollapsingHeader("Nodes")) {
+        // Translation in the space of the parent, rotation (Euler angles in
+        // degrees) and scale in the space of the node, applied to the local
+        // matrix the node had when selected
+        static int editedEntry = 0;
+        static bool nodeSelected = false;
+        static glm::mat4 selectedLocalMatrix(1);
+        static glm::vec3 nodeTranslation(0.f);
+        static glm::vec3 nodeRotation(0.f);
+        static float nodeScale = 1.f;
+
+        editedEntry = std::min(editedEntry, int(nodeTable.size()) - 1);
+        if (ImGui::SliderInt("entry", &editedEntry, 0,
+                int(nodeTable.size()) - 1) ||
+            !nodeSelected) {
+          nodeSelected = true;
+          selectedLocalMatrix = nodeTable.localMatrix(editedEntry);
+          nodeTranslation = nodeRotation = glm::vec3(0.f);
+          nodeScale = 1.f;
+        }
+        const auto nodeIdx = nodeTable.node(editedEntry);
+        ImGui::Text("node %d '%s', %zu descendants", nodeIdx,
+            model.nodes[nodeIdx].name.c_str(),
+            nodeTable.subtreeEnd(editedEntry) - editedEntry - 1);
+
+        auto nodeChanged = ImGui::DragFloat3(
+            "translation", &nodeTranslation[0], 0.005f * maxDistance);
+        nodeChanged |= ImGui::DragFloat3("rotation", &nodeRotation[0], 1.f);
+        nodeChanged |=
+            ImGui::DragFloat("scale", &nodeScale, 0.01f, 0.01f, 100.f);
+        if (ImGui::Button("reset node")) {
+          nodeTranslation = nodeRotation = glm::vec3(0.f);
+          nodeScale = 1.f;
+          nodeChanged = true;
+        }
+        if (nodeChanged) {
+          nodeTable.setLocalMatrix(editedEntry,
+              glm::translate(glm::mat4(1), nodeTranslation) *
+                  selectedLocalMatrix *
+                  glm::mat4_cast(glm::quat(glm::radians(nodeRotation))) *
+                  glm::scale(glm::mat4(1), glm::vec3(nodeScale)));
+        }
+        ImGui::Text("World matrices updated this frame: %zu",
+            updatedWorldMatrices);
+      }
       if (ImGui::CollapsingHeader("Light", ImGuiTreeNodeFlags_DefaultOpen)) {
         static float lightTheta = 0.f;
         static float lightPhi = 0.f;
@@ -615,6 +1393,33 @@ int ViewerApplication::run()
     }
 
     m_GLFWHandle.swapBuffers(); // Swap front and back buffers
+
+    if (iterationCount == 0) {
+      firstFramePhase.end();
+      std::clog << "First frame after " << 1000. * (glfwGetTime() - runStart)
+                << " ms" << std::endl;
+    }
+    if (!startupReportWritten && sceneStreamed) {
+      writeStartupReport();
+    }
+  }
+
+  for (size_t pass = 0; pass < gpuTimers.passCount(); ++pass) {
+    if (gpuTimers.frameCount(pass) > 0) {
+      std::clog << "GPU time of pass " << gpuTimers.passName(pass) << ": "
+                << gpuTimers.averageMs(pass) << " ms per frame over "
+                << gpuTimers.frameCount(pass) << " frames" << std::endl;
+    }
+  }
+
+  // Background tasks reference model, let them finish before it goes away
+  if (sceneLoading.valid()) {
+    sceneLoading.wait();
+  }
+  for (const auto &imageDecoding : streaming.imageDecoding) {
+    if (imageDecoding.valid()) {
+      imageDecoding.wait();
+    }
   }
 
   // TODO clean up allocated GL data
@@ -622,16 +1427,55 @@ int ViewerApplication::run()
   return 0;
 }
 
-bool ViewerApplication::loadGltfFile(tinygltf::Model &model)
+bool ViewerApplication::loadGltfFile(tinygltf::Model &model,
+    GltfBuffers &buffers, glm::vec3 &bboxMin, glm::vec3 &bboxMax,
+    bool &cacheHit)
 {
   std::clog << "Loading file " << m_gltfFilePath << std::endl;
 
-  tinygltf::TinyGLTF loader;
+  cacheHit = false;
+  if (!m_options.sceneCacheDirectory.empty()) {
+    auto phase = m_startupReport.phase("scene_cache.load");
+    const auto start = glfwGetTime();
+    const auto cacheFile =
+        sceneCachePath(m_options.sceneCacheDirectory, m_gltfFilePath);
+    if (loadSceneCache(
+            cacheFile, m_gltfFilePath, model, buffers, bboxMin, bboxMax)) {
+      std::clog << "Loaded scene cache " << cacheFile << " in "
+                << 1000. * (glfwGetTime() - start) << " ms" << std::endl;
+      for (const auto &buffer : buffers.bytes) {
+        phase.addBytes(buffer.size);
+      }
+      for (const auto &image : model.images) {
+        phase.addBytes(image.image.size());
+      }
+      cacheHit = true;
+      // The cache may have been written without ormTextures
+      packOrmTextures(model);
+      return true;
+    }
+  }
+
   std::string err;
   std::string warn;
 
-  bool ret =
-      loader.LoadASCIIFromFile(&model, &err, &warn, m_gltfFilePath.string());
+  auto parsePhase = m_startupReport.phase("parse");
+  const auto start = glfwGetTime();
+  bool ret = loadGltf(m_gltfFilePath, m_options.loader, model, buffers, err,
+      warn, &m_threadPool);
+  // JSON (or GLB) file plus the external buffers loaded with it
+  std::error_code ec;
+  const auto fileSize = fs::file_size(m_gltfFilePath, ec);
+  parsePhase.addBytes(ec ? 0 : fileSize);
+  for (size_t i = 0; i < buffers.bytes.size(); ++i) {
+    const auto &uri = model.buffers[i].uri;
+    if (!uri.empty() && !tinygltf::IsDataURI(uri)) {
+      parsePhase.addBytes(buffers.bytes[i].size);
+    }
+  }
+  parsePhase.end();
+  std::clog << "Parsed glTF file in " << 1000. * (glfwGetTime() - start)
+            << " ms" << std::endl;
 
   if (!warn.empty()) {
     std::cerr << warn << std::endl;
@@ -646,68 +1490,535 @@ bool ViewerApplication::loadGltfFile(tinygltf::Model &model)
     return false;
   }
 
+  {
+    const auto phase = m_startupReport.phase("bounds");
+    computeSceneBounds(model, buffers.bytes, bboxMin, bboxMax);
+  }
+
+  packOrmTextures(model);
+
   return true;
 }
 
+void ViewerApplication::packOrmTextures(tinygltf::Model &model) const
+{
+  if (!m_options.ormTextures) {
+    return;
+  }
+  const auto phase = m_startupReport.phase("orm_textures");
+  const auto start = glfwGetTime();
+  const auto stats = packOcclusionTextures(model);
+  std::clog << "Packed occlusion with metallic-roughness: "
+            << stats.packedMaterialCount << " materials into "
+            << stats.packedImageCount << " new images, "
+            << stats.sharedMaterialCount << " already packed, in "
+            << 1000. * (glfwGetTime() - start) << " ms" << std::endl;
+  if (stats.droppedOcclusionCount > 0) {
+    std::cerr << "Occlusion ignored for " << stats.droppedOcclusionCount
+              << " materials whose images cannot be merged" << std::endl;
+  }
+}
+
+void ViewerApplication::finishSceneUpload(tinygltf::Model &model,
+    GltfBuffers &buffers, const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+    bool cacheHit) const
+{
+  // Images are decoded once textures are created, and downscaled ones would
+  // be cached for every later run
+  const auto texturesLimited =
+      m_options.maxTextureSize > 0 || m_options.textureBudget > 0;
+  if (!m_options.sceneCacheDirectory.empty() && !cacheHit) {
+    if (texturesLimited) {
+      std::clog << "Scene cache not written: textures are downscaled"
+                << std::endl;
+    } else {
+      updateSceneCache(model, buffers, bboxMin, bboxMax);
+    }
+  }
+
+  // Mapped buffers are not needed anymore once uploaded
+  buffers = GltfBuffers();
+
+  if (m_options.releaseCpuData) {
+    const auto toMB = [](size_t bytes) { return bytes / (1024. * 1024.); };
+    const auto rssBefore = currentResidentMemory();
+    releaseBulkData(model);
+    const auto rssAfter = currentResidentMemory();
+    std::clog << "Released CPU copies of buffers and images: resident memory "
+              << toMB(rssBefore) << " MB -> " << toMB(rssAfter)
+              << " MB (peak " << toMB(peakResidentMemory()) << " MB)"
+              << std::endl;
+  }
+}
+
+void ViewerApplication::updateSceneCache(const tinygltf::Model &model,
+    const GltfBuffers &buffers, const glm::vec3 &bboxMin,
+    const glm::vec3 &bboxMax) const
+{
+  auto phase = m_startupReport.phase("scene_cache.write");
+  const auto start = glfwGetTime();
+  const auto cacheFile =
+      sceneCachePath(m_options.sceneCacheDirectory, m_gltfFilePath);
+  if (!writeSceneCache(cacheFile, m_gltfFilePath, model, buffers.bytes,
+          bboxMin, bboxMax)) {
+    std::cerr << "Unable to write scene cache " << cacheFile << std::endl;
+    return;
+  }
+  std::error_code ec;
+  const auto cacheSize = fs::file_size(cacheFile, ec);
+  phase.addBytes(ec ? 0 : cacheSize);
+  std::clog << "Wrote scene cache " << cacheFile << " in "
+            << 1000. * (glfwGetTime() - start) << " ms" << std::endl;
+}
+
 std::vector<GLuint> ViewerApplication::createTextureObjects(
+    tinygltf::Model &model, std::vector<int> &imageSources)
+{
+  // One texture object per unique image, shared by all textures reading it
+  auto usages = imageUsages(model);
+  imageSources = uniqueImages(model, usages);
+  limitTextureSizes(model, imageSources, usages);
+  const auto &sources = imageSources;
+  const auto isUnique = [&](size_t imageIdx) {
+    return sources[imageIdx] == int(imageIdx);
+  };
+  // Virtual textures are created from the decoded images once all are ready
+  const auto virtualTextures = m_options.virtualTextureBudget > 0;
+  std::vector<GLuint> textureObjects(model.images.size(), 0);
+
+  glActiveTexture(GL_TEXTURE0);
+
+  // Pixels of each image in the upload ring, staged by the decoding workers
+  std::vector<PixelUploadRegion> imageRegions(model.images.size());
+  // Block compressed pixels of each image, filled by the decoding workers
+  std::vector<CompressedTexture> compressedImages(model.images.size());
+  TextureMemory memory;
+
+  decodeImages(
+      model, m_threadPool,
+      [&](size_t imageIdx) {
+        if (!isUnique(imageIdx) || virtualTextures) {
+          return;
+        }
+        auto &pixels = imageRegions[imageIdx];
+        auto &compressed = compressedImages[imageIdx];
+        stageImagePixels(model.images[imageIdx], compressed, pixels, true);
+        glGenTextures(1, &textureObjects[imageIdx]);
+        uploadImageTexture(model.images[imageIdx], usages[imageIdx],
+            textureObjects[imageIdx], pixels, compressed, memory);
+        releaseImagePixels(pixels);
+        compressed = CompressedTexture();
+      },
+      [&](size_t imageIdx) {
+        if (!isUnique(imageIdx)) {
+          return;
+        }
+        prepareImagePixels(model.images[imageIdx], usages[imageIdx],
+            compressedImages[imageIdx]);
+        if (!virtualTextures) {
+          stageImagePixels(model.images[imageIdx], compressedImages[imageIdx],
+              imageRegions[imageIdx], false);
+        }
+      });
+  glBindTexture(GL_TEXTURE_2D, 0);
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (sources[i] >= 0) {
+      textureObjects[i] = textureObjects[sources[i]];
+    }
+  }
+  logTextureMemory(memory);
+
+  return textureObjects;
+}
+
+void ViewerApplication::limitTextureSizes(const tinygltf::Model &model,
+    const std::vector<int> &imageSources,
+    std::vector<ImageUsage> &usages) const
+{
+  if (m_options.maxTextureSize <= 0 && m_options.textureBudget == 0) {
+    return;
+  }
+  // Block compressed texels take at most a byte
+  const auto bytesPerPixel = m_options.compressTextures ? 1. : 4.;
+  const auto sizes = chooseTextureSizes(model, imageSources,
+      m_options.maxTextureSize, m_options.textureBudget, bytesPerPixel);
+
+  const auto toMB = [](double bytes) { return bytes / (1024. * 1024.); };
+  double bytesBefore = 0;
+  double bytesAfter = 0;
+  size_t downscaledCount = 0;
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    if (imageSources[i] != int(i) || sizes[i].width == 0) {
+      continue;
+    }
+    const auto &size = sizes[i];
+    auto width = size.width;
+    auto height = size.height;
+    while (size.maxSize > 0 && std::max(width, height) > size.maxSize) {
+      width = std::max(width / 2, 1);
+      height = std::max(height / 2, 1);
+    }
+    bytesBefore += double(size.width) * size.height * bytesPerPixel * 4 / 3;
+    bytesAfter += double(width) * height * bytesPerPixel * 4 / 3;
+    if (size.maxSize == 0) {
+      continue;
+    }
+    usages[i].maxSize = size.maxSize;
+    ++downscaledCount;
+    std::clog << "Texture '" << model.images[i].uri << "' " << size.width
+              << "x" << size.height << " -> " << width << "x" << height
+              << std::endl;
+  }
+  std::clog << "Downscaled " << downscaledCount << " textures: about "
+            << toMB(bytesBefore) << " MB -> " << toMB(bytesAfter) << " MB";
+  if (m_options.textureBudget > 0) {
+    std::clog << " (budget " << toMB(double(m_options.textureBudget))
+              << " MB)";
+  }
+  std::clog << std::endl;
+}
+
+void ViewerApplication::prepareImagePixels(tinygltf::Image &image,
+    const ImageUsage &usage, CompressedTexture &compressed) const
+{
+  // Pages of virtual textures are copied from RGBA8 mip chains, KTX2 images
+  // are not virtualized
+  const auto virtualTextures = m_options.virtualTextureBudget > 0;
+  if (isKtx2(image.image.data(), image.image.size())) {
+    if (virtualTextures) {
+      return;
+    }
+    std::string err;
+    if (!transcodeKtx2(image.image.data(), image.image.size(), usage.channels,
+            m_bc1Supported, compressed, err)) {
+      std::cerr << "Unable to transcode image '" << image.uri << "': " << err
+                << std::endl;
+    }
+    // Transcoded files are not resampled, they only drop their largest levels
+    auto &levels = compressed.levels;
+    size_t dropped = 0;
+    while (usage.maxSize > 0 && dropped + 1 < levels.size() &&
+           std::max(levels[dropped].width, levels[dropped].height) >
+               usage.maxSize) {
+      ++dropped;
+    }
+    if (dropped > 0) {
+      const auto offset = levels[dropped].offset;
+      compressed.data.erase(begin(compressed.data),
+          begin(compressed.data) + ptrdiff_t(offset));
+      levels.erase(begin(levels), begin(levels) + ptrdiff_t(dropped));
+      for (auto &level : levels) {
+        level.offset -= offset;
+      }
+    }
+    return;
+  }
+  const auto downscale =
+      usage.maxSize > 0 && std::max(image.width, image.height) > usage.maxSize;
+  // There is no 16 bits sRGB format, and images are only downscaled as RGBA8
+  if ((virtualTextures || downscale ||
+          (m_options.srgbTextures && usage.srgb)) &&
+      image.bits == 16 &&
+      image.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+    convertTo8Bits(image);
+  }
+  // Images that failed to decode fallback to white, 16 bits ones are uploaded
+  // as they are and get their mip chain from glGenerateMipmap
+  if (image.image.empty() || image.bits != 8 || image.component != 4) {
+    return;
+  }
+  if (downscale) {
+    downscaleImage(image, usage.maxSize, usage.srgb);
+  }
+  // Images loaded from the scene cache already have their chain
+  if ((usage.mipmaps || virtualTextures) && storedMipLevelCount(image) == 1) {
+    generateMipChain(image.image, image.width, image.height, usage.srgb);
+  }
+  if (!m_options.compressTextures || virtualTextures) {
+    return;
+  }
+
+  const auto levelCount = usage.mipmaps ? storedMipLevelCount(image) : 1;
+  const auto transparent = (usage.channels & ChannelAlpha) &&
+                           hasTransparentPixels(image.image.data(),
+                               size_t(image.width) * image.height);
+  const auto encoding =
+      chooseBlockEncoding(usage.channels, transparent, m_bc1Supported);
+
+  fs::path cacheFile;
+  if (!m_options.textureCacheDirectory.empty()) {
+    cacheFile = compressedTexturePath(m_options.textureCacheDirectory,
+        image.image.data(), image.width, image.height, levelCount, encoding);
+    if (loadCompressedTexture(cacheFile, compressed)) {
+      return;
+    }
+  }
+  compressed = compressTexture(
+      image.image.data(), image.width, image.height, levelCount, encoding);
+  if (!cacheFile.empty() && !writeCompressedTexture(cacheFile, compressed)) {
+    std::cerr << "Unable to write compressed texture " << cacheFile
+              << std::endl;
+  }
+}
+
+void ViewerApplication::stageImagePixels(const tinygltf::Image &image,
+    const CompressedTexture &compressed, PixelUploadRegion &pixels,
+    bool onGLThread) const
+{
+  const auto &bytes = compressed.empty() ? image.image : compressed.data;
+  if (!m_pixelUploadRing || !pixels.empty() || bytes.empty() ||
+      (compressed.empty() && isKtx2(bytes.data(), bytes.size()))) {
+    return;
+  }
+  auto data = m_pixelUploadRing->tryAllocate(bytes.size(), pixels);
+  if (!data && onGLThread) {
+    // Only the GL thread can tell when the GPU is done with older uploads
+    m_pixelUploadRing->retire(true);
+    data = m_pixelUploadRing->tryAllocate(bytes.size(), pixels);
+  }
+  if (data) {
+    std::memcpy(data, bytes.data(), bytes.size());
+  }
+}
+
+void ViewerApplication::releaseImagePixels(PixelUploadRegion &pixels) const
+{
+  if (m_pixelUploadRing && !pixels.empty()) {
+    m_pixelUploadRing->release(pixels);
+    m_pixelUploadRing->retire();
+    pixels = PixelUploadRegion();
+  }
+}
+
+std::vector<GLuint> ViewerApplication::createSamplerObjects(
     const tinygltf::Model &model) const
 {
-  std::vector<GLuint> textureObjects(model.textures.size(), 0);
+  std::vector<GLuint> samplerObjects(model.samplers.size() + 1, 0);
+  glGenSamplers(GLsizei(samplerObjects.size()), samplerObjects.data());
 
   // default sampler:
   // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#texturesampler
   // "When undefined, a sampler with repeat wrapping and auto filtering should
   // be used."
   tinygltf::Sampler defaultSampler;
-  defaultSampler.minFilter = GL_LINEAR;
-  defaultSampler.magFilter = GL_LINEAR;
   defaultSampler.wrapS = GL_REPEAT;
   defaultSampler.wrapT = GL_REPEAT;
   defaultSampler.wrapR = GL_REPEAT;
 
-  glActiveTexture(GL_TEXTURE0);
-
-  glGenTextures(GLsizei(model.textures.size()), textureObjects.data());
-  for (size_t i = 0; i < model.textures.size(); ++i) {
-    const auto &texture = model.textures[i];
-    assert(texture.source >= 0);
-    const auto &image = model.images[texture.source];
-
+  for (size_t i = 0; i < samplerObjects.size(); ++i) {
     const auto &sampler =
-        texture.sampler >= 0 ? model.samplers[texture.sampler] : defaultSampler;
-    glBindTexture(GL_TEXTURE_2D, textureObjects[i]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
-        GL_RGBA, image.pixel_type, image.image.data());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-        sampler.minFilter != -1 ? sampler.minFilter : GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+        i < model.samplers.size() ? model.samplers[i] : defaultSampler;
+    // Minified textures without mipmaps thrash the texture cache, so samplers
+    // without a minification filter get a mipmap one (see imageUsages())
+    glSamplerParameteri(samplerObjects[i], GL_TEXTURE_MIN_FILTER,
+        sampler.minFilter != -1 ? sampler.minFilter : GL_LINEAR_MIPMAP_LINEAR);
+    glSamplerParameteri(samplerObjects[i], GL_TEXTURE_MAG_FILTER,
         sampler.magFilter != -1 ? sampler.magFilter : GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrapS);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrapT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, sampler.wrapR);
-
-    if (sampler.minFilter == GL_NEAREST_MIPMAP_NEAREST ||
-        sampler.minFilter == GL_NEAREST_MIPMAP_LINEAR ||
-        sampler.minFilter == GL_LINEAR_MIPMAP_NEAREST ||
-        sampler.minFilter == GL_LINEAR_MIPMAP_LINEAR) {
+    glSamplerParameteri(samplerObjects[i], GL_TEXTURE_WRAP_S, sampler.wrapS);
+    glSamplerParameteri(samplerObjects[i], GL_TEXTURE_WRAP_T, sampler.wrapT);
+    glSamplerParameteri(samplerObjects[i], GL_TEXTURE_WRAP_R, sampler.wrapR);
+  }
+
+  return samplerObjects;
+}
+
+GLint ViewerApplication::uploadImageTexture(const tinygltf::Image &image,
+    const ImageUsage &usage, GLuint textureObject,
+    const PixelUploadRegion &pixels, const CompressedTexture &compressed,
+    TextureMemory &memory, bool coarseLevelsOnly) const
+{
+  // KTX2 images are only uploaded once transcoded
+  const auto decoded = !image.image.empty() &&
+                       !isKtx2(image.image.data(), image.image.size());
+  const auto mipmaps = usage.mipmaps;
+  const auto levels = mipChainLayout(std::max(image.width, 1),
+      std::max(image.height, 1), 4 * size_t(std::max(image.bits, 8) / 8),
+      mipmaps ? mipLevelCount(image.width, image.height) : 1);
+  const auto uncompressedBytes = levels.back().offset + levels.back().size;
+  memory.uncompressedBytes += uncompressedBytes;
+  const auto srgb = m_options.srgbTextures && usage.srgb;
+
+  // First level of at most coarseMipSize texels
+  const auto coarseLevel = [&](size_t levelCount, int width, int height) {
+    size_t level = 0;
+    while (coarseLevelsOnly && level + 1 < levelCount &&
+           std::max(width >> level, height >> level) > coarseMipSize) {
+      ++level;
+    }
+    return level;
+  };
+  size_t firstLevel = 0;
+
+  // Immutable storage, allocated once with all its levels
+  glBindTexture(GL_TEXTURE_2D, textureObject);
+  if (!compressed.empty()) {
+    // Mip levels come with the compressed image, glGenerateMipmap does not
+    // support compressed formats
+    const auto internalFormat =
+        compressedInternalFormat(compressed.encoding.format, srgb);
+    const auto levelCount = mipmaps ? compressed.levels.size() : 1;
+    glTexStorage2D(GL_TEXTURE_2D, GLsizei(levelCount), internalFormat,
+        compressed.levels[0].width, compressed.levels[0].height);
+    firstLevel = coarseLevel(
+        levelCount, compressed.levels[0].width, compressed.levels[0].height);
+    if (!pixels.empty()) {
+      m_pixelUploadRing->bind();
+    }
+    for (size_t i = 0; i < levelCount; ++i) {
+      const auto &level = compressed.levels[i];
+      memory.bytes += level.size;
+      if (i < firstLevel) {
+        continue;
+      }
+      const auto data =
+          pixels.empty()
+              ? (const void *)(compressed.data.data() + level.offset)
+              : (const void *)(pixels.offset + level.offset);
+      glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(i), 0, 0, level.width,
+          level.height, internalFormat, GLsizei(level.size), data);
+    }
+    if (!pixels.empty()) {
+      m_pixelUploadRing->unbind();
+    }
+
+    // BC4 and BC5 store the channels the shaders read in red and green
+    if (compressed.encoding.format == BlockFormat::BC4 ||
+        compressed.encoding.format == BlockFormat::BC5) {
+      GLint swizzle[4] = {GL_ZERO, GL_ZERO, GL_ZERO, GL_ONE};
+      swizzle[compressed.encoding.sourceChannels[0]] = GL_RED;
+      if (compressed.encoding.format == BlockFormat::BC5) {
+        swizzle[compressed.encoding.sourceChannels[1]] = GL_GREEN;
+      }
+      glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+  } else if (!decoded) {
+    // The image could not be decoded or transcoded, fallback to white
+    const unsigned char white[] = {255, 255, 255, 255};
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+  } else {
+    // Levels missing from the pixels of the image (16 bits images) are
+    // generated by the GPU, from all the others
+    const auto storedLevels =
+        std::min(size_t(storedMipLevelCount(image)), levels.size());
+    const auto internalFormat =
+        image.bits == 16 ? GL_RGBA16 : srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    glTexStorage2D(GL_TEXTURE_2D, GLsizei(levels.size()), internalFormat,
+        image.width, image.height);
+    if (storedLevels == levels.size()) {
+      firstLevel = coarseLevel(levels.size(), image.width, image.height);
+    }
+    // From the ring, only queues copies the GPU performs asynchronously
+    if (!pixels.empty()) {
+      m_pixelUploadRing->bind();
+    }
+    for (size_t i = firstLevel; i < storedLevels; ++i) {
+      const auto &level = levels[i];
+      const auto data =
+          pixels.empty() ? (const void *)(image.image.data() + level.offset)
+                         : (const void *)(pixels.offset + level.offset);
+      glTexSubImage2D(GL_TEXTURE_2D, GLint(i), 0, 0, level.width,
+          level.height, GL_RGBA, image.pixel_type, data);
+    }
+    if (!pixels.empty()) {
+      m_pixelUploadRing->unbind();
+    }
+    if (storedLevels < levels.size()) {
       glGenerateMipmap(GL_TEXTURE_2D);
     }
+    memory.bytes += uncompressedBytes;
+  }
+  // Sampler objects override the LOD clamps of textures, not their base level
+  if (firstLevel > 0) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, GLint(firstLevel));
+  }
+  return GLint(firstLevel);
+}
+
+void ViewerApplication::uploadImageLevel(const tinygltf::Image &image,
+    const ImageUsage &usage, GLuint textureObject, GLint level,
+    const CompressedTexture &compressed) const
+{
+  glBindTexture(GL_TEXTURE_2D, textureObject);
+  if (!compressed.empty()) {
+    const auto &compressedLevel = compressed.levels[level];
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0,
+        compressedLevel.width, compressedLevel.height,
+        compressedInternalFormat(compressed.encoding.format,
+            m_options.srgbTextures && usage.srgb),
+        GLsizei(compressedLevel.size),
+        compressed.data.data() + compressedLevel.offset);
+  } else {
+    const auto levels = mipChainLayout(image.width, image.height,
+        4 * size_t(image.bits / 8), level + 1);
+    const auto &pixelsLevel = levels.back();
+    glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pixelsLevel.width,
+        pixelsLevel.height, GL_RGBA, image.pixel_type,
+        image.image.data() + pixelsLevel.offset);
   }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
   glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-  return textureObjects;
+void ViewerApplication::logTextureMemory(const TextureMemory &memory) const
+{
+  const auto toMB = [](size_t bytes) { return bytes / (1024. * 1024.); };
+  std::clog << "Textures use " << toMB(memory.bytes) << " MB of video memory";
+  if (memory.bytes < memory.uncompressedBytes) {
+    std::clog << " (" << toMB(memory.uncompressedBytes)
+              << " MB uncompressed)";
+  }
+  std::clog << std::endl;
+}
+
+std::unique_ptr<VirtualTextureCache> ViewerApplication::createVirtualTextures(
+    const tinygltf::Model &model, const std::vector<int> &imageSources,
+    std::vector<int> &virtualImages) const
+{
+  size_t uniqueImageCount = 0;
+  for (size_t i = 0; i < imageSources.size(); ++i) {
+    uniqueImageCount += imageSources[i] == int(i);
+  }
+  auto cache = std::make_unique<VirtualTextureCache>(
+      m_options.virtualTextureBudget, uniqueImageCount);
+  virtualImages.assign(model.images.size(), -1);
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (imageSources[i] != int(i)) {
+      continue;
+    }
+    const auto &image = model.images[i];
+    virtualImages[i] = cache->addImage(image);
+    if (virtualImages[i] < 0 && !image.image.empty()) {
+      std::cerr << "Image '" << image.uri
+                << "' cannot be virtualized, its textures are ignored"
+                << std::endl;
+    }
+  }
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (imageSources[i] >= 0) {
+      virtualImages[i] = virtualImages[imageSources[i]];
+    }
+  }
+  cache->finishImages();
+  return cache;
 }
 
 std::vector<GLuint> ViewerApplication::createBufferObjects(
-    const tinygltf::Model &model) const
+    const std::vector<BufferBytes> &buffers, bool uploadData) const
 {
-  std::vector<GLuint> bufferObjects(model.buffers.size(), 0);
+  std::vector<GLuint> bufferObjects(buffers.size(), 0);
 
-  glGenBuffers(GLsizei(model.buffers.size()), bufferObjects.data());
-  for (size_t i = 0; i < model.buffers.size(); ++i) {
+  glGenBuffers(GLsizei(buffers.size()), bufferObjects.data());
+  for (size_t i = 0; i < buffers.size(); ++i) {
     glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[i]);
-    glBufferStorage(GL_ARRAY_BUFFER, model.buffers[i].data.size(),
-        model.buffers[i].data.data(), 0);
+    if (uploadData) {
+      // When buffers are mapped, the driver reads directly from the mapping
+      glBufferStorage(GL_ARRAY_BUFFER, buffers[i].size, buffers[i].data, 0);
+    } else {
+      glBufferStorage(
+          GL_ARRAY_BUFFER, buffers[i].size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    }
   }
   glBindBuffer(GL_ARRAY_BUFFER, 0);
 
@@ -723,10 +2034,6 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
   // For each mesh of model we keep its range of VAOs
   meshToVertexArrays.resize(model.meshes.size());
 
-  const GLuint VERTEX_ATTRIB_POSITION_IDX = 0;
-  const GLuint VERTEX_ATTRIB_NORMAL_IDX = 1;
-  const GLuint VERTEX_ATTRIB_TEXCOORD0_IDX = 2;
-
   for (size_t i = 0; i < model.meshes.size(); ++i) {
     const auto &mesh = model.meshes[i];
 
@@ -741,98 +2048,281 @@ std::vector<GLuint> ViewerApplication::createVertexArrayObjects(
     vertexArrayObjects.resize(
         vertexArrayObjects.size() + mesh.primitives.size());
 
-    glGenVertexArrays(vaoRange.count, &vertexArrayObjects[vaoRange.begin]);
-    for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
-      const auto vao = vertexArrayObjects[vaoRange.begin + pIdx];
-      const auto &primitive = mesh.primitives[pIdx];
-      glBindVertexArray(vao);
-      { // POSITION attribute
-        // scope, so we can declare const variable with the same name on each
-        // scope
-        const auto iterator = primitive.attributes.find("POSITION");
-        if (iterator != end(primitive.attributes)) {
-          const auto accessorIdx = (*iterator).second;
-          const auto &accessor = model.accessors[accessorIdx];
-          const auto &bufferView = model.bufferViews[accessor.bufferView];
-          const auto bufferIdx = bufferView.buffer;
-
-          glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION_IDX);
-          assert(GL_ARRAY_BUFFER == bufferView.target);
-          // Theorically we could also use bufferView.target, but it is safer
-          // Here it is important to know that the next call
-          // (glVertexAttribPointer) use what is currently bound
-          glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferIdx]);
-
-          // tinygltf converts strings type like "VEC3, "VEC2" to the number of
-          // components, stored in accessor.type
-          const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
-          glVertexAttribPointer(VERTEX_ATTRIB_POSITION_IDX, accessor.type,
-              accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
-              (const GLvoid *)byteOffset);
-        }
-      }
-      // todo Refactor to remove code duplication (loop over "POSITION",
-      // "NORMAL" and their corresponding VERTEX_ATTRIB_*)
-      { // NORMAL attribute
-        const auto iterator = primitive.attributes.find("NORMAL");
-        if (iterator != end(primitive.attributes)) {
-          const auto accessorIdx = (*iterator).second;
-          const auto &accessor = model.accessors[accessorIdx];
-          const auto &bufferView = model.bufferViews[accessor.bufferView];
-          const auto bufferIdx = bufferView.buffer;
-
-          glEnableVertexAttribArray(VERTEX_ATTRIB_NORMAL_IDX);
-          assert(GL_ARRAY_BUFFER == bufferView.target);
-          glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferIdx]);
-          glVertexAttribPointer(VERTEX_ATTRIB_NORMAL_IDX, accessor.type,
-              accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
-              (const GLvoid *)(accessor.byteOffset + bufferView.byteOffset));
-        }
+    createMeshVertexArrayObjects(
+        model, mesh, bufferObjects, &vertexArrayObjects[vaoRange.begin]);
+  }
+  glBindVertexArray(0);
+
+  std::clog << "Number of VAOs: " << vertexArrayObjects.size() << std::endl;
+
+  return vertexArrayObjects;
+}
+
+void ViewerApplication::createMeshVertexArrayObjects(
+    const tinygltf::Model &model, const tinygltf::Mesh &mesh,
+    const std::vector<GLuint> &bufferObjects, GLuint *vertexArrayObjects) const
+{
+  const GLuint VERTEX_ATTRIB_POSITION_IDX = 0;
+  const GLuint VERTEX_ATTRIB_NORMAL_IDX = 1;
+  const GLuint VERTEX_ATTRIB_TEXCOORD0_IDX = 2;
+
+  glGenVertexArrays(GLsizei(mesh.primitives.size()), vertexArrayObjects);
+  for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
+    const auto vao = vertexArrayObjects[pIdx];
+    const auto &primitive = mesh.primitives[pIdx];
+    glBindVertexArray(vao);
+    { // POSITION attribute
+      // scope, so we can declare const variable with the same name on each
+      // scope
+      const auto iterator = primitive.attributes.find("POSITION");
+      if (iterator != end(primitive.attributes)) {
+        const auto accessorIdx = (*iterator).second;
+        const auto &accessor = model.accessors[accessorIdx];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        const auto bufferIdx = bufferView.buffer;
+
+        glEnableVertexAttribArray(VERTEX_ATTRIB_POSITION_IDX);
+        assert(GL_ARRAY_BUFFER == bufferView.target);
+        // Theorically we could also use bufferView.target, but it is safer
+        // Here it is important to know that the next call
+        // (glVertexAttribPointer) use what is currently bound
+        glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferIdx]);
+
+        // tinygltf converts strings type like "VEC3, "VEC2" to the number of
+        // components, stored in accessor.type
+        const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+        glVertexAttribPointer(VERTEX_ATTRIB_POSITION_IDX, accessor.type,
+            accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
+            (const GLvoid *)byteOffset);
       }
-      { // TEXCOORD_0 attribute
-        const auto iterator = primitive.attributes.find("TEXCOORD_0");
-        if (iterator != end(primitive.attributes)) {
-          const auto accessorIdx = (*iterator).second;
-          const auto &accessor = model.accessors[accessorIdx];
-          const auto &bufferView = model.bufferViews[accessor.bufferView];
-          const auto bufferIdx = bufferView.buffer;
-
-          glEnableVertexAttribArray(VERTEX_ATTRIB_TEXCOORD0_IDX);
-          assert(GL_ARRAY_BUFFER == bufferView.target);
-          glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferIdx]);
-          glVertexAttribPointer(VERTEX_ATTRIB_TEXCOORD0_IDX, accessor.type,
-              accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
-              (const GLvoid *)(accessor.byteOffset + bufferView.byteOffset));
-        }
+    }
+    // todo Refactor to remove code duplication (loop over "POSITION",
+    // "NORMAL" and their corresponding VERTEX_ATTRIB_*)
+    { // NORMAL attribute
+      const auto iterator = primitive.attributes.find("NORMAL");
+      if (iterator != end(primitive.attributes)) {
+        const auto accessorIdx = (*iterator).second;
+        const auto &accessor = model.accessors[accessorIdx];
+        const auto &bufferView = model.bufferViews[accessor.bufferView];
+        const auto bufferIdx = bufferView.buffer;
+
+        glEnableVertexAttribArray(VERTEX_ATTRIB_NORMAL_IDX);
+        assert(GL_ARRAY_BUFFER == bufferView.target);
+        glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferIdx]);
+        glVertexAttribPointer(VERTEX_ATTRIB_NORMAL_IDX, accessor.type,
+            accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
+            (const GLvoid *)(accessor.byteOffset + bufferView.byteOffset));
       }
-      // Index array if defined
-      if (primitive.indices >= 0) {
-        const auto accessorIdx = primitive.indices;
+    }
+    { // TEXCOORD_0 attribute
+      const auto iterator = primitive.attributes.find("TEXCOORD_0");
+      if (iterator != end(primitive.attributes)) {
+        const auto accessorIdx = (*iterator).second;
         const auto &accessor = model.accessors[accessorIdx];
         const auto &bufferView = model.bufferViews[accessor.bufferView];
         const auto bufferIdx = bufferView.buffer;
 
-        assert(GL_ELEMENT_ARRAY_BUFFER == bufferView.target);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-            bufferObjects[bufferIdx]); // Binding the index buffer to
-                                       // GL_ELEMENT_ARRAY_BUFFER while the VAO
-                                       // is bound is enough to tell OpenGL we
-                                       // want to use that index buffer for that
-                                       // VAO
+        glEnableVertexAttribArray(VERTEX_ATTRIB_TEXCOORD0_IDX);
+        assert(GL_ARRAY_BUFFER == bufferView.target);
+        glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[bufferIdx]);
+        glVertexAttribPointer(VERTEX_ATTRIB_TEXCOORD0_IDX, accessor.type,
+            accessor.componentType, GL_FALSE, GLsizei(bufferView.byteStride),
+            (const GLvoid *)(accessor.byteOffset + bufferView.byteOffset));
       }
     }
+    // Index array if defined
+    if (primitive.indices >= 0) {
+      const auto accessorIdx = primitive.indices;
+      const auto &accessor = model.accessors[accessorIdx];
+      const auto &bufferView = model.bufferViews[accessor.bufferView];
+      const auto bufferIdx = bufferView.buffer;
+
+      assert(GL_ELEMENT_ARRAY_BUFFER == bufferView.target);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+          bufferObjects[bufferIdx]); // Binding the index buffer to
+                                     // GL_ELEMENT_ARRAY_BUFFER while the VAO
+                                     // is bound is enough to tell OpenGL we
+                                     // want to use that index buffer for that
+                                     // VAO
+    }
+    if (m_options.instancing) {
+      InstanceBuffer::setupVertexArray();
+    }
+    if (m_options.uniformBuffers) {
+      UniformBuffers::setupVertexArray();
+    }
   }
-  glBindVertexArray(0);
+}
 
-  std::clog << "Number of VAOs: " << vertexArrayObjects.size() << std::endl;
+void ViewerApplication::startSceneStreaming(tinygltf::Model &model,
+    const GltfBuffers &buffers, SceneStreamingState &streaming,
+    std::vector<GLuint> &bufferObjects,
+    std::vector<VaoRange> &meshToVertexArrays,
+    std::vector<GLuint> &vertexArrayObjects,
+    std::vector<GLuint> &textureObjects)
+{
+  bufferObjects = createBufferObjects(buffers.bytes, false);
 
-  return vertexArrayObjects;
+  meshToVertexArrays.resize(model.meshes.size());
+  GLsizei vertexArrayCount = 0;
+  for (size_t i = 0; i < model.meshes.size(); ++i) {
+    meshToVertexArrays[i].begin = vertexArrayCount;
+    meshToVertexArrays[i].count = GLsizei(model.meshes[i].primitives.size());
+    vertexArrayCount += meshToVertexArrays[i].count;
+  }
+  vertexArrayObjects.assign(vertexArrayCount, 0);
+
+  textureObjects.assign(model.images.size(), 0);
+  streaming.textureBaseLevels.assign(model.images.size(), 0);
+  streaming.imageRegions.assign(model.images.size(), PixelUploadRegion());
+  streaming.compressedImages.assign(model.images.size(), CompressedTexture());
+  streaming.imageUsages = imageUsages(model);
+  streaming.imageSources = uniqueImages(model, streaming.imageUsages);
+  limitTextureSizes(model, streaming.imageSources, streaming.imageUsages);
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (streaming.imageSources[i] == int(i)) {
+      streaming.pendingImages.push_back(i);
+    }
+  }
+  streaming.uniqueImageCount = streaming.pendingImages.size();
+  // The model is not modified anymore by the loading task, workers can
+  // decode images in place while we stream buffers
+  streaming.imageDecoding = startDecodingImages(
+      model, m_threadPool, [this, &model, &streaming](size_t imageIdx) {
+        if (streaming.imageSources[imageIdx] != int(imageIdx)) {
+          return;
+        }
+        prepareImagePixels(model.images[imageIdx],
+            streaming.imageUsages[imageIdx],
+            streaming.compressedImages[imageIdx]);
+        // Levels uploaded over several frames are read from client memory,
+        // so that they do not hold regions of the ring
+        if (m_options.virtualTextureBudget == 0 && !m_options.lowMipsFirst) {
+          stageImagePixels(model.images[imageIdx],
+              streaming.compressedImages[imageIdx],
+              streaming.imageRegions[imageIdx], false);
+        }
+      });
+}
+
+bool ViewerApplication::streamSceneObjects(const tinygltf::Model &model,
+    const GltfBuffers &buffers, double budgetSeconds,
+    SceneStreamingState &streaming, const std::vector<GLuint> &bufferObjects,
+    const std::vector<VaoRange> &meshToVertexArrays,
+    std::vector<GLuint> &vertexArrayObjects,
+    std::vector<GLuint> &textureObjects) const
+{
+  // Large enough to amortize the call, small enough to fit in a frame budget
+  const size_t bufferChunkSize = 8 * 1024 * 1024;
+
+  const auto deadline = glfwGetTime() + budgetSeconds;
+  // At least one step per frame so that a tiny budget still makes progress
+  do {
+    if (streaming.nextBuffer < buffers.bytes.size()) {
+      const auto &bytes = buffers.bytes[streaming.nextBuffer];
+      const auto offset = streaming.nextBufferOffset;
+      const auto size = std::min(bufferChunkSize, bytes.size - offset);
+      glBindBuffer(GL_ARRAY_BUFFER, bufferObjects[streaming.nextBuffer]);
+      glBufferSubData(GL_ARRAY_BUFFER, offset, size, bytes.data + offset);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      streaming.nextBufferOffset += size;
+      if (streaming.nextBufferOffset >= bytes.size) {
+        ++streaming.nextBuffer;
+        streaming.nextBufferOffset = 0;
+      }
+    } else if (streaming.nextMesh < model.meshes.size()) {
+      // Meshes only need buffers, so they show up untextured first
+      const auto &vaoRange = meshToVertexArrays[streaming.nextMesh];
+      createMeshVertexArrayObjects(model, model.meshes[streaming.nextMesh],
+          bufferObjects, &vertexArrayObjects[vaoRange.begin]);
+      glBindVertexArray(0);
+      ++streaming.nextMesh;
+    } else {
+      // Upload images in the order they get decoded
+      auto &pending = streaming.pendingImages;
+      const auto it =
+          std::find_if(begin(pending), end(pending), [&](size_t imageIdx) {
+            return streaming.imageDecoding[imageIdx].wait_for(
+                       std::chrono::seconds(0)) == std::future_status::ready;
+          });
+      if (it == end(pending)) {
+        auto &refining = streaming.refiningImages;
+        if (refining.empty()) {
+          break; // Wait for decoding workers
+        }
+        // The next level of the image whose base level is the smallest, so
+        // that all textures get sharper together
+        const auto imageIdx = *std::max_element(begin(refining),
+            end(refining), [&](size_t lhs, size_t rhs) {
+              return streaming.textureBaseLevels[lhs] <
+                     streaming.textureBaseLevels[rhs];
+            });
+        auto &baseLevel = streaming.textureBaseLevels[imageIdx];
+        --baseLevel;
+        uploadImageLevel(model.images[imageIdx],
+            streaming.imageUsages[imageIdx], textureObjects[imageIdx],
+            baseLevel, streaming.compressedImages[imageIdx]);
+        if (baseLevel == 0) {
+          streaming.compressedImages[imageIdx] = CompressedTexture();
+          refining.erase(std::find(begin(refining), end(refining), imageIdx));
+        }
+        continue;
+      }
+      const auto imageIdx = *it;
+      auto &pixels = streaming.imageRegions[imageIdx];
+      auto &compressed = streaming.compressedImages[imageIdx];
+      try {
+        streaming.imageDecoding[imageIdx].get();
+      } catch (const std::exception &e) {
+        // The image may be half prepared, its textures use the fallbacks
+        std::cerr << "Unable to decode image '" << model.images[imageIdx].uri
+                  << "': " << e.what() << ", its textures are ignored"
+                  << std::endl;
+        releaseImagePixels(pixels);
+        compressed = CompressedTexture();
+        streaming.failedImages.push_back(imageIdx);
+        pending.erase(it);
+        continue;
+      }
+      if (m_options.virtualTextureBudget > 0) {
+        pending.erase(it); // Virtualized once all images are decoded
+        continue;
+      }
+      if (!m_options.lowMipsFirst) {
+        stageImagePixels(model.images[imageIdx], compressed, pixels, true);
+      }
+      glGenTextures(1, &textureObjects[imageIdx]);
+      const auto baseLevel = uploadImageTexture(model.images[imageIdx],
+          streaming.imageUsages[imageIdx], textureObjects[imageIdx], pixels,
+          compressed, streaming.textureMemory, m_options.lowMipsFirst);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      releaseImagePixels(pixels);
+      if (baseLevel > 0) {
+        streaming.textureBaseLevels[imageIdx] = baseLevel;
+        streaming.refiningImages.push_back(imageIdx);
+      } else {
+        compressed = CompressedTexture();
+      }
+      // Identical images share the texture object
+      for (size_t i = 0; i < model.images.size(); ++i) {
+        if (streaming.imageSources[i] == int(imageIdx)) {
+          textureObjects[i] = textureObjects[imageIdx];
+        }
+      }
+      pending.erase(it);
+    }
+  } while (glfwGetTime() < deadline);
+
+  return streaming.nextBuffer == buffers.bytes.size() &&
+         streaming.nextMesh == model.meshes.size() &&
+         streaming.pendingImages.empty() && streaming.refiningImages.empty();
 }
 
 ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     uint32_t height, const fs::path &gltfFile,
     const std::vector<float> &lookatArgs, const std::string &vertexShader,
-    const std::string &fragmentShader, const fs::path &output) :
+    const std::string &fragmentShader, const fs::path &output,
+    const ViewerOptions &options) :
     m_nWindowWidth(width),
     m_nWindowHeight(height),
     m_AppPath{appPath},
@@ -840,6 +2330,8 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
     m_ImGuiIniFilename{m_AppName + ".imgui.ini"},
     m_ShadersRootPath{m_AppPath.parent_path() / "shaders"},
     m_gltfFilePath{gltfFile},
+    m_options{options},
+    m_startupReport{!options.startupReportPath.empty()},
     m_OutputPath{output}
 {
   if (!lookatArgs.empty()) {
@@ -865,6 +2357,57 @@ ViewerApplication::ViewerApplication(const fs::path &appPath, uint32_t width,
   glfwSetKeyCallback(m_GLFWHandle.window(), keyCallback);
 
   printGLVersion();
+
+  // BC1 is the only block format of the compressed textures that is not
+  // core, bindless textures are optional for the material buffer, multi-draw
+  // shaders need gl_DrawIDARB, and free video memory can only be queried
+  // through vendor extensions
+  bool nvxMemoryInfo = false;
+  bool atiMemInfo = false;
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; ++i) {
+    const auto extension = (const char *)glGetStringi(GL_EXTENSIONS, GLuint(i));
+    if (!extension) {
+      continue;
+    }
+    if (std::strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0) {
+      m_bc1Supported = true;
+    } else if (std::strcmp(extension, "GL_ARB_bindless_texture") == 0) {
+      m_bindlessSupported = true;
+    } else if (std::strcmp(extension, "GL_ARB_shader_draw_parameters") == 0) {
+      m_drawParametersSupported = true;
+    } else if (std::strcmp(extension, "GL_NVX_gpu_memory_info") == 0) {
+      nvxMemoryInfo = true;
+    } else if (std::strcmp(extension, "GL_ATI_meminfo") == 0) {
+      atiMemInfo = true;
+    }
+  }
+
+  if (m_options.autoTextureBudget) {
+    GLint freeKB = 0;
+    if (nvxMemoryInfo) {
+      glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &freeKB);
+    } else if (atiMemInfo) {
+      // Total free memory, largest free block, then the same for auxiliary
+      // memory
+      GLint info[4] = {0, 0, 0, 0};
+      glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, info);
+      freeKB = info[0];
+    }
+    if (freeKB > 0) {
+      m_options.textureBudget =
+          size_t(autoTextureBudgetShare * double(freeKB) * 1024);
+      std::clog << "Texture budget: "
+                << m_options.textureBudget / (1024 * 1024) << " MB of "
+                << freeKB / 1024 << " MB of free video memory"
+                << std::endl;
+    } else {
+      std::cerr << "Unable to query free video memory, textures are not "
+                   "fitted to a budget"
+                << std::endl;
+    }
+  }
 }
 
 void ViewerApplication::loadLocations(GLuint ID, Locations &locations)
@@ -892,6 +2435,11 @@ void ViewerApplication::loadLocations(GLuint ID, Locations &locations)
   locations.uOcclusionTexture = glGetUniformLocation(ID, "uOcclusionTexture");
   locations.uOcclusionStrength = glGetUniformLocation(ID, "uOcclusionStrength");
   locations.uApplyOcclusion = glGetUniformLocation(ID, "uApplyOcclusion");
+  locations.uMaterialIndex = glGetUniformLocation(ID, "uMaterialIndex");
+  locations.uViewMatrix = glGetUniformLocation(ID, "uViewMatrix");
+  locations.uProjMatrix = glGetUniformLocation(ID, "uProjMatrix");
+  locations.uDrawOffset = glGetUniformLocation(ID, "uDrawOffset");
+  locations.aDrawIndices = glGetAttribLocation(ID, "aDrawIndices");
 }
 
 int ViewerApplication::createGBuffer()
@@ -3,8 +3,15 @@
 #include "utils/GLFWHandle.hpp"
 #include "utils/cameras.hpp"
 #include "utils/filesystem.hpp"
+#include "utils/gltf_loader.hpp"
+#include "utils/pixel_upload_ring.hpp"
 #include "utils/shaders.hpp"
+#include "utils/startup_report.hpp"
+#include "utils/texture_compression.hpp"
+#include "utils/virtual_textures.hpp"
 
+#include <future>
+#include <memory>
 #include <random>
 #include <tiny_gltf.h>
 
@@ -26,6 +33,84 @@ struct Locations
   int uOcclusionTexture;
   int uOcclusionStrength;
   int uApplyOcclusion;
+  int uMaterialIndex; // Shaders reading a MaterialTable
+  // Shaders drawing a MultiDrawScene
+  int uViewMatrix;
+  int uProjMatrix;
+  int uDrawOffset;
+  int aDrawIndices; // Attribute of the shaders reading UniformBuffers
+};
+
+struct ViewerOptions
+{
+  GltfLoaderOptions loader;
+  // Parse the file in the background and stream buffers, meshes and textures
+  // to the GPU across frames, instead of blocking before the first frame
+  bool progressive = false;
+  // Time spent uploading scene objects per frame in progressive mode
+  double uploadBudgetMs = 4;
+  // In progressive mode, upload the coarse levels of each texture first, then
+  // finer levels over the next frames, instead of all its levels at once
+  bool lowMipsFirst = false;
+  // Size in bytes of the ring of staging memory texture uploads go through,
+  // 0 to upload from client memory
+  size_t uploadRingSize = 64 * 1024 * 1024;
+  // Free buffers and decoded images of the model once they are on the GPU,
+  // keeping only what the render loop reads
+  bool releaseCpuData = false;
+  // Directory of scene cache files (see scene_cache.hpp), empty to disable
+  fs::path sceneCacheDirectory;
+  // Upload textures block compressed (see texture_compression.hpp) instead of
+  // as GL_RGBA8. Images are compressed by the decoding workers.
+  bool compressTextures = false;
+  // Directory of compressed texture files, so that each image is compressed
+  // once, empty to disable
+  fs::path textureCacheDirectory;
+  // Largest side of textures, larger images are downscaled by the decoding
+  // workers before being uploaded, 0 to keep their size
+  int maxTextureSize = 0;
+  // Size in bytes the textures should fit in, by downscaling the images with
+  // the most texels per world unit first (see texture_budget.hpp), 0 to
+  // disable
+  size_t textureBudget = 0;
+  // Set textureBudget to a share of the free video memory, when the driver
+  // tells it (GL_NVX_gpu_memory_info or GL_ATI_meminfo)
+  bool autoTextureBudget = false;
+  // Upload color images (base color, emissive) as sRGB textures decoded by
+  // the texture units, and let an sRGB default framebuffer encode the output,
+  // instead of pow() calls in the shaders
+  bool srgbTextures = false;
+  // Merge distinct occlusion and metallic-roughness images of materials into
+  // one texture at load time (see orm_textures.hpp), so that shaders fetch
+  // and draws bind one texture less
+  bool ormTextures = false;
+  // Once the scene is uploaded, draw with shaders reading all materials from
+  // a buffer (see material_table.hpp) instead of binding textures per draw
+  bool materialBuffer = false;
+  // With materialBuffer, use texture arrays even if bindless textures are
+  // supported
+  bool textureArrays = false;
+  // Size in bytes of the page cache of virtual textures (see
+  // virtual_textures.hpp), which replace texture objects with materialBuffer,
+  // 0 to disable
+  size_t virtualTextureBudget = 0;
+  // With materialBuffer, draw the scene with one
+  // glMultiDrawElementsIndirect() call per vertex format, from geometry packed
+  // at load time (see multi_draw.hpp), when GL_ARB_shader_draw_parameters is
+  // supported
+  bool multiDraw = false;
+  // Draw consecutive draws of the same primitive (nodes sharing a mesh, or
+  // the instances of EXT_mesh_gpu_instancing) with one instanced draw reading
+  // the matrices from an instance buffer (see instancing.hpp)
+  bool instancing = false;
+  // With the material buffer, read the camera and light from a uniform buffer
+  // written once per frame, the matrices of nodes from a storage buffer only
+  // written when they change, and the object and material of each draw from a
+  // per instance attribute, so that draws upload no uniforms (see
+  // uniform_buffers.hpp). Ignored with multiDraw.
+  bool uniformBuffers = false;
+  // Where to write the timings of the startup phases as JSON, empty to disable
+  fs::path startupReportPath;
 };
 
 class ViewerApplication
@@ -34,7 +119,7 @@ public:
   ViewerApplication(const fs::path &appPath, uint32_t width, uint32_t height,
       const fs::path &gltfFile, const std::vector<float> &lookatArgs,
       const std::string &vertexShader, const std::string &fragmentShader,
-      const fs::path &output);
+      const fs::path &output, const ViewerOptions &options);
 
   int run();
 
@@ -46,11 +131,124 @@ private:
     GLsizei count; // Number of elements in range
   };
 
-  bool loadGltfFile(tinygltf::Model &model);
+  // Video memory of the texture objects created, and what it would be with
+  // uncompressed pixels
+  struct TextureMemory
+  {
+    size_t bytes = 0;
+    size_t uncompressedBytes = 0;
+  };
+
+  // Progress of the upload of a scene in progressive mode
+  struct SceneStreamingState
+  {
+    size_t nextBuffer = 0;       // Index of the buffer being uploaded
+    size_t nextBufferOffset = 0; // Bytes of nextBuffer already uploaded
+    size_t nextMesh = 0;         // Index of the next mesh to get its VAOs
+    size_t uniqueImageCount = 0;       // Images with their texture object
+    std::vector<size_t> pendingImages; // Unique images not uploaded yet
+    std::vector<size_t> refiningImages; // Uploaded without their finer levels
+    std::vector<size_t> failedImages;   // Unique images that failed to decode
+    std::vector<GLint> textureBaseLevels; // Per image, first level uploaded
+    std::vector<std::future<void>> imageDecoding; // One per image
+    std::vector<PixelUploadRegion> imageRegions;  // Staged pixels per image
+    std::vector<int> imageSources;       // See uniqueImages()
+    std::vector<ImageUsage> imageUsages; // One per image
+    std::vector<CompressedTexture> compressedImages; // One per image
+    TextureMemory textureMemory;
+  };
+
+  // Load the scene from its cache file if it is up to date (cacheHit), or
+  // from the glTF file. With ormTextures, materials are then packed by
+  // packOrmTextures().
+  bool loadGltfFile(tinygltf::Model &model, GltfBuffers &buffers,
+      glm::vec3 &bboxMin, glm::vec3 &bboxMax, bool &cacheHit);
+
+  // Move the occlusion of all materials to the red channel of their
+  // metallic-roughness texture (see orm_textures.hpp), as shaders compiled
+  // with ORM_TEXTURES expect
+  void packOrmTextures(tinygltf::Model &model) const;
+
+  // Called once all GPU objects of the scene are created, to release what is
+  // not needed anymore
+  void finishSceneUpload(tinygltf::Model &model, GltfBuffers &buffers,
+      const glm::vec3 &bboxMin, const glm::vec3 &bboxMax,
+      bool cacheHit) const;
+
+  // Write the cache file of the scene, images of model must be decoded
+  void updateSceneCache(const tinygltf::Model &model,
+      const GltfBuffers &buffers, const glm::vec3 &bboxMin,
+      const glm::vec3 &bboxMax) const;
+
+  // Decode images left encoded by the loader, and upload each of them to a
+  // texture object as soon as it is ready. Identical images are uploaded once
+  // and share their texture object, indexed by image. With virtual textures,
+  // images are only decoded and no texture object is created.
+  std::vector<GLuint> createTextureObjects(
+      tinygltf::Model &model, std::vector<int> &imageSources);
 
-  std::vector<GLuint> createTextureObjects(const tinygltf::Model &model) const;
+  // One sampler object per sampler of model, followed by the default sampler
+  // of textures without one. Textures are sampled with them instead of
+  // parameters of their texture object, which can be shared by several
+  // textures with different samplers.
+  std::vector<GLuint> createSamplerObjects(const tinygltf::Model &model) const;
 
-  std::vector<GLuint> createBufferObjects(const tinygltf::Model &model) const;
+  // Set the maxSize of the usage of each unique image to fit maxTextureSize
+  // and textureBudget, and log the images that get downscaled
+  void limitTextureSizes(const tinygltf::Model &model,
+      const std::vector<int> &imageSources,
+      std::vector<ImageUsage> &usages) const;
+
+  // Transcode KTX2 images. Append their mip chain to the pixels of other
+  // images if usage needs one and, with compressTextures, block compress them
+  // or load them from the texture cache. With virtual textures, images are
+  // only converted to RGBA8 with a full mip chain. Images larger than the
+  // maxSize of usage are downscaled first. Called by decoding workers.
+  void prepareImagePixels(tinygltf::Image &image,
+      const ImageUsage &usage, CompressedTexture &compressed) const;
+
+  // Copy the pixels of image, or compressed if not empty, to the upload ring,
+  // if there is one and it has room. Only the GL thread (onGLThread) may wait
+  // for room to be freed.
+  void stageImagePixels(const tinygltf::Image &image,
+      const CompressedTexture &compressed, PixelUploadRegion &pixels,
+      bool onGLThread) const;
+
+  // Once the image is uploaded
+  void releaseImagePixels(PixelUploadRegion &pixels) const;
+
+  // pixels are those of image (compressed ones if compressed is not empty)
+  // when staged, otherwise they are read from client memory. The texture gets
+  // immutable storage with a full mip chain unless usage says no sampler of the
+  // image needs one, in an sRGB format with srgbTextures if usage says so. The
+  // size of the texture object is added to memory. With coarseLevelsOnly,
+  // only the levels from the first one of at most coarseMipSize texels are
+  // uploaded, and the texture is sampled from there (its base level) until
+  // uploadImageLevel() fills the finer ones. Return that base level.
+  GLint uploadImageTexture(const tinygltf::Image &image,
+      const ImageUsage &usage, GLuint textureObject,
+      const PixelUploadRegion &pixels, const CompressedTexture &compressed,
+      TextureMemory &memory, bool coarseLevelsOnly = false) const;
+
+  // Upload level of a texture created by uploadImageTexture() from client
+  // memory, and make it the base level of the texture
+  void uploadImageLevel(const tinygltf::Image &image, const ImageUsage &usage,
+      GLuint textureObject, GLint level,
+      const CompressedTexture &compressed) const;
+
+  void logTextureMemory(const TextureMemory &memory) const;
+
+  // Page cache holding the unique images of model (see uniqueImages()), and
+  // the index of each image in it in virtualImages, -1 for images that cannot
+  // be virtualized
+  std::unique_ptr<VirtualTextureCache> createVirtualTextures(
+      const tinygltf::Model &model, const std::vector<int> &imageSources,
+      std::vector<int> &virtualImages) const;
+
+  // Without uploadData, buffer objects are only allocated and must be filled
+  // with glBufferSubData
+  std::vector<GLuint> createBufferObjects(
+      const std::vector<BufferBytes> &buffers, bool uploadData = true) const;
 
   void loadLocations(GLuint, Locations &);
   int createGBuffer();
@@ -61,6 +259,28 @@ private:
       const std::vector<GLuint> &bufferObjects,
       std::vector<VaoRange> &meshToVertexArrays) const;
 
+  // Create and setup one VAO per primitive of mesh in vertexArrayObjects
+  void createMeshVertexArrayObjects(const tinygltf::Model &model,
+      const tinygltf::Mesh &mesh, const std::vector<GLuint> &bufferObjects,
+      GLuint *vertexArrayObjects) const;
+
+  // Allocate scene objects, left empty (0), and start decoding images
+  void startSceneStreaming(tinygltf::Model &model, const GltfBuffers &buffers,
+      SceneStreamingState &streaming, std::vector<GLuint> &bufferObjects,
+      std::vector<VaoRange> &meshToVertexArrays,
+      std::vector<GLuint> &vertexArrayObjects,
+      std::vector<GLuint> &textureObjects);
+
+  // Upload buffer chunks, then create VAOs, then textures of decoded images,
+  // then with lowMipsFirst their finer levels, for about budgetSeconds.
+  // Return true once everything is uploaded.
+  bool streamSceneObjects(const tinygltf::Model &model,
+      const GltfBuffers &buffers, double budgetSeconds,
+      SceneStreamingState &streaming, const std::vector<GLuint> &bufferObjects,
+      const std::vector<VaoRange> &meshToVertexArrays,
+      std::vector<GLuint> &vertexArrayObjects,
+      std::vector<GLuint> &textureObjects) const;
+
   GLsizei m_nWindowWidth = 1280;
   GLsizei m_nWindowHeight = 720;
 
@@ -69,6 +289,9 @@ private:
   const fs::path m_ShadersRootPath;
 
   fs::path m_gltfFilePath;
+  ViewerOptions m_options;
+  StartupReport m_startupReport;
+  ThreadPool m_threadPool;
   std::string m_vertexShader = "forward.vs.glsl";
   std::string m_fragmentShader = "pbr_directional_light.fs.glsl";
   std::string m_vertexShaderGBuffer = "deferred_gbuffer.vs.glsl";
@@ -101,6 +324,11 @@ private:
     the creation of a GLFW windows and thus a GL context which must exists
     before most of OpenGL function calls.
   */
+  std::unique_ptr<PixelUploadRing> m_pixelUploadRing;
+  bool m_bc1Supported = false;            // GL_EXT_texture_compression_s3tc
+  bool m_bindlessSupported = false;       // GL_ARB_bindless_texture
+  bool m_drawParametersSupported = false; // GL_ARB_shader_draw_parameters
+
   unsigned int quadVAO = 0;
   unsigned int quadVBO;
 
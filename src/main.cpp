@@ -1,8 +1,10 @@
 #include "ViewerApplication.hpp"
 #include "utils/GLFWHandle.hpp"
+#include "utils/benchmarks.hpp"
 #include "utils/filesystem.hpp"
 
 #include <args.hxx>
+#include <cstdlib>
 
 std::vector<std::string> split(
     const std::string &str, const std::string &delim);
@@ -21,6 +23,46 @@ int main(int argc, char **argv)
         GLFWHandle handle{1, 1, "", false};
         printGLVersion();
       }};
+  args::Command benchParser{commands, "bench-parser",
+      "Compare glTF JSON parsers on a file, generated if it does not exist",
+      [&](args::Subparser &parser) {
+        args::Positional<std::string> file{
+            parser, "file", "Path to file", args::Options::Required};
+        args::ValueFlag<size_t> nodes{parser, "nodes",
+            "Number of nodes of the generated file (default 100000)",
+            {"nodes"}, 100000};
+        args::ValueFlag<size_t> iterations{parser, "iterations",
+            "Number of runs of each parser (default 3)", {"iterations"}, 3};
+        parser.Parse();
+        returnCode = benchmarkGltfParsers(
+            args::get(file), args::get(nodes), args::get(iterations));
+      }};
+  args::Command benchDecoders{commands, "bench-decoders",
+      "Compare the throughput of image decoders on the images of glTF files "
+      "or on image files",
+      [&](args::Subparser &parser) {
+        args::PositionalList<std::string> files{
+            parser, "files", "Paths to files", args::Options::Required};
+        args::ValueFlag<size_t> iterations{parser, "iterations",
+            "Number of decodings of each image by each decoder (default 3)",
+            {"iterations"}, 3};
+        parser.Parse();
+        const auto paths = args::get(files);
+        returnCode = benchmarkImageDecoders(
+            std::vector<fs::path>(begin(paths), end(paths)),
+            args::get(iterations));
+      }};
+  args::Command benchCompression{commands, "bench-texture-compression",
+      "Measure the speed, size and quality of the block compression of the "
+      "images of glTF files or of image files",
+      [&](args::Subparser &parser) {
+        args::PositionalList<std::string> files{
+            parser, "files", "Paths to files", args::Options::Required};
+        parser.Parse();
+        const auto paths = args::get(files);
+        returnCode = benchmarkTextureCompression(
+            std::vector<fs::path>(begin(paths), end(paths)));
+      }};
   args::Command interactive{
       commands, "viewer", "Run glTF viewer", [&](args::Subparser &parser) {
         args::Positional<std::string> file{
@@ -43,6 +85,105 @@ int main(int argc, char **argv)
             "Output path to render the image. If specified no window is shown. "
             "Only png is supported.",
             {"o", "output"}};
+        args::Flag mmap{parser, "mmap",
+            "Memory map .glb BIN chunk and external .bin buffers and upload "
+            "them to the GPU without intermediate copy",
+            {"mmap"}};
+        args::Flag parallelImageDecode{parser, "parallel-image-decode",
+            "Decode images on a pool of threads (one per core) after parsing, "
+            "instead of one at a time while parsing",
+            {"parallel-image-decode"}};
+        args::Flag progressive{parser, "progressive",
+            "Show the window while the file is parsed, then stream geometry "
+            "and textures to the GPU across frames",
+            {"progressive"}};
+        args::ValueFlag<double> uploadBudget{parser, "upload-budget",
+            "Milliseconds per frame spent uploading the scene with "
+            "--progressive (default 4)",
+            {"upload-budget"}};
+        args::Flag lowMipsFirst{parser, "low-mips-first",
+            "With --progressive, upload the 32x32 level of each texture and "
+            "its smaller ones first, then finer levels over the next frames "
+            "(implies --progressive)",
+            {"low-mips-first"}};
+        args::ValueFlag<std::string> sceneCache{parser, "scene-cache",
+            "Directory of preprocessed scene files. The scene is loaded from "
+            "there when up to date, and written there otherwise",
+            {"scene-cache"}};
+        args::Flag lean{parser, "lean",
+            "Free CPU copies of geometry and images once they are uploaded "
+            "to the GPU, and report resident memory",
+            {"lean"}};
+        args::Flag compressTextures{parser, "compress-textures",
+            "Upload textures block compressed (BC1, BC4, BC5 or BC7 depending "
+            "on the channels materials read) instead of as RGBA8",
+            {"compress-textures"}};
+        args::ValueFlag<std::string> textureCache{parser, "texture-cache",
+            "Directory of compressed textures with --compress-textures, so "
+            "that each image is only compressed once",
+            {"texture-cache"}};
+        args::ValueFlag<int> maxTextureSize{parser, "max-texture-size",
+            "Downscale images whose width or height exceeds this size before "
+            "uploading them",
+            {"max-texture-size"}};
+        args::ValueFlag<std::string> textureBudget{parser, "texture-budget",
+            "Megabytes of video memory textures should fit in, or 'auto' for "
+            "a share of the free video memory, by downscaling the images with "
+            "the most texels per world unit first",
+            {"texture-budget"}};
+        args::Flag srgbTextures{parser, "srgb-textures",
+            "Upload base color and emissive textures in sRGB formats and "
+            "render to an sRGB framebuffer, so that shaders skip their gamma "
+            "conversions",
+            {"srgb-textures"}};
+        args::Flag ormTextures{parser, "orm-textures",
+            "Merge the separate occlusion and metallic-roughness images of "
+            "materials into one texture at load time",
+            {"orm-textures"}};
+        args::Flag materialBuffer{parser, "material-buffer",
+            "Read materials from a shader storage buffer indexed per draw, "
+            "with bindless textures or texture arrays, instead of binding "
+            "textures for each draw",
+            {"material-buffer"}};
+        args::Flag textureArrays{parser, "texture-arrays",
+            "With --material-buffer, use texture arrays even if bindless "
+            "textures are supported",
+            {"texture-arrays"}};
+        args::ValueFlag<size_t> virtualTextures{parser, "virtual-textures",
+            "Megabytes of video memory of a page cache holding the parts of "
+            "textures the camera sees, found by a feedback pass, instead of "
+            "whole textures (implies --material-buffer)",
+            {"virtual-textures"}};
+        args::Flag multiDraw{parser, "multi-draw",
+            "Pack primitives by vertex format and draw the scene with one "
+            "multi-draw indirect call per format and material (implies "
+            "--material-buffer)",
+            {"multi-draw"}};
+        args::Flag instancing{parser, "instancing",
+            "Draw the nodes sharing a primitive with one instanced draw, with "
+            "their matrices in an instance buffer",
+            {"instancing"}};
+        args::Flag uniformBuffers{parser, "uniform-buffers",
+            "Read the camera, light, matrices and materials of draws from "
+            "buffers instead of per draw uniforms (implies --material-buffer)",
+            {"uniform-buffers"}};
+        args::Flag fastJson{parser, "fast-json",
+            "Parse the glTF JSON with the built-in on-demand parser instead "
+            "of tinygltf (animations, skins, cameras and extensions are "
+            "skipped)",
+            {"fast-json"}};
+        args::Flag asyncIo{parser, "async-io",
+            "Read all external buffers and images concurrently (through "
+            "io_uring when available) instead of one after the other",
+            {"async-io"}};
+        args::ValueFlag<size_t> uploadRing{parser, "upload-ring",
+            "Megabytes of persistently mapped staging memory textures are "
+            "uploaded through, 0 to upload from client memory (default 64)",
+            {"upload-ring"}};
+        args::ValueFlag<std::string> startupReport{parser, "startup-report",
+            "Write the wall time, CPU time and bytes processed by each phase "
+            "of the startup to this JSON file",
+            {"startup-report"}};
         parser.Parse();
 
         std::vector<float> lookatParams;
@@ -62,9 +203,57 @@ int main(int argc, char **argv)
         uint32_t width = imageWidth ? args::get(imageWidth) : 1280;
         uint32_t height = imageHeight ? args::get(imageHeight) : 720;
 
+        ViewerOptions options;
+        options.loader.mmapBuffers = mmap;
+        options.loader.fastJsonParser = fastJson;
+        options.loader.asyncFileReads = asyncIo;
+        // Progressive loading decodes images while geometry is streamed
+        options.loader.deferImageDecoding =
+            parallelImageDecode || progressive || lowMipsFirst;
+        options.progressive = progressive || lowMipsFirst;
+        options.lowMipsFirst = lowMipsFirst;
+        if (uploadBudget) {
+          options.uploadBudgetMs = args::get(uploadBudget);
+        }
+        options.sceneCacheDirectory = args::get(sceneCache);
+        options.releaseCpuData = lean;
+        options.compressTextures = compressTextures;
+        options.textureCacheDirectory = args::get(textureCache);
+        options.maxTextureSize = args::get(maxTextureSize);
+        if (textureBudget) {
+          const auto &budget = args::get(textureBudget);
+          if (budget == "auto") {
+            options.autoTextureBudget = true;
+          } else {
+            char *end = nullptr;
+            const auto megabytes = std::strtoull(budget.c_str(), &end, 10);
+            if (budget.empty() || *end != '\0') {
+              throw args::ValidationError("Unable to parse --texture-budget "
+                                          "argument (expected megabytes or "
+                                          "auto)");
+            }
+            options.textureBudget = size_t(megabytes) * 1024 * 1024;
+          }
+        }
+        options.srgbTextures = srgbTextures;
+        options.ormTextures = ormTextures;
+        options.materialBuffer =
+            materialBuffer || textureArrays || virtualTextures || multiDraw ||
+            uniformBuffers;
+        options.textureArrays = textureArrays;
+        options.virtualTextureBudget =
+            args::get(virtualTextures) * 1024 * 1024;
+        options.multiDraw = multiDraw;
+        options.instancing = instancing;
+        options.uniformBuffers = uniformBuffers;
+        if (uploadRing) {
+          options.uploadRingSize = args::get(uploadRing) * 1024 * 1024;
+        }
+        options.startupReportPath = args::get(startupReport);
+
         ViewerApplication app{fs::path{argv[0]}, width, height, args::get(file),
             lookatParams, args::get(vertexShader), args::get(fragmentShader),
-            args::get(output)};
+            args::get(output), options};
         returnCode = app.run();
       }};
 
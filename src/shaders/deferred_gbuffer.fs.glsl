@@ -1,4 +1,13 @@
 #version 330 core
+#ifdef MATERIAL_BUFFER
+#extension GL_ARB_shader_storage_buffer_object : require
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#elif !defined(VIRTUAL_TEXTURES)
+// Indexing uTextureArrays with the index of the material of the draw call
+#extension GL_ARB_gpu_shader5 : require
+#endif
+#endif
 layout(location = 0) out vec3 gPosition;
 layout(location = 1) out vec3 gNormal;
 layout(location = 2) out vec4 gDiffuse;
@@ -10,6 +19,127 @@ in vec2 vTexCoords;
 in vec3 vSpacePosition;
 in vec3 vViewSpaceNormal;
 
+// Factors and texels of the material of the fragment, read from uniforms and
+// bound textures, or with MATERIAL_BUFFER from the material buffer (see
+// material_table.hpp)
+struct MaterialSample {
+    vec4 baseColorFactor;
+    vec4 baseColorTexel;
+    float metallicFactor;
+    float roughnessFactor;
+    vec4 metallicRoughnessTexel;
+    vec3 emissiveFactor;
+    vec4 emissiveTexel;
+    float occlusionStrength;
+    vec4 occlusionTexel;
+};
+
+#ifdef MATERIAL_BUFFER
+struct Material {
+    vec4 baseColorFactor;
+    vec3 emissiveFactor;
+    float metallicFactor;
+    float roughnessFactor;
+    float occlusionStrength;
+    uint textureMask; // Bit i is set when textures[i] is valid
+    uint padding;
+    // Base color, metallic-roughness, emissive and occlusion textures, as
+    // bindless handles, as the index of a texture array and a layer, or as the
+    // index of a virtual image
+    uvec2 textures[4];
+};
+
+layout(std430) buffer Materials {
+    Material materials[];
+};
+
+#ifdef UNIFORM_BUFFERS
+// Material of the draw, from the vertex shader. Runs of instances are drawn
+// per primitive, so it is the same for all the instances of a call
+flat in int vMaterialIndex;
+#define MATERIAL_INDEX vMaterialIndex
+#else
+uniform int uMaterialIndex;
+#define MATERIAL_INDEX uMaterialIndex
+#endif
+
+#ifdef VIRTUAL_TEXTURES
+// Virtual textures (see virtual_textures.hpp): the page cache, the tile of
+// each page, the first page of each level of each image, and the width,
+// height, level count and first level of each image
+uniform sampler2D uPageCache;
+uniform usamplerBuffer uPageTable;
+uniform usamplerBuffer uVirtualLevels;
+uniform usamplerBuffer uVirtualImages;
+
+const int PAGE_SIZE = 128;
+const int TILE_SIZE = PAGE_SIZE + 2; // With a border of one texel
+
+// Nearest level of the mip chain with repeat wrapping, filtered bilinearly in
+// the closest resident page covering texCoords
+vec4 virtualTexel(uint image, vec2 texCoords) {
+    uvec4 info = texelFetch(uVirtualImages, int(image));
+    vec2 texels = texCoords * vec2(info.xy);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    int level = clamp(int(floor(lod + 0.5)), 0, int(info.z) - 1);
+    vec2 uv = fract(texCoords);
+
+    ivec2 levelSize = max(ivec2(info.xy) >> level, ivec2(1));
+    int pagesX = (levelSize.x + PAGE_SIZE - 1) / PAGE_SIZE;
+    ivec2 page = min(ivec2(uv * vec2(levelSize)), levelSize - 1) / PAGE_SIZE;
+    int firstPage = int(texelFetch(uVirtualLevels, int(info.w) + level).x);
+    uvec2 entry = texelFetch(uPageTable, firstPage + page.y * pagesX + page.x).xy;
+
+    // The resident page may be of a coarser level
+    int residentLevel = int(entry.x >> 24);
+    ivec2 tile = ivec2(entry.x & 0xFFFu, (entry.x >> 12) & 0xFFFu);
+    ivec2 residentPage = ivec2(entry.y & 0xFFFFu, entry.y >> 16);
+    vec2 residentSize = vec2(max(ivec2(info.xy) >> residentLevel, ivec2(1)));
+    vec2 inPage = clamp(uv * residentSize - vec2(residentPage * PAGE_SIZE),
+        vec2(0), vec2(PAGE_SIZE));
+    vec2 cacheTexel = vec2(tile * TILE_SIZE) + 1.0 + inPage;
+    return textureLod(uPageCache, cacheTexel / vec2(textureSize(uPageCache, 0)), 0.0);
+}
+#elif !defined(BINDLESS_TEXTURES)
+uniform sampler2DArray uTextureArrays[TEXTURE_ARRAY_COUNT];
+#endif
+
+// Same fallbacks as the textures bound without a texture: white for base
+// color and occlusion, and texture 0 otherwise
+vec4 materialTexel(int slot, vec2 texCoords, vec4 fallback) {
+    if ((materials[MATERIAL_INDEX].textureMask & (1u << slot)) == 0u) {
+        return fallback;
+    }
+    uvec2 reference = materials[MATERIAL_INDEX].textures[slot];
+#ifdef BINDLESS_TEXTURES
+    return texture(sampler2D(reference), texCoords);
+#elif defined(VIRTUAL_TEXTURES)
+    return virtualTexel(reference.x, texCoords);
+#else
+    return texture(uTextureArrays[reference.x], vec3(texCoords, reference.y));
+#endif
+}
+
+MaterialSample sampleMaterial(vec2 texCoords) {
+    MaterialSample m;
+    m.baseColorFactor = materials[MATERIAL_INDEX].baseColorFactor;
+    m.baseColorTexel = materialTexel(0, texCoords, vec4(1));
+    m.metallicFactor = materials[MATERIAL_INDEX].metallicFactor;
+    m.roughnessFactor = materials[MATERIAL_INDEX].roughnessFactor;
+    m.metallicRoughnessTexel = materialTexel(1, texCoords, vec4(0, 0, 0, 1));
+    m.emissiveFactor = materials[MATERIAL_INDEX].emissiveFactor;
+    m.emissiveTexel = materialTexel(2, texCoords, vec4(0, 0, 0, 1));
+    m.occlusionStrength = materials[MATERIAL_INDEX].occlusionStrength;
+#ifdef ORM_TEXTURES
+    m.occlusionTexel = vec4(m.metallicRoughnessTexel.rrr, 1);
+#else
+    m.occlusionTexel = materialTexel(3, texCoords, vec4(1));
+#endif
+    return m;
+}
+#else
 uniform vec4 uBaseColorFactor;
 uniform float uMetallicFactor;
 uniform float uRoughnessFactor;
@@ -19,7 +149,30 @@ uniform float uOcclusionStrength;
 uniform sampler2D uBaseColorTexture;
 uniform sampler2D uMetallicRoughnessTexture;
 uniform sampler2D uEmissiveTexture;
+#ifndef ORM_TEXTURES
 uniform sampler2D uOcclusionTexture;
+#endif
+
+MaterialSample sampleMaterial(vec2 texCoords) {
+    MaterialSample m;
+    m.baseColorFactor = uBaseColorFactor;
+    m.baseColorTexel = texture(uBaseColorTexture, texCoords);
+    m.metallicFactor = uMetallicFactor;
+    m.roughnessFactor = uRoughnessFactor;
+    m.metallicRoughnessTexel = texture(uMetallicRoughnessTexture, texCoords);
+    m.emissiveFactor = uEmissiveFactor;
+    m.emissiveTexel = texture(uEmissiveTexture, texCoords);
+    m.occlusionStrength = uOcclusionStrength;
+#ifdef ORM_TEXTURES
+    // Occlusion is in the red channel of the metallic-roughness texture (see
+    // orm_textures.hpp), no occlusion texture is bound
+    m.occlusionTexel = vec4(m.metallicRoughnessTexel.rrr, 1);
+#else
+    m.occlusionTexel = texture(uOcclusionTexture, texCoords);
+#endif
+    return m;
+}
+#endif
 
 // Constants
 const float GAMMA = 2.2;
@@ -29,8 +182,14 @@ vec3 LINEARtoSRGB(vec3 color) {
     return pow(color, vec3(INV_GAMMA));
 }
 
+// With SRGB_TEXTURES, color textures are stored in sRGB formats and already
+// decoded by the texture units
 vec4 SRGBtoLINEAR(vec4 srgbIn) {
+#ifdef SRGB_TEXTURES
+    return srgbIn;
+#else
     return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+#endif
 }
 
 void main() {    
@@ -39,16 +198,17 @@ void main() {
     // also store the per-fragment normals into the gbuffer
     gNormal = normalize(vViewSpaceNormal);
     // and also all the different textures used for pdr
-    vec4 baseColorFromTexture = SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords));
-    gDiffuse = baseColorFromTexture * uBaseColorFactor;
+    MaterialSample material = sampleMaterial(vTexCoords);
+    vec4 baseColorFromTexture = SRGBtoLINEAR(material.baseColorTexel);
+    gDiffuse = baseColorFromTexture * material.baseColorFactor;
 
-    vec4 metallicRougnessFromTexture = texture(uMetallicRoughnessTexture, vTexCoords);
-    gMetallic.xyz = vec3(uMetallicFactor * metallicRougnessFromTexture.b);
-    gMetallic.w = uRoughnessFactor * metallicRougnessFromTexture.g;
+    vec4 metallicRougnessFromTexture = material.metallicRoughnessTexel;
+    gMetallic.xyz = vec3(material.metallicFactor * metallicRougnessFromTexture.b);
+    gMetallic.w = material.roughnessFactor * metallicRougnessFromTexture.g;
 
-    gEmissive = SRGBtoLINEAR(texture2D(uEmissiveTexture, vTexCoords)).rgb *
-        uEmissiveFactor;
+    gEmissive = SRGBtoLINEAR(material.emissiveTexel).rgb *
+        material.emissiveFactor;
 
-    gOcclusion.xyz = texture(uOcclusionTexture, vTexCoords).xyz;
-    gOcclusion.w = uOcclusionStrength; // maybe we need to optimize this
+    gOcclusion.xyz = material.occlusionTexel.xyz;
+    gOcclusion.w = material.occlusionStrength; // maybe we need to optimize this
 }
\ No newline at end of file
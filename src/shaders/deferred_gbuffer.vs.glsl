@@ -1,4 +1,10 @@
 #version 330 core
+#if defined(MULTI_DRAW) || defined(UNIFORM_BUFFERS)
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 avViewSpaceNormal;
 layout(location = 2) in vec2 aTexCoords;
@@ -7,13 +13,83 @@ out vec3 vSpacePosition;
 out vec2 vTexCoords;
 out vec3 vViewSpaceNormal;
 
+#if defined(MULTI_DRAW) || defined(INSTANCING)
+uniform mat4 uViewMatrix;
+uniform mat4 uProjMatrix;
+#elif defined(UNIFORM_BUFFERS)
+// Camera and light of the frame (see uniform_buffers.hpp)
+layout(std140) uniform Frame {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    vec3 uLightDirection;
+    vec3 uLightIntensity;
+    int uApplyOcclusion;
+};
+#endif
+
+#ifdef MULTI_DRAW
+// Matrices of each draw of glMultiDrawElementsIndirect() (see multi_draw.hpp),
+// those of a call from uDrawOffset
+struct Draw {
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+};
+
+layout(std430) readonly buffer Draws {
+    Draw draws[];
+};
+
+uniform int uDrawOffset;
+#elif defined(UNIFORM_BUFFERS)
+// Matrices of each node instance, and the object and material of each draw
+// as a per instance attribute (see uniform_buffers.hpp)
+struct Object {
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+};
+
+layout(std430) readonly buffer Objects {
+    Object objects[];
+};
+
+layout(location = 10) in ivec2 aDrawIndices;
+
+flat out int vMaterialIndex;
+#elif defined(INSTANCING)
+// Matrices of each instance (see instancing.hpp)
+layout(location = 3) in mat4 aInstanceModelMatrix;
+layout(location = 7) in mat3 aInstanceNormalMatrix;
+#else
 uniform mat4 uModelViewProjMatrix;
 uniform mat4 uModelViewMatrix;
 uniform mat4 uNormalMatrix;
+#endif
 
 void main() {
+#if defined(MULTI_DRAW) || defined(INSTANCING) || defined(UNIFORM_BUFFERS)
+#ifdef MULTI_DRAW
+    Draw draw = draws[uDrawOffset + gl_DrawIDARB];
+    mat4 modelMatrix = draw.modelMatrix;
+    mat3 normalMatrix = mat3(draw.normalMatrix);
+#elif defined(UNIFORM_BUFFERS)
+    Object object = objects[aDrawIndices.x];
+    mat4 modelMatrix = object.modelMatrix;
+    mat3 normalMatrix = mat3(object.normalMatrix);
+    vMaterialIndex = aDrawIndices.y;
+#else
+    mat4 modelMatrix = aInstanceModelMatrix;
+    mat3 normalMatrix = aInstanceNormalMatrix;
+#endif
+    vec4 viewSpacePosition = uViewMatrix * modelMatrix * vec4(aPos, 1.0);
+    vTexCoords = aTexCoords;
+    gl_Position = uProjMatrix * viewSpacePosition;
+    // The view matrix is a rotation and a translation
+    vViewSpaceNormal = mat3(uViewMatrix) * normalMatrix * avViewSpaceNormal;
+    vSpacePosition = viewSpacePosition.xyz;
+#else
     vTexCoords = aTexCoords;
     gl_Position = uModelViewProjMatrix * vec4(aPos, 1.0);
     vViewSpaceNormal = (uNormalMatrix * vec4(avViewSpaceNormal, 0.0)).xyz;
     vSpacePosition = (uModelViewMatrix * vec4(aPos, 1.0)).xyz;
+#endif
 }
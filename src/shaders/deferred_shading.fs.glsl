@@ -25,8 +25,13 @@ const float INV_GAMMA = 1. / GAMMA;
 const float M_PI = 3.141592653589793;
 const float M_1_PI = 1.0 / M_PI;
 
+// With SRGB_FRAMEBUFFER, the framebuffer encodes the output itself
 vec3 LINEARtoSRGB(vec3 color) {
+#ifdef SRGB_FRAMEBUFFER
+    return color;
+#else
     return pow(color, vec3(INV_GAMMA));
+#endif
 }
 
 void main() {
@@ -1,4 +1,13 @@
 #version 330
+#ifdef MATERIAL_BUFFER
+#extension GL_ARB_shader_storage_buffer_object : require
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#elif !defined(VIRTUAL_TEXTURES)
+// Indexing uTextureArrays with the index of the material of the draw call
+#extension GL_ARB_gpu_shader5 : require
+#endif
+#endif
 
 // A reference implementation can be found here:
 // https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/metallic-roughness.frag
@@ -14,9 +23,142 @@ in vec2 vTexCoords;
 // https://github.com/KhronosGroup/glTF-Sample-Viewer/blob/master/src/shaders/textures.glsl
 // for a reference implementation
 
+#ifdef UNIFORM_BUFFERS
+// Camera and light of the frame (see uniform_buffers.hpp), the same block as
+// in the vertex shader
+layout(std140) uniform Frame {
+    mat4 uViewMatrix;
+    mat4 uProjMatrix;
+    vec3 uLightDirection;
+    vec3 uLightIntensity;
+    int uApplyOcclusion;
+};
+#else
 uniform vec3 uLightDirection;
 uniform vec3 uLightIntensity;
+#endif
 
+// Factors and texels of the material of the fragment, read from uniforms and
+// bound textures, or with MATERIAL_BUFFER from the material buffer (see
+// material_table.hpp)
+struct MaterialSample {
+    vec4 baseColorFactor;
+    vec4 baseColorTexel;
+    float metallicFactor;
+    float roughnessFactor;
+    vec4 metallicRoughnessTexel;
+    vec3 emissiveFactor;
+    vec4 emissiveTexel;
+    float occlusionStrength;
+    vec4 occlusionTexel;
+};
+
+#ifdef MATERIAL_BUFFER
+struct Material {
+    vec4 baseColorFactor;
+    vec3 emissiveFactor;
+    float metallicFactor;
+    float roughnessFactor;
+    float occlusionStrength;
+    uint textureMask; // Bit i is set when textures[i] is valid
+    uint padding;
+    // Base color, metallic-roughness, emissive and occlusion textures, as
+    // bindless handles, as the index of a texture array and a layer, or as the
+    // index of a virtual image
+    uvec2 textures[4];
+};
+
+layout(std430) buffer Materials {
+    Material materials[];
+};
+
+#ifdef UNIFORM_BUFFERS
+// Material of the draw, from the vertex shader. Runs of instances are drawn
+// per primitive, so it is the same for all the instances of a call
+flat in int vMaterialIndex;
+#define MATERIAL_INDEX vMaterialIndex
+#else
+uniform int uMaterialIndex;
+#define MATERIAL_INDEX uMaterialIndex
+#endif
+
+#ifdef VIRTUAL_TEXTURES
+// Virtual textures (see virtual_textures.hpp): the page cache, the tile of
+// each page, the first page of each level of each image, and the width,
+// height, level count and first level of each image
+uniform sampler2D uPageCache;
+uniform usamplerBuffer uPageTable;
+uniform usamplerBuffer uVirtualLevels;
+uniform usamplerBuffer uVirtualImages;
+
+const int PAGE_SIZE = 128;
+const int TILE_SIZE = PAGE_SIZE + 2; // With a border of one texel
+
+// Nearest level of the mip chain with repeat wrapping, filtered bilinearly in
+// the closest resident page covering texCoords
+vec4 virtualTexel(uint image, vec2 texCoords) {
+    uvec4 info = texelFetch(uVirtualImages, int(image));
+    vec2 texels = texCoords * vec2(info.xy);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    int level = clamp(int(floor(lod + 0.5)), 0, int(info.z) - 1);
+    vec2 uv = fract(texCoords);
+
+    ivec2 levelSize = max(ivec2(info.xy) >> level, ivec2(1));
+    int pagesX = (levelSize.x + PAGE_SIZE - 1) / PAGE_SIZE;
+    ivec2 page = min(ivec2(uv * vec2(levelSize)), levelSize - 1) / PAGE_SIZE;
+    int firstPage = int(texelFetch(uVirtualLevels, int(info.w) + level).x);
+    uvec2 entry = texelFetch(uPageTable, firstPage + page.y * pagesX + page.x).xy;
+
+    // The resident page may be of a coarser level
+    int residentLevel = int(entry.x >> 24);
+    ivec2 tile = ivec2(entry.x & 0xFFFu, (entry.x >> 12) & 0xFFFu);
+    ivec2 residentPage = ivec2(entry.y & 0xFFFFu, entry.y >> 16);
+    vec2 residentSize = vec2(max(ivec2(info.xy) >> residentLevel, ivec2(1)));
+    vec2 inPage = clamp(uv * residentSize - vec2(residentPage * PAGE_SIZE),
+        vec2(0), vec2(PAGE_SIZE));
+    vec2 cacheTexel = vec2(tile * TILE_SIZE) + 1.0 + inPage;
+    return textureLod(uPageCache, cacheTexel / vec2(textureSize(uPageCache, 0)), 0.0);
+}
+#elif !defined(BINDLESS_TEXTURES)
+uniform sampler2DArray uTextureArrays[TEXTURE_ARRAY_COUNT];
+#endif
+
+// Same fallbacks as the textures bound without a texture: white for base
+// color and occlusion, and texture 0 otherwise
+vec4 materialTexel(int slot, vec2 texCoords, vec4 fallback) {
+    if ((materials[MATERIAL_INDEX].textureMask & (1u << slot)) == 0u) {
+        return fallback;
+    }
+    uvec2 reference = materials[MATERIAL_INDEX].textures[slot];
+#ifdef BINDLESS_TEXTURES
+    return texture(sampler2D(reference), texCoords);
+#elif defined(VIRTUAL_TEXTURES)
+    return virtualTexel(reference.x, texCoords);
+#else
+    return texture(uTextureArrays[reference.x], vec3(texCoords, reference.y));
+#endif
+}
+
+MaterialSample sampleMaterial(vec2 texCoords) {
+    MaterialSample m;
+    m.baseColorFactor = materials[MATERIAL_INDEX].baseColorFactor;
+    m.baseColorTexel = materialTexel(0, texCoords, vec4(1));
+    m.metallicFactor = materials[MATERIAL_INDEX].metallicFactor;
+    m.roughnessFactor = materials[MATERIAL_INDEX].roughnessFactor;
+    m.metallicRoughnessTexel = materialTexel(1, texCoords, vec4(0, 0, 0, 1));
+    m.emissiveFactor = materials[MATERIAL_INDEX].emissiveFactor;
+    m.emissiveTexel = materialTexel(2, texCoords, vec4(0, 0, 0, 1));
+    m.occlusionStrength = materials[MATERIAL_INDEX].occlusionStrength;
+#ifdef ORM_TEXTURES
+    m.occlusionTexel = vec4(m.metallicRoughnessTexel.rrr, 1);
+#else
+    m.occlusionTexel = materialTexel(3, texCoords, vec4(1));
+#endif
+    return m;
+}
+#else
 uniform vec4 uBaseColorFactor;
 uniform float uMetallicFactor;
 uniform float uRoughnessFactor;
@@ -26,9 +168,34 @@ uniform float uOcclusionStrength;
 uniform sampler2D uBaseColorTexture;
 uniform sampler2D uMetallicRoughnessTexture;
 uniform sampler2D uEmissiveTexture;
+#ifndef ORM_TEXTURES
 uniform sampler2D uOcclusionTexture;
+#endif
+
+MaterialSample sampleMaterial(vec2 texCoords) {
+    MaterialSample m;
+    m.baseColorFactor = uBaseColorFactor;
+    m.baseColorTexel = texture(uBaseColorTexture, texCoords);
+    m.metallicFactor = uMetallicFactor;
+    m.roughnessFactor = uRoughnessFactor;
+    m.metallicRoughnessTexel = texture(uMetallicRoughnessTexture, texCoords);
+    m.emissiveFactor = uEmissiveFactor;
+    m.emissiveTexel = texture(uEmissiveTexture, texCoords);
+    m.occlusionStrength = uOcclusionStrength;
+#ifdef ORM_TEXTURES
+    // Occlusion is in the red channel of the metallic-roughness texture (see
+    // orm_textures.hpp), no occlusion texture is bound
+    m.occlusionTexel = vec4(m.metallicRoughnessTexel.rrr, 1);
+#else
+    m.occlusionTexel = texture(uOcclusionTexture, texCoords);
+#endif
+    return m;
+}
+#endif
 
+#ifndef UNIFORM_BUFFERS
 uniform int uApplyOcclusion;
+#endif
 
 out vec3 fColor;
 
@@ -45,14 +212,25 @@ const float M_1_PI = 1.0 / M_PI;
 
 // linear to sRGB approximation
 // see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+// With SRGB_FRAMEBUFFER, the framebuffer encodes the output itself
 vec3 LINEARtoSRGB(vec3 color) {
+#ifdef SRGB_FRAMEBUFFER
+    return color;
+#else
     return pow(color, vec3(INV_GAMMA));
+#endif
 }
 
 // sRGB to linear approximation
 // see http://chilliant.blogspot.com/2012/08/srgb-approximations-for-hlsl.html
+// With SRGB_TEXTURES, color textures are stored in sRGB formats and already
+// decoded by the texture units
 vec4 SRGBtoLINEAR(vec4 srgbIn) {
+#ifdef SRGB_TEXTURES
+    return srgbIn;
+#else
     return vec4(pow(srgbIn.xyz, vec3(GAMMA)), srgbIn.w);
+#endif
 }
 
 // The model is mathematically described here
@@ -66,12 +244,13 @@ void main() {
     vec3 L = uLightDirection;
     vec3 H = normalize(L + V);
 
-    vec4 baseColorFromTexture = SRGBtoLINEAR(texture(uBaseColorTexture, vTexCoords)); // game correction
-    vec4 metallicRougnessFromTexture = texture(uMetallicRoughnessTexture, vTexCoords);
+    MaterialSample material = sampleMaterial(vTexCoords);
+    vec4 baseColorFromTexture = SRGBtoLINEAR(material.baseColorTexel); // game correction
+    vec4 metallicRougnessFromTexture = material.metallicRoughnessTexel;
 
-    vec4 baseColor = uBaseColorFactor * baseColorFromTexture;
-    vec3 metallic = vec3(uMetallicFactor * metallicRougnessFromTexture.b);
-    float roughness = uRoughnessFactor * metallicRougnessFromTexture.g;
+    vec4 baseColor = material.baseColorFactor * baseColorFromTexture;
+    vec3 metallic = vec3(material.metallicFactor * metallicRougnessFromTexture.b);
+    float roughness = material.roughnessFactor * metallicRougnessFromTexture.g;
 
   // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#pbrmetallicroughnessmetallicroughnesstexture
   // "The metallic-roughness texture.The metalness values are sampled from the B
@@ -107,15 +286,15 @@ void main() {
     vec3 diffuse = c_diff * M_1_PI;
 
     vec3 f_diffuse = (1. - F) * diffuse;
-    vec3 emissive = SRGBtoLINEAR(texture2D(uEmissiveTexture, vTexCoords)).rgb *
-        uEmissiveFactor;
+    vec3 emissive = SRGBtoLINEAR(material.emissiveTexel).rgb *
+        material.emissiveFactor;
 
     vec3 color = (f_diffuse + f_specular) * uLightIntensity * NdotL;
     color += emissive;
 
     if(1 == uApplyOcclusion) {
-        float ao = texture2D(uOcclusionTexture, vTexCoords).r;
-        color = mix(color, color * ao, uOcclusionStrength);
+        float ao = material.occlusionTexel.r;
+        color = mix(color, color * ao, material.occlusionStrength);
     }
 
     fColor = LINEARtoSRGB(color);
@@ -0,0 +1,74 @@
+#version 330 core
+#extension GL_ARB_shader_storage_buffer_object : require
+// Virtual texture feedback (see virtual_textures.hpp): the page of one of the
+// textures of the material of each pixel, read back by the application to
+// load the pages missing from the page cache
+layout(location = 0) out uvec2 fPage;
+
+in vec2 vTexCoords;
+
+struct Material {
+    vec4 baseColorFactor;
+    vec3 emissiveFactor;
+    float metallicFactor;
+    float roughnessFactor;
+    float occlusionStrength;
+    uint textureMask; // Bit i is set when textures[i] is valid
+    uint padding;
+    uvec2 textures[4]; // Index of a virtual image
+};
+
+layout(std430) buffer Materials {
+    Material materials[];
+};
+
+#ifdef UNIFORM_BUFFERS
+// Material of the draw, from the vertex shader. Runs of instances are drawn
+// per primitive, so it is the same for all the instances of a call
+flat in int vMaterialIndex;
+#define MATERIAL_INDEX vMaterialIndex
+#else
+uniform int uMaterialIndex;
+#define MATERIAL_INDEX uMaterialIndex
+#endif
+
+// Width, height, level count and first level of each image
+uniform usamplerBuffer uVirtualImages;
+
+// Pixels report a different texture every frame
+uniform uint uFrame;
+// The pass is rendered at a lower resolution, with larger derivatives
+uniform float uFeedbackLodBias;
+
+const int PAGE_SIZE = 128;
+
+void main() {
+    uint mask = materials[MATERIAL_INDEX].textureMask;
+    uint first = (uint(gl_FragCoord.x) + uint(gl_FragCoord.y) + uFrame) % 4u;
+    int slot = -1;
+    for (uint i = 0u; i < 4u && slot < 0; ++i) {
+        uint candidate = (first + i) % 4u;
+        if ((mask & (1u << candidate)) != 0u) {
+            slot = int(candidate);
+        }
+    }
+    if (slot < 0) {
+        fPage = uvec2(0);
+        return;
+    }
+
+    // Same level and page as virtualTexel() of the material shaders
+    uint image = materials[MATERIAL_INDEX].textures[slot].x;
+    uvec4 info = texelFetch(uVirtualImages, int(image));
+    vec2 texels = vTexCoords * vec2(info.xy);
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + uFeedbackLodBias;
+    int level = clamp(int(floor(lod + 0.5)), 0, int(info.z) - 1);
+    vec2 uv = fract(vTexCoords);
+
+    ivec2 levelSize = max(ivec2(info.xy) >> level, ivec2(1));
+    ivec2 page = min(ivec2(uv * vec2(levelSize)), levelSize - 1) / PAGE_SIZE;
+    fPage = uvec2(image + 1u,
+        uint(level) << 24 | uint(page.y) << 12 | uint(page.x));
+}
@@ -33,6 +33,8 @@ public:
     glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
     glfwWindowHint(GLFW_SAMPLES, 4);
+    // Only encodes output with GL_FRAMEBUFFER_SRGB enabled
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE);
 
     m_pWindow =
         glfwCreateWindow(int(width), int(height), title, nullptr, nullptr);
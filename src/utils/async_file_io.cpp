@@ -0,0 +1,272 @@
+#include "async_file_io.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef GLTF_VIEWER_USE_IO_URING
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+// Items run by pool workers, and by the calling thread while it waits for them
+// to complete. Since the caller takes part, it never waits for a task the pool
+// has no thread left to run, e.g. when readFiles() is itself called from a
+// worker. Shared with the queued tasks, which may outlive the call.
+class SharedWork
+{
+public:
+  static void post(const std::shared_ptr<SharedWork> &work, ThreadPool &pool,
+      std::function<void()> item)
+  {
+    {
+      std::lock_guard<std::mutex> lock(work->m_mutex);
+      work->m_items.emplace_back(std::move(item));
+      ++work->m_nPending;
+    }
+    work->m_condition.notify_all();
+    pool.submit([work]() { work->runOne(); });
+  }
+
+  // Run items until all posted items have completed
+  void wait()
+  {
+    while (runOne()) {
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [&]() { return m_nPending == 0; });
+    if (m_exception) {
+      std::rethrow_exception(m_exception);
+    }
+  }
+
+private:
+  // Return false if there was no item to run
+  bool runOne()
+  {
+    std::function<void()> item;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_items.empty()) {
+        return false;
+      }
+      item = std::move(m_items.front());
+      m_items.pop_front();
+    }
+
+    std::exception_ptr exception;
+    try {
+      item();
+    } catch (...) {
+      exception = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (exception && !m_exception) {
+        m_exception = exception;
+      }
+      --m_nPending;
+    }
+    m_condition.notify_all();
+    return true;
+  }
+
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::deque<std::function<void()>> m_items;
+  size_t m_nPending = 0; // Queued or running items
+  std::exception_ptr m_exception;
+};
+
+FileReadResult readFile(const fs::path &path)
+{
+  FileReadResult result;
+  std::ifstream in(path.string(), std::ios::binary | std::ios::ate);
+  if (!in) {
+    result.error = "Unable to open " + path.string();
+    return result;
+  }
+  const auto size = in.tellg();
+  in.seekg(0);
+  result.bytes.resize(size_t(size));
+  if (!in.read((char *)result.bytes.data(), size)) {
+    result.bytes.clear();
+    result.error = "Unable to read " + path.string();
+  }
+  return result;
+}
+
+void readFilesWithPool(const std::vector<fs::path> &paths, ThreadPool &pool,
+    const std::function<void(size_t, FileReadResult &)> &onFileRead)
+{
+  const auto work = std::make_shared<SharedWork>();
+  for (size_t i = 0; i < paths.size(); ++i) {
+    SharedWork::post(work, pool, [&paths, &onFileRead, i]() {
+      auto result = readFile(paths[i]);
+      onFileRead(i, result);
+    });
+  }
+  work->wait();
+}
+
+#ifdef GLTF_VIEWER_USE_IO_URING
+
+// Requests in flight at once, the kernel runs them concurrently
+const unsigned ringEntries = 64;
+// Reads are split in chunks, as the length of one read is 32 bits
+const size_t maxReadSize = size_t(1) << 30;
+
+struct FileRequest
+{
+  int fd = -1; // -1 while opening
+  size_t offset = 0;
+  FileReadResult result;
+};
+
+// Return false if the ring could not be created, nothing has been read then.
+// Throws std::runtime_error if the ring fails while reading.
+bool readFilesWithIoUring(const std::vector<fs::path> &paths,
+    ThreadPool &pool,
+    const std::function<void(size_t, FileReadResult &)> &onFileRead)
+{
+  io_uring ring;
+  if (io_uring_queue_init(ringEntries, &ring, 0) < 0) {
+    return false;
+  }
+
+  const auto work = std::make_shared<SharedWork>();
+  std::vector<std::string> pathStrings;
+  pathStrings.reserve(paths.size());
+  for (const auto &path : paths) {
+    pathStrings.emplace_back(path.string());
+  }
+  std::vector<FileRequest> requests(paths.size());
+
+  // At most ringEntries requests are in flight, and each completion queues at
+  // most one new request, so submission entries never run out
+  const auto queueRead = [&](size_t fileIdx) {
+    auto &request = requests[fileIdx];
+    const auto size = std::min(
+        request.result.bytes.size() - request.offset, maxReadSize);
+    auto sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_read(sqe, request.fd,
+        request.result.bytes.data() + request.offset, unsigned(size),
+        request.offset);
+    io_uring_sqe_set_data(sqe, (void *)uintptr_t(fileIdx));
+  };
+
+  // Hand the file to the workers, or to this thread once all I/O is done
+  const auto complete = [&](size_t fileIdx, const std::string &error) {
+    auto &request = requests[fileIdx];
+    if (request.fd >= 0) {
+      close(request.fd);
+      request.fd = -1;
+    }
+    if (!error.empty()) {
+      request.result.bytes.clear();
+      request.result.error = error + " " + pathStrings[fileIdx];
+    }
+    SharedWork::post(work, pool, [&requests, &onFileRead, fileIdx]() {
+      onFileRead(fileIdx, requests[fileIdx].result);
+      // Processed, free the content while other files are still in flight
+      requests[fileIdx].result = FileReadResult();
+    });
+  };
+
+  size_t nextFile = 0;
+  size_t inFlight = 0;
+  while (nextFile < paths.size() || inFlight > 0) {
+    for (; nextFile < paths.size() && inFlight < ringEntries;
+         ++nextFile, ++inFlight) {
+      auto sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_openat(sqe, AT_FDCWD, pathStrings[nextFile].c_str(),
+          O_RDONLY | O_CLOEXEC, 0);
+      io_uring_sqe_set_data(sqe, (void *)uintptr_t(nextFile));
+    }
+
+    const auto submitted = io_uring_submit_and_wait(&ring, 1);
+    if (submitted < 0 && submitted != -EINTR && submitted != -EAGAIN &&
+        submitted != -EBUSY) {
+      // Tearing down the ring cancels the requests in flight
+      io_uring_queue_exit(&ring);
+      work->wait();
+      throw std::runtime_error(
+          std::string("io_uring submission failed: ") +
+          std::strerror(-submitted));
+    }
+
+    io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+      const auto fileIdx = size_t(uintptr_t(io_uring_cqe_get_data(cqe)));
+      const auto res = cqe->res;
+      io_uring_cqe_seen(&ring, cqe);
+      --inFlight;
+
+      auto &request = requests[fileIdx];
+      if (request.fd < 0) {
+        // Open completed
+        if (res < 0) {
+          complete(fileIdx, "Unable to open");
+          continue;
+        }
+        request.fd = res;
+        struct stat status;
+        if (fstat(request.fd, &status) != 0) {
+          complete(fileIdx, "Unable to stat");
+          continue;
+        }
+        if (status.st_size == 0) {
+          complete(fileIdx, std::string());
+          continue;
+        }
+        request.result.bytes.resize(size_t(status.st_size));
+      } else {
+        // Read completed
+        if (res < 0) {
+          complete(fileIdx, "Unable to read");
+          continue;
+        }
+        request.offset += size_t(res);
+        if (res == 0 || request.offset == request.result.bytes.size()) {
+          request.result.bytes.resize(request.offset); // Truncated meanwhile
+          complete(fileIdx, std::string());
+          continue;
+        }
+      }
+      queueRead(fileIdx);
+      ++inFlight;
+    }
+  }
+
+  io_uring_queue_exit(&ring);
+  work->wait();
+  return true;
+}
+
+#endif
+
+} // namespace
+
+void readFiles(const std::vector<fs::path> &paths, ThreadPool &pool,
+    const std::function<void(size_t, FileReadResult &)> &onFileRead)
+{
+#ifdef GLTF_VIEWER_USE_IO_URING
+  if (readFilesWithIoUring(paths, pool, onFileRead)) {
+    return;
+  }
+#endif
+  readFilesWithPool(paths, pool, onFileRead);
+}
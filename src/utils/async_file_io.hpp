@@ -0,0 +1,28 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "thread_pool.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Content of a file read by readFiles()
+struct FileReadResult
+{
+  std::vector<unsigned char> bytes;
+  std::string error; // Empty on success
+};
+
+// Read whole files concurrently. onFileRead(fileIdx, result) is called as soon
+// as each file is read, on a thread of pool or on the calling thread, so that
+// processing a file overlaps with the I/O of the others. Return once every
+// callback has returned, rethrowing the first exception thrown by one.
+//
+// When built with io_uring (GLTF_VIEWER_USE_IO_URING), the calling thread
+// submits the opens and reads of all files to the kernel in batches, keeping
+// many requests in flight at once, which is what pays off on network
+// filesystems and cold caches. Otherwise, or if the ring cannot be created,
+// each file is read with blocking calls by a task of pool.
+void readFiles(const std::vector<fs::path> &paths, ThreadPool &pool,
+    const std::function<void(size_t, FileReadResult &)> &onFileRead);
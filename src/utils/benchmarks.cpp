@@ -0,0 +1,440 @@
+#include "benchmarks.hpp"
+#include "gltf_loader.hpp"
+#include "image_decoders.hpp"
+#include "memory_usage.hpp"
+#include "texture_compression.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+
+namespace
+{
+
+using clock = std::chrono::steady_clock;
+
+double toMs(clock::duration d)
+{
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+double toMB(size_t bytes) { return bytes / (1024. * 1024.); }
+
+// One triangle shared by all meshes, accessors are duplicated per mesh so
+// that the JSON grows like in real scenes
+bool writeSyntheticGltf(const fs::path &gltfFile, size_t nodeCount)
+{
+  const float positions[] = {0, 0, 0, 1, 0, 0, 0, 1, 0};
+  const float normals[] = {0, 0, 1, 0, 0, 1, 0, 0, 1};
+  const auto binFile = gltfFile.stem().string() + ".bin";
+  {
+    std::ofstream bin((gltfFile.parent_path() / binFile).string(),
+        std::ios::binary);
+    bin.write((const char *)positions, sizeof(positions));
+    bin.write((const char *)normals, sizeof(normals));
+    if (!bin) {
+      return false;
+    }
+  }
+
+  std::ofstream out(gltfFile.string());
+  out << "{\n\"asset\": {\"version\": \"2.0\", \"generator\": "
+         "\"gltf-viewer synthetic scene\"},\n";
+  out << "\"scene\": 0,\n\"scenes\": [{\"nodes\": [";
+  for (size_t i = 0; i < nodeCount; ++i) {
+    out << (i ? ", " : "") << i;
+  }
+  out << "]}],\n";
+
+  out << "\"nodes\": [\n";
+  for (size_t i = 0; i < nodeCount; ++i) {
+    out << (i ? ",\n" : "") << "{\"name\": \"Part_" << i
+        << "\", \"mesh\": " << i << ", \"translation\": [" << (i % 100)
+        << ".5, " << (i / 100 % 100) << ".25, " << (i / 10000)
+        << ".125], \"rotation\": [0.0, 0.0, 0.0, 1.0]}";
+  }
+  out << "\n],\n";
+
+  out << "\"meshes\": [\n";
+  for (size_t i = 0; i < nodeCount; ++i) {
+    out << (i ? ",\n" : "") << "{\"name\": \"Mesh_" << i
+        << "\", \"primitives\": [{\"attributes\": {\"POSITION\": " << 2 * i
+        << ", \"NORMAL\": " << 2 * i + 1
+        << "}, \"material\": 0, \"mode\": 4}]}";
+  }
+  out << "\n],\n";
+
+  out << "\"accessors\": [\n";
+  for (size_t i = 0; i < nodeCount; ++i) {
+    out << (i ? ",\n" : "")
+        << "{\"bufferView\": 0, \"componentType\": 5126, \"count\": 3, "
+           "\"type\": \"VEC3\", \"min\": [0.0, 0.0, 0.0], \"max\": [1.0, 1.0, "
+           "0.0]},\n"
+        << "{\"bufferView\": 1, \"componentType\": 5126, \"count\": 3, "
+           "\"type\": \"VEC3\"}";
+  }
+  out << "\n],\n";
+
+  out << "\"bufferViews\": [{\"buffer\": 0, \"byteOffset\": 0, "
+         "\"byteLength\": 36, \"target\": 34962}, {\"buffer\": 0, "
+         "\"byteOffset\": 36, \"byteLength\": 36, \"target\": 34962}],\n";
+  out << "\"buffers\": [{\"uri\": \"" << binFile
+      << "\", \"byteLength\": 72}],\n";
+  out << "\"materials\": [{\"name\": \"Steel\", \"pbrMetallicRoughness\": "
+         "{\"baseColorFactor\": [0.8, 0.8, 0.8, 1.0], \"metallicFactor\": "
+         "1.0, \"roughnessFactor\": 0.4}}]\n}\n";
+
+  return bool(out);
+}
+
+struct ParserResult
+{
+  double bestMs = std::numeric_limits<double>::max();
+  size_t peakBytes = 0; // Above the resident memory before loading
+  size_t nodeCount = 0;
+};
+
+bool runParser(const fs::path &gltfFile, bool fastJsonParser,
+    size_t iterations, ParserResult &result)
+{
+  GltfLoaderOptions options;
+  options.fastJsonParser = fastJsonParser;
+  for (size_t i = 0; i < iterations; ++i) {
+    resetPeakResidentMemory();
+    const auto baseline = currentResidentMemory();
+    const auto start = clock::now();
+    {
+      tinygltf::Model model;
+      GltfBuffers buffers;
+      std::string err, warn;
+      if (!loadGltf(gltfFile, options, model, buffers, err, warn)) {
+        std::cerr << err << std::endl;
+        return false;
+      }
+      result.bestMs = std::min(result.bestMs, toMs(clock::now() - start));
+      result.nodeCount = model.nodes.size();
+    }
+    const auto peak = peakResidentMemory();
+    result.peakBytes =
+        std::max(result.peakBytes, peak > baseline ? peak - baseline : 0);
+  }
+  return true;
+}
+
+// Encoded images of a glTF file (or the content of an image file)
+bool readEncodedImages(
+    const fs::path &file, std::vector<std::vector<unsigned char>> &images)
+{
+  auto extension = file.extension().string();
+  std::transform(begin(extension), end(extension), begin(extension),
+      [](unsigned char c) { return char(std::tolower(c)); });
+  if (extension != ".gltf" && extension != ".glb") {
+    std::vector<unsigned char> bytes;
+    std::string err;
+    if (!tinygltf::ReadWholeFile(&bytes, &err, file.string(), nullptr)) {
+      std::cerr << err << std::endl;
+      return false;
+    }
+    images.emplace_back(std::move(bytes));
+    return true;
+  }
+
+  GltfLoaderOptions options;
+  options.deferImageDecoding = true;
+  tinygltf::Model model;
+  GltfBuffers buffers;
+  std::string err, warn;
+  if (!loadGltf(file, options, model, buffers, err, warn)) {
+    std::cerr << err << std::endl;
+    return false;
+  }
+  for (auto &image : model.images) {
+    if (image.as_is && !image.image.empty()) {
+      images.emplace_back(std::move(image.image));
+    }
+  }
+  return true;
+}
+
+// Largest difference between two channels of a and b, in the scale of 8 bits
+int maxChannelDifference(const DecodedImage &a, const DecodedImage &b)
+{
+  if (a.width != b.width || a.height != b.height || a.bits != b.bits ||
+      a.pixels.size() != b.pixels.size()) {
+    return 255;
+  }
+  int difference = 0;
+  if (a.bits == 16) {
+    const auto channelCount = a.pixels.size() / 2;
+    for (size_t i = 0; i < channelCount; ++i) {
+      uint16_t x, y;
+      std::memcpy(&x, a.pixels.data() + 2 * i, 2);
+      std::memcpy(&y, b.pixels.data() + 2 * i, 2);
+      difference = std::max(difference, std::abs(int(x) - int(y)) >> 8);
+    }
+  } else {
+    for (size_t i = 0; i < a.pixels.size(); ++i) {
+      difference =
+          std::max(difference, std::abs(int(a.pixels[i]) - int(b.pixels[i])));
+    }
+  }
+  return difference;
+}
+
+struct DecoderResult
+{
+  double ms = 0; // Sum over images of the best time of each
+  size_t imageCount = 0;
+  size_t encodedBytes = 0;
+  size_t decodedBytes = 0;
+  size_t failureCount = 0;
+  int maxDifference = 0; // To stb_image
+};
+
+// Channels of the image a block format keeps
+int storedChannelCount(BlockFormat format)
+{
+  switch (format) {
+  case BlockFormat::BC1:
+    return 3;
+  case BlockFormat::BC4:
+    return 1;
+  case BlockFormat::BC5:
+    return 2;
+  case BlockFormat::BC7:
+    return 4;
+  }
+  return 4;
+}
+
+struct CompressionResult
+{
+  double encodingMs = 0; // Sum over images
+  size_t pixelBytes = 0; // RGBA8
+  size_t compressedBytes = 0;
+  double squaredError = 0;
+  size_t sampleCount = 0; // Channels compared
+};
+
+} // namespace
+
+int benchmarkGltfParsers(
+    const fs::path &gltfFile, size_t syntheticNodeCount, size_t iterations)
+{
+  std::error_code error;
+  if (!fs::exists(gltfFile, error)) {
+    std::cout << "Generating " << gltfFile << " with " << syntheticNodeCount
+              << " nodes" << std::endl;
+    if (!writeSyntheticGltf(gltfFile, syntheticNodeCount)) {
+      std::cerr << "Unable to write " << gltfFile << std::endl;
+      return 1;
+    }
+  }
+  std::cout << "JSON size: " << toMB(fs::file_size(gltfFile, error)) << " MB"
+            << std::endl;
+
+  if (!resetPeakResidentMemory()) {
+    std::cout << "Peak memory cannot be reset on this platform, it includes "
+                 "previous runs"
+              << std::endl;
+  }
+
+  ParserResult tinygltfResult, fastResult;
+  // Fast parser first, so that a peak of tinygltf cannot hide its own
+  if (!runParser(gltfFile, true, iterations, fastResult) ||
+      !runParser(gltfFile, false, iterations, tinygltfResult)) {
+    return 1;
+  }
+
+  const auto print = [](const char *name, const ParserResult &result) {
+    std::cout << name << ": " << result.bestMs << " ms, peak "
+              << toMB(result.peakBytes) << " MB, " << result.nodeCount
+              << " nodes" << std::endl;
+  };
+  print("tinygltf (nlohmann::json)", tinygltfResult);
+  print("parseGltfJson (JsonReader)", fastResult);
+  std::cout << "Speedup: " << tinygltfResult.bestMs / fastResult.bestMs << "x"
+            << std::endl;
+
+  return 0;
+}
+
+int benchmarkImageDecoders(
+    const std::vector<fs::path> &files, size_t iterations)
+{
+  std::vector<std::vector<unsigned char>> images;
+  for (const auto &file : files) {
+    if (!readEncodedImages(file, images)) {
+      return 1;
+    }
+  }
+  std::cout << images.size() << " images" << std::endl;
+
+  const auto &decoders = imageDecoders();
+  const auto stb = decoders.back();
+  // By format, then by decoder in order of preference
+  std::map<ImageFormat, std::vector<DecoderResult>> results;
+  for (const auto &bytes : images) {
+    const auto format = detectImageFormat(bytes.data(), bytes.size());
+    auto &formatResults = results[format];
+    formatResults.resize(decoders.size());
+
+    DecodedImage reference;
+    std::string err;
+    const auto hasReference =
+        stb->decode(bytes.data(), bytes.size(), reference, err);
+
+    for (size_t d = 0; d < decoders.size(); ++d) {
+      if (!decoders[d]->supports(format)) {
+        continue;
+      }
+      auto &result = formatResults[d];
+      DecodedImage image;
+      auto bestMs = std::numeric_limits<double>::max();
+      bool ok = true;
+      for (size_t i = 0; i < iterations && ok; ++i) {
+        const auto start = clock::now();
+        ok = decoders[d]->decode(bytes.data(), bytes.size(), image, err);
+        bestMs = std::min(bestMs, toMs(clock::now() - start));
+      }
+      if (!ok) {
+        ++result.failureCount;
+        continue;
+      }
+      result.ms += bestMs;
+      ++result.imageCount;
+      result.encodedBytes += bytes.size();
+      result.decodedBytes += image.pixels.size();
+      if (hasReference) {
+        result.maxDifference = std::max(
+            result.maxDifference, maxChannelDifference(image, reference));
+      }
+    }
+  }
+
+  for (const auto &formatResults : results) {
+    std::cout << imageFormatName(formatResults.first) << ":" << std::endl;
+    for (size_t d = 0; d < decoders.size(); ++d) {
+      const auto &result = formatResults.second[d];
+      if (!result.imageCount && !result.failureCount) {
+        continue;
+      }
+      std::cout << "  " << decoders[d]->name() << ": " << result.imageCount
+                << " images in " << result.ms << " ms, "
+                << toMB(result.decodedBytes) / (result.ms / 1000.)
+                << " MB/s of pixels ("
+                << toMB(result.encodedBytes) / (result.ms / 1000.)
+                << " MB/s of input), max difference to stb_image "
+                << result.maxDifference;
+      if (result.failureCount) {
+        std::cout << ", " << result.failureCount
+                  << " images left to the next decoder";
+      }
+      std::cout << std::endl;
+    }
+  }
+
+  return 0;
+}
+
+int benchmarkTextureCompression(const std::vector<fs::path> &files)
+{
+  std::vector<std::vector<unsigned char>> encodedImages;
+  for (const auto &file : files) {
+    if (!readEncodedImages(file, encodedImages)) {
+      return 1;
+    }
+  }
+  std::vector<DecodedImage> images;
+  for (const auto &bytes : encodedImages) {
+    DecodedImage image;
+    std::string err;
+    if (!decodeImage(bytes.data(), bytes.size(), image, err)) {
+      std::cerr << err << std::endl;
+      continue;
+    }
+    if (image.bits != 8) {
+      std::cout << "Skipping a " << image.bits << " bits image" << std::endl;
+      continue;
+    }
+    images.emplace_back(std::move(image));
+  }
+  encodedImages.clear();
+
+  ThreadPool pool;
+  std::cout << images.size() << " images, " << pool.threadCount()
+            << " threads" << std::endl;
+
+  BlockEncoding encodings[4];
+  encodings[0].format = BlockFormat::BC1;
+  encodings[1].format = BlockFormat::BC4;
+  encodings[2].format = BlockFormat::BC5;
+  encodings[3].format = BlockFormat::BC7;
+  for (const auto &encoding : encodings) {
+    const auto channelCount = storedChannelCount(encoding.format);
+
+    std::vector<CompressionResult> imageResults(images.size());
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < images.size(); ++i) {
+      futures.push_back(pool.submit([&, i]() {
+        const auto &image = images[i];
+        auto &result = imageResults[i];
+        std::vector<unsigned char> blocks(
+            compressedLevelSize(encoding.format, image.width, image.height));
+        const auto encodingStart = clock::now();
+        compressBlocks(image.pixels.data(), image.width, image.height,
+            encoding, blocks.data());
+        result.encodingMs = toMs(clock::now() - encodingStart);
+        result.pixelBytes = image.pixels.size();
+        result.compressedBytes = blocks.size();
+
+        std::vector<unsigned char> decompressed(image.pixels.size());
+        decompressBlocks(blocks.data(), image.width, image.height, encoding,
+            decompressed.data());
+        for (size_t p = 0; p < decompressed.size(); p += 4) {
+          for (int c = 0; c < channelCount; ++c) {
+            const auto d =
+                double(decompressed[p + c]) - double(image.pixels[p + c]);
+            result.squaredError += d * d;
+          }
+        }
+        result.sampleCount = decompressed.size() / 4 * channelCount;
+      }));
+    }
+    for (auto &future : futures) {
+      future.get();
+    }
+
+    CompressionResult total;
+    for (const auto &result : imageResults) {
+      total.encodingMs += result.encodingMs;
+      total.pixelBytes += result.pixelBytes;
+      total.compressedBytes += result.compressedBytes;
+      total.squaredError += result.squaredError;
+      total.sampleCount += result.sampleCount;
+    }
+    const auto mse =
+        total.squaredError / std::max(total.sampleCount, size_t(1));
+    std::cout << blockFormatName(encoding.format) << " (" << channelCount
+              << " channels): " << total.encodingMs << " ms of encoding, "
+              << toMB(total.pixelBytes) / (total.encodingMs / 1000.)
+              << " MB/s per thread, " << toMB(total.pixelBytes) << " MB -> "
+              << toMB(total.compressedBytes) << " MB, PSNR ";
+    if (mse > 0) {
+      std::cout << 10 * std::log10(255. * 255. / mse) << " dB";
+    } else {
+      std::cout << "infinite";
+    }
+    std::cout << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <vector>
+
+// Command line benchmarks, printing their results on the standard output.
+// They return the exit code of the program.
+
+// Compare tinygltf and parseGltfJson() on gltfFile: loading time (best of
+// iterations) and peak resident memory. If gltfFile does not exist, it is
+// first generated with syntheticNodeCount nodes, each with its own mesh and
+// accessors, to mimic scenes exported from CAD software.
+int benchmarkGltfParsers(
+    const fs::path &gltfFile, size_t syntheticNodeCount, size_t iterations);
+
+// Decode throughput (MB/s, best of iterations) of each image decoder on the
+// images of files, grouped by format. files are glTF files, whose images are
+// all decoded, or image files. Also prints the largest channel difference of
+// each decoder to stb_image.
+int benchmarkImageDecoders(
+    const std::vector<fs::path> &files, size_t iterations);
+
+// Block compression of the images of files (glTF or image files, like
+// benchmarkImageDecoders()) to each BCn format, images being compressed in
+// parallel: encoding throughput per thread, size compared to RGBA8 and PSNR
+// of the channels each format stores
+int benchmarkTextureCompression(const std::vector<fs::path> &files);
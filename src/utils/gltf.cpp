@@ -3,6 +3,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 glm::mat4 getLocalToWorldMatrix(
@@ -35,8 +37,150 @@ glm::mat4 getLocalToWorldMatrix(
                                                  node.scale[1], node.scale[2]));
 };
 
-void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax)
+namespace
+{
+
+const char *const instancingExtension = "EXT_mesh_gpu_instancing";
+
+// Elements of accessorIdx with components float components, or normalized
+// signed bytes or shorts (rotations), padded with 0. Return false if they
+// cannot be read.
+bool readInstanceVectors(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, int accessorIdx, int components,
+    std::vector<glm::vec4> &vectors)
+{
+  if (accessorIdx < 0 || size_t(accessorIdx) >= model.accessors.size()) {
+    return false;
+  }
+  const auto &accessor = model.accessors[accessorIdx];
+  if (accessor.bufferView < 0 || accessor.sparse.isSparse ||
+      tinygltf::GetNumComponentsInType(accessor.type) != components) {
+    return false;
+  }
+  const auto componentSize =
+      tinygltf::GetComponentSizeInBytes(accessor.componentType);
+  if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT &&
+      accessor.componentType != TINYGLTF_COMPONENT_TYPE_BYTE &&
+      accessor.componentType != TINYGLTF_COMPONENT_TYPE_SHORT) {
+    return false;
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto &buffer = buffers[bufferView.buffer];
+  const auto elementSize = size_t(componentSize * components);
+  const auto stride =
+      bufferView.byteStride ? bufferView.byteStride : elementSize;
+  const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+  if (!buffer.data ||
+      (accessor.count > 0 && byteOffset + (accessor.count - 1) * stride +
+                                     elementSize >
+                                 buffer.size)) {
+    return false;
+  }
+
+  vectors.assign(accessor.count, glm::vec4(0));
+  for (size_t i = 0; i < accessor.count; ++i) {
+    const auto element = buffer.data + byteOffset + i * stride;
+    for (int c = 0; c < components; ++c) {
+      const auto component = element + c * componentSize;
+      if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+        std::memcpy(&vectors[i][c], component, sizeof(float));
+      } else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_BYTE) {
+        int8_t value;
+        std::memcpy(&value, component, sizeof(value));
+        vectors[i][c] = std::max(value / 127.f, -1.f);
+      } else {
+        int16_t value;
+        std::memcpy(&value, component, sizeof(value));
+        vectors[i][c] = std::max(value / 32767.f, -1.f);
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+std::map<std::string, int> getInstancingAttributes(const tinygltf::Node &node)
+{
+  std::map<std::string, int> attributes;
+  const auto extension = node.extensions.find(instancingExtension);
+  if (extension == end(node.extensions) ||
+      !extension->second.Has("attributes")) {
+    return attributes;
+  }
+  const auto &values = extension->second.Get("attributes");
+  for (const auto &key : values.Keys()) {
+    const auto &value = values.Get(key);
+    if (value.IsNumber()) {
+      attributes[key] = value.GetNumberAsInt();
+    }
+  }
+  return attributes;
+}
+
+void setInstancingAttributes(
+    tinygltf::Node &node, const std::map<std::string, int> &attributes)
+{
+  if (attributes.empty()) {
+    node.extensions.erase(instancingExtension);
+    return;
+  }
+  tinygltf::Value::Object values;
+  for (const auto &attribute : attributes) {
+    values[attribute.first] = tinygltf::Value(attribute.second);
+  }
+  tinygltf::Value::Object extension;
+  extension["attributes"] = tinygltf::Value(std::move(values));
+  node.extensions[instancingExtension] = tinygltf::Value(std::move(extension));
+}
+
+std::vector<glm::mat4> getInstanceMatrices(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, const tinygltf::Node &node)
+{
+  const auto attributes = getInstancingAttributes(node);
+  // Missing attributes keep their identity value
+  const char *const names[] = {"TRANSLATION", "ROTATION", "SCALE"};
+  const int components[] = {3, 4, 3};
+  std::vector<glm::vec4> vectors[3];
+  size_t count = 0;
+  bool found = false;
+  for (int i = 0; i < 3; ++i) {
+    const auto attribute = attributes.find(names[i]);
+    if (attribute == end(attributes)) {
+      continue;
+    }
+    if (!readInstanceVectors(
+            model, buffers, attribute->second, components[i], vectors[i]) ||
+        (found && vectors[i].size() != count)) {
+      std::cerr << "Unable to read the " << names[i] << " of the instances of "
+                << "node " << node.name << ", drawing its mesh once"
+                << std::endl;
+      return {};
+    }
+    count = vectors[i].size();
+    found = true;
+  }
+
+  std::vector<glm::mat4> matrices(count);
+  for (size_t i = 0; i < count; ++i) {
+    const auto T = vectors[0].empty()
+                       ? glm::mat4(1)
+                       : glm::translate(glm::mat4(1), glm::vec3(vectors[0][i]));
+    const auto R =
+        vectors[1].empty()
+            ? glm::mat4(1)
+            : glm::mat4_cast(glm::quat(vectors[1][i].w, vectors[1][i].x,
+                  vectors[1][i].y, vectors[1][i].z)); // w, x, y, z
+    matrices[i] = vectors[2].empty()
+                      ? T * R
+                      : glm::scale(T * R, glm::vec3(vectors[2][i]));
+  }
+  return matrices;
+}
+
+void computeSceneBounds(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax)
 {
   // Compute scene bounding box
   // todo refactor with scene drawing
@@ -50,6 +194,22 @@ void computeSceneBounds(
           const glm::mat4 modelMatrix =
               getLocalToWorldMatrix(node, parentMatrix);
           if (node.mesh >= 0) {
+            // Instances are bounded by the bounds of the mesh
+            const auto instanceMatrices =
+                getInstanceMatrices(model, buffers, node);
+            auto meshMin = glm::vec3(std::numeric_limits<float>::max());
+            auto meshMax = glm::vec3(std::numeric_limits<float>::lowest());
+            const auto addPosition = [&](const glm::vec3 &localPosition) {
+              if (!instanceMatrices.empty()) {
+                meshMin = glm::min(meshMin, localPosition);
+                meshMax = glm::max(meshMax, localPosition);
+                return;
+              }
+              const auto worldPosition =
+                  glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
+              bboxMin = glm::min(bboxMin, worldPosition);
+              bboxMax = glm::max(bboxMax, worldPosition);
+            };
             const auto &mesh = model.meshes[node.mesh];
             for (size_t pIdx = 0; pIdx < mesh.primitives.size(); ++pIdx) {
               const auto &primitive = mesh.primitives[pIdx];
@@ -69,8 +229,7 @@ void computeSceneBounds(
                   model.bufferViews[positionAccessor.bufferView];
               const auto byteOffset =
                   positionAccessor.byteOffset + positionBufferView.byteOffset;
-              const auto &positionBuffer =
-                  model.buffers[positionBufferView.buffer];
+              const auto &positionBuffer = buffers[positionBufferView.buffer];
               const auto positionByteStride =
                   positionBufferView.byteStride ? positionBufferView.byteStride
                                                 : 3 * sizeof(float);
@@ -81,7 +240,7 @@ void computeSceneBounds(
                     model.bufferViews[indexAccessor.bufferView];
                 const auto indexByteOffset =
                     indexAccessor.byteOffset + indexBufferView.byteOffset;
-                const auto &indexBuffer = model.buffers[indexBufferView.buffer];
+                const auto &indexBuffer = buffers[indexBufferView.buffer];
                 auto indexByteStride = indexBufferView.byteStride;
 
                 switch (indexAccessor.componentType) {
@@ -121,26 +280,31 @@ void computeSceneBounds(
                                   .data[indexByteOffset + indexByteStride * i]);
                     break;
                   }
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * index]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
+                  addPosition(*((const glm::vec3 *)&positionBuffer
+                          .data[byteOffset + positionByteStride * index]));
                 }
               } else {
                 for (size_t i = 0; i < positionAccessor.count; ++i) {
-                  const auto &localPosition =
-                      *((const glm::vec3 *)&positionBuffer
-                              .data[byteOffset + positionByteStride * i]);
-                  const auto worldPosition =
-                      glm::vec3(modelMatrix * glm::vec4(localPosition, 1.f));
-                  bboxMin = glm::min(bboxMin, worldPosition);
-                  bboxMax = glm::max(bboxMax, worldPosition);
+                  addPosition(*((const glm::vec3 *)&positionBuffer
+                          .data[byteOffset + positionByteStride * i]));
                 }
               }
             }
+            for (const auto &instanceMatrix : instanceMatrices) {
+              if (meshMin.x > meshMax.x) {
+                break;
+              }
+              for (int corner = 0; corner < 8; ++corner) {
+                const auto localPosition =
+                    glm::vec3(corner & 1 ? meshMax.x : meshMin.x,
+                        corner & 2 ? meshMax.y : meshMin.y,
+                        corner & 4 ? meshMax.z : meshMin.z);
+                const auto worldPosition = glm::vec3(
+                    modelMatrix * instanceMatrix * glm::vec4(localPosition, 1));
+                bboxMin = glm::min(bboxMin, worldPosition);
+                bboxMax = glm::max(bboxMax, worldPosition);
+              }
+            }
           }
           for (const auto childNodeIdx : node.children) {
             updateBounds(childNodeIdx, modelMatrix);
@@ -150,4 +314,26 @@ void computeSceneBounds(
       updateBounds(nodeIdx, glm::mat4(1));
     }
   }
-}
\ No newline at end of file
+}
+
+std::vector<glm::vec3> computePrimitiveCenters(const tinygltf::Model &model)
+{
+  std::vector<glm::vec3> centers;
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      glm::vec3 center(0);
+      const auto position = primitive.attributes.find("POSITION");
+      if (position != end(primitive.attributes)) {
+        const auto &accessor = model.accessors[position->second];
+        if (accessor.minValues.size() >= 3 && accessor.maxValues.size() >= 3) {
+          for (int i = 0; i < 3; ++i) {
+            center[i] =
+                float(0.5 * (accessor.minValues[i] + accessor.maxValues[i]));
+          }
+        }
+      }
+      centers.push_back(center);
+    }
+  }
+  return centers;
+}
@@ -3,8 +3,42 @@
 #include <glm/glm.hpp>
 #include <tiny_gltf.h>
 
+#include <map>
+#include <string>
+#include <vector>
+
+// Bytes of a glTF buffer, either owned by tinygltf::Buffer::data or mapped from
+// the BIN chunk of a .glb or from an external .bin file
+struct BufferBytes
+{
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+};
+
 glm::mat4 getLocalToWorldMatrix(
     const tinygltf::Node &node, const glm::mat4 &parentMatrix);
 
-void computeSceneBounds(
-    const tinygltf::Model &model, glm::vec3 &bboxMin, glm::vec3 &bboxMax);
\ No newline at end of file
+// Accessors of the attributes (TRANSLATION, ROTATION, SCALE...) of the
+// EXT_mesh_gpu_instancing extension of node, empty without it
+std::map<std::string, int> getInstancingAttributes(const tinygltf::Node &node);
+void setInstancingAttributes(
+    tinygltf::Node &node, const std::map<std::string, int> &attributes);
+
+// Matrix of each instance of the mesh of node with EXT_mesh_gpu_instancing,
+// relative to the node:
+// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_mesh_gpu_instancing
+// Empty without the extension, or if its accessors cannot be read (a message
+// is then printed and the mesh is drawn once).
+std::vector<glm::mat4> getInstanceMatrices(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, const tinygltf::Node &node);
+
+// buffers must contain one element per model.buffers element. The instances of
+// nodes with EXT_mesh_gpu_instancing are bounded by the bounds of their mesh.
+void computeSceneBounds(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax);
+
+// Center of the bounds of each primitive (from the min and max of its POSITION
+// accessor, the origin without them), mesh after mesh in the order of their
+// primitives
+std::vector<glm::vec3> computePrimitiveCenters(const tinygltf::Model &model);
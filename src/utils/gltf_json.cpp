@@ -0,0 +1,605 @@
+#include "gltf_json.hpp"
+#include "gltf.hpp"
+#include "json_reader.hpp"
+
+#include <stdexcept>
+
+namespace
+{
+
+using Key = JsonReader::Key;
+
+template <typename Function>
+void forEachMember(JsonReader &reader, Function &&f)
+{
+  reader.beginObject();
+  Key key;
+  while (reader.nextMember(key)) {
+    f(key);
+  }
+}
+
+template <typename T, typename Function>
+void readArray(JsonReader &reader, std::vector<T> &values, Function &&f)
+{
+  reader.beginArray();
+  while (reader.nextElement()) {
+    values.emplace_back();
+    f(reader, values.back());
+  }
+}
+
+std::vector<double> readDoubles(JsonReader &reader)
+{
+  std::vector<double> values;
+  readArray(reader, values,
+      [](JsonReader &reader, double &value) { value = reader.readDouble(); });
+  return values;
+}
+
+std::vector<int> readInts(JsonReader &reader)
+{
+  std::vector<int> values;
+  readArray(reader, values,
+      [](JsonReader &reader, int &value) { value = reader.readInt(); });
+  return values;
+}
+
+std::vector<std::string> readStrings(JsonReader &reader)
+{
+  std::vector<std::string> values;
+  readArray(reader, values, [](JsonReader &reader, std::string &value) {
+    value = reader.readString();
+  });
+  return values;
+}
+
+std::map<std::string, int> readAttributes(JsonReader &reader)
+{
+  std::map<std::string, int> attributes;
+  forEachMember(reader, [&](const Key &key) {
+    const std::string name(key.data, key.size);
+    attributes[name] = reader.readInt();
+  });
+  return attributes;
+}
+
+int accessorType(const std::string &type)
+{
+  if (type == "SCALAR") {
+    return TINYGLTF_TYPE_SCALAR;
+  } else if (type == "VEC2") {
+    return TINYGLTF_TYPE_VEC2;
+  } else if (type == "VEC3") {
+    return TINYGLTF_TYPE_VEC3;
+  } else if (type == "VEC4") {
+    return TINYGLTF_TYPE_VEC4;
+  } else if (type == "MAT2") {
+    return TINYGLTF_TYPE_MAT2;
+  } else if (type == "MAT3") {
+    return TINYGLTF_TYPE_MAT3;
+  } else if (type == "MAT4") {
+    return TINYGLTF_TYPE_MAT4;
+  }
+  throw std::runtime_error("Unsupported accessor type " + type);
+}
+
+void readTextureInfo(JsonReader &reader, tinygltf::TextureInfo &info)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "index") {
+      info.index = reader.readInt();
+    } else if (key == "texCoord") {
+      info.texCoord = reader.readInt();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readNormalTextureInfo(
+    JsonReader &reader, tinygltf::NormalTextureInfo &info)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "index") {
+      info.index = reader.readInt();
+    } else if (key == "texCoord") {
+      info.texCoord = reader.readInt();
+    } else if (key == "scale") {
+      info.scale = reader.readDouble();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readOcclusionTextureInfo(
+    JsonReader &reader, tinygltf::OcclusionTextureInfo &info)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "index") {
+      info.index = reader.readInt();
+    } else if (key == "texCoord") {
+      info.texCoord = reader.readInt();
+    } else if (key == "strength") {
+      info.strength = reader.readDouble();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readMaterial(JsonReader &reader, tinygltf::Material &material)
+{
+  material.emissiveFactor = {0., 0., 0.};
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "name") {
+      material.name = reader.readString();
+    } else if (key == "pbrMetallicRoughness") {
+      auto &pbr = material.pbrMetallicRoughness;
+      forEachMember(reader, [&](const Key &key) {
+        if (key == "baseColorFactor") {
+          pbr.baseColorFactor = readDoubles(reader);
+        } else if (key == "baseColorTexture") {
+          readTextureInfo(reader, pbr.baseColorTexture);
+        } else if (key == "metallicFactor") {
+          pbr.metallicFactor = reader.readDouble();
+        } else if (key == "roughnessFactor") {
+          pbr.roughnessFactor = reader.readDouble();
+        } else if (key == "metallicRoughnessTexture") {
+          readTextureInfo(reader, pbr.metallicRoughnessTexture);
+        } else {
+          reader.skipValue();
+        }
+      });
+    } else if (key == "normalTexture") {
+      readNormalTextureInfo(reader, material.normalTexture);
+    } else if (key == "occlusionTexture") {
+      readOcclusionTextureInfo(reader, material.occlusionTexture);
+    } else if (key == "emissiveTexture") {
+      readTextureInfo(reader, material.emissiveTexture);
+    } else if (key == "emissiveFactor") {
+      material.emissiveFactor = readDoubles(reader);
+    } else if (key == "alphaMode") {
+      material.alphaMode = reader.readString();
+    } else if (key == "alphaCutoff") {
+      material.alphaCutoff = reader.readDouble();
+    } else if (key == "doubleSided") {
+      material.doubleSided = reader.readBool();
+    } else {
+      reader.skipValue();
+    }
+  });
+  if (material.emissiveFactor.size() != 3 ||
+      material.pbrMetallicRoughness.baseColorFactor.size() != 4) {
+    throw std::runtime_error("Invalid factor in material " + material.name);
+  }
+}
+
+void readAccessor(JsonReader &reader, tinygltf::Accessor &accessor,
+    std::string &warn)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "bufferView") {
+      accessor.bufferView = reader.readInt();
+    } else if (key == "byteOffset") {
+      accessor.byteOffset = reader.readSize();
+    } else if (key == "normalized") {
+      accessor.normalized = reader.readBool();
+    } else if (key == "componentType") {
+      accessor.componentType = reader.readInt();
+    } else if (key == "count") {
+      accessor.count = reader.readSize();
+    } else if (key == "type") {
+      accessor.type = accessorType(reader.readString());
+    } else if (key == "min") {
+      accessor.minValues = readDoubles(reader);
+    } else if (key == "max") {
+      accessor.maxValues = readDoubles(reader);
+    } else if (key == "name") {
+      accessor.name = reader.readString();
+    } else if (key == "sparse") {
+      warn += "Sparse accessors are ignored by the fast JSON parser.\n";
+      reader.skipValue();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readBufferView(JsonReader &reader, tinygltf::BufferView &bufferView)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "buffer") {
+      bufferView.buffer = reader.readInt();
+    } else if (key == "byteOffset") {
+      bufferView.byteOffset = reader.readSize();
+    } else if (key == "byteLength") {
+      bufferView.byteLength = reader.readSize();
+    } else if (key == "byteStride") {
+      bufferView.byteStride = reader.readSize();
+    } else if (key == "target") {
+      bufferView.target = reader.readInt();
+    } else if (key == "name") {
+      bufferView.name = reader.readString();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readBuffer(
+    JsonReader &reader, tinygltf::Buffer &buffer, size_t &byteLength)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "uri") {
+      buffer.uri = reader.readString();
+    } else if (key == "byteLength") {
+      byteLength = reader.readSize();
+    } else if (key == "name") {
+      buffer.name = reader.readString();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readImage(JsonReader &reader, tinygltf::Image &image)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "uri") {
+      image.uri = reader.readString();
+    } else if (key == "mimeType") {
+      image.mimeType = reader.readString();
+    } else if (key == "bufferView") {
+      image.bufferView = reader.readInt();
+    } else if (key == "name") {
+      image.name = reader.readString();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readSampler(JsonReader &reader, tinygltf::Sampler &sampler)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "minFilter") {
+      sampler.minFilter = reader.readInt();
+    } else if (key == "magFilter") {
+      sampler.magFilter = reader.readInt();
+    } else if (key == "wrapS") {
+      sampler.wrapS = reader.readInt();
+    } else if (key == "wrapT") {
+      sampler.wrapT = reader.readInt();
+    } else if (key == "name") {
+      sampler.name = reader.readString();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readTexture(JsonReader &reader, tinygltf::Texture &texture)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "sampler") {
+      texture.sampler = reader.readInt();
+    } else if (key == "source") {
+      texture.source = reader.readInt();
+    } else if (key == "name") {
+      texture.name = reader.readString();
+    } else if (key == "extensions") {
+      // Only KHR_texture_basisu, whose source loadGltf() resolves
+      forEachMember(reader, [&](const Key &key) {
+        if (key == "KHR_texture_basisu") {
+          forEachMember(reader, [&](const Key &key) {
+            if (key == "source") {
+              tinygltf::Value::Object extension;
+              extension["source"] = tinygltf::Value(reader.readInt());
+              texture.extensions["KHR_texture_basisu"] =
+                  tinygltf::Value(std::move(extension));
+            } else {
+              reader.skipValue();
+            }
+          });
+        } else {
+          reader.skipValue();
+        }
+      });
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readPrimitive(JsonReader &reader, tinygltf::Primitive &primitive)
+{
+  primitive.mode = TINYGLTF_MODE_TRIANGLES;
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "attributes") {
+      primitive.attributes = readAttributes(reader);
+    } else if (key == "indices") {
+      primitive.indices = reader.readInt();
+    } else if (key == "material") {
+      primitive.material = reader.readInt();
+    } else if (key == "mode") {
+      primitive.mode = reader.readInt();
+    } else if (key == "targets") {
+      readArray(reader, primitive.targets,
+          [](JsonReader &reader, std::map<std::string, int> &target) {
+            target = readAttributes(reader);
+          });
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readMesh(JsonReader &reader, tinygltf::Mesh &mesh)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "name") {
+      mesh.name = reader.readString();
+    } else if (key == "primitives") {
+      readArray(reader, mesh.primitives, readPrimitive);
+    } else if (key == "weights") {
+      mesh.weights = readDoubles(reader);
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readNode(JsonReader &reader, tinygltf::Node &node)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "name") {
+      node.name = reader.readString();
+    } else if (key == "mesh") {
+      node.mesh = reader.readInt();
+    } else if (key == "children") {
+      node.children = readInts(reader);
+    } else if (key == "matrix") {
+      node.matrix = readDoubles(reader);
+    } else if (key == "rotation") {
+      node.rotation = readDoubles(reader);
+    } else if (key == "scale") {
+      node.scale = readDoubles(reader);
+    } else if (key == "translation") {
+      node.translation = readDoubles(reader);
+    } else if (key == "camera") {
+      node.camera = reader.readInt();
+    } else if (key == "skin") {
+      node.skin = reader.readInt();
+    } else if (key == "weights") {
+      node.weights = readDoubles(reader);
+    } else if (key == "extensions") {
+      // Only EXT_mesh_gpu_instancing, whose instances the viewer draws
+      forEachMember(reader, [&](const Key &key) {
+        if (key == "EXT_mesh_gpu_instancing") {
+          forEachMember(reader, [&](const Key &key) {
+            if (key == "attributes") {
+              setInstancingAttributes(node, readAttributes(reader));
+            } else {
+              reader.skipValue();
+            }
+          });
+        } else {
+          reader.skipValue();
+        }
+      });
+    } else {
+      reader.skipValue();
+    }
+  });
+  if ((!node.matrix.empty() && node.matrix.size() != 16) ||
+      (!node.rotation.empty() && node.rotation.size() != 4) ||
+      (!node.scale.empty() && node.scale.size() != 3) ||
+      (!node.translation.empty() && node.translation.size() != 3)) {
+    throw std::runtime_error("Invalid transform in node " + node.name);
+  }
+}
+
+void readScene(JsonReader &reader, tinygltf::Scene &scene)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "name") {
+      scene.name = reader.readString();
+    } else if (key == "nodes") {
+      scene.nodes = readInts(reader);
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+void readAsset(JsonReader &reader, tinygltf::Asset &asset)
+{
+  forEachMember(reader, [&](const Key &key) {
+    if (key == "version") {
+      asset.version = reader.readString();
+    } else if (key == "generator") {
+      asset.generator = reader.readString();
+    } else if (key == "minVersion") {
+      asset.minVersion = reader.readString();
+    } else if (key == "copyright") {
+      asset.copyright = reader.readString();
+    } else {
+      reader.skipValue();
+    }
+  });
+}
+
+// Indices read from the document are used without further checks by the
+// viewer, reject the ones out of range
+void checkIndex(int index, size_t count, const char *what)
+{
+  if (index < -1 || (index >= 0 && size_t(index) >= count)) {
+    throw std::runtime_error(
+        std::string("Invalid ") + what + " index " + std::to_string(index));
+  }
+}
+
+void checkIndices(const tinygltf::Model &model)
+{
+  checkIndex(model.defaultScene, model.scenes.size(), "scene");
+  for (const auto &scene : model.scenes) {
+    for (const auto node : scene.nodes) {
+      checkIndex(node, model.nodes.size(), "node");
+    }
+  }
+  for (const auto &node : model.nodes) {
+    checkIndex(node.mesh, model.meshes.size(), "mesh");
+    for (const auto child : node.children) {
+      checkIndex(child, model.nodes.size(), "node");
+    }
+  }
+  for (const auto &mesh : model.meshes) {
+    for (const auto &primitive : mesh.primitives) {
+      checkIndex(primitive.material, model.materials.size(), "material");
+      checkIndex(primitive.indices, model.accessors.size(), "accessor");
+      for (const auto &attribute : primitive.attributes) {
+        checkIndex(attribute.second, model.accessors.size(), "accessor");
+      }
+    }
+  }
+  for (const auto &accessor : model.accessors) {
+    checkIndex(accessor.bufferView, model.bufferViews.size(), "buffer view");
+  }
+  for (const auto &bufferView : model.bufferViews) {
+    if (bufferView.buffer < 0) {
+      throw std::runtime_error("Buffer view without buffer");
+    }
+    checkIndex(bufferView.buffer, model.buffers.size(), "buffer");
+  }
+  for (const auto &material : model.materials) {
+    const auto &pbr = material.pbrMetallicRoughness;
+    for (const auto index : {pbr.baseColorTexture.index,
+             pbr.metallicRoughnessTexture.index, material.normalTexture.index,
+             material.occlusionTexture.index, material.emissiveTexture.index}) {
+      checkIndex(index, model.textures.size(), "texture");
+    }
+  }
+  for (const auto &texture : model.textures) {
+    checkIndex(texture.source, model.images.size(), "image");
+    checkIndex(texture.sampler, model.samplers.size(), "sampler");
+  }
+  for (const auto &image : model.images) {
+    checkIndex(image.bufferView, model.bufferViews.size(), "buffer view");
+  }
+}
+
+// Extensions read by the parser above and used by the viewer
+bool isSupportedExtension(const std::string &extension)
+{
+  return extension == "KHR_texture_basisu" ||
+         extension == "EXT_mesh_gpu_instancing";
+}
+
+} // namespace
+
+bool parseGltfJson(const char *json, size_t size, tinygltf::Model &model,
+    std::vector<size_t> &bufferByteLengths, std::string &err,
+    std::string &warn)
+{
+  model = tinygltf::Model();
+  model.defaultScene = -1;
+  bufferByteLengths.clear();
+
+  try {
+    JsonReader reader(json, json + size);
+    forEachMember(reader, [&](const Key &key) {
+      if (key == "asset") {
+        readAsset(reader, model.asset);
+      } else if (key == "scene") {
+        model.defaultScene = reader.readInt();
+      } else if (key == "scenes") {
+        readArray(reader, model.scenes, readScene);
+      } else if (key == "nodes") {
+        readArray(reader, model.nodes, readNode);
+      } else if (key == "meshes") {
+        readArray(reader, model.meshes, readMesh);
+      } else if (key == "accessors") {
+        readArray(reader, model.accessors,
+            [&](JsonReader &reader, tinygltf::Accessor &accessor) {
+              readAccessor(reader, accessor, warn);
+            });
+      } else if (key == "bufferViews") {
+        readArray(reader, model.bufferViews, readBufferView);
+      } else if (key == "buffers") {
+        readArray(reader, model.buffers,
+            [&](JsonReader &reader, tinygltf::Buffer &buffer) {
+              bufferByteLengths.emplace_back(0);
+              readBuffer(reader, buffer, bufferByteLengths.back());
+            });
+      } else if (key == "materials") {
+        readArray(reader, model.materials, readMaterial);
+      } else if (key == "textures") {
+        readArray(reader, model.textures, readTexture);
+      } else if (key == "images") {
+        readArray(reader, model.images, readImage);
+      } else if (key == "samplers") {
+        readArray(reader, model.samplers, readSampler);
+      } else if (key == "extensionsUsed") {
+        model.extensionsUsed = readStrings(reader);
+      } else if (key == "extensionsRequired") {
+        model.extensionsRequired = readStrings(reader);
+      } else {
+        // Animations, skins, cameras, extensions and extras are not used
+        reader.skipValue();
+      }
+    });
+    checkIndices(model);
+  } catch (const std::exception &e) {
+    err += std::string("glTF JSON parsing error: ") + e.what() + "\n";
+    return false;
+  }
+
+  if (model.asset.version.empty()) {
+    err += "Missing asset version.\n";
+    return false;
+  }
+  for (const auto &extension : model.extensionsRequired) {
+    if (!isSupportedExtension(extension)) {
+      warn += "Required extension " + extension + " is not supported.\n";
+    }
+  }
+
+  return true;
+}
+
+bool listGltfUris(const char *json, size_t size,
+    std::vector<std::string> &bufferUris, std::vector<std::string> &imageUris,
+    std::string &err)
+{
+  bufferUris.clear();
+  imageUris.clear();
+
+  const auto readUri = [](JsonReader &reader, std::string &uri) {
+    forEachMember(reader, [&](const Key &key) {
+      if (key == "uri") {
+        uri = reader.readString();
+      } else {
+        reader.skipValue();
+      }
+    });
+  };
+
+  try {
+    JsonReader reader(json, json + size);
+    forEachMember(reader, [&](const Key &key) {
+      if (key == "buffers") {
+        readArray(reader, bufferUris, readUri);
+      } else if (key == "images") {
+        readArray(reader, imageUris, readUri);
+      } else {
+        reader.skipValue();
+      }
+    });
+  } catch (const std::exception &e) {
+    err += std::string("glTF JSON parsing error: ") + e.what() + "\n";
+    return false;
+  }
+  return true;
+}
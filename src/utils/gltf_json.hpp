@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Parse the JSON of a glTF document straight into model with JsonReader,
+// instead of building the nlohmann::json DOM tinygltf parses from. This is
+// much faster and lighter for scenes with many nodes, but only fills what the
+// viewer uses: animations, skins, cameras, lights, extras and extensions
+// (except KHR_texture_basisu and EXT_mesh_gpu_instancing) are skipped, and
+// sparse accessors are not supported.
+//
+// Buffers and images are only described (uri, bufferView...): their data is
+// loaded by the caller. bufferByteLengths receives the byteLength of each
+// buffer, which tinygltf::Buffer has no member for.
+bool parseGltfJson(const char *json, size_t size, tinygltf::Model &model,
+    std::vector<size_t> &bufferByteLengths, std::string &err,
+    std::string &warn);
+
+// Only read the uri of each buffer and image of a glTF document, empty when
+// it has none, e.g. to start reading external files before the document is
+// fully parsed
+bool listGltfUris(const char *json, size_t size,
+    std::vector<std::string> &bufferUris, std::vector<std::string> &imageUris,
+    std::string &err);
@@ -0,0 +1,901 @@
+#include "gltf_loader.hpp"
+#include "async_file_io.hpp"
+#include "gltf_json.hpp"
+#include "image_decoders.hpp"
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <json.hpp>
+
+using nlohmann::json;
+
+namespace
+{
+
+// URIs substituted to mapped buffers and to images stored in mapped buffer
+// views before handing the JSON to tinygltf. mappedReadWholeFile() resolves
+// them from memory instead of the disk.
+const std::string mappedUriPrefix = "mapped-bytes:";
+const std::string mappedBufferUri = mappedUriPrefix + "buffer/";
+const std::string mappedImageUri = mappedUriPrefix + "image/";
+
+// External files of a document read ahead with readFiles(), then handed to
+// tinygltf by prefetchedReadWholeFile() instead of reading them one by one
+struct PrefetchedFiles
+{
+  std::unordered_map<std::string, FileReadResult> files; // By fileKey()
+};
+
+struct MappedLoadState
+{
+  // Indexed by buffer (resp. image) index, data is nullptr if not mapped
+  std::vector<BufferBytes> buffers;
+  std::vector<BufferBytes> images;
+  PrefetchedFiles prefetched;
+};
+
+// Image loader callback used to defer decoding: tinygltf hands us the
+// encoded bytes, we keep them as they are
+bool storeEncodedImage(tinygltf::Image *image, const int, std::string *,
+    std::string *, int, int, const unsigned char *bytes, int size, void *)
+{
+  image->image.assign(bytes, bytes + size);
+  image->as_is = true;
+  return true;
+}
+
+void setupLoader(
+    tinygltf::TinyGLTF &loader, const GltfLoaderOptions &options)
+{
+  if (options.deferImageDecoding) {
+    loader.SetImageLoader(&storeEncodedImage, nullptr);
+  } else {
+    loader.SetImageLoader(&loadImageData, nullptr);
+  }
+}
+
+bool isGlbPath(const fs::path &path)
+{
+  auto extension = path.extension().string();
+  std::transform(begin(extension), end(extension), begin(extension),
+      [](unsigned char c) { return char(std::tolower(c)); });
+  return extension == ".glb";
+}
+
+// tinygltf joins the base directory and the uri with '/', fs::path with the
+// preferred separator: compare paths with a single kind of separator
+std::string fileKey(const std::string &path)
+{
+  std::string key;
+  key.reserve(path.size());
+  for (auto c : path) {
+    if (c == '\\') {
+      c = '/';
+    }
+    if (c != '/' || key.empty() || key.back() != '/') {
+      key.push_back(c);
+    }
+  }
+  return key;
+}
+
+// Read the external files referenced by uris concurrently
+PrefetchedFiles prefetchFiles(const fs::path &baseDir,
+    const std::vector<std::string> &uris, ThreadPool &pool)
+{
+  std::vector<fs::path> paths;
+  std::vector<std::string> keys;
+  std::unordered_map<std::string, size_t> known;
+  for (const auto &uri : uris) {
+    if (uri.empty() || tinygltf::IsDataURI(uri)) {
+      continue;
+    }
+    const auto path = baseDir / uri;
+    auto key = fileKey(path.string());
+    if (known.emplace(key, paths.size()).second) {
+      paths.emplace_back(path);
+      keys.emplace_back(std::move(key));
+    }
+  }
+
+  PrefetchedFiles prefetched;
+  std::mutex mutex;
+  readFiles(paths, pool, [&](size_t fileIdx, FileReadResult &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    prefetched.files[keys[fileIdx]] = std::move(result);
+  });
+  return prefetched;
+}
+
+const FileReadResult *findPrefetchedFile(
+    const PrefetchedFiles &prefetched, const std::string &filepath)
+{
+  if (prefetched.files.empty()) {
+    return nullptr;
+  }
+  const auto it = prefetched.files.find(fileKey(filepath));
+  return it != prefetched.files.end() ? &it->second : nullptr;
+}
+
+bool prefetchedFileExists(const std::string &absFilename, void *userData)
+{
+  const auto &prefetched = *(const PrefetchedFiles *)userData;
+  return findPrefetchedFile(prefetched, absFilename) ||
+         tinygltf::FileExists(absFilename, nullptr);
+}
+
+std::string prefetchedExpandFilePath(
+    const std::string &filepath, void *userData)
+{
+  // The default expands shell variables, which would change the key
+  const auto &prefetched = *(const PrefetchedFiles *)userData;
+  if (findPrefetchedFile(prefetched, filepath)) {
+    return filepath;
+  }
+  return tinygltf::ExpandFilePath(filepath, nullptr);
+}
+
+bool prefetchedReadWholeFile(std::vector<unsigned char> *out, std::string *err,
+    const std::string &filepath, void *userData)
+{
+  auto &prefetched = *(PrefetchedFiles *)userData;
+  const auto it = prefetched.files.find(fileKey(filepath));
+  if (it == prefetched.files.end()) {
+    return tinygltf::ReadWholeFile(out, err, filepath, nullptr);
+  }
+  if (!it->second.error.empty()) {
+    if (err) {
+      *err += it->second.error + "\n";
+    }
+    return false;
+  }
+  // Moved out rather than copied: files referenced again, which is rare, are
+  // read from the disk
+  *out = std::move(it->second.bytes);
+  prefetched.files.erase(it);
+  return true;
+}
+
+bool mappedFileExists(const std::string &absFilename, void *userData)
+{
+  const auto &state = *(MappedLoadState *)userData;
+  return absFilename.find(mappedUriPrefix) != std::string::npos ||
+         prefetchedFileExists(absFilename, (void *)&state.prefetched);
+}
+
+std::string mappedExpandFilePath(const std::string &filepath, void *userData)
+{
+  const auto &state = *(MappedLoadState *)userData;
+  if (filepath.find(mappedUriPrefix) != std::string::npos) {
+    return filepath;
+  }
+  return prefetchedExpandFilePath(filepath, (void *)&state.prefetched);
+}
+
+bool mappedReadWholeFile(std::vector<unsigned char> *out, std::string *err,
+    const std::string &filepath, void *userData)
+{
+  const auto &state = *(const MappedLoadState *)userData;
+
+  const auto bufferPos = filepath.find(mappedBufferUri);
+  if (bufferPos != std::string::npos) {
+    // One byte placeholder, matching the byteLength we have written in the
+    // JSON, so that tinygltf never copies the mapped buffer
+    out->assign(1, 0);
+    return true;
+  }
+
+  const auto imagePos = filepath.find(mappedImageUri);
+  if (imagePos != std::string::npos) {
+    const auto imageIdx =
+        std::stoul(filepath.substr(imagePos + mappedImageUri.size()));
+    const auto &bytes = state.images[imageIdx];
+    // Encoded image bytes are small compared to geometry, and tinygltf needs
+    // them in a vector to decode them
+    out->assign(bytes.data, bytes.data + bytes.size);
+    return true;
+  }
+
+  return prefetchedReadWholeFile(out, err, filepath, (void *)&state.prefetched);
+}
+
+// https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#glb-file-format-specification
+bool parseGlbChunks(const MappedFile &file, const char *&jsonData,
+    size_t &jsonSize, BufferBytes &binChunk, std::string &err)
+{
+  const auto *bytes = file.data();
+  const auto readUint32 = [&](size_t offset) {
+    uint32_t value;
+    std::memcpy(&value, bytes + offset, sizeof(value));
+    return value;
+  };
+
+  if (file.size() < 20 || std::memcmp(bytes, "glTF", 4) != 0) {
+    err += "Invalid glTF binary header.\n";
+    return false;
+  }
+
+  const uint32_t jsonChunkType = 0x4E4F534A;
+  const uint32_t binChunkType = 0x004E4942;
+
+  const auto length = std::min(size_t(readUint32(8)), file.size());
+  size_t offset = 12;
+  while (offset + 8 <= length) {
+    const auto chunkLength = size_t(readUint32(offset));
+    const auto chunkType = readUint32(offset + 4);
+    const auto chunkBegin = offset + 8;
+    if (chunkBegin + chunkLength > length) {
+      err += "Truncated chunk in glTF binary.\n";
+      return false;
+    }
+    if (chunkType == jsonChunkType && !jsonData) {
+      jsonData = (const char *)bytes + chunkBegin;
+      jsonSize = chunkLength;
+    } else if (chunkType == binChunkType && !binChunk.data) {
+      binChunk.data = bytes + chunkBegin;
+      binChunk.size = chunkLength;
+    }
+    offset = chunkBegin + ((chunkLength + 3) & ~size_t(3));
+  }
+
+  if (!jsonData) {
+    err += "Missing JSON chunk in glTF binary.\n";
+    return false;
+  }
+  return true;
+}
+
+// ioPool, when not null, reads external files concurrently
+bool loadGltfMapped(const fs::path &path, const GltfLoaderOptions &options,
+    ThreadPool *ioPool, tinygltf::Model &model, GltfBuffers &buffers,
+    std::string &err, std::string &warn)
+{
+  GltfBuffers result;
+
+  MappedFile file;
+  try {
+    file = MappedFile(path);
+  } catch (const std::runtime_error &e) {
+    err += std::string(e.what()) + "\n";
+    return false;
+  }
+
+  const char *jsonData = (const char *)file.data();
+  size_t jsonSize = file.size();
+  BufferBytes binChunk;
+  if (isGlbPath(path)) {
+    jsonData = nullptr;
+    if (!parseGlbChunks(file, jsonData, jsonSize, binChunk, err)) {
+      return false;
+    }
+  }
+
+  json document;
+  try {
+    document = json::parse(jsonData, jsonData + jsonSize);
+  } catch (const std::exception &e) {
+    err += std::string("JSON parsing error: ") + e.what() + "\n";
+    return false;
+  }
+
+  // Replace each mappable buffer by a placeholder and remember where its
+  // bytes live
+  const auto baseDir = path.parent_path();
+  MappedLoadState state;
+  std::vector<std::string> bufferUris;
+
+  const auto jsonBuffers = document.find("buffers");
+  if (jsonBuffers != document.end()) {
+    for (size_t i = 0; i < jsonBuffers->size(); ++i) {
+      auto &jsonBuffer = (*jsonBuffers)[i];
+      const auto uri = jsonBuffer.value("uri", std::string());
+      const auto byteLength = jsonBuffer.value("byteLength", size_t(0));
+      bufferUris.emplace_back(uri);
+
+      BufferBytes bytes;
+      if (uri.empty()) {
+        if (!binChunk.data || binChunk.size < byteLength) {
+          err += "Buffer " + std::to_string(i) +
+                 " references a missing or too small BIN chunk.\n";
+          return false;
+        }
+        bytes = {binChunk.data, byteLength};
+      } else if (uri.compare(0, 5, "data:") == 0) {
+        // Base64 buffers must be decoded anyway, let tinygltf do it
+        state.buffers.emplace_back();
+        continue;
+      } else {
+        try {
+          MappedFile mappedFile(baseDir / uri);
+          if (mappedFile.size() < byteLength) {
+            err += "File size mismatch for buffer " + uri + "\n";
+            return false;
+          }
+          bytes = {mappedFile.data(), byteLength};
+          result.mappedFiles.emplace_back(std::move(mappedFile));
+        } catch (const std::runtime_error &e) {
+          err += std::string(e.what()) + "\n";
+          return false;
+        }
+      }
+
+      state.buffers.emplace_back(bytes);
+      jsonBuffer["uri"] = mappedBufferUri + std::to_string(i);
+      jsonBuffer["byteLength"] = 1;
+    }
+  }
+
+  // tinygltf decodes images stored in buffer views by reading the buffer
+  // data, which is now a placeholder: route them through the FS callbacks
+  std::vector<int> imageBufferViews;
+  std::vector<std::string> imageMimeTypes;
+  const auto jsonImages = document.find("images");
+  if (ioPool && jsonImages != document.end()) {
+    std::vector<std::string> imageUris;
+    for (const auto &jsonImage : *jsonImages) {
+      imageUris.emplace_back(jsonImage.value("uri", std::string()));
+    }
+    state.prefetched = prefetchFiles(baseDir, imageUris, *ioPool);
+  }
+  const auto jsonBufferViews = document.find("bufferViews");
+  if (jsonImages != document.end() && jsonBufferViews != document.end()) {
+    state.images.resize(jsonImages->size());
+    imageBufferViews.resize(jsonImages->size(), -1);
+    imageMimeTypes.resize(jsonImages->size());
+    for (size_t i = 0; i < jsonImages->size(); ++i) {
+      auto &jsonImage = (*jsonImages)[i];
+      const auto viewIdx = jsonImage.value("bufferView", -1);
+      if (viewIdx < 0 || size_t(viewIdx) >= jsonBufferViews->size()) {
+        continue; // tinygltf reports invalid indices
+      }
+      const auto &jsonView = (*jsonBufferViews)[viewIdx];
+      const auto bufferIdx = jsonView.value("buffer", size_t(0));
+      if (bufferIdx >= state.buffers.size() ||
+          !state.buffers[bufferIdx].data) {
+        continue;
+      }
+      const auto byteOffset = jsonView.value("byteOffset", size_t(0));
+      const auto byteLength = jsonView.value("byteLength", size_t(0));
+      if (byteOffset + byteLength > state.buffers[bufferIdx].size) {
+        err += "Buffer view " + std::to_string(viewIdx) +
+               " of image " + std::to_string(i) + " is out of range.\n";
+        return false;
+      }
+
+      state.images[i] = {state.buffers[bufferIdx].data + byteOffset,
+          byteLength};
+      imageBufferViews[i] = viewIdx;
+      imageMimeTypes[i] = jsonImage.value("mimeType", std::string());
+      jsonImage.erase("bufferView");
+      jsonImage["uri"] = mappedImageUri + std::to_string(i);
+    }
+  }
+
+  tinygltf::TinyGLTF loader;
+  setupLoader(loader, options);
+  loader.SetFsCallbacks({&mappedFileExists, &mappedExpandFilePath,
+      &mappedReadWholeFile, &tinygltf::WriteWholeFile, &state});
+
+  const auto rewrittenJson = document.dump();
+  if (!loader.LoadASCIIFromString(&model, &err, &warn, rewrittenJson.c_str(),
+          (unsigned int)rewrittenJson.size(), baseDir.string())) {
+    return false;
+  }
+
+  // Undo the placeholders so the model looks as if it was loaded normally,
+  // except for empty data of mapped buffers
+  for (size_t i = 0; i < model.buffers.size(); ++i) {
+    auto &buffer = model.buffers[i];
+    const auto &mapped = state.buffers[i];
+    if (mapped.data) {
+      buffer.uri = bufferUris[i];
+      buffer.data = std::vector<unsigned char>();
+      result.bytes.emplace_back(mapped);
+    } else {
+      result.bytes.push_back({buffer.data.data(), buffer.data.size()});
+    }
+  }
+  for (size_t i = 0; i < imageBufferViews.size(); ++i) {
+    if (imageBufferViews[i] >= 0) {
+      model.images[i].uri.clear();
+      model.images[i].bufferView = imageBufferViews[i];
+      model.images[i].mimeType = imageMimeTypes[i];
+    }
+  }
+
+  if (binChunk.data) {
+    result.mappedFiles.emplace_back(std::move(file));
+  }
+  buffers = std::move(result);
+
+  return true;
+}
+
+// Same as tinygltf, but the JSON is parsed by parseGltfJson() and mapped
+// buffers are used in place instead of being placeholders in the document
+bool loadGltfFast(const fs::path &path, const GltfLoaderOptions &options,
+    ThreadPool *ioPool, tinygltf::Model &model, GltfBuffers &buffers,
+    std::string &err, std::string &warn)
+{
+  MappedFile file;
+  try {
+    file = MappedFile(path);
+  } catch (const std::runtime_error &e) {
+    err += std::string(e.what()) + "\n";
+    return false;
+  }
+
+  const char *jsonData = (const char *)file.data();
+  size_t jsonSize = file.size();
+  BufferBytes binChunk;
+  if (isGlbPath(path)) {
+    jsonData = nullptr;
+    if (!parseGlbChunks(file, jsonData, jsonSize, binChunk, err)) {
+      return false;
+    }
+  }
+
+  std::vector<size_t> byteLengths;
+  if (!parseGltfJson(jsonData, jsonSize, model, byteLengths, err, warn)) {
+    return false;
+  }
+
+  const auto baseDir = path.parent_path();
+  GltfBuffers result;
+  bool binChunkMapped = false;
+
+  // With ioPool, external files that are not mapped are all read at once
+  // below, instead of one after the other in these loops
+  struct ExternalFile
+  {
+    bool isBuffer;
+    size_t index; // In model.buffers or model.images
+  };
+  std::vector<ExternalFile> externalFiles;
+  std::vector<fs::path> externalPaths;
+
+  for (size_t i = 0; i < model.buffers.size(); ++i) {
+    auto &buffer = model.buffers[i];
+    const auto byteLength = byteLengths[i];
+    BufferBytes bytes;
+    if (buffer.uri.empty()) {
+      if (!binChunk.data || binChunk.size < byteLength) {
+        err += "Buffer " + std::to_string(i) +
+               " references a missing or too small BIN chunk.\n";
+        return false;
+      }
+      if (options.mmapBuffers) {
+        bytes = {binChunk.data, byteLength};
+        binChunkMapped = true;
+      } else {
+        buffer.data.assign(binChunk.data, binChunk.data + byteLength);
+      }
+    } else if (tinygltf::IsDataURI(buffer.uri)) {
+      std::string mimeType;
+      if (!tinygltf::DecodeDataURI(
+              &buffer.data, mimeType, buffer.uri, byteLength, true)) {
+        err += "Failed to decode data URI of buffer " + std::to_string(i) +
+               ".\n";
+        return false;
+      }
+    } else if (ioPool && !options.mmapBuffers) {
+      externalFiles.push_back({true, i});
+      externalPaths.emplace_back(baseDir / buffer.uri);
+    } else {
+      try {
+        MappedFile mappedFile(baseDir / buffer.uri);
+        if (mappedFile.size() < byteLength) {
+          err += "File size mismatch for buffer " + buffer.uri + "\n";
+          return false;
+        }
+        if (options.mmapBuffers) {
+          bytes = {mappedFile.data(), byteLength};
+          result.mappedFiles.emplace_back(std::move(mappedFile));
+        } else {
+          buffer.data.assign(mappedFile.data(), mappedFile.data() + byteLength);
+        }
+      } catch (const std::runtime_error &e) {
+        err += std::string(e.what()) + "\n";
+        return false;
+      }
+    }
+    result.bytes.emplace_back(bytes);
+  }
+
+  const auto isExternalImage = [&](const tinygltf::Image &image) {
+    return ioPool && image.bufferView < 0 &&
+           !tinygltf::IsDataURI(image.uri);
+  };
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (isExternalImage(model.images[i])) {
+      externalFiles.push_back({false, i});
+      externalPaths.emplace_back(baseDir / model.images[i].uri);
+    }
+  }
+
+  // Decode, or keep encoded for decodeImages()
+  const auto loadImage = [&](size_t imageIdx, const unsigned char *data,
+                             size_t size, std::string &imageErr,
+                             std::string &imageWarn) {
+    auto &image = model.images[imageIdx];
+    if (options.deferImageDecoding) {
+      return storeEncodedImage(&image, int(imageIdx), &imageErr, &imageWarn, 0,
+          0, data, int(size), nullptr);
+    }
+    return loadImageData(&image, int(imageIdx), &imageErr, &imageWarn, 0, 0,
+        data, int(size), nullptr);
+  };
+
+  if (!externalFiles.empty()) {
+    // Images are decoded by the workers as they arrive, while the remaining
+    // files are still being read
+    std::mutex mutex;
+    bool failed = false;
+    readFiles(externalPaths, *ioPool, [&](size_t fileIdx,
+                                          FileReadResult &file) {
+      const auto &externalFile = externalFiles[fileIdx];
+      std::string fileErr;
+      std::string fileWarn;
+      bool ok = file.error.empty();
+      if (!ok) {
+        fileErr = file.error + "\n";
+      } else if (externalFile.isBuffer) {
+        auto &buffer = model.buffers[externalFile.index];
+        const auto byteLength = byteLengths[externalFile.index];
+        if (file.bytes.size() < byteLength) {
+          fileErr = "File size mismatch for buffer " + buffer.uri + "\n";
+          ok = false;
+        } else {
+          file.bytes.resize(byteLength);
+          buffer.data = std::move(file.bytes);
+        }
+      } else {
+        ok = loadImage(externalFile.index, file.bytes.data(),
+            file.bytes.size(), fileErr, fileWarn);
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      err += fileErr;
+      warn += fileWarn;
+      failed = failed || !ok;
+    });
+    if (failed) {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < model.buffers.size(); ++i) {
+    if (!result.bytes[i].data) {
+      const auto &data = model.buffers[i].data;
+      result.bytes[i] = {data.data(), data.size()};
+    }
+  }
+
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    auto &image = model.images[i];
+    if (isExternalImage(image)) {
+      continue; // Already loaded
+    }
+    std::vector<unsigned char> encoded;
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    if (image.bufferView >= 0) {
+      const auto &bufferView = model.bufferViews[image.bufferView];
+      const auto &bytes = result.bytes[bufferView.buffer];
+      if (bufferView.byteOffset + bufferView.byteLength > bytes.size) {
+        err += "Buffer view " + std::to_string(image.bufferView) +
+               " of image " + std::to_string(i) + " is out of range.\n";
+        return false;
+      }
+      data = bytes.data + bufferView.byteOffset;
+      size = bufferView.byteLength;
+    } else {
+      if (tinygltf::IsDataURI(image.uri)) {
+        std::string mimeType;
+        if (!tinygltf::DecodeDataURI(&encoded, mimeType, image.uri, 0, false)) {
+          err += "Failed to decode data URI of image " + std::to_string(i) +
+                 ".\n";
+          return false;
+        }
+      } else if (!tinygltf::ReadWholeFile(
+                     &encoded, &err, (baseDir / image.uri).string(), nullptr)) {
+        return false;
+      }
+      data = encoded.data();
+      size = encoded.size();
+    }
+
+    if (!loadImage(i, data, size, err, warn)) {
+      return false;
+    }
+  }
+
+  if (binChunkMapped) {
+    result.mappedFiles.emplace_back(std::move(file));
+  }
+  buffers = std::move(result);
+
+  return true;
+}
+
+// Same as tinygltf, with the external files read ahead concurrently
+bool loadGltfPrefetched(const fs::path &path, const GltfLoaderOptions &options,
+    ThreadPool &ioPool, tinygltf::Model &model, std::string &err,
+    std::string &warn)
+{
+  MappedFile file;
+  try {
+    file = MappedFile(path);
+  } catch (const std::runtime_error &e) {
+    err += std::string(e.what()) + "\n";
+    return false;
+  }
+
+  const char *jsonData = (const char *)file.data();
+  size_t jsonSize = file.size();
+  BufferBytes binChunk;
+  const auto isGlb = isGlbPath(path);
+  if (isGlb) {
+    jsonData = nullptr;
+    if (!parseGlbChunks(file, jsonData, jsonSize, binChunk, err)) {
+      return false;
+    }
+  }
+
+  std::vector<std::string> uris;
+  std::vector<std::string> imageUris;
+  if (!listGltfUris(jsonData, jsonSize, uris, imageUris, err)) {
+    return false;
+  }
+  uris.insert(end(uris), begin(imageUris), end(imageUris));
+
+  const auto baseDir = path.parent_path();
+  auto prefetched = prefetchFiles(baseDir, uris, ioPool);
+
+  tinygltf::TinyGLTF loader;
+  setupLoader(loader, options);
+  loader.SetFsCallbacks({&prefetchedFileExists, &prefetchedExpandFilePath,
+      &prefetchedReadWholeFile, &tinygltf::WriteWholeFile, &prefetched});
+  return isGlb ? loader.LoadBinaryFromMemory(&model, &err, &warn, file.data(),
+                     (unsigned int)file.size(), baseDir.string())
+               : loader.LoadASCIIFromString(&model, &err, &warn, jsonData,
+                     (unsigned int)jsonSize, baseDir.string());
+}
+
+// Decode an image left encoded by storeEncodedImage(), in place
+void decodeImage(tinygltf::Image &image, size_t imageIdx)
+{
+  std::vector<unsigned char> encoded;
+  encoded.swap(image.image);
+  image.as_is = false;
+  std::string err;
+  std::string warn;
+  if (!loadImageData(&image, int(imageIdx), &err, &warn, 0, 0,
+          encoded.data(), int(encoded.size()), nullptr)) {
+    std::cerr << err << std::endl;
+    image.image.clear();
+  }
+}
+
+// Point textures with the KHR_texture_basisu extension to its KTX2 image when
+// it can be transcoded. Otherwise they keep their fallback source, if any.
+void resolveTextureSources(tinygltf::Model &model)
+{
+  for (auto &texture : model.textures) {
+    const auto extension = texture.extensions.find("KHR_texture_basisu");
+    if (extension == end(texture.extensions) ||
+        !extension->second.Has("source")) {
+      continue;
+    }
+    const auto source = int(extension->second.Get("source").GetNumberAsInt());
+    if (source < 0 || size_t(source) >= model.images.size()) {
+      continue;
+    }
+    if (basisTranscodingSupported() || texture.source < 0) {
+      texture.source = source;
+    }
+  }
+}
+
+} // namespace
+
+bool loadGltf(const fs::path &path, const GltfLoaderOptions &options,
+    tinygltf::Model &model, GltfBuffers &buffers, std::string &err,
+    std::string &warn, ThreadPool *pool)
+{
+  std::unique_ptr<ThreadPool> ownPool;
+  ThreadPool *ioPool = nullptr;
+  if (options.asyncFileReads) {
+    if (!pool) {
+      ownPool = std::make_unique<ThreadPool>();
+      pool = ownPool.get();
+    }
+    ioPool = pool;
+  }
+
+  bool ret;
+  if (options.fastJsonParser) {
+    ret = loadGltfFast(path, options, ioPool, model, buffers, err, warn);
+  } else if (options.mmapBuffers) {
+    ret = loadGltfMapped(path, options, ioPool, model, buffers, err, warn);
+  } else {
+    if (ioPool) {
+      ret = loadGltfPrefetched(path, options, *ioPool, model, err, warn);
+    } else {
+      tinygltf::TinyGLTF loader;
+      setupLoader(loader, options);
+      ret = isGlbPath(path)
+                ? loader.LoadBinaryFromFile(&model, &err, &warn, path.string())
+                : loader.LoadASCIIFromFile(&model, &err, &warn, path.string());
+    }
+    if (ret) {
+      buffers = GltfBuffers();
+      for (const auto &buffer : model.buffers) {
+        buffers.bytes.push_back({buffer.data.data(), buffer.data.size()});
+      }
+    }
+  }
+  if (!ret) {
+    return false;
+  }
+
+  resolveTextureSources(model);
+  return true;
+}
+
+void decodeImages(tinygltf::Model &model, ThreadPool &pool,
+    const std::function<void(size_t)> &onImageReady,
+    const std::function<void(size_t)> &onImageDecoded)
+{
+  using clock = std::chrono::steady_clock;
+  const auto start = clock::now();
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<size_t> decodedImages; // Filled by workers, drained below
+  clock::duration decodingTime{0};   // Sum of the time spent by each worker
+  // First exception thrown by a worker or onImageReady(), rethrown once all
+  // workers are done with the locals above
+  std::exception_ptr error;
+
+  // Images left encoded, found before any worker starts, since workers clear
+  // the as_is flag of the images they decode
+  std::vector<bool> encodedImages(model.images.size());
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    encodedImages[i] = model.images[i].as_is;
+  }
+
+  std::vector<size_t> loadedImages; // Decoded by tinygltf
+  size_t pendingCount = 0;
+  size_t decodedCount = 0;
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    const bool decode = encodedImages[i];
+    if (!decode && !onImageDecoded) {
+      loadedImages.push_back(i);
+      continue;
+    }
+    ++pendingCount;
+    decodedCount += decode ? 1 : 0;
+    pool.submit([&, i, decode]() {
+      // The future of the task is not kept, so exceptions are passed to the
+      // loop below, which must still count the image
+      clock::duration time{0};
+      std::exception_ptr taskError;
+      try {
+        const auto decodeStart = clock::now();
+        if (decode) {
+          decodeImage(model.images[i], i);
+        }
+        time = clock::now() - decodeStart;
+        if (onImageDecoded) {
+          onImageDecoded(i);
+        }
+      } catch (...) {
+        taskError = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      decodingTime += time;
+      if (taskError && !error) {
+        error = taskError;
+      }
+      decodedImages.push_back(i);
+      condition.notify_one();
+    });
+  }
+
+  // Images are not used anymore after an error, but workers are waited for
+  const auto useImage = [&](size_t imageIdx) {
+    try {
+      onImageReady(imageIdx);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  // Images decoded by tinygltf are ready right away, use them while the
+  // workers are busy
+  for (const auto imageIdx : loadedImages) {
+    useImage(imageIdx);
+  }
+
+  std::vector<size_t> readyImages;
+  while (pendingCount > 0) {
+    bool failed;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [&]() { return !decodedImages.empty(); });
+      readyImages.swap(decodedImages);
+      failed = bool(error);
+    }
+    for (const auto imageIdx : readyImages) {
+      if (!failed) {
+        useImage(imageIdx);
+      }
+      --pendingCount;
+    }
+    readyImages.clear();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  if (decodedCount > 0) {
+    const auto toMs = [](clock::duration d) {
+      return std::chrono::duration<double, std::milli>(d).count();
+    };
+    const auto wallTime = toMs(clock::now() - start);
+    std::clog << "Decoded " << decodedCount << " images on "
+              << pool.threadCount() << " threads in " << wallTime << " ms ("
+              << toMs(decodingTime) << " ms of decoding, "
+              << toMs(decodingTime) / wallTime << "x speedup)" << std::endl;
+  }
+}
+
+std::vector<std::future<void>> startDecodingImages(tinygltf::Model &model,
+    ThreadPool &pool, const std::function<void(size_t)> &onImageDecoded)
+{
+  std::vector<std::future<void>> futures;
+  futures.reserve(model.images.size());
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    auto &image = model.images[i];
+    if (image.as_is || onImageDecoded) {
+      futures.push_back(pool.submit([&image, i, onImageDecoded]() {
+        if (image.as_is) {
+          decodeImage(image, i);
+        }
+        if (onImageDecoded) {
+          onImageDecoded(i);
+        }
+      }));
+    } else {
+      std::promise<void> ready;
+      ready.set_value();
+      futures.push_back(ready.get_future());
+    }
+  }
+  return futures;
+}
+
+void releaseBulkData(tinygltf::Model &model)
+{
+  // clear() keeps the capacity, swapping with an empty vector frees it
+  for (auto &buffer : model.buffers) {
+    std::vector<unsigned char>().swap(buffer.data);
+  }
+  for (auto &image : model.images) {
+    std::vector<unsigned char>().swap(image.image);
+  }
+}
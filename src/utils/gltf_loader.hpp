@@ -0,0 +1,71 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gltf.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+#include <functional>
+#include <future>
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+struct GltfLoaderOptions
+{
+  // Map the BIN chunk of a .glb and external .bin files instead of reading
+  // them into tinygltf::Buffer::data
+  bool mmapBuffers = false;
+  // Keep images encoded while parsing (tinygltf::Image::as_is) so that they
+  // can be decoded in parallel by decodeImages()
+  bool deferImageDecoding = false;
+  // Parse the JSON with parseGltfJson() instead of tinygltf (see
+  // gltf_json.hpp for what is left out)
+  bool fastJsonParser = false;
+  // Read all external buffers and images concurrently with readFiles() (see
+  // async_file_io.hpp) instead of one after the other. With fastJsonParser,
+  // images are also decoded as soon as their file is read.
+  bool asyncFileReads = false;
+};
+
+// Bytes of all buffers of a loaded model. When buffers are mapped,
+// tinygltf::Buffer::data is left empty and bytes point inside mappedFiles,
+// which must then outlive any use of bytes.
+struct GltfBuffers
+{
+  std::vector<BufferBytes> bytes; // One element per model.buffers element
+  std::vector<MappedFile> mappedFiles;
+};
+
+// Load a .gltf or a .glb file (chosen from the file extension). pool runs the
+// reads of GltfLoaderOptions::asyncFileReads, a temporary one is created if
+// it is null.
+bool loadGltf(const fs::path &path, const GltfLoaderOptions &options,
+    tinygltf::Model &model, GltfBuffers &buffers, std::string &err,
+    std::string &warn, ThreadPool *pool = nullptr);
+
+// Decode the images left encoded by GltfLoaderOptions::deferImageDecoding on
+// the threads of pool. onImageReady(imageIdx) is called on the calling thread
+// for every image of model, in completion order, as soon as it can be used.
+// onImageDecoded(imageIdx), if given, is called on a worker thread for every
+// image, right after decoding for those left encoded, before onImageReady.
+// Images that fail to decode are left empty. Once all workers are done, the
+// first exception thrown by a callback or a worker is rethrown, and no image
+// is passed to onImageReady after it.
+void decodeImages(tinygltf::Model &model, ThreadPool &pool,
+    const std::function<void(size_t)> &onImageReady,
+    const std::function<void(size_t)> &onImageDecoded = nullptr);
+
+// Same as decodeImages() without waiting: the returned futures, one per image
+// of model, become ready when the corresponding image can be used. model must
+// not be modified until they are all ready. An exception thrown while decoding
+// an image or by onImageDecoded is stored in the future of the image, and
+// rethrown by its get(): the image must not be used then.
+std::vector<std::future<void>> startDecodingImages(tinygltf::Model &model,
+    ThreadPool &pool,
+    const std::function<void(size_t)> &onImageDecoded = nullptr);
+
+// Free the data of model.buffers and the pixels of model.images, keeping
+// everything else (accessors, materials, image sizes...). Used once they are
+// uploaded to the GPU.
+void releaseBulkData(tinygltf::Model &model);
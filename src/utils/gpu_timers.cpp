@@ -0,0 +1,84 @@
+#include "gpu_timers.hpp"
+
+#include <cassert>
+
+namespace
+{
+
+// Weight of the last frame in recentMs
+const double recentWeight = 0.05;
+
+} // namespace
+
+GpuPassTimers::GpuPassTimers(std::vector<std::string> passNames)
+{
+  m_passes.resize(passNames.size());
+  for (size_t i = 0; i < passNames.size(); ++i) {
+    auto &pass = m_passes[i];
+    pass.name = std::move(passNames[i]);
+    glGenQueries(GLsizei(frameLatency), pass.queries);
+    for (auto &pending : pass.pending) {
+      pending = false;
+    }
+  }
+}
+
+GpuPassTimers::~GpuPassTimers()
+{
+  for (auto &pass : m_passes) {
+    glDeleteQueries(GLsizei(frameLatency), pass.queries);
+  }
+}
+
+void GpuPassTimers::beginFrame()
+{
+  assert(m_nActivePass == SIZE_MAX);
+  m_nFrame = (m_nFrame + 1) % frameLatency;
+
+  // Queries of the frame issued frameLatency frames ago are reused: read them
+  // first. Their result is almost always available by now, waiting for it
+  // otherwise keeps measurements complete.
+  for (auto &pass : m_passes) {
+    if (!pass.pending[m_nFrame]) {
+      continue;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(
+        pass.queries[m_nFrame], GL_QUERY_RESULT, &nanoseconds);
+    pass.pending[m_nFrame] = false;
+
+    const auto ms = nanoseconds / 1e6;
+    pass.recentMs = pass.frameCount == 0 ? ms
+                                         : (1 - recentWeight) * pass.recentMs +
+                                               recentWeight * ms;
+    pass.totalMs += ms;
+    ++pass.frameCount;
+  }
+}
+
+void GpuPassTimers::begin(size_t pass)
+{
+  assert(m_nActivePass == SIZE_MAX && pass < m_passes.size());
+  // A pass running twice in a frame only measures its first run
+  if (m_passes[pass].pending[m_nFrame]) {
+    return;
+  }
+  glBeginQuery(GL_TIME_ELAPSED, m_passes[pass].queries[m_nFrame]);
+  m_passes[pass].pending[m_nFrame] = true;
+  m_nActivePass = pass;
+}
+
+void GpuPassTimers::end()
+{
+  if (m_nActivePass != SIZE_MAX) {
+    glEndQuery(GL_TIME_ELAPSED);
+    m_nActivePass = SIZE_MAX;
+  }
+}
+
+double GpuPassTimers::averageMs(size_t pass) const
+{
+  const auto &timedPass = m_passes[pass];
+  return timedPass.frameCount == 0 ? 0
+                                   : timedPass.totalMs / timedPass.frameCount;
+}
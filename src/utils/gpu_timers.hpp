@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+// GPU time of each render pass of a frame, measured with GL_TIME_ELAPSED
+// queries. Results are read several frames later, when the GPU is done with
+// them, so that measuring never stalls the CPU.
+//
+// Passes cannot overlap: begin() and end() must alternate. All member
+// functions must be called on the thread owning the GL context.
+class GpuPassTimers
+{
+public:
+  explicit GpuPassTimers(std::vector<std::string> passNames);
+
+  ~GpuPassTimers();
+
+  GpuPassTimers(const GpuPassTimers &) = delete;
+
+  GpuPassTimers &operator=(const GpuPassTimers &) = delete;
+
+  size_t passCount() const { return m_passes.size(); }
+
+  const std::string &passName(size_t pass) const
+  {
+    return m_passes[pass].name;
+  }
+
+  // Called once per frame, before its first pass
+  void beginFrame();
+
+  void begin(size_t pass);
+
+  void end();
+
+  // Average GPU time of pass over the last frames it ran in, 0 if it never
+  // ran
+  double recentMs(size_t pass) const { return m_passes[pass].recentMs; }
+
+  // Average GPU time of pass over all frames it ran in
+  double averageMs(size_t pass) const;
+
+  // Frames pass ran in, with a result read back
+  uint64_t frameCount(size_t pass) const
+  {
+    return m_passes[pass].frameCount;
+  }
+
+private:
+  // Frames in flight before the results of a frame are read
+  static const size_t frameLatency = 4;
+
+  struct Pass
+  {
+    std::string name;
+    GLuint queries[frameLatency];
+    bool pending[frameLatency]; // The query of the frame awaits its result
+    double recentMs = 0;
+    double totalMs = 0;
+    uint64_t frameCount = 0;
+  };
+
+  std::vector<Pass> m_passes;
+  size_t m_nFrame = 0;             // Index of the current frame in queries
+  size_t m_nActivePass = SIZE_MAX; // Between begin() and end()
+};
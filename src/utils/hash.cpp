@@ -0,0 +1,20 @@
+#include "hash.hpp"
+
+#include <cstring>
+
+uint64_t hashBytes(const unsigned char *data, size_t size)
+{
+  const uint64_t prime = 1099511628211ull;
+  uint64_t hash = 14695981039346656037ull;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ data[i]) * prime;
+  }
+  return hash ^ size;
+}
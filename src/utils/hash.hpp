@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, consuming 8 bytes at a time. Used to key cache files on content,
+// not suited to hash tables (words are not mixed enough).
+uint64_t hashBytes(const unsigned char *data, size_t size);
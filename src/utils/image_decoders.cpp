@@ -0,0 +1,464 @@
+#include "image_decoders.hpp"
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <stb_image.h>
+
+#ifdef GLTF_VIEWER_USE_LIBPNG
+#include <png.h>
+#endif
+
+#ifdef GLTF_VIEWER_USE_LIBJPEG
+#include <jpeglib.h>
+#endif
+
+namespace
+{
+
+// libpng and libjpeg report errors with longjmp, which skips destructors:
+// the functions calling setjmp below only have trivially destructible locals,
+// and C++ objects are allocated by their callers.
+
+class StbImageDecoder : public ImageDecoder
+{
+public:
+  const char *name() const override { return "stb_image"; }
+
+  bool supports(ImageFormat) const override { return true; }
+
+  bool decode(const unsigned char *bytes, size_t size, DecodedImage &image,
+      std::string &err) const override
+  {
+    int width = 0, height = 0, channels = 0;
+    int bits = 8;
+    unsigned char *data = nullptr;
+    if (stbi_is_16_bit_from_memory(bytes, int(size))) {
+      data = (unsigned char *)stbi_load_16_from_memory(
+          bytes, int(size), &width, &height, &channels, 4);
+      bits = 16;
+    }
+    if (!data) {
+      data = stbi_load_from_memory(
+          bytes, int(size), &width, &height, &channels, 4);
+      bits = 8;
+    }
+    if (!data) {
+      err = "stb_image cannot decode the image";
+      return false;
+    }
+
+    image.width = width;
+    image.height = height;
+    image.bits = bits;
+    image.pixels.assign(data, data + size_t(width) * height * 4 * (bits / 8));
+    stbi_image_free(data);
+    return true;
+  }
+};
+
+#ifdef GLTF_VIEWER_USE_LIBPNG
+
+bool isLittleEndian()
+{
+  const uint16_t one = 1;
+  return *(const unsigned char *)&one == 1;
+}
+
+struct PngReadState
+{
+  const unsigned char *bytes;
+  size_t size;
+  size_t offset;
+  char message[256];
+};
+
+void pngRead(png_structp png, png_bytep out, png_size_t length)
+{
+  auto &state = *(PngReadState *)png_get_io_ptr(png);
+  if (length > state.size - state.offset) {
+    png_error(png, "truncated PNG data");
+  }
+  std::memcpy(out, state.bytes + state.offset, length);
+  state.offset += length;
+}
+
+void pngError(png_structp png, png_const_charp message)
+{
+  auto &state = *(PngReadState *)png_get_error_ptr(png);
+  std::snprintf(state.message, sizeof(state.message), "%s", message);
+  std::longjmp(png_jmpbuf(png), 1);
+}
+
+void pngWarning(png_structp, png_const_charp) {}
+
+// Setup the transforms producing 4 channels of 8 or 16 bits, like stb_image
+// does. Gamma is left untouched, as stb_image ignores it too.
+bool readPngHeader(png_structp png, png_infop info, png_uint_32 &width,
+    png_uint_32 &height, int &bitDepth)
+{
+  if (setjmp(png_jmpbuf(png))) {
+    return false;
+  }
+  png_read_info(png, info);
+
+  int colorType;
+  png_get_IHDR(png, info, &width, &height, &bitDepth, &colorType, nullptr,
+      nullptr, nullptr);
+  const auto hasTransparency = png_get_valid(png, info, PNG_INFO_tRNS) != 0;
+  if (colorType == PNG_COLOR_TYPE_PALETTE) {
+    png_set_palette_to_rgb(png);
+  }
+  if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8) {
+    png_set_expand_gray_1_2_4_to_8(png);
+  }
+  if (hasTransparency) {
+    png_set_tRNS_to_alpha(png);
+  }
+  if (colorType == PNG_COLOR_TYPE_GRAY ||
+      colorType == PNG_COLOR_TYPE_GRAY_ALPHA) {
+    png_set_gray_to_rgb(png);
+  }
+  if (!(colorType & PNG_COLOR_MASK_ALPHA) && !hasTransparency) {
+    png_set_add_alpha(png, bitDepth == 16 ? 0xffff : 0xff, PNG_FILLER_AFTER);
+  }
+  if (bitDepth == 16 && isLittleEndian()) {
+    png_set_swap(png); // PNG stores 16 bit samples big endian
+  }
+  png_set_interlace_handling(png);
+  png_read_update_info(png, info);
+
+  bitDepth = png_get_bit_depth(png, info);
+  return png_get_channels(png, info) == 4 &&
+         png_get_rowbytes(png, info) == size_t(width) * 4 * (bitDepth / 8);
+}
+
+bool readPngRows(png_structp png, png_bytepp rows)
+{
+  if (setjmp(png_jmpbuf(png))) {
+    return false;
+  }
+  png_read_image(png, rows);
+  png_read_end(png, nullptr);
+  return true;
+}
+
+// libpng unfilters rows with SSE2/NEON when built with them
+class LibpngDecoder : public ImageDecoder
+{
+public:
+  const char *name() const override { return "libpng"; }
+
+  bool supports(ImageFormat format) const override
+  {
+    return format == ImageFormat::Png;
+  }
+
+  bool decode(const unsigned char *bytes, size_t size, DecodedImage &image,
+      std::string &err) const override
+  {
+    PngReadState state{bytes, size, 0, "invalid PNG header"};
+    auto png = png_create_read_struct(
+        PNG_LIBPNG_VER_STRING, &state, &pngError, &pngWarning);
+    if (!png) {
+      err = "libpng initialization failed";
+      return false;
+    }
+    auto info = png_create_info_struct(png);
+    if (!info) {
+      png_destroy_read_struct(&png, nullptr, nullptr);
+      err = "libpng initialization failed";
+      return false;
+    }
+    png_set_read_fn(png, &state, &pngRead);
+
+    png_uint_32 width = 0, height = 0;
+    int bitDepth = 0;
+    auto ok = readPngHeader(png, info, width, height, bitDepth);
+    if (ok) {
+      const auto rowSize = size_t(width) * 4 * (bitDepth / 8);
+      image.pixels.resize(rowSize * height);
+      std::vector<png_bytep> rows(height);
+      for (png_uint_32 y = 0; y < height; ++y) {
+        rows[y] = image.pixels.data() + y * rowSize;
+      }
+      ok = readPngRows(png, rows.data());
+    }
+    png_destroy_read_struct(&png, &info, nullptr);
+
+    if (!ok) {
+      image.pixels.clear();
+      err = std::string("libpng: ") + state.message;
+      return false;
+    }
+    image.width = int(width);
+    image.height = int(height);
+    image.bits = bitDepth;
+    return true;
+  }
+};
+
+#endif
+
+#ifdef GLTF_VIEWER_USE_LIBJPEG
+
+struct JpegErrorManager
+{
+  jpeg_error_mgr base; // First, libjpeg sees a jpeg_error_mgr
+  std::jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+};
+
+void jpegErrorExit(j_common_ptr info)
+{
+  auto &error = *(JpegErrorManager *)info->err;
+  info->err->format_message(info, error.message);
+  std::longjmp(error.jump, 1);
+}
+
+void jpegOutputMessage(j_common_ptr) {}
+
+bool readJpegHeader(jpeg_decompress_struct &info, JpegErrorManager &error,
+    const unsigned char *bytes, size_t size)
+{
+  if (setjmp(error.jump)) {
+    return false;
+  }
+  jpeg_mem_src(&info, (unsigned char *)bytes, (unsigned long)size);
+  jpeg_read_header(&info, TRUE);
+  if (info.jpeg_color_space == JCS_CMYK ||
+      info.jpeg_color_space == JCS_YCCK) {
+    std::snprintf(error.message, sizeof(error.message),
+        "CMYK images are left to stb_image");
+    return false;
+  }
+#ifdef JCS_EXTENSIONS
+  // libjpeg-turbo converts to RGBA in its SIMD color conversion
+  info.out_color_space = JCS_EXT_RGBA;
+#else
+  info.out_color_space = JCS_RGB;
+#endif
+  jpeg_start_decompress(&info);
+  return true;
+}
+
+bool readJpegRows(
+    jpeg_decompress_struct &info, JpegErrorManager &error, JSAMPROW *rows)
+{
+  if (setjmp(error.jump)) {
+    return false;
+  }
+  while (info.output_scanline < info.output_height) {
+    jpeg_read_scanlines(&info, rows + info.output_scanline,
+        info.output_height - info.output_scanline);
+  }
+  jpeg_finish_decompress(&info);
+  return true;
+}
+
+class LibjpegDecoder : public ImageDecoder
+{
+public:
+  const char *name() const override
+  {
+#ifdef LIBJPEG_TURBO_VERSION
+    return "libjpeg-turbo";
+#else
+    return "libjpeg";
+#endif
+  }
+
+  bool supports(ImageFormat format) const override
+  {
+    return format == ImageFormat::Jpeg;
+  }
+
+  bool decode(const unsigned char *bytes, size_t size, DecodedImage &image,
+      std::string &err) const override
+  {
+    jpeg_decompress_struct info;
+    JpegErrorManager error;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = &jpegErrorExit;
+    error.base.output_message = &jpegOutputMessage;
+    jpeg_create_decompress(&info);
+
+    auto ok = readJpegHeader(info, error, bytes, size);
+    if (ok) {
+      const auto width = size_t(info.output_width);
+      const auto height = size_t(info.output_height);
+      image.pixels.resize(width * height * 4);
+      std::vector<JSAMPROW> rows(height);
+      for (size_t y = 0; y < height; ++y) {
+        rows[y] = image.pixels.data() + y * width * 4;
+      }
+      ok = readJpegRows(info, error, rows.data());
+#ifndef JCS_EXTENSIONS
+      // Rows hold RGB pixels at their start, expand them backwards in place
+      for (size_t y = 0; ok && y < height; ++y) {
+        auto row = rows[y];
+        for (size_t x = width; x-- > 0;) {
+          row[4 * x + 3] = 255;
+          row[4 * x + 2] = row[3 * x + 2];
+          row[4 * x + 1] = row[3 * x + 1];
+          row[4 * x] = row[3 * x];
+        }
+      }
+#endif
+      image.width = int(width);
+      image.height = int(height);
+      image.bits = 8;
+    }
+    jpeg_destroy_decompress(&info);
+
+    if (!ok) {
+      image.pixels.clear();
+      err = std::string(name()) + ": " + error.message;
+      return false;
+    }
+    return true;
+  }
+};
+
+#endif
+
+} // namespace
+
+ImageFormat detectImageFormat(const unsigned char *bytes, size_t size)
+{
+  const unsigned char png[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  const unsigned char jpeg[] = {0xFF, 0xD8, 0xFF};
+  if (size >= sizeof(png) && std::memcmp(bytes, png, sizeof(png)) == 0) {
+    return ImageFormat::Png;
+  }
+  if (size >= sizeof(jpeg) && std::memcmp(bytes, jpeg, sizeof(jpeg)) == 0) {
+    return ImageFormat::Jpeg;
+  }
+  return ImageFormat::Unknown;
+}
+
+const char *imageFormatName(ImageFormat format)
+{
+  switch (format) {
+  case ImageFormat::Png:
+    return "PNG";
+  case ImageFormat::Jpeg:
+    return "JPEG";
+  default:
+    return "other";
+  }
+}
+
+const std::vector<const ImageDecoder *> &imageDecoders()
+{
+#ifdef GLTF_VIEWER_USE_LIBJPEG
+  static const LibjpegDecoder libjpeg;
+#endif
+#ifdef GLTF_VIEWER_USE_LIBPNG
+  static const LibpngDecoder libpng;
+#endif
+  static const StbImageDecoder stb;
+  static const std::vector<const ImageDecoder *> decoders = {
+#ifdef GLTF_VIEWER_USE_LIBJPEG
+      &libjpeg,
+#endif
+#ifdef GLTF_VIEWER_USE_LIBPNG
+      &libpng,
+#endif
+      &stb};
+  return decoders;
+}
+
+bool decodeImage(const unsigned char *bytes, size_t size, DecodedImage &image,
+    std::string &err)
+{
+  const auto format = detectImageFormat(bytes, size);
+  std::string errors;
+  for (const auto decoder : imageDecoders()) {
+    if (!decoder->supports(format)) {
+      continue;
+    }
+    std::string decoderErr;
+    if (decoder->decode(bytes, size, image, decoderErr)) {
+      return true;
+    }
+    errors += (errors.empty() ? "" : ", ") + decoderErr;
+  }
+  err = errors;
+  return false;
+}
+
+bool readImageSize(
+    const unsigned char *bytes, size_t size, int &width, int &height)
+{
+  if (isKtx2(bytes, size)) {
+    Ktx2Info info;
+    std::string err;
+    if (!readKtx2Info(bytes, size, info, err)) {
+      return false;
+    }
+    width = info.width;
+    height = info.height;
+    return true;
+  }
+  int components = 0;
+  return stbi_info_from_memory(bytes, int(size), &width, &height,
+             &components) != 0;
+}
+
+bool loadImageData(tinygltf::Image *image, const int imageIdx,
+    std::string *err, std::string *, int reqWidth, int reqHeight,
+    const unsigned char *bytes, int size, void *)
+{
+  const auto fail = [&](const std::string &message) {
+    if (err) {
+      *err += message + " for image[" + std::to_string(imageIdx) +
+              "] name = \"" + image->name + "\".\n";
+    }
+    return false;
+  };
+
+  // KTX2 containers are kept as they are, to be transcoded to a GPU format
+  // (see transcodeKtx2()) instead of decoded to pixels
+  if (isKtx2(bytes, size_t(size))) {
+    Ktx2Info info;
+    std::string ktx2Err;
+    if (!readKtx2Info(bytes, size_t(size), info, ktx2Err)) {
+      return fail(ktx2Err);
+    }
+    image->width = info.width;
+    image->height = info.height;
+    image->component = 4;
+    image->bits = 8;
+    image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    image->image.assign(bytes, bytes + size);
+    return true;
+  }
+
+  DecodedImage decoded;
+  std::string decodeErr;
+  if (!decodeImage(bytes, size_t(size), decoded, decodeErr)) {
+    return fail("Unable to decode image (" + decodeErr + ")");
+  }
+  if (decoded.width < 1 || decoded.height < 1) {
+    return fail("Invalid image data");
+  }
+  if ((reqWidth > 0 && reqWidth != decoded.width) ||
+      (reqHeight > 0 && reqHeight != decoded.height)) {
+    return fail("Image size mismatch");
+  }
+
+  image->width = decoded.width;
+  image->height = decoded.height;
+  image->component = 4;
+  image->bits = decoded.bits;
+  image->pixel_type = decoded.bits == 16
+                          ? TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT
+                          : TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+  image->image = std::move(decoded.pixels);
+  return true;
+}
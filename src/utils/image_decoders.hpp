@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+enum class ImageFormat
+{
+  Unknown,
+  Png,
+  Jpeg
+};
+
+// From the signature at the start of bytes
+ImageFormat detectImageFormat(const unsigned char *bytes, size_t size);
+
+const char *imageFormatName(ImageFormat format);
+
+// Decoded pixels laid out like those of tinygltf::Image: 4 channels of 8 or
+// 16 bits (in native byte order), rows from top to bottom
+struct DecodedImage
+{
+  int width = 0;
+  int height = 0;
+  int bits = 8;
+  std::vector<unsigned char> pixels;
+};
+
+// Backend decoding encoded images to DecodedImage
+class ImageDecoder
+{
+public:
+  virtual ~ImageDecoder() = default;
+
+  virtual const char *name() const = 0;
+
+  virtual bool supports(ImageFormat format) const = 0;
+
+  // Thread safe. Return false with a message in err on failure, including for
+  // variants of the format the backend leaves to another one.
+  virtual bool decode(const unsigned char *bytes, size_t size,
+      DecodedImage &image, std::string &err) const = 0;
+};
+
+// Decoders compiled in, preferred first. The last one is stb_image, which
+// supports every format (Unknown included, for the formats stb_image detects
+// itself).
+const std::vector<const ImageDecoder *> &imageDecoders();
+
+// Decode with the first decoder supporting the format of bytes, falling back
+// to stb_image if it fails
+bool decodeImage(const unsigned char *bytes, size_t size, DecodedImage &image,
+    std::string &err);
+
+// Size of an encoded image or of a KTX2 file, read from its header without
+// decoding it
+bool readImageSize(
+    const unsigned char *bytes, size_t size, int &width, int &height);
+
+// Same as tinygltf::LoadImageData(), which always goes through stb_image, but
+// with decodeImage(). KTX2 files are not decoded: their bytes are stored in
+// image->image as they are. To be installed with TinyGLTF::SetImageLoader().
+bool loadImageData(tinygltf::Image *image, const int imageIdx,
+    std::string *err, std::string *warn, int reqWidth, int reqHeight,
+    const unsigned char *bytes, int size, void *userData);
@@ -0,0 +1,69 @@
+#include "instancing.hpp"
+
+namespace
+{
+
+// Vertex buffer binding of the instance attributes, after those the vertex
+// arrays of primitives set with glVertexAttribPointer()
+const GLuint instanceBinding = 3;
+const GLuint modelMatrixLocation = 3;  // 4 locations, one per column
+const GLuint normalMatrixLocation = 7; // 3 locations
+
+} // namespace
+
+InstanceBuffer::InstanceBuffer() { glGenBuffers(1, &m_bufferObject); }
+
+InstanceBuffer::~InstanceBuffer() { glDeleteBuffers(1, &m_bufferObject); }
+
+std::vector<std::string> InstanceBuffer::shaderDefines()
+{
+  return {"INSTANCING"};
+}
+
+void InstanceBuffer::setupVertexArray()
+{
+  for (GLuint column = 0; column < 4; ++column) {
+    const auto location = modelMatrixLocation + column;
+    glVertexAttribFormat(location, 4, GL_FLOAT, GL_FALSE,
+        GLuint(offsetof(InstanceData, modelMatrix) +
+               column * sizeof(glm::vec4)));
+    glVertexAttribBinding(location, instanceBinding);
+  }
+  for (GLuint column = 0; column < 3; ++column) {
+    const auto location = normalMatrixLocation + column;
+    glVertexAttribFormat(location, 3, GL_FLOAT, GL_FALSE,
+        GLuint(offsetof(InstanceData, normalMatrix) +
+               column * sizeof(glm::vec3)));
+    glVertexAttribBinding(location, instanceBinding);
+  }
+  glVertexBindingDivisor(instanceBinding, 1);
+}
+
+void InstanceBuffer::enableVertexArray(bool enable)
+{
+  for (GLuint location = modelMatrixLocation;
+       location < normalMatrixLocation + 3; ++location) {
+    if (enable) {
+      glEnableVertexAttribArray(location);
+    } else {
+      glDisableVertexAttribArray(location);
+    }
+  }
+}
+
+void InstanceBuffer::upload(const std::vector<InstanceData> &instances)
+{
+  // Orphan the storage read by the draws of the previous pass
+  glBindBuffer(GL_ARRAY_BUFFER, m_bufferObject);
+  glBufferData(GL_ARRAY_BUFFER,
+      GLsizeiptr(instances.size() * sizeof(InstanceData)), instances.data(),
+      GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstanceBuffer::bind(size_t firstInstance) const
+{
+  glBindVertexBuffer(instanceBinding, m_bufferObject,
+      GLintptr(firstInstance * sizeof(InstanceData)),
+      GLsizei(sizeof(InstanceData)));
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// Matrices of an instance of a primitive, read by the shaders compiled with
+// InstanceBuffer::shaderDefines() from per instance vertex attributes
+struct InstanceData
+{
+  glm::mat4 modelMatrix;
+  glm::mat3 normalMatrix; // Of modelMatrix
+};
+
+// Instances of the draws of a pass, uploaded at once, so that the nodes
+// sharing a primitive are drawn with one glDrawElementsInstanced() call
+// instead of a draw and matrix uploads each.
+//
+// All member functions must be called on the thread owning the GL context.
+class InstanceBuffer
+{
+public:
+  InstanceBuffer();
+
+  ~InstanceBuffer();
+
+  InstanceBuffer(const InstanceBuffer &) = delete;
+
+  InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+  // INSTANCING
+  static std::vector<std::string> shaderDefines();
+
+  // Set the format of the instance attributes (locations 3 to 9) of the bound
+  // vertex array, read from what bind() binds. They are left disabled.
+  static void setupVertexArray();
+
+  // Enable the instance attributes of the bound vertex array for the draws of
+  // INSTANCING programs, or disable them for the other programs, which do not
+  // bind their buffer: drawing with an enabled attribute without buffer is
+  // undefined behavior
+  static void enableVertexArray(bool enable);
+
+  // Replace the instances of the buffer
+  void upload(const std::vector<InstanceData> &instances);
+
+  // Instance 0 of the next draws is instance firstInstance of the buffer
+  void bind(size_t firstInstance) const;
+
+private:
+  GLuint m_bufferObject = 0;
+};
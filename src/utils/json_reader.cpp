@@ -0,0 +1,483 @@
+#include "json_reader.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_READER_USE_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace
+{
+
+#ifdef JSON_READER_USE_SSE2
+unsigned countTrailingZeros(unsigned mask)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return unsigned(index);
+#else
+  return unsigned(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+// First '"' or '\' in [p, end), or end. Strings are where most bytes of a
+// glTF document are (names, base64 data URIs), so they are scanned 16 bytes
+// at a time when SSE2 is available.
+const char *findQuoteOrBackslash(const char *p, const char *end)
+{
+#ifdef JSON_READER_USE_SSE2
+  const auto quote = _mm_set1_epi8('"');
+  const auto backslash = _mm_set1_epi8('\\');
+  while (end - p >= 16) {
+    const auto chunk = _mm_loadu_si128((const __m128i *)p);
+    const auto matches = _mm_or_si128(
+        _mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+    const auto mask = unsigned(_mm_movemask_epi8(matches));
+    if (mask) {
+      return p + countTrailingZeros(mask);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && *p != '"' && *p != '\\') {
+    ++p;
+  }
+  return p;
+}
+
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+bool isNumberCharacter(char c)
+{
+  return isDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' ||
+         c == 'E';
+}
+
+int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void appendUtf8(std::string &out, uint32_t codePoint)
+{
+  if (codePoint < 0x80) {
+    out += char(codePoint);
+  } else if (codePoint < 0x800) {
+    out += char(0xC0 | (codePoint >> 6));
+    out += char(0x80 | (codePoint & 0x3F));
+  } else if (codePoint < 0x10000) {
+    out += char(0xE0 | (codePoint >> 12));
+    out += char(0x80 | ((codePoint >> 6) & 0x3F));
+    out += char(0x80 | (codePoint & 0x3F));
+  } else {
+    out += char(0xF0 | (codePoint >> 18));
+    out += char(0x80 | ((codePoint >> 12) & 0x3F));
+    out += char(0x80 | ((codePoint >> 6) & 0x3F));
+    out += char(0x80 | (codePoint & 0x3F));
+  }
+}
+
+} // namespace
+
+JsonReader::JsonReader(const char *begin, const char *end) :
+    m_pBegin(begin),
+    m_pCurrent(begin),
+    m_pEnd(end)
+{
+  // UTF-8 byte order mark
+  if (m_pEnd - m_pCurrent >= 3 &&
+      std::memcmp(m_pCurrent, "\xEF\xBB\xBF", 3) == 0) {
+    m_pCurrent += 3;
+  }
+}
+
+void JsonReader::fail(const char *message) const
+{
+  throw std::runtime_error(
+      std::string(message) + " at offset " + std::to_string(offset()));
+}
+
+void JsonReader::skipWhitespace()
+{
+  while (m_pCurrent < m_pEnd &&
+         (*m_pCurrent == ' ' || *m_pCurrent == '\n' || *m_pCurrent == '\r' ||
+             *m_pCurrent == '\t')) {
+    ++m_pCurrent;
+  }
+}
+
+void JsonReader::expect(char c)
+{
+  skipWhitespace();
+  if (m_pCurrent == m_pEnd || *m_pCurrent != c) {
+    const char message[] = {'E', 'x', 'p', 'e', 'c', 't', 'e', 'd', ' ', '\'',
+        c, '\'', '\0'};
+    fail(message);
+  }
+  ++m_pCurrent;
+}
+
+JsonReader::Type JsonReader::peek()
+{
+  skipWhitespace();
+  if (m_pCurrent == m_pEnd) {
+    fail("Unexpected end of document");
+  }
+  switch (*m_pCurrent) {
+  case '{':
+    return Type::Object;
+  case '[':
+    return Type::Array;
+  case '"':
+    return Type::String;
+  case 't':
+  case 'f':
+    return Type::Bool;
+  case 'n':
+    return Type::Null;
+  default:
+    if (*m_pCurrent == '-' || isDigit(*m_pCurrent)) {
+      return Type::Number;
+    }
+    fail("Unexpected character");
+  }
+}
+
+void JsonReader::beginObject() { expect('{'); }
+
+bool JsonReader::nextMember(Key &key)
+{
+  skipWhitespace();
+  if (m_pCurrent < m_pEnd && *m_pCurrent == '}') {
+    ++m_pCurrent;
+    return false;
+  }
+  if (m_pCurrent < m_pEnd && *m_pCurrent == ',') {
+    ++m_pCurrent;
+    skipWhitespace();
+  }
+  if (m_pCurrent == m_pEnd || *m_pCurrent != '"') {
+    fail("Expected member name");
+  }
+  readStringContent(key.data, key.size);
+  expect(':');
+  return true;
+}
+
+void JsonReader::beginArray() { expect('['); }
+
+bool JsonReader::nextElement()
+{
+  skipWhitespace();
+  if (m_pCurrent < m_pEnd && *m_pCurrent == ']') {
+    ++m_pCurrent;
+    return false;
+  }
+  if (m_pCurrent < m_pEnd && *m_pCurrent == ',') {
+    ++m_pCurrent;
+  }
+  return true;
+}
+
+bool JsonReader::readBool()
+{
+  skipWhitespace();
+  if (m_pEnd - m_pCurrent >= 4 && std::memcmp(m_pCurrent, "true", 4) == 0) {
+    m_pCurrent += 4;
+    return true;
+  }
+  if (m_pEnd - m_pCurrent >= 5 && std::memcmp(m_pCurrent, "false", 5) == 0) {
+    m_pCurrent += 5;
+    return false;
+  }
+  fail("Expected boolean");
+}
+
+void JsonReader::readNull()
+{
+  skipWhitespace();
+  if (m_pEnd - m_pCurrent >= 4 && std::memcmp(m_pCurrent, "null", 4) == 0) {
+    m_pCurrent += 4;
+    return;
+  }
+  fail("Expected null");
+}
+
+const char *JsonReader::skipNumber()
+{
+  skipWhitespace();
+  const auto begin = m_pCurrent;
+  while (m_pCurrent < m_pEnd && isNumberCharacter(*m_pCurrent)) {
+    ++m_pCurrent;
+  }
+  if (m_pCurrent == begin) {
+    fail("Expected number");
+  }
+  return m_pCurrent;
+}
+
+double JsonReader::readDouble()
+{
+  skipWhitespace();
+  const auto begin = m_pCurrent;
+  const auto end = skipNumber();
+
+  // Fast path for integers, the most common numbers in glTF
+  auto p = begin;
+  const bool negative = *p == '-';
+  if (negative) {
+    ++p;
+  }
+  if (end - p > 0 && end - p <= 18) {
+    int64_t value = 0;
+    while (p < end && isDigit(*p)) {
+      value = value * 10 + (*p - '0');
+      ++p;
+    }
+    if (p == end) {
+      return double(negative ? -value : value);
+    }
+  }
+
+  // The document is not null terminated, strtod() needs a copy
+  char buffer[64];
+  const auto length = size_t(end - begin);
+  if (length >= sizeof(buffer)) {
+    fail("Number too long");
+  }
+  std::memcpy(buffer, begin, length);
+  buffer[length] = '\0';
+  char *parsedEnd = nullptr;
+  const auto value = std::strtod(buffer, &parsedEnd);
+  if (parsedEnd != buffer + length) {
+    m_pCurrent = begin;
+    fail("Invalid number");
+  }
+  return value;
+}
+
+int JsonReader::readInt()
+{
+  const auto begin = offset();
+  const auto value = readDouble();
+  if (value != std::floor(value) || value < double(INT32_MIN) ||
+      value > double(INT32_MAX)) {
+    m_pCurrent = m_pBegin + begin;
+    fail("Expected integer");
+  }
+  return int(value);
+}
+
+size_t JsonReader::readSize()
+{
+  const auto begin = offset();
+  const auto value = readDouble();
+  // Sizes above 2^53 are not exactly representable, and never in a glTF file
+  if (value != std::floor(value) || value < 0 || value > 9007199254740992.) {
+    m_pCurrent = m_pBegin + begin;
+    fail("Expected unsigned integer");
+  }
+  return size_t(value);
+}
+
+void JsonReader::readStringContent(const char *&data, size_t &size)
+{
+  ++m_pCurrent; // Opening quote
+  const auto begin = m_pCurrent;
+  auto p = findQuoteOrBackslash(begin, m_pEnd);
+  if (p == m_pEnd) {
+    fail("Unterminated string");
+  }
+  if (*p == '"') {
+    data = begin;
+    size = size_t(p - begin);
+    m_pCurrent = p + 1;
+    return;
+  }
+
+  m_escaped.assign(begin, p);
+  while (*p != '"') {
+    // p is on a backslash
+    if (m_pEnd - p < 2) {
+      m_pCurrent = p;
+      fail("Unterminated string");
+    }
+    const auto escaped = p[1];
+    p += 2;
+    switch (escaped) {
+    case '"':
+      m_escaped += '"';
+      break;
+    case '\\':
+      m_escaped += '\\';
+      break;
+    case '/':
+      m_escaped += '/';
+      break;
+    case 'b':
+      m_escaped += '\b';
+      break;
+    case 'f':
+      m_escaped += '\f';
+      break;
+    case 'n':
+      m_escaped += '\n';
+      break;
+    case 'r':
+      m_escaped += '\r';
+      break;
+    case 't':
+      m_escaped += '\t';
+      break;
+    case 'u': {
+      const auto readHex4 = [&](uint32_t &codeUnit) {
+        if (m_pEnd - p < 4) {
+          return false;
+        }
+        codeUnit = 0;
+        for (int i = 0; i < 4; ++i) {
+          const auto digit = hexDigit(p[i]);
+          if (digit < 0) {
+            return false;
+          }
+          codeUnit = codeUnit * 16 + uint32_t(digit);
+        }
+        p += 4;
+        return true;
+      };
+      uint32_t codePoint;
+      if (!readHex4(codePoint)) {
+        m_pCurrent = p;
+        fail("Invalid unicode escape");
+      }
+      // Surrogate pair
+      uint32_t low;
+      if (codePoint >= 0xD800 && codePoint < 0xDC00 && m_pEnd - p >= 6 &&
+          p[0] == '\\' && p[1] == 'u') {
+        p += 2;
+        if (!readHex4(low) || low < 0xDC00 || low >= 0xE000) {
+          m_pCurrent = p;
+          fail("Invalid unicode surrogate pair");
+        }
+        codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+      }
+      appendUtf8(m_escaped, codePoint);
+      break;
+    }
+    default:
+      m_pCurrent = p - 2;
+      fail("Invalid escape sequence");
+    }
+
+    const auto next = findQuoteOrBackslash(p, m_pEnd);
+    if (next == m_pEnd) {
+      m_pCurrent = p;
+      fail("Unterminated string");
+    }
+    m_escaped.append(p, next);
+    p = next;
+  }
+
+  data = m_escaped.data();
+  size = m_escaped.size();
+  m_pCurrent = p + 1;
+}
+
+std::string JsonReader::readString()
+{
+  skipWhitespace();
+  if (m_pCurrent == m_pEnd || *m_pCurrent != '"') {
+    fail("Expected string");
+  }
+  const char *data;
+  size_t size;
+  readStringContent(data, size);
+  return std::string(data, size);
+}
+
+void JsonReader::skipString()
+{
+  auto p = m_pCurrent + 1;
+  for (;;) {
+    p = findQuoteOrBackslash(p, m_pEnd);
+    if (p == m_pEnd) {
+      fail("Unterminated string");
+    }
+    if (*p == '"') {
+      break;
+    }
+    // p is on a backslash
+    if (m_pEnd - p < 2) {
+      m_pCurrent = p;
+      fail("Unterminated string");
+    }
+    p += 2; // Escaped character, \uXXXX digits are skipped as plain text
+  }
+  m_pCurrent = p + 1;
+}
+
+void JsonReader::skipValue()
+{
+  switch (peek()) {
+  case Type::Null:
+    readNull();
+    return;
+  case Type::Bool:
+    readBool();
+    return;
+  case Type::Number:
+    skipNumber();
+    return;
+  case Type::String:
+    skipString();
+    return;
+  case Type::Array:
+  case Type::Object:
+    break;
+  }
+
+  // Containers are skipped by matching brackets, values inside are not
+  // validated
+  size_t depth = 0;
+  while (m_pCurrent < m_pEnd) {
+    switch (*m_pCurrent) {
+    case '"':
+      skipString();
+      continue;
+    case '[':
+    case '{':
+      ++depth;
+      break;
+    case ']':
+    case '}':
+      if (--depth == 0) {
+        ++m_pCurrent;
+        return;
+      }
+      break;
+    default:
+      break;
+    }
+    ++m_pCurrent;
+  }
+  fail("Unexpected end of document");
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// Forward-only JSON reader over a range of bytes that are not copied. Values
+// are read on demand by the caller, in document order, and the ones it does
+// not need are skipped without being materialized: no DOM is built.
+//
+// Objects are read with:
+//   reader.beginObject();
+//   JsonReader::Key key;
+//   while (reader.nextMember(key)) {
+//     if (key == "name") ... else reader.skipValue();
+//   }
+// and arrays with:
+//   reader.beginArray();
+//   while (reader.nextElement()) { ... }
+//
+// Malformed documents throw std::runtime_error, with the byte offset of the
+// error in the message.
+class JsonReader
+{
+public:
+  enum class Type
+  {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object
+  };
+
+  // Name of an object member. Points into the document, or into a buffer of
+  // the reader when the name contains escape sequences: only valid until the
+  // next call on the reader.
+  struct Key
+  {
+    const char *data = nullptr;
+    size_t size = 0;
+
+    bool operator==(const char *other) const
+    {
+      return std::strlen(other) == size && std::memcmp(data, other, size) == 0;
+    }
+
+    bool operator!=(const char *other) const { return !(*this == other); }
+  };
+
+  JsonReader(const char *begin, const char *end);
+
+  // Type of the next value
+  Type peek();
+
+  void beginObject();
+
+  // Read the name of the next member of the current object and move to its
+  // value. Return false, after consuming '}', if there is none.
+  bool nextMember(Key &key);
+
+  void beginArray();
+
+  // Move to the next element of the current array. Return false, after
+  // consuming ']', if there is none.
+  bool nextElement();
+
+  bool readBool();
+
+  double readDouble();
+
+  // Integral numbers, throws if the value has a fractional part
+  int readInt();
+
+  size_t readSize();
+
+  std::string readString();
+
+  void readNull();
+
+  // Skip the next value, including nested arrays and objects
+  void skipValue();
+
+  // Offset in the document of the next character to read
+  size_t offset() const { return size_t(m_pCurrent - m_pBegin); }
+
+private:
+  [[noreturn]] void fail(const char *message) const;
+
+  void skipWhitespace();
+
+  void expect(char c);
+
+  // Consume a string, m_pCurrent being on its opening quote. Return its
+  // content in data/size, decoding escapes in m_escaped when necessary.
+  void readStringContent(const char *&data, size_t &size);
+
+  // Move past the closing quote of the string starting at m_pCurrent, without
+  // decoding it
+  void skipString();
+
+  // Move past a number and return its last character + 1
+  const char *skipNumber();
+
+  const char *m_pBegin;
+  const char *m_pCurrent;
+  const char *m_pEnd;
+  std::string m_escaped;
+};
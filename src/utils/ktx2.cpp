@@ -0,0 +1,287 @@
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef GLTF_VIEWER_USE_BASISU
+#include <basisu_transcoder.h>
+#include <mutex>
+#endif
+
+namespace
+{
+
+const unsigned char ktx2Identifier[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+// Start of a KTX2 file, little endian like the rest of it
+struct Ktx2Header
+{
+  unsigned char identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount; // 0 asks the loader to generate mipmaps
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80, "KTX2 header must be packed");
+
+// Level index entries directly follow the header, level 0 (largest) first
+struct Ktx2Level
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+// Color models of the Data Format Descriptor
+const unsigned dfdModelEtc1s = 163;
+const unsigned dfdModelUastc = 166;
+// Channel ids of DFD samples holding alpha
+const unsigned etc1sChannelAaa = 15;
+const unsigned uastcChannelRgba = 3;
+const unsigned uastcChannelRrrg = 5;
+
+bool fail(std::string &err, const std::string &message)
+{
+  err = "KTX2: " + message;
+  return false;
+}
+
+// Block formats of KTX2 files copied as they are. sRGB variants are treated as
+// their UNORM counterpart: like for other images, the color space follows how
+// materials read the image.
+bool blockFormatOfVkFormat(uint32_t vkFormat, BlockFormat &format)
+{
+  switch (vkFormat) {
+  case 131: // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+  case 132: // VK_FORMAT_BC1_RGB_SRGB_BLOCK
+    format = BlockFormat::BC1;
+    return true;
+  case 139: // VK_FORMAT_BC4_UNORM_BLOCK
+    format = BlockFormat::BC4;
+    return true;
+  case 141: // VK_FORMAT_BC5_UNORM_BLOCK
+    format = BlockFormat::BC5;
+    return true;
+  case 145: // VK_FORMAT_BC7_UNORM_BLOCK
+  case 146: // VK_FORMAT_BC7_SRGB_BLOCK
+    format = BlockFormat::BC7;
+    return true;
+  }
+  return false;
+}
+
+#ifdef GLTF_VIEWER_USE_BASISU
+
+basist::transcoder_texture_format transcoderFormat(BlockFormat format)
+{
+  switch (format) {
+  case BlockFormat::BC1:
+    return basist::transcoder_texture_format::cTFBC1_RGB;
+  case BlockFormat::BC4:
+    return basist::transcoder_texture_format::cTFBC4_R;
+  case BlockFormat::BC5:
+    return basist::transcoder_texture_format::cTFBC5_RG;
+  case BlockFormat::BC7:
+    return basist::transcoder_texture_format::cTFBC7_RGBA;
+  }
+  return basist::transcoder_texture_format::cTFBC7_RGBA;
+}
+
+bool transcodeBasisUniversal(const unsigned char *bytes, size_t size,
+    const BlockEncoding &encoding, CompressedTexture &texture,
+    std::string &err)
+{
+  static std::once_flag initialized;
+  std::call_once(initialized, []() { basist::basisu_transcoder_init(); });
+
+  // A transcoder per call, they are not thread safe
+  basist::ktx2_transcoder transcoder;
+  if (!transcoder.init(bytes, uint32_t(size)) ||
+      !transcoder.start_transcoding()) {
+    return fail(err, "invalid Basis Universal payload");
+  }
+
+  // BC4 and BC5 keep the channels of sourceChannels, which index channels
+  // like the transcoder does (3 being alpha)
+  int channel0 = -1, channel1 = -1;
+  if (encoding.format == BlockFormat::BC4 ||
+      encoding.format == BlockFormat::BC5) {
+    channel0 = encoding.sourceChannels[0];
+  }
+  if (encoding.format == BlockFormat::BC5) {
+    channel1 = encoding.sourceChannels[1];
+  }
+
+  CompressedTexture transcoded;
+  transcoded.encoding = encoding;
+  for (uint32_t level = 0; level < transcoder.get_levels(); ++level) {
+    basist::ktx2_image_level_info levelInfo;
+    if (!transcoder.get_image_level_info(levelInfo, level, 0, 0)) {
+      return fail(err, "invalid level " + std::to_string(level));
+    }
+    const auto levelSize =
+        size_t(levelInfo.m_total_blocks) * blockBytes(encoding.format);
+    const auto offset = transcoded.data.size();
+    transcoded.data.resize(offset + levelSize);
+    if (!transcoder.transcode_image_level(level, 0, 0,
+            transcoded.data.data() + offset, levelInfo.m_total_blocks,
+            transcoderFormat(encoding.format), 0, 0, 0, channel0,
+            channel1)) {
+      return fail(err, "unable to transcode level " + std::to_string(level));
+    }
+    transcoded.levels.push_back({int(levelInfo.m_orig_width),
+        int(levelInfo.m_orig_height), offset, levelSize});
+  }
+  texture = std::move(transcoded);
+  return true;
+}
+
+#endif
+
+} // namespace
+
+bool isKtx2(const unsigned char *bytes, size_t size)
+{
+  return size >= sizeof(ktx2Identifier) &&
+         std::memcmp(bytes, ktx2Identifier, sizeof(ktx2Identifier)) == 0;
+}
+
+bool readKtx2Info(
+    const unsigned char *bytes, size_t size, Ktx2Info &info, std::string &err)
+{
+  if (!isKtx2(bytes, size) || size < sizeof(Ktx2Header)) {
+    return fail(err, "not a KTX2 file");
+  }
+  Ktx2Header header;
+  std::memcpy(&header, bytes, sizeof(header));
+  if (header.pixelWidth == 0 || header.pixelHeight == 0 ||
+      header.pixelDepth > 1 || header.layerCount > 1 ||
+      header.faceCount != 1) {
+    return fail(err, "only 2D textures are supported");
+  }
+
+  const auto levelCount = std::max(header.levelCount, 1u);
+  if (levelCount > 32 ||
+      sizeof(Ktx2Header) + levelCount * sizeof(Ktx2Level) > size) {
+    return fail(err, "invalid level index");
+  }
+  for (uint32_t i = 0; i < levelCount; ++i) {
+    Ktx2Level level;
+    std::memcpy(&level, bytes + sizeof(Ktx2Header) + i * sizeof(Ktx2Level),
+        sizeof(level));
+    if (level.byteOffset > size || level.byteLength > size - level.byteOffset) {
+      return fail(err, "level " + std::to_string(i) + " is out of range");
+    }
+  }
+
+  info = Ktx2Info();
+  info.width = int(header.pixelWidth);
+  info.height = int(header.pixelHeight);
+  info.levelCount = int(levelCount);
+  info.vkFormat = header.vkFormat;
+  info.supercompressionScheme = header.supercompressionScheme;
+
+  // Basic descriptor block of the Data Format Descriptor, after its total
+  // size: color model in byte 8, block size in bytes 6-7, then 16 bytes per
+  // sample whose byte 3 holds the channel id in its low bits
+  const size_t descriptorHeaderSize = 24, sampleSize = 16;
+  if (header.dfdByteLength >= 4 + descriptorHeaderSize &&
+      header.dfdByteOffset <= size &&
+      header.dfdByteLength <= size - header.dfdByteOffset) {
+    const auto block = bytes + header.dfdByteOffset + 4;
+    const unsigned colorModel = block[8];
+    const auto blockSize =
+        std::min<size_t>(size_t(block[6]) | (size_t(block[7]) << 8),
+            header.dfdByteLength - 4);
+    info.basisUniversal =
+        colorModel == dfdModelEtc1s || colorModel == dfdModelUastc;
+    for (size_t offset = descriptorHeaderSize; offset + sampleSize <= blockSize;
+         offset += sampleSize) {
+      const unsigned channelId = block[offset + 3] & 0xF;
+      if ((colorModel == dfdModelEtc1s && channelId == etc1sChannelAaa) ||
+          (colorModel == dfdModelUastc && (channelId == uastcChannelRgba ||
+                                              channelId == uastcChannelRrrg))) {
+        info.hasAlpha = true;
+      }
+    }
+  }
+  if (header.vkFormat == 0 && !info.basisUniversal) {
+    return fail(err, "unsupported data format");
+  }
+  return true;
+}
+
+bool basisTranscodingSupported()
+{
+#ifdef GLTF_VIEWER_USE_BASISU
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool transcodeKtx2(const unsigned char *bytes, size_t size,
+    unsigned usedChannels, bool bc1Supported, CompressedTexture &texture,
+    std::string &err)
+{
+  Ktx2Info info;
+  if (!readKtx2Info(bytes, size, info, err)) {
+    return false;
+  }
+
+  if (info.basisUniversal) {
+#ifdef GLTF_VIEWER_USE_BASISU
+    return transcodeBasisUniversal(bytes, size,
+        chooseBlockEncoding(usedChannels, info.hasAlpha, bc1Supported),
+        texture, err);
+#else
+    (void)usedChannels;
+    return fail(err, "Basis Universal payloads need basis_universal, which "
+                     "was not found at build time");
+#endif
+  }
+
+  BlockFormat format;
+  if (!blockFormatOfVkFormat(info.vkFormat, format)) {
+    return fail(err, "unsupported VkFormat " + std::to_string(info.vkFormat));
+  }
+  if (info.supercompressionScheme != 0) {
+    return fail(err, "supercompression is only supported for Basis "
+                     "Universal payloads");
+  }
+  if (format == BlockFormat::BC1 && !bc1Supported) {
+    return fail(err, "BC1 is not supported by the GL implementation");
+  }
+
+  CompressedTexture copied;
+  copied.encoding.format = format;
+  for (int i = 0; i < info.levelCount; ++i) {
+    Ktx2Level level;
+    std::memcpy(&level, bytes + sizeof(Ktx2Header) + i * sizeof(Ktx2Level),
+        sizeof(level));
+    const auto width = std::max(info.width >> i, 1);
+    const auto height = std::max(info.height >> i, 1);
+    const auto levelSize = compressedLevelSize(format, width, height);
+    if (level.byteLength != levelSize) {
+      return fail(err, "level " + std::to_string(i) + " has the wrong size");
+    }
+    const auto offset = copied.data.size();
+    copied.data.insert(end(copied.data), bytes + level.byteOffset,
+        bytes + level.byteOffset + levelSize);
+    copied.levels.push_back({width, height, offset, levelSize});
+  }
+  texture = std::move(copied);
+  return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "texture_compression.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// KTX2 texture containers, as referenced by the KHR_texture_basisu glTF
+// extension. Their levels are either Basis Universal payloads (ETC1S or
+// UASTC), transcoded to a block format the GPU samples, or already in a BCn
+// format, copied as they are.
+
+// From the identifier at the start of bytes
+bool isKtx2(const unsigned char *bytes, size_t size);
+
+struct Ktx2Info
+{
+  int width = 0;
+  int height = 0;
+  int levelCount = 0;
+  uint32_t vkFormat = 0; // 0 (VK_FORMAT_UNDEFINED) for Basis Universal
+  uint32_t supercompressionScheme = 0;
+  bool basisUniversal = false; // ETC1S or UASTC payload
+  bool hasAlpha = false;       // Only known for Basis Universal payloads
+};
+
+// Read and validate the header of a KTX2 file. Only 2D textures (no array
+// layers, cube faces or depth) are supported.
+bool readKtx2Info(
+    const unsigned char *bytes, size_t size, Ktx2Info &info, std::string &err);
+
+// Whether Basis Universal payloads can be transcoded, which requires the
+// basis_universal transcoder (GLTF_VIEWER_USE_BASISU)
+bool basisTranscodingSupported();
+
+// Thread safe. All levels of a KTX2 file in texture. Basis Universal payloads
+// are transcoded to the format chooseBlockEncoding() picks for usedChannels
+// (ImageChannel bits); other files must hold BC1, BC4, BC5 or BC7 blocks
+// without supercompression, which are copied.
+bool transcodeKtx2(const unsigned char *bytes, size_t size,
+    unsigned usedChannels, bool bc1Supported, CompressedTexture &texture,
+    std::string &err);
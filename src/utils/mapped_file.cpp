@@ -0,0 +1,175 @@
+#include "mapped_file.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const fs::path &path)
+{
+  m_hFile = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ,
+      nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (m_hFile == INVALID_HANDLE_VALUE) {
+    m_hFile = nullptr;
+    throw std::runtime_error("Unable to open file " + path.string());
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(m_hFile, &fileSize)) {
+    unmap();
+    throw std::runtime_error("Unable to get size of file " + path.string());
+  }
+  m_nSize = size_t(fileSize.QuadPart);
+  if (m_nSize == 0) {
+    return; // Nothing to map, data() stays nullptr
+  }
+
+  m_hMapping =
+      CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!m_hMapping) {
+    unmap();
+    throw std::runtime_error("Unable to map file " + path.string());
+  }
+  m_pData = (unsigned char *)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+  if (!m_pData) {
+    unmap();
+    throw std::runtime_error("Unable to map file " + path.string());
+  }
+}
+
+void MappedFile::unmap()
+{
+  if (m_pData) {
+    UnmapViewOfFile(m_pData);
+  }
+  if (m_hMapping) {
+    CloseHandle(m_hMapping);
+  }
+  if (m_hFile) {
+    CloseHandle(m_hFile);
+  }
+  m_pData = nullptr;
+  m_nSize = 0;
+  m_hMapping = nullptr;
+  m_hFile = nullptr;
+}
+
+MappedFile::MappedFile(MappedFile &&rvalue) :
+    m_pData(rvalue.m_pData),
+    m_nSize(rvalue.m_nSize),
+    m_hFile(rvalue.m_hFile),
+    m_hMapping(rvalue.m_hMapping)
+{
+  rvalue.m_pData = nullptr;
+  rvalue.m_nSize = 0;
+  rvalue.m_hFile = nullptr;
+  rvalue.m_hMapping = nullptr;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rvalue)
+{
+  unmap();
+  std::swap(m_pData, rvalue.m_pData);
+  std::swap(m_nSize, rvalue.m_nSize);
+  std::swap(m_hFile, rvalue.m_hFile);
+  std::swap(m_hMapping, rvalue.m_hMapping);
+  return *this;
+}
+
+void MappedFile::evict(const unsigned char *data, size_t size) const
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  const auto pageSize = uintptr_t(info.dwPageSize);
+  const auto begin = (uintptr_t(data) + pageSize - 1) / pageSize * pageSize;
+  const auto end = (uintptr_t(data) + size) / pageSize * pageSize;
+  if (begin < end) {
+    // Unlocking pages that are not locked removes them from the working set,
+    // the call then reports an error on purpose
+    VirtualUnlock((void *)begin, SIZE_T(end - begin));
+  }
+}
+
+#else
+
+MappedFile::MappedFile(const fs::path &path)
+{
+  const auto fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open file " + path.string());
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    close(fd);
+    throw std::runtime_error("Unable to get size of file " + path.string());
+  }
+  m_nSize = size_t(fileStat.st_size);
+  if (m_nSize == 0) {
+    close(fd);
+    return; // mmap() rejects empty ranges, data() stays nullptr
+  }
+
+  void *ptr = mmap(nullptr, m_nSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps its own reference to the file
+  if (ptr == MAP_FAILED) {
+    m_nSize = 0;
+    throw std::runtime_error("Unable to map file " + path.string());
+  }
+  // GL uploads and bounds computation read the buffers front to back
+  madvise(ptr, m_nSize, MADV_SEQUENTIAL);
+  m_pData = (unsigned char *)ptr;
+}
+
+void MappedFile::unmap()
+{
+  if (m_pData) {
+    munmap(m_pData, m_nSize);
+  }
+  m_pData = nullptr;
+  m_nSize = 0;
+}
+
+MappedFile::MappedFile(MappedFile &&rvalue) :
+    m_pData(rvalue.m_pData), m_nSize(rvalue.m_nSize)
+{
+  rvalue.m_pData = nullptr;
+  rvalue.m_nSize = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rvalue)
+{
+  unmap();
+  std::swap(m_pData, rvalue.m_pData);
+  std::swap(m_nSize, rvalue.m_nSize);
+  return *this;
+}
+
+void MappedFile::evict(const unsigned char *data, size_t size) const
+{
+  const auto pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+  const auto begin = (uintptr_t(data) + pageSize - 1) / pageSize * pageSize;
+  const auto end = (uintptr_t(data) + size) / pageSize * pageSize;
+  if (begin < end) {
+    // The mapping is private and read-only, discarded pages are faulted in
+    // from the file again
+    madvise((void *)begin, end - begin, MADV_DONTNEED);
+  }
+}
+
+#endif
+
+MappedFile::~MappedFile() { unmap(); }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The pages are faulted in lazily by
+// whoever reads data(), so handing data() to glBufferStorage lets the driver
+// read straight from the page cache without an intermediate copy.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+
+  // Throws std::runtime_error if the file cannot be opened or mapped
+  explicit MappedFile(const fs::path &path);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&rvalue);
+
+  MappedFile &operator=(MappedFile &&rvalue);
+
+  const unsigned char *data() const { return m_pData; }
+
+  size_t size() const { return m_nSize; }
+
+  // Drop the pages of [data, data + size), a range of data(), from the memory
+  // of the process once their bytes are copied elsewhere. They are read again
+  // from the file if accessed later. Pages shared with the bytes around the
+  // range are kept.
+  void evict(const unsigned char *data, size_t size) const;
+
+private:
+  void unmap();
+
+  unsigned char *m_pData = nullptr;
+  size_t m_nSize = 0;
+#ifdef _WIN32
+  void *m_hFile = nullptr;
+  void *m_hMapping = nullptr;
+#endif
+};
@@ -0,0 +1,367 @@
+#include "material_table.hpp"
+#include "glfw.hpp"
+#include "virtual_textures.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+#ifndef GL_ARB_bindless_texture
+// From GL_ARB_bindless_texture, which glad is not generated with
+typedef GLuint64(APIENTRYP PFNGLGETTEXTURESAMPLERHANDLEARBPROC)(
+    GLuint texture, GLuint sampler);
+typedef void(APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(
+    GLuint64 handle);
+typedef void(APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(
+    GLuint64 handle);
+#endif
+
+namespace
+{
+
+// Binding point of the Materials block
+const GLuint materialBinding = 0;
+
+enum TextureSlot
+{
+  BaseColorSlot,
+  MetallicRoughnessSlot,
+  EmissiveSlot,
+  OcclusionSlot,
+  TextureSlotCount
+};
+
+// A Material of the shaders, with the std430 layout
+struct GpuMaterial
+{
+  float baseColorFactor[4];
+  float emissiveFactor[3];
+  float metallicFactor;
+  float roughnessFactor;
+  float occlusionStrength;
+  uint32_t textureMask; // Bit i is set when textures[i] is valid
+  uint32_t padding;
+  // Bindless handle, or index of the texture array and layer
+  uint32_t textures[TextureSlotCount][2];
+};
+
+static_assert(sizeof(GpuMaterial) == 80, "GpuMaterial must match std430");
+
+// What GpuMaterial::textures holds for a texture of the model
+struct TextureReference
+{
+  bool valid = false;
+  uint32_t value[2] = {0, 0};
+};
+
+// Buffer of the materials of model, then the default material:
+// https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md#reference-pbrmetallicroughness3
+GLuint createMaterialBuffer(const tinygltf::Model &model,
+    const std::vector<TextureReference> &textureReferences)
+{
+  std::vector<GpuMaterial> materials(model.materials.size() + 1);
+  for (size_t i = 0; i < model.materials.size(); ++i) {
+    const auto &material = model.materials[i];
+    const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+    auto &gpuMaterial = materials[i];
+    for (size_t c = 0; c < 4; ++c) {
+      gpuMaterial.baseColorFactor[c] =
+          float(pbrMetallicRoughness.baseColorFactor[c]);
+    }
+    for (size_t c = 0; c < 3; ++c) {
+      gpuMaterial.emissiveFactor[c] = float(material.emissiveFactor[c]);
+    }
+    gpuMaterial.metallicFactor = float(pbrMetallicRoughness.metallicFactor);
+    gpuMaterial.roughnessFactor = float(pbrMetallicRoughness.roughnessFactor);
+    gpuMaterial.occlusionStrength = float(material.occlusionTexture.strength);
+    gpuMaterial.textureMask = 0;
+    gpuMaterial.padding = 0;
+
+    const int textureIndices[TextureSlotCount] = {
+        pbrMetallicRoughness.baseColorTexture.index,
+        pbrMetallicRoughness.metallicRoughnessTexture.index,
+        material.emissiveTexture.index, material.occlusionTexture.index};
+    for (int slot = 0; slot < TextureSlotCount; ++slot) {
+      gpuMaterial.textures[slot][0] = gpuMaterial.textures[slot][1] = 0;
+      const auto textureIdx = textureIndices[slot];
+      if (textureIdx < 0 || !textureReferences[textureIdx].valid) {
+        continue;
+      }
+      const auto &reference = textureReferences[textureIdx];
+      gpuMaterial.textures[slot][0] = reference.value[0];
+      gpuMaterial.textures[slot][1] = reference.value[1];
+      gpuMaterial.textureMask |= 1u << slot;
+    }
+  }
+  materials.back() = GpuMaterial{
+      {1, 1, 1, 1}, {0, 0, 0}, 1, 1, 0, 0, 0, {{0, 0}, {0, 0}, {0, 0}, {0, 0}}};
+
+  GLuint bufferObject = 0;
+  glGenBuffers(1, &bufferObject);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferObject);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      materials.size() * sizeof(GpuMaterial), materials.data(), 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  return bufferObject;
+}
+
+struct BindlessFunctions
+{
+  PFNGLGETTEXTURESAMPLERHANDLEARBPROC getTextureSamplerHandle = nullptr;
+  PFNGLMAKETEXTUREHANDLERESIDENTARBPROC makeTextureHandleResident = nullptr;
+  PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC makeTextureHandleNonResident =
+      nullptr;
+
+  BindlessFunctions()
+  {
+    getTextureSamplerHandle = (PFNGLGETTEXTURESAMPLERHANDLEARBPROC)
+        glfwGetProcAddress("glGetTextureSamplerHandleARB");
+    makeTextureHandleResident = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)
+        glfwGetProcAddress("glMakeTextureHandleResidentARB");
+    makeTextureHandleNonResident = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)
+        glfwGetProcAddress("glMakeTextureHandleNonResidentARB");
+  }
+
+  bool loaded() const
+  {
+    return getTextureSamplerHandle && makeTextureHandleResident &&
+           makeTextureHandleNonResident;
+  }
+};
+
+const BindlessFunctions &bindlessFunctions()
+{
+  static const BindlessFunctions functions;
+  return functions;
+}
+
+// What the layers of a texture array must have in common: width, height,
+// levels, internal format, swizzle and sampler object
+typedef std::array<GLint, 9> TextureArrayKey;
+
+TextureArrayKey textureArrayKey(GLuint textureObject, GLuint samplerObject)
+{
+  TextureArrayKey key;
+  glBindTexture(GL_TEXTURE_2D, textureObject);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &key[0]);
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &key[1]);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &key[2]);
+  glGetTexLevelParameteriv(
+      GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &key[3]);
+  glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, &key[4]);
+  key[8] = GLint(samplerObject);
+  return key;
+}
+
+} // namespace
+
+MaterialTable::MaterialTable(const tinygltf::Model &model,
+    const std::vector<GLuint> &textureObjects,
+    const std::vector<GLuint> &samplerObjects, TextureMode mode,
+    size_t maxTextureArrays) :
+    m_textureMode(mode)
+{
+  if (mode == TextureMode::Bindless && !bindlessFunctions().loaded()) {
+    throw std::runtime_error("Unable to load ARB_bindless_texture functions");
+  }
+
+  // Texture and sampler objects of each texture of the model, 0 when there is
+  // no texture object
+  std::vector<std::pair<GLuint, GLuint>> textures(model.textures.size());
+  for (size_t i = 0; i < model.textures.size(); ++i) {
+    const auto &texture = model.textures[i];
+    if (texture.source >= 0 && textureObjects[texture.source]) {
+      textures[i] = {textureObjects[texture.source],
+          samplerObjects[texture.sampler >= 0 ? size_t(texture.sampler)
+                                              : model.samplers.size()]};
+    }
+  }
+  std::map<std::pair<GLuint, GLuint>, std::array<uint32_t, 2>> references;
+  for (const auto &texture : textures) {
+    if (texture.first) {
+      references[texture] = {0, 0};
+    }
+  }
+
+  if (mode == TextureMode::Bindless) {
+    // Handles of pairs of a texture and a sampler, made resident for the
+    // lifetime of the table
+    const auto &functions = bindlessFunctions();
+    for (auto &reference : references) {
+      const auto handle = functions.getTextureSamplerHandle(
+          reference.first.first, reference.first.second);
+      if (!handle) {
+        throw std::runtime_error("Unable to get a bindless texture handle");
+      }
+      functions.makeTextureHandleResident(handle);
+      m_residentHandles.push_back(handle);
+      reference.second = {uint32_t(handle), uint32_t(handle >> 32)};
+    }
+  } else {
+    // Bucket textures by the array they can share, then copy each of them in
+    // a layer of its array. Buckets with more textures than an array can
+    // hold layers are split across several arrays.
+    std::map<TextureArrayKey, std::vector<std::pair<GLuint, GLuint>>> buckets;
+    glActiveTexture(GL_TEXTURE0);
+    for (const auto &reference : references) {
+      buckets[textureArrayKey(reference.first.first, reference.first.second)]
+          .push_back(reference.first);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    const auto layersPerArray = size_t(std::max(maxLayers, 1));
+    size_t arrayCount = 0;
+    for (const auto &bucket : buckets) {
+      arrayCount +=
+          (bucket.second.size() + layersPerArray - 1) / layersPerArray;
+    }
+    if (arrayCount > maxTextureArrays) {
+      throw std::runtime_error("Textures need " + std::to_string(arrayCount) +
+                               " texture arrays, more than the " +
+                               std::to_string(maxTextureArrays) +
+                               " texture units available");
+    }
+
+    for (const auto &bucket : buckets) {
+      const auto &key = bucket.first;
+      const auto width = key[0], height = key[1], levels = key[2];
+      for (size_t first = 0; first < bucket.second.size();
+           first += layersPerArray) {
+        const auto layers =
+            GLsizei(std::min(layersPerArray, bucket.second.size() - first));
+        TextureArray textureArray{0, GLuint(key[8])};
+        glGenTextures(1, &textureArray.textureObject);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray.textureObject);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, std::max(levels, 1),
+            GLenum(key[3]), width, height, layers);
+        glTexParameteriv(
+            GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, &key[4]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        // Copies between textures of the same format stay on the GPU, block
+        // compressed ones included
+        for (GLsizei layer = 0; layer < layers; ++layer) {
+          const auto texture = bucket.second[first + size_t(layer)];
+          for (GLint level = 0; level < std::max(levels, 1); ++level) {
+            glCopyImageSubData(texture.first, GL_TEXTURE_2D, level, 0, 0, 0,
+                textureArray.textureObject, GL_TEXTURE_2D_ARRAY, level, 0, 0,
+                layer, std::max(width >> level, 1),
+                std::max(height >> level, 1), 1);
+          }
+          references[texture] = {
+              uint32_t(m_textureArrays.size()), uint32_t(layer)};
+        }
+        m_textureArrays.push_back(textureArray);
+        m_nTextureLayers += layers;
+      }
+    }
+  }
+
+  std::vector<TextureReference> textureReferences(model.textures.size());
+  for (size_t i = 0; i < model.textures.size(); ++i) {
+    if (textures[i].first) {
+      const auto &reference = references[textures[i]];
+      textureReferences[i].valid = true;
+      textureReferences[i].value[0] = reference[0];
+      textureReferences[i].value[1] = reference[1];
+    }
+  }
+  m_bufferObject = createMaterialBuffer(model, textureReferences);
+  m_nDefaultMaterial = int(model.materials.size());
+}
+
+MaterialTable::MaterialTable(const tinygltf::Model &model,
+    const std::vector<int> &virtualImages,
+    const VirtualTextureCache &virtualTextures) :
+    m_textureMode(TextureMode::Virtual),
+    m_virtualTextures(&virtualTextures)
+{
+  std::vector<TextureReference> textureReferences(model.textures.size());
+  for (size_t i = 0; i < model.textures.size(); ++i) {
+    const auto source = model.textures[i].source;
+    if (source >= 0 && virtualImages[source] >= 0) {
+      textureReferences[i].valid = true;
+      textureReferences[i].value[0] = uint32_t(virtualImages[source]);
+    }
+  }
+  m_bufferObject = createMaterialBuffer(model, textureReferences);
+  m_nDefaultMaterial = int(model.materials.size());
+}
+
+MaterialTable::~MaterialTable()
+{
+  for (const auto handle : m_residentHandles) {
+    bindlessFunctions().makeTextureHandleNonResident(handle);
+  }
+  for (const auto &textureArray : m_textureArrays) {
+    glDeleteTextures(1, &textureArray.textureObject);
+  }
+  glDeleteBuffers(1, &m_bufferObject);
+}
+
+std::vector<std::string> MaterialTable::shaderDefines() const
+{
+  std::vector<std::string> defines = {"MATERIAL_BUFFER"};
+  if (m_textureMode == TextureMode::Bindless) {
+    defines.push_back("BINDLESS_TEXTURES");
+  } else if (m_textureMode == TextureMode::Virtual) {
+    defines.push_back("VIRTUAL_TEXTURES");
+  } else {
+    // GLSL arrays cannot be empty
+    defines.push_back("TEXTURE_ARRAY_COUNT " +
+                      std::to_string(std::max(m_textureArrays.size(),
+                          size_t(1))));
+  }
+  return defines;
+}
+
+void MaterialTable::setupProgram(GLuint program) const
+{
+  const auto block = glGetProgramResourceIndex(
+      program, GL_SHADER_STORAGE_BLOCK, "Materials");
+  if (block != GL_INVALID_INDEX) {
+    glShaderStorageBlockBinding(program, block, materialBinding);
+  }
+  const auto location = glGetUniformLocation(program, "uTextureArrays");
+  if (location >= 0 && !m_textureArrays.empty()) {
+    std::vector<GLint> units(m_textureArrays.size());
+    for (size_t i = 0; i < units.size(); ++i) {
+      units[i] = GLint(i);
+    }
+    glProgramUniform1iv(program, location, GLsizei(units.size()), units.data());
+  }
+  if (m_virtualTextures) {
+    m_virtualTextures->setupProgram(program);
+  }
+}
+
+void MaterialTable::bind() const
+{
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, materialBinding, m_bufferObject);
+  for (size_t i = 0; i < m_textureArrays.size(); ++i) {
+    glActiveTexture(GLenum(GL_TEXTURE0 + i));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_textureArrays[i].textureObject);
+    glBindSampler(GLuint(i), m_textureArrays[i].samplerObject);
+  }
+  if (m_virtualTextures) {
+    m_virtualTextures->bind();
+  }
+}
+
+void MaterialTable::unbind() const
+{
+  if (m_virtualTextures) {
+    m_virtualTextures->unbind();
+  }
+  for (size_t i = 0; i < m_textureArrays.size(); ++i) {
+    glActiveTexture(GLenum(GL_TEXTURE0 + i));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindSampler(GLuint(i), 0);
+  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, materialBinding, 0);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <glad/glad.h>
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+class VirtualTextureCache;
+
+// Factors and textures of all the materials of a scene in a shader storage
+// buffer. Shaders compiled with shaderDefines() read the material of a draw at
+// uMaterialIndex, so that drawing a primitive only sets that uniform instead
+// of binding the four textures of its material.
+//
+// Textures are referenced either by ARB_bindless_texture handles, or by a
+// layer of a GL_TEXTURE_2D_ARRAY when bindless textures are not supported:
+// textures with the same size, mip levels, format, swizzle and sampler are
+// copied into the layers of one array (several past GL_MAX_ARRAY_TEXTURE_LAYERS
+// textures), and all arrays are bound once per pass.
+// With virtual textures, they are the index of their image in a
+// VirtualTextureCache, which the table binds along with the buffer.
+//
+// All member functions must be called on the thread owning the GL context.
+class MaterialTable
+{
+public:
+  enum class TextureMode
+  {
+    Bindless,
+    TextureArrays,
+    Virtual
+  };
+
+  // textureObjects holds the texture object of each image, samplerObjects the
+  // sampler object of each sampler followed by the default one. Throw
+  // std::runtime_error if the textures need more than maxTextureArrays arrays
+  // or if bindless textures cannot be used.
+  MaterialTable(const tinygltf::Model &model,
+      const std::vector<GLuint> &textureObjects,
+      const std::vector<GLuint> &samplerObjects, TextureMode mode,
+      size_t maxTextureArrays);
+
+  // virtualImages holds the index of each image in virtualTextures, or -1 if
+  // its textures are ignored. virtualTextures must outlive the table.
+  MaterialTable(const tinygltf::Model &model,
+      const std::vector<int> &virtualImages,
+      const VirtualTextureCache &virtualTextures);
+
+  ~MaterialTable();
+
+  MaterialTable(const MaterialTable &) = delete;
+
+  MaterialTable &operator=(const MaterialTable &) = delete;
+
+  TextureMode textureMode() const { return m_textureMode; }
+
+  size_t textureArrayCount() const { return m_textureArrays.size(); }
+
+  // Layers of all texture arrays
+  size_t textureLayerCount() const { return m_nTextureLayers; }
+
+  // Index of the material of primitives without one
+  int defaultMaterial() const { return m_nDefaultMaterial; }
+
+  // Defines of the shaders reading the table: MATERIAL_BUFFER, then
+  // BINDLESS_TEXTURES, TEXTURE_ARRAY_COUNT or VIRTUAL_TEXTURES
+  std::vector<std::string> shaderDefines() const;
+
+  // Connect the Materials block and the samplers of program (uTextureArrays or
+  // those of the virtual textures) to what bind() binds
+  void setupProgram(GLuint program) const;
+
+  // Bind the buffer, and the texture arrays or the virtual textures to the
+  // first texture units
+  void bind() const;
+
+  // Unbind the textures and their sampler objects, which would
+  // otherwise apply to textures later bound to the same units
+  void unbind() const;
+
+private:
+  struct TextureArray
+  {
+    GLuint textureObject;
+    GLuint samplerObject;
+  };
+
+  TextureMode m_textureMode;
+  GLuint m_bufferObject = 0;
+  std::vector<TextureArray> m_textureArrays;
+  std::vector<GLuint64> m_residentHandles; // Bindless textures
+  const VirtualTextureCache *m_virtualTextures = nullptr;
+  size_t m_nTextureLayers = 0;
+  int m_nDefaultMaterial = 0;
+};
@@ -0,0 +1,97 @@
+#include "memory_usage.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+// windows.h must come first
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <cstring>
+#endif
+
+#ifdef _WIN32
+
+size_t currentResidentMemory()
+{
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.WorkingSetSize;
+}
+
+size_t peakResidentMemory()
+{
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+}
+
+bool resetPeakResidentMemory() { return false; }
+
+#else
+
+namespace
+{
+
+// Read a "<field>: <value> kB" line of /proc/self/status (Linux only)
+size_t readProcStatus(const char *field)
+{
+  FILE *file = std::fopen("/proc/self/status", "r");
+  if (!file) {
+    return 0;
+  }
+  size_t value = 0;
+  const auto fieldLength = std::strlen(field);
+  char line[256];
+  while (std::fgets(line, sizeof(line), file)) {
+    unsigned long long kiloBytes;
+    if (std::strncmp(line, field, fieldLength) == 0 &&
+        std::sscanf(line + fieldLength, ": %llu", &kiloBytes) == 1) {
+      value = size_t(kiloBytes) * 1024;
+      break;
+    }
+  }
+  std::fclose(file);
+  return value;
+}
+
+} // namespace
+
+size_t currentResidentMemory() { return readProcStatus("VmRSS"); }
+
+size_t peakResidentMemory()
+{
+  if (const auto peak = readProcStatus("VmHWM")) {
+    return peak;
+  }
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return size_t(usage.ru_maxrss); // Bytes on macOS
+#else
+  return size_t(usage.ru_maxrss) * 1024; // Kilobytes elsewhere
+#endif
+}
+
+bool resetPeakResidentMemory()
+{
+  // https://www.kernel.org/doc/Documentation/filesystems/proc.txt
+  FILE *file = std::fopen("/proc/self/clear_refs", "w");
+  if (!file) {
+    return false;
+  }
+  const auto written = std::fputs("5", file) >= 0;
+  return std::fclose(file) == 0 && written;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+
+// Resident set size of the process, in bytes. Return 0 when the platform
+// does not report it.
+size_t currentResidentMemory();
+
+// Highest resident set size reached by the process so far, in bytes
+size_t peakResidentMemory();
+
+// Restart peakResidentMemory() from the current resident set size. Return
+// false if the platform does not allow it (only Linux does).
+bool resetPeakResidentMemory();
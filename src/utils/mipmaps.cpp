@@ -0,0 +1,257 @@
+#include "mipmaps.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPMAPS_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// Linear values are quantized to this many steps to be converted back to
+// sRGB through a table, which is within one step of the exact conversion
+const int linearSteps = 4095;
+
+struct ColorTables
+{
+  float srgbToLinear[256];
+  float unormToFloat[256];
+  unsigned char linearToSrgb[linearSteps + 1];
+
+  ColorTables()
+  {
+    for (int i = 0; i < 256; ++i) {
+      const auto c = i / 255.f;
+      srgbToLinear[i] = c <= 0.04045f ? c / 12.92f
+                                      : std::pow((c + 0.055f) / 1.055f, 2.4f);
+      unormToFloat[i] = c;
+    }
+    for (int i = 0; i <= linearSteps; ++i) {
+      const auto l = float(i) / linearSteps;
+      const auto c = l <= 0.0031308f
+                         ? l * 12.92f
+                         : 1.055f * std::pow(l, 1.f / 2.4f) - 0.055f;
+      linearToSrgb[i] = (unsigned char)std::lrint(
+          std::min(std::max(c, 0.f), 1.f) * 255.f);
+    }
+  }
+};
+
+const ColorTables &colorTables()
+{
+  static const ColorTables tables;
+  return tables;
+}
+
+// Source pixels an output pixel covers along one axis, and their weights. An
+// even size halves to 2 taps of 1/2. An odd size n = 2m + 1 halves to m
+// pixels of width n / m, covering 3 source pixels each.
+struct Taps
+{
+  int index[3];
+  float weight[3];
+  int count;
+};
+
+Taps filterTaps(int i, int size)
+{
+  Taps taps;
+  if (size == 1) {
+    taps.index[0] = 0;
+    taps.weight[0] = 1.f;
+    taps.count = 1;
+  } else if (size % 2 == 0) {
+    taps.index[0] = 2 * i;
+    taps.index[1] = 2 * i + 1;
+    taps.weight[0] = taps.weight[1] = 0.5f;
+    taps.count = 2;
+  } else {
+    const auto m = size / 2;
+    taps.index[0] = 2 * i;
+    taps.index[1] = 2 * i + 1;
+    taps.index[2] = 2 * i + 2;
+    taps.weight[0] = float(m - i) / size;
+    taps.weight[1] = float(m) / size;
+    taps.weight[2] = float(i + 1) / size;
+    taps.count = 3;
+  }
+  return taps;
+}
+
+// RGBA of a row as floats, in linear space with srgb (alpha is always linear)
+void loadRow(const unsigned char *rgba, int width, bool srgb, float *row)
+{
+  const auto &tables = colorTables();
+  const auto color = srgb ? tables.srgbToLinear : tables.unormToFloat;
+  for (int x = 0; x < width; ++x) {
+    row[4 * x + 0] = color[rgba[4 * x + 0]];
+    row[4 * x + 1] = color[rgba[4 * x + 1]];
+    row[4 * x + 2] = color[rgba[4 * x + 2]];
+    row[4 * x + 3] = tables.unormToFloat[rgba[4 * x + 3]];
+  }
+}
+
+// Weighted sum of the taps of column taps in the rows of rowTaps, one float
+// per channel in out
+void filterPixel(const float *const *rows, const Taps &rowTaps,
+    const Taps &columnTaps, float *out)
+{
+#ifdef MIPMAPS_USE_SSE2
+  auto sum = _mm_setzero_ps();
+  for (int y = 0; y < rowTaps.count; ++y) {
+    auto rowSum = _mm_setzero_ps();
+    for (int x = 0; x < columnTaps.count; ++x) {
+      rowSum = _mm_add_ps(rowSum,
+          _mm_mul_ps(_mm_set1_ps(columnTaps.weight[x]),
+              _mm_loadu_ps(rows[y] + 4 * columnTaps.index[x])));
+    }
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(rowTaps.weight[y]), rowSum));
+  }
+  _mm_storeu_ps(out, sum);
+#else
+  for (int c = 0; c < 4; ++c) {
+    float sum = 0.f;
+    for (int y = 0; y < rowTaps.count; ++y) {
+      float rowSum = 0.f;
+      for (int x = 0; x < columnTaps.count; ++x) {
+        rowSum += columnTaps.weight[x] * rows[y][4 * columnTaps.index[x] + c];
+      }
+      sum += rowTaps.weight[y] * rowSum;
+    }
+    out[c] = sum;
+  }
+#endif
+}
+
+void storePixel(const float *linear, bool srgb, unsigned char *rgba)
+{
+  const auto quantize = [](float value, int steps) {
+    return std::min(std::max(int(std::lrint(value * steps)), 0), steps);
+  };
+  for (int c = 0; c < 3; ++c) {
+    rgba[c] = srgb
+                  ? colorTables().linearToSrgb[quantize(linear[c], linearSteps)]
+                  : (unsigned char)quantize(linear[c], 255);
+  }
+  rgba[3] = (unsigned char)quantize(linear[3], 255);
+}
+
+} // namespace
+
+int mipLevelCount(int width, int height)
+{
+  int count = 1;
+  for (auto size = std::max(width, height); size > 1; size /= 2) {
+    ++count;
+  }
+  return count;
+}
+
+std::vector<MipLevel> mipChainLayout(
+    int width, int height, size_t pixelSize, int levelCount)
+{
+  std::vector<MipLevel> levels;
+  size_t offset = 0;
+  for (int i = 0; i < levelCount; ++i) {
+    const auto size = size_t(width) * height * pixelSize;
+    levels.push_back({width, height, offset, size});
+    offset += size;
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  return levels;
+}
+
+void downsampleImage(const unsigned char *rgba, int width, int height,
+    bool srgb, unsigned char *half)
+{
+  const auto halfWidth = std::max(width / 2, 1);
+  const auto halfHeight = std::max(height / 2, 1);
+
+  std::vector<Taps> columnTaps(halfWidth);
+  for (int x = 0; x < halfWidth; ++x) {
+    columnTaps[x] = filterTaps(x, width);
+  }
+
+  // Source rows of the current output row, as floats. Consecutive output rows
+  // of odd heights share a row, which is converted again for simplicity.
+  std::vector<float> rowStorage(3 * size_t(width) * 4);
+  const float *rows[3];
+  float linear[4];
+  for (int y = 0; y < halfHeight; ++y) {
+    const auto rowTaps = filterTaps(y, height);
+    for (int i = 0; i < rowTaps.count; ++i) {
+      auto row = rowStorage.data() + i * size_t(width) * 4;
+      loadRow(rgba + size_t(rowTaps.index[i]) * width * 4, width, srgb, row);
+      rows[i] = row;
+    }
+    auto out = half + size_t(y) * halfWidth * 4;
+    for (int x = 0; x < halfWidth; ++x) {
+      filterPixel(rows, rowTaps, columnTaps[x], linear);
+      storePixel(linear, srgb, out + 4 * x);
+    }
+  }
+}
+
+void generateMipChain(
+    std::vector<unsigned char> &rgba, int width, int height, bool srgb)
+{
+  const auto levels =
+      mipChainLayout(width, height, 4, mipLevelCount(width, height));
+  rgba.resize(levels.back().offset + levels.back().size);
+  for (size_t i = 1; i < levels.size(); ++i) {
+    const auto &source = levels[i - 1];
+    downsampleImage(rgba.data() + source.offset, source.width, source.height,
+        srgb, rgba.data() + levels[i].offset);
+  }
+}
+
+int storedMipLevelCount(const tinygltf::Image &image)
+{
+  if (image.width <= 0 || image.height <= 0 || image.component != 4 ||
+      image.bits != 8) {
+    return 1;
+  }
+  const auto levels = mipChainLayout(
+      image.width, image.height, 4, mipLevelCount(image.width, image.height));
+  return image.image.size() == levels.back().offset + levels.back().size
+             ? int(levels.size())
+             : 1;
+}
+
+void downscaleImage(tinygltf::Image &image, int maxSize, bool srgb)
+{
+  if (maxSize <= 0 || image.component != 4 || image.bits != 8 ||
+      std::max(image.width, image.height) <= maxSize) {
+    return;
+  }
+  if (storedMipLevelCount(image) > 1) {
+    const auto levels = mipChainLayout(image.width, image.height, 4,
+        mipLevelCount(image.width, image.height));
+    size_t first = 0;
+    while (std::max(levels[first].width, levels[first].height) > maxSize) {
+      ++first;
+    }
+    image.image.erase(
+        begin(image.image), begin(image.image) + levels[first].offset);
+    image.width = levels[first].width;
+    image.height = levels[first].height;
+    return;
+  }
+  std::vector<unsigned char> half;
+  while (std::max(image.width, image.height) > maxSize) {
+    const auto halfWidth = std::max(image.width / 2, 1);
+    const auto halfHeight = std::max(image.height / 2, 1);
+    half.resize(size_t(halfWidth) * halfHeight * 4);
+    downsampleImage(image.image.data(), image.width, image.height, srgb,
+        half.data());
+    image.image.swap(half);
+    image.width = halfWidth;
+    image.height = halfHeight;
+  }
+  image.image.shrink_to_fit();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Mip chains of RGBA8 images, generated on the CPU so that the decoding
+// workers produce them instead of glGenerateMipmap on the GL thread, and so
+// that they can be cached with the decoded image.
+//
+// A chain is stored in a single buffer, levels one after the other from the
+// largest, as glTexStorage2D() expects them.
+
+struct MipLevel
+{
+  int width;
+  int height;
+  size_t offset; // In the chain
+  size_t size;
+};
+
+// Levels of a full chain of a width x height image, down to 1x1
+int mipLevelCount(int width, int height);
+
+// Layout of the levelCount first levels of the chain of a width x height
+// image with pixelSize bytes per pixel
+std::vector<MipLevel> mipChainLayout(
+    int width, int height, size_t pixelSize, int levelCount);
+
+// Half size (rounded down) RGBA8 image of rgba, with an exact box filter: odd
+// dimensions are filtered with three weighted taps instead of dropping the
+// last row or column. With srgb, RGB are averaged in linear space.
+void downsampleImage(const unsigned char *rgba, int width, int height,
+    bool srgb, unsigned char *half);
+
+// Grow rgba, holding the first level of a width x height RGBA8 image, to the
+// full chain of the image
+void generateMipChain(
+    std::vector<unsigned char> &rgba, int width, int height, bool srgb);
+
+// Levels stored in the pixels of a decoded image: the full chain once
+// generateMipChain() ran on it (possibly before being cached), otherwise one
+int storedMipLevelCount(const tinygltf::Image &image);
+
+// Halve the pixels of image (RGBA8, a single level or its full chain) until
+// its largest side is at most maxSize. Chains only drop their largest levels.
+void downscaleImage(tinygltf::Image &image, int maxSize, bool srgb);
@@ -0,0 +1,383 @@
+#include "multi_draw.hpp"
+#include "node_table.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+
+namespace
+{
+
+// Binding point of the Draws block, after the Materials block
+const GLuint drawBinding = 1;
+
+// Attribute locations of the shaders, as in createMeshVertexArrayObjects()
+const char *const attributeNames[] = {"POSITION", "NORMAL", "TEXCOORD_0"};
+const int attributeCount = 3;
+
+struct DrawElementsIndirectCommand
+{
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+// A Draw of the shaders, with the std430 layout
+struct GpuDraw
+{
+  float modelMatrix[16];
+  // Normal matrix of the model matrix, as a mat4 to keep the mat3 columns
+  // aligned
+  float normalMatrix[16];
+};
+
+static_assert(sizeof(GpuDraw) == 128, "GpuDraw must match std430");
+
+// Everything primitives of a group have in common: mode, index type, then the
+// component type and count of each attribute (0 when missing)
+typedef std::tuple<int, int, int, int, int, int, int, int> GroupKey;
+
+// Elements of an accessor, with their size in bytes and their stride in the
+// bytes of its buffer
+struct AccessorData
+{
+  const unsigned char *data = nullptr;
+  size_t count = 0;
+  size_t elementSize = 0;
+  size_t stride = 0;
+};
+
+AccessorData accessorData(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, int accessorIdx)
+{
+  const auto &accessor = model.accessors[accessorIdx];
+  if (accessor.sparse.isSparse || accessor.bufferView < 0) {
+    throw std::runtime_error(
+        "Accessor " + std::to_string(accessorIdx) + " is not in a buffer");
+  }
+  const auto &bufferView = model.bufferViews[accessor.bufferView];
+  const auto &buffer = buffers[bufferView.buffer];
+
+  AccessorData result;
+  result.count = accessor.count;
+  result.elementSize =
+      size_t(tinygltf::GetComponentSizeInBytes(accessor.componentType) *
+             tinygltf::GetNumComponentsInType(accessor.type));
+  result.stride =
+      bufferView.byteStride ? bufferView.byteStride : result.elementSize;
+  const auto byteOffset = accessor.byteOffset + bufferView.byteOffset;
+  if (!buffer.data || result.count == 0 ||
+      byteOffset + (result.count - 1) * result.stride + result.elementSize >
+          buffer.size) {
+    throw std::runtime_error("Accessor " + std::to_string(accessorIdx) +
+                             " is out of its buffer");
+  }
+  result.data = buffer.data + byteOffset;
+  return result;
+}
+
+size_t alignUp(size_t size, size_t alignment)
+{
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Where the vertices and indices of a primitive are in the buffers of its
+// group
+struct PackedPrimitive
+{
+  size_t group;
+  GLuint indexCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+};
+
+// Geometry of a group while it is packed
+struct GroupData
+{
+  GroupKey key;
+  size_t vertexCount = 0;
+  size_t indexCount = 0;
+  size_t indexSize = 0;
+  std::vector<std::pair<int, int>> primitives; // Mesh and primitive
+};
+
+} // namespace
+
+MultiDrawScene::MultiDrawScene(const tinygltf::Model &model,
+    const std::vector<BufferBytes> &buffers, const NodeTable &nodes,
+    int defaultMaterial)
+{
+  // Group the primitives of the meshes by format
+  std::map<GroupKey, size_t> groupIndices;
+  std::vector<GroupData> groups;
+  std::vector<std::vector<PackedPrimitive>> packedPrimitives(
+      model.meshes.size());
+  for (size_t meshIdx = 0; meshIdx < model.meshes.size(); ++meshIdx) {
+    const auto &primitives = model.meshes[meshIdx].primitives;
+    packedPrimitives[meshIdx].resize(primitives.size());
+    for (size_t pIdx = 0; pIdx < primitives.size(); ++pIdx) {
+      const auto &primitive = primitives[pIdx];
+      int format[2 * attributeCount] = {};
+      size_t vertexCount = 0;
+      for (int attribute = 0; attribute < attributeCount; ++attribute) {
+        const auto iterator =
+            primitive.attributes.find(attributeNames[attribute]);
+        if (iterator == end(primitive.attributes)) {
+          continue;
+        }
+        const auto &accessor = model.accessors[iterator->second];
+        format[2 * attribute] = accessor.componentType;
+        format[2 * attribute + 1] = accessor.type;
+        vertexCount = std::max(vertexCount, accessor.count);
+      }
+      // Primitives without indices are drawn with generated ones
+      const auto indexType =
+          primitive.indices >= 0
+              ? model.accessors[primitive.indices].componentType
+              : GL_UNSIGNED_INT;
+      const auto key = GroupKey(primitive.mode, indexType, format[0],
+          format[1], format[2], format[3], format[4], format[5]);
+      const auto inserted = groupIndices.emplace(key, groups.size());
+      if (inserted.second) {
+        groups.emplace_back();
+        groups.back().key = key;
+        groups.back().indexSize =
+            size_t(tinygltf::GetComponentSizeInBytes(indexType));
+      }
+      auto &group = groups[inserted.first->second];
+      const auto indexCount = primitive.indices >= 0
+                                  ? model.accessors[primitive.indices].count
+                                  : vertexCount;
+      packedPrimitives[meshIdx][pIdx] = {inserted.first->second,
+          GLuint(indexCount), GLuint(group.indexCount),
+          GLint(group.vertexCount)};
+      group.vertexCount += vertexCount;
+      group.indexCount += indexCount;
+      group.primitives.emplace_back(int(meshIdx), int(pIdx));
+    }
+  }
+
+  // Copy the attributes of the primitives of each group one after the other,
+  // attribute after attribute, and their indices
+  m_groups.resize(groups.size());
+  for (size_t groupIdx = 0; groupIdx < groups.size(); ++groupIdx) {
+    const auto &data = groups[groupIdx];
+    const int format[2 * attributeCount] = {std::get<2>(data.key),
+        std::get<3>(data.key), std::get<4>(data.key), std::get<5>(data.key),
+        std::get<6>(data.key), std::get<7>(data.key)};
+    size_t attributeOffsets[attributeCount] = {};
+    size_t attributeSizes[attributeCount] = {};
+    size_t vertexBytes = 0;
+    for (int attribute = 0; attribute < attributeCount; ++attribute) {
+      if (!format[2 * attribute]) {
+        continue;
+      }
+      attributeSizes[attribute] =
+          size_t(tinygltf::GetComponentSizeInBytes(format[2 * attribute]) *
+                 tinygltf::GetNumComponentsInType(format[2 * attribute + 1]));
+      attributeOffsets[attribute] = alignUp(vertexBytes, 4);
+      vertexBytes = attributeOffsets[attribute] +
+                    data.vertexCount * attributeSizes[attribute];
+    }
+    std::vector<unsigned char> vertices(vertexBytes);
+    std::vector<unsigned char> indices(data.indexCount * data.indexSize);
+
+    for (const auto &meshPrimitive : data.primitives) {
+      const auto &primitive =
+          model.meshes[meshPrimitive.first].primitives[meshPrimitive.second];
+      const auto &packed =
+          packedPrimitives[meshPrimitive.first][meshPrimitive.second];
+      size_t vertexCount = 0;
+      for (int attribute = 0; attribute < attributeCount; ++attribute) {
+        const auto iterator =
+            primitive.attributes.find(attributeNames[attribute]);
+        if (iterator == end(primitive.attributes)) {
+          continue;
+        }
+        const auto source = accessorData(model, buffers, iterator->second);
+        auto destination = vertices.data() + attributeOffsets[attribute] +
+                           size_t(packed.baseVertex) * source.elementSize;
+        for (size_t i = 0; i < source.count; ++i) {
+          std::memcpy(destination + i * source.elementSize,
+              source.data + i * source.stride, source.elementSize);
+        }
+        vertexCount = std::max(vertexCount, source.count);
+      }
+      auto destination =
+          indices.data() + size_t(packed.firstIndex) * data.indexSize;
+      if (primitive.indices >= 0) {
+        const auto source = accessorData(model, buffers, primitive.indices);
+        for (size_t i = 0; i < source.count; ++i) {
+          std::memcpy(destination + i * data.indexSize,
+              source.data + i * source.stride, data.indexSize);
+        }
+      } else {
+        for (uint32_t i = 0; i < uint32_t(vertexCount); ++i) {
+          std::memcpy(destination + i * data.indexSize, &i, data.indexSize);
+        }
+      }
+    }
+
+    auto &group = m_groups[groupIdx];
+    group.mode = GLenum(std::get<0>(data.key));
+    group.indexType = GLenum(std::get<1>(data.key));
+    glGenVertexArrays(1, &group.vertexArray);
+    glGenBuffers(1, &group.vertexBuffer);
+    glGenBuffers(1, &group.indexBuffer);
+    glBindVertexArray(group.vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, group.vertexBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER, GLsizeiptr(vertices.size()),
+        vertices.empty() ? nullptr : vertices.data(), 0);
+    for (int attribute = 0; attribute < attributeCount; ++attribute) {
+      if (!format[2 * attribute]) {
+        continue;
+      }
+      glEnableVertexAttribArray(GLuint(attribute));
+      glVertexAttribPointer(GLuint(attribute), format[2 * attribute + 1],
+          GLenum(format[2 * attribute]), GL_FALSE, 0,
+          (const GLvoid *)attributeOffsets[attribute]);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, group.indexBuffer);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, GLsizeiptr(indices.size()),
+        indices.empty() ? nullptr : indices.data(), 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_nGeometryBytes += vertices.size() + indices.size();
+  }
+
+  // One command per mesh node instance and primitive, those of a group
+  // contiguous and sorted by material
+  std::vector<std::vector<DrawElementsIndirectCommand>> groupCommands(
+      m_groups.size());
+  std::vector<std::vector<uint32_t>> groupEntries(m_groups.size());
+  std::vector<std::vector<uint32_t>> groupInstances(m_groups.size());
+  std::vector<std::vector<int>> groupMaterials(m_groups.size());
+  for (const auto entry : nodes.meshEntries()) {
+    const auto meshIdx = nodes.mesh(entry);
+    const auto &primitives = model.meshes[meshIdx].primitives;
+    for (size_t instance = 0; instance < nodes.instanceCount(entry);
+         ++instance) {
+      for (size_t pIdx = 0; pIdx < primitives.size(); ++pIdx) {
+        const auto &packed = packedPrimitives[meshIdx][pIdx];
+        groupCommands[packed.group].push_back(
+            {packed.indexCount, 1, packed.firstIndex, packed.baseVertex, 0});
+        groupEntries[packed.group].push_back(entry);
+        groupInstances[packed.group].push_back(uint32_t(instance));
+        groupMaterials[packed.group].push_back(primitives[pIdx].material >= 0
+                                                   ? primitives[pIdx].material
+                                                   : defaultMaterial);
+      }
+    }
+  }
+  std::vector<DrawElementsIndirectCommand> commands;
+  for (size_t groupIdx = 0; groupIdx < m_groups.size(); ++groupIdx) {
+    const auto &materials = groupMaterials[groupIdx];
+    std::vector<size_t> order(materials.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      order[i] = i;
+    }
+    std::stable_sort(begin(order), end(order), [&](size_t lhs, size_t rhs) {
+      return materials[lhs] < materials[rhs];
+    });
+    for (size_t i = 0; i < order.size(); ++i) {
+      const auto drawIdx = order[i];
+      if (i == 0 || materials[drawIdx] != m_batches.back().material) {
+        m_batches.push_back({groupIdx, commands.size(), 0, materials[drawIdx]});
+      }
+      ++m_batches.back().drawCount;
+      commands.push_back(groupCommands[groupIdx][drawIdx]);
+      m_drawEntries.push_back(groupEntries[groupIdx][drawIdx]);
+      m_drawInstances.push_back(groupInstances[groupIdx][drawIdx]);
+    }
+  }
+
+  glGenBuffers(1, &m_commandBuffer);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+  glBufferStorage(GL_DRAW_INDIRECT_BUFFER,
+      GLsizeiptr(commands.size() * sizeof(DrawElementsIndirectCommand)),
+      commands.empty() ? nullptr : commands.data(), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  // Storage blocks cannot be empty
+  glGenBuffers(1, &m_drawDataBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_drawDataBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(std::max(m_drawEntries.size(), size_t(1)) * sizeof(GpuDraw)),
+      nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  updateDrawData(nodes);
+}
+
+MultiDrawScene::~MultiDrawScene()
+{
+  for (const auto &group : m_groups) {
+    glDeleteVertexArrays(1, &group.vertexArray);
+    glDeleteBuffers(1, &group.vertexBuffer);
+    glDeleteBuffers(1, &group.indexBuffer);
+  }
+  glDeleteBuffers(1, &m_commandBuffer);
+  glDeleteBuffers(1, &m_drawDataBuffer);
+}
+
+std::vector<std::string> MultiDrawScene::shaderDefines()
+{
+  return {"MULTI_DRAW"};
+}
+
+void MultiDrawScene::setupProgram(GLuint program) const
+{
+  const auto block =
+      glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Draws");
+  if (block != GL_INVALID_INDEX) {
+    glShaderStorageBlockBinding(program, block, drawBinding);
+  }
+}
+
+void MultiDrawScene::updateDrawData(const NodeTable &nodes)
+{
+  if (m_drawEntries.empty()) {
+    return;
+  }
+  std::vector<GpuDraw> draws(m_drawEntries.size());
+  for (size_t i = 0; i < draws.size(); ++i) {
+    const auto &modelMatrix =
+        nodes.instanceWorldMatrix(m_drawEntries[i], m_drawInstances[i]);
+    const auto normalMatrix =
+        glm::mat4(glm::transpose(glm::inverse(glm::mat3(modelMatrix))));
+    std::memcpy(draws[i].modelMatrix, &modelMatrix[0][0], sizeof(glm::mat4));
+    std::memcpy(draws[i].normalMatrix, &normalMatrix[0][0], sizeof(glm::mat4));
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_drawDataBuffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+      GLsizeiptr(draws.size() * sizeof(GpuDraw)), draws.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void MultiDrawScene::draw(
+    GLint drawOffsetLocation, GLint materialIndexLocation) const
+{
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawBinding, m_drawDataBuffer);
+  size_t boundGroup = m_groups.size();
+  for (const auto &batch : m_batches) {
+    const auto &group = m_groups[batch.group];
+    // gl_DrawIDARB restarts from 0 at each call
+    glUniform1i(drawOffsetLocation, GLint(batch.firstDraw));
+    glUniform1i(materialIndexLocation, batch.material);
+    if (batch.group != boundGroup) {
+      glBindVertexArray(group.vertexArray);
+      boundGroup = batch.group;
+    }
+    glMultiDrawElementsIndirect(group.mode, group.indexType,
+        (const GLvoid *)(batch.firstDraw *
+                         sizeof(DrawElementsIndirectCommand)),
+        GLsizei(batch.drawCount), 0);
+  }
+  glBindVertexArray(0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawBinding, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
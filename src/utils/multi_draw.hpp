@@ -0,0 +1,99 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+class NodeTable;
+
+// Geometry of a scene packed for glMultiDrawElementsIndirect(), so that the
+// whole scene is drawn with one call per vertex format and material instead
+// of one glDrawElements() per primitive.
+//
+// Primitives with the same mode, index type and attribute formats (POSITION,
+// NORMAL and TEXCOORD_0) are copied into the vertex and index buffers of a
+// group, with one vertex array. Each group gets a DrawElementsIndirectCommand
+// per mesh node (per instance with EXT_mesh_gpu_instancing) and primitive,
+// and each command an element of the Draws shader storage block: the world
+// matrix of its node, indexed in the shaders compiled with shaderDefines() by
+// uDrawOffset + gl_DrawIDARB (GL_ARB_shader_draw_parameters).
+//
+// The commands of a group are sorted by material, and each run of commands
+// with the same material is one call that sets uMaterialIndex: an index
+// derived from gl_DrawIDARB is not dynamically uniform across the draws of a
+// call, and cannot select texture arrays or bindless samplers.
+//
+// All member functions must be called on the thread owning the GL context.
+class MultiDrawScene
+{
+public:
+  // buffers are the bytes of model.buffers. Primitives without material get
+  // defaultMaterial. Throw std::runtime_error if a primitive cannot be packed
+  // (sparse accessors, accessors without buffer view or out of their buffer).
+  MultiDrawScene(const tinygltf::Model &model,
+      const std::vector<BufferBytes> &buffers, const NodeTable &nodes,
+      int defaultMaterial);
+
+  ~MultiDrawScene();
+
+  MultiDrawScene(const MultiDrawScene &) = delete;
+
+  MultiDrawScene &operator=(const MultiDrawScene &) = delete;
+
+  // Vertex formats, one vertex array each
+  size_t groupCount() const { return m_groups.size(); }
+
+  // glMultiDrawElementsIndirect() calls, one per material of each group
+  size_t callCount() const { return m_batches.size(); }
+
+  // Commands of all groups
+  size_t drawCount() const { return m_drawEntries.size(); }
+
+  // Bytes of the packed vertices and indices
+  size_t geometryBytes() const { return m_nGeometryBytes; }
+
+  // MULTI_DRAW
+  static std::vector<std::string> shaderDefines();
+
+  // Connect the Draws block of program to what draw() binds
+  void setupProgram(GLuint program) const;
+
+  // Upload the world matrices of nodes again, once they changed
+  void updateDrawData(const NodeTable &nodes);
+
+  // Draw all groups with the current program, whose uDrawOffset and
+  // uMaterialIndex uniforms are at drawOffsetLocation and materialIndexLocation
+  void draw(GLint drawOffsetLocation, GLint materialIndexLocation) const;
+
+private:
+  struct Group
+  {
+    GLenum mode;
+    GLenum indexType;
+    GLuint vertexArray;
+    GLuint vertexBuffer; // Attribute after attribute
+    GLuint indexBuffer;
+  };
+
+  // Commands of a group with the same material
+  struct Batch
+  {
+    size_t group;
+    size_t firstDraw;
+    size_t drawCount;
+    int material;
+  };
+
+  std::vector<Group> m_groups;
+  std::vector<Batch> m_batches;
+  GLuint m_commandBuffer = 0;
+  GLuint m_drawDataBuffer = 0;
+  std::vector<uint32_t> m_drawEntries; // NodeTable entry of each draw
+  std::vector<uint32_t> m_drawInstances;
+  size_t m_nGeometryBytes = 0;
+};
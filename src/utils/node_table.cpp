@@ -0,0 +1,107 @@
+#include "node_table.hpp"
+
+#include <algorithm>
+#include <utility>
+
+NodeTable::NodeTable(
+    const tinygltf::Model &model, const std::vector<BufferBytes> &buffers)
+{
+  m_firstInstances.push_back(0);
+  if (model.defaultScene < 0) {
+    return;
+  }
+
+  // Depth first, children in order, without recursion. glTF nodes have one
+  // parent at most, visited guards against files that break that rule.
+  std::vector<bool> visited(model.nodes.size(), false);
+  std::vector<std::pair<int, int>> stack; // Node and entry of its parent
+  const auto &roots = model.scenes[model.defaultScene].nodes;
+  for (auto root = roots.rbegin(); root != roots.rend(); ++root) {
+    stack.emplace_back(*root, -1);
+  }
+  while (!stack.empty()) {
+    const auto nodeIdx = stack.back().first;
+    const auto parent = stack.back().second;
+    stack.pop_back();
+    if (nodeIdx < 0 || size_t(nodeIdx) >= model.nodes.size() ||
+        visited[nodeIdx]) {
+      continue;
+    }
+    visited[nodeIdx] = true;
+
+    const auto &node = model.nodes[nodeIdx];
+    const auto entry = int(m_nodes.size());
+    const auto localMatrix = getLocalToWorldMatrix(node, glm::mat4(1));
+    m_nodes.push_back(nodeIdx);
+    m_parents.push_back(parent);
+    m_meshes.push_back(node.mesh);
+    m_localMatrices.push_back(localMatrix);
+    m_worldMatrices.push_back(
+        parent >= 0 ? m_worldMatrices[parent] * localMatrix : localMatrix);
+    if (node.mesh >= 0) {
+      m_meshEntries.push_back(uint32_t(entry));
+      const auto instanceMatrices = getInstanceMatrices(model, buffers, node);
+      for (const auto &instanceMatrix : instanceMatrices) {
+        m_instanceMatrices.push_back(instanceMatrix);
+        m_instanceWorldMatrices.push_back(
+            m_worldMatrices.back() * instanceMatrix);
+      }
+    }
+    m_firstInstances.push_back(uint32_t(m_instanceMatrices.size()));
+    for (auto child = node.children.rbegin(); child != node.children.rend();
+         ++child) {
+      stack.emplace_back(*child, entry);
+    }
+  }
+
+  // Descendants directly follow their ancestors
+  m_subtreeEnds.resize(m_nodes.size());
+  for (size_t entry = m_nodes.size(); entry-- > 0;) {
+    m_subtreeEnds[entry] = std::max(m_subtreeEnds[entry], uint32_t(entry + 1));
+    if (m_parents[entry] >= 0) {
+      auto &parentEnd = m_subtreeEnds[m_parents[entry]];
+      parentEnd = std::max(parentEnd, m_subtreeEnds[entry]);
+    }
+  }
+  m_dirty.assign(m_nodes.size(), 0);
+}
+
+void NodeTable::setLocalMatrix(size_t entry, const glm::mat4 &matrix)
+{
+  m_localMatrices[entry] = matrix;
+  m_dirty[entry] = 1;
+  if (m_nFirstDirty == m_nDirtyEnd) {
+    m_nFirstDirty = entry;
+    m_nDirtyEnd = m_subtreeEnds[entry];
+  } else {
+    m_nFirstDirty = std::min(m_nFirstDirty, entry);
+    m_nDirtyEnd = std::max(m_nDirtyEnd, size_t(m_subtreeEnds[entry]));
+  }
+}
+
+size_t NodeTable::updateWorldMatrices()
+{
+  size_t updatedCount = 0;
+  // End of the subtrees of the dirty entries met so far
+  size_t subtreeEnd = 0;
+  for (auto entry = m_nFirstDirty; entry < m_nDirtyEnd; ++entry) {
+    if (m_dirty[entry]) {
+      m_dirty[entry] = 0;
+      subtreeEnd = std::max(subtreeEnd, size_t(m_subtreeEnds[entry]));
+    }
+    if (entry < subtreeEnd) {
+      const auto parent = m_parents[entry];
+      m_worldMatrices[entry] =
+          parent >= 0 ? m_worldMatrices[parent] * m_localMatrices[entry]
+                      : m_localMatrices[entry];
+      for (auto instance = m_firstInstances[entry];
+           instance < m_firstInstances[entry + 1]; ++instance) {
+        m_instanceWorldMatrices[instance] =
+            m_worldMatrices[entry] * m_instanceMatrices[instance];
+      }
+      ++updatedCount;
+    }
+  }
+  m_nFirstDirty = m_nDirtyEnd = 0;
+  return updatedCount;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "gltf.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Nodes of the default scene of a model, flattened in depth first order so
+// that each node comes after its parent and before its descendants, which
+// directly follow it. Each property is stored in its own array (indexed by
+// entry), so that walking the table reads memory linearly.
+//
+// Local matrices are built once from the TRS or matrix of the nodes, and world
+// matrices are cached: setLocalMatrix() marks an entry dirty, and
+// updateWorldMatrices() only recomputes the subtrees of dirty entries, nothing
+// for a static scene. So are the world matrices of the instances of nodes with
+// EXT_mesh_gpu_instancing.
+class NodeTable
+{
+public:
+  NodeTable() = default;
+
+  // buffers are the bytes of model.buffers, read for EXT_mesh_gpu_instancing
+  NodeTable(
+      const tinygltf::Model &model, const std::vector<BufferBytes> &buffers);
+
+  size_t size() const { return m_nodes.size(); }
+
+  // Index of the node of entry in model.nodes
+  int node(size_t entry) const { return m_nodes[entry]; }
+
+  // Entry of the parent of entry, -1 for the roots of the scene
+  int parent(size_t entry) const { return m_parents[entry]; }
+
+  // One past the last descendant of entry
+  size_t subtreeEnd(size_t entry) const { return m_subtreeEnds[entry]; }
+
+  // Mesh of the node of entry, -1 if none
+  int mesh(size_t entry) const { return m_meshes[entry]; }
+
+  const glm::mat4 &localMatrix(size_t entry) const
+  {
+    return m_localMatrices[entry];
+  }
+
+  // As of the last updateWorldMatrices()
+  const glm::mat4 &worldMatrix(size_t entry) const
+  {
+    return m_worldMatrices[entry];
+  }
+
+  // Times the mesh of entry is drawn: the number of instances of its node with
+  // EXT_mesh_gpu_instancing, 1 without
+  size_t instanceCount(size_t entry) const
+  {
+    return std::max(
+        size_t(m_firstInstances[entry + 1] - m_firstInstances[entry]),
+        size_t(1));
+  }
+
+  // World matrix of an instance of entry, worldMatrix() without
+  // EXT_mesh_gpu_instancing
+  const glm::mat4 &instanceWorldMatrix(size_t entry, size_t instance) const
+  {
+    return m_firstInstances[entry] == m_firstInstances[entry + 1]
+               ? m_worldMatrices[entry]
+               : m_instanceWorldMatrices[m_firstInstances[entry] + instance];
+  }
+
+  // Entries with a mesh, in the order the recursive traversal of the scene
+  // visits them
+  const std::vector<uint32_t> &meshEntries() const { return m_meshEntries; }
+
+  // The world matrices of entry and of its descendants are recomputed by the
+  // next updateWorldMatrices()
+  void setLocalMatrix(size_t entry, const glm::mat4 &matrix);
+
+  // Recompute the world matrices of the subtrees of dirty entries, in one pass
+  // from the first dirty entry. Return the number of matrices recomputed.
+  size_t updateWorldMatrices();
+
+private:
+  std::vector<int> m_nodes;
+  std::vector<int> m_parents;
+  std::vector<uint32_t> m_subtreeEnds;
+  std::vector<int> m_meshes;
+  std::vector<glm::mat4> m_localMatrices;
+  std::vector<glm::mat4> m_worldMatrices;
+  std::vector<uint8_t> m_dirty;
+  // Instances of entry e are in [m_firstInstances[e], m_firstInstances[e + 1])
+  std::vector<uint32_t> m_firstInstances;
+  std::vector<glm::mat4> m_instanceMatrices; // Relative to their node
+  std::vector<glm::mat4> m_instanceWorldMatrices;
+  std::vector<uint32_t> m_meshEntries;
+  // Range of entries holding the dirty ones and their descendants, empty when
+  // all world matrices are up to date
+  size_t m_nFirstDirty = 0;
+  size_t m_nDirtyEnd = 0;
+};
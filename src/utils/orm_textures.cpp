@@ -0,0 +1,240 @@
+#include "orm_textures.hpp"
+#include "image_decoders.hpp"
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+// Level 0 of an image as RGBA8
+struct Rgba8
+{
+  int width = 0;
+  int height = 0;
+  std::vector<unsigned char> pixels;
+};
+
+bool loadRgba8(const tinygltf::Image &image, Rgba8 &rgba)
+{
+  if (image.image.empty() || isKtx2(image.image.data(), image.image.size())) {
+    return false;
+  }
+  DecodedImage decoded;
+  if (image.as_is) {
+    std::string err;
+    if (!decodeImage(image.image.data(), image.image.size(), decoded, err)) {
+      std::cerr << "Unable to decode image '" << image.uri << "': " << err
+                << std::endl;
+      return false;
+    }
+  } else {
+    if (image.component != 4 || (image.bits != 8 && image.bits != 16)) {
+      return false;
+    }
+    decoded.width = image.width;
+    decoded.height = image.height;
+    decoded.bits = image.bits;
+  }
+  const auto &pixels = image.as_is ? decoded.pixels : image.image;
+  const auto count = size_t(decoded.width) * decoded.height * 4;
+  if (decoded.width <= 0 || decoded.height <= 0 ||
+      pixels.size() < count * (decoded.bits / 8)) {
+    return false;
+  }
+
+  rgba.width = decoded.width;
+  rgba.height = decoded.height;
+  rgba.pixels.resize(count);
+  if (decoded.bits == 8) {
+    std::copy_n(pixels.data(), count, rgba.pixels.data());
+  } else {
+    for (size_t i = 0; i < count; ++i) {
+      uint16_t value;
+      std::memcpy(&value, pixels.data() + 2 * i, sizeof(value));
+      rgba.pixels[i] = (unsigned char)((value * 255u + 32767u) / 65535u);
+    }
+  }
+  return true;
+}
+
+// Channel of image at the texel (x, y) of an image of width x height covering
+// the same texture coordinates, filtered bilinearly with repeat wrapping
+unsigned char sampleChannel(
+    const Rgba8 &image, int x, int y, int width, int height, int channel)
+{
+  const auto texel = [&](int tx, int ty) {
+    tx = (tx % image.width + image.width) % image.width;
+    ty = (ty % image.height + image.height) % image.height;
+    return float(
+        image.pixels[4 * (size_t(ty) * image.width + tx) + size_t(channel)]);
+  };
+  if (width == image.width && height == image.height) {
+    return (unsigned char)texel(x, y);
+  }
+  const auto u = (x + 0.5f) * image.width / width - 0.5f;
+  const auto v = (y + 0.5f) * image.height / height - 0.5f;
+  const auto x0 = int(std::floor(u));
+  const auto y0 = int(std::floor(v));
+  const auto fx = u - float(x0);
+  const auto fy = v - float(y0);
+  const auto top = texel(x0, y0) * (1 - fx) + texel(x0 + 1, y0) * fx;
+  const auto bottom =
+      texel(x0, y0 + 1) * (1 - fx) + texel(x0 + 1, y0 + 1) * fx;
+  return (unsigned char)std::lround(top * (1 - fy) + bottom * fy);
+}
+
+// Occlusion in red, and metallic-roughness in green and blue (black without
+// metallicRoughness), at the largest size of the two
+tinygltf::Image mergeOrmImage(
+    const Rgba8 &occlusion, const Rgba8 *metallicRoughness)
+{
+  tinygltf::Image merged;
+  merged.width = occlusion.width;
+  merged.height = occlusion.height;
+  if (metallicRoughness) {
+    merged.width = std::max(merged.width, metallicRoughness->width);
+    merged.height = std::max(merged.height, metallicRoughness->height);
+  }
+  merged.component = 4;
+  merged.bits = 8;
+  merged.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+  merged.image.resize(size_t(merged.width) * merged.height * 4);
+  for (int y = 0; y < merged.height; ++y) {
+    for (int x = 0; x < merged.width; ++x) {
+      auto pixel = &merged.image[4 * (size_t(y) * merged.width + x)];
+      pixel[0] =
+          sampleChannel(occlusion, x, y, merged.width, merged.height, 0);
+      pixel[1] = metallicRoughness ? sampleChannel(*metallicRoughness, x, y,
+                                         merged.width, merged.height, 1)
+                                   : 0;
+      pixel[2] = metallicRoughness ? sampleChannel(*metallicRoughness, x, y,
+                                         merged.width, merged.height, 2)
+                                   : 0;
+      pixel[3] = 255;
+    }
+  }
+  return merged;
+}
+
+} // namespace
+
+OrmPackingStats packOcclusionTextures(tinygltf::Model &model)
+{
+  OrmPackingStats stats;
+  const auto imageOf = [&](int textureIdx) {
+    return textureIdx >= 0 && size_t(textureIdx) < model.textures.size()
+               ? model.textures[textureIdx].source
+               : -1;
+  };
+
+  // Merged image of each pair of occlusion and metallic-roughness images (-1
+  // without metallic-roughness), -1 when they cannot be merged
+  std::map<std::pair<int, int>, int> mergedImages;
+  // Texture of each merged image and sampler
+  std::map<std::pair<int, int>, int> mergedTextures;
+  // Textures materials may not read anymore
+  std::set<int> replacedTextures;
+
+  for (auto &material : model.materials) {
+    auto &occlusion = material.occlusionTexture;
+    auto &metallicRoughness =
+        material.pbrMetallicRoughness.metallicRoughnessTexture;
+    const auto occlusionImage = imageOf(occlusion.index);
+    if (occlusionImage < 0) {
+      occlusion.strength = 0;
+      continue;
+    }
+    const auto metallicRoughnessImage = imageOf(metallicRoughness.index);
+    if (metallicRoughnessImage == occlusionImage) {
+      ++stats.sharedMaterialCount;
+      continue;
+    }
+
+    const auto imageKey =
+        std::make_pair(occlusionImage, metallicRoughnessImage);
+    auto mergedImage = mergedImages.find(imageKey);
+    if (mergedImage == end(mergedImages)) {
+      Rgba8 occlusionPixels;
+      Rgba8 metallicRoughnessPixels;
+      auto imageIdx = -1;
+      if (loadRgba8(model.images[occlusionImage], occlusionPixels) &&
+          (metallicRoughnessImage < 0 ||
+              loadRgba8(model.images[metallicRoughnessImage],
+                  metallicRoughnessPixels))) {
+        auto image = mergeOrmImage(occlusionPixels,
+            metallicRoughnessImage >= 0 ? &metallicRoughnessPixels : nullptr);
+        image.name = "ORM of images " + std::to_string(occlusionImage) +
+                     " and " + std::to_string(metallicRoughnessImage);
+        imageIdx = int(model.images.size());
+        model.images.push_back(std::move(image));
+        ++stats.packedImageCount;
+      }
+      mergedImage = mergedImages.emplace(imageKey, imageIdx).first;
+    }
+
+    replacedTextures.insert(occlusion.index);
+    if (mergedImage->second < 0) {
+      occlusion.index = -1;
+      occlusion.strength = 0;
+      ++stats.droppedOcclusionCount;
+      continue;
+    }
+
+    const auto sampler =
+        model.textures[metallicRoughnessImage >= 0 ? metallicRoughness.index
+                                                   : occlusion.index]
+            .sampler;
+    const auto textureKey = std::make_pair(mergedImage->second, sampler);
+    auto mergedTexture = mergedTextures.find(textureKey);
+    if (mergedTexture == end(mergedTextures)) {
+      tinygltf::Texture texture;
+      texture.source = mergedImage->second;
+      texture.sampler = sampler;
+      mergedTexture =
+          mergedTextures.emplace(textureKey, int(model.textures.size())).first;
+      model.textures.push_back(std::move(texture));
+    }
+    if (metallicRoughness.index >= 0) {
+      replacedTextures.insert(metallicRoughness.index);
+    }
+    occlusion.index = mergedTexture->second;
+    metallicRoughness.index = mergedTexture->second;
+    ++stats.packedMaterialCount;
+  }
+
+  // Release the images of the replaced textures no material reads anymore
+  for (const auto &material : model.materials) {
+    for (const auto textureIdx :
+        {material.pbrMetallicRoughness.baseColorTexture.index,
+            material.pbrMetallicRoughness.metallicRoughnessTexture.index,
+            material.normalTexture.index, material.occlusionTexture.index,
+            material.emissiveTexture.index}) {
+      replacedTextures.erase(textureIdx);
+    }
+  }
+  std::set<int> releasedImages;
+  for (const auto textureIdx : replacedTextures) {
+    if (model.textures[textureIdx].source >= 0) {
+      releasedImages.insert(model.textures[textureIdx].source);
+    }
+    model.textures[textureIdx].source = -1;
+  }
+  for (const auto &texture : model.textures) {
+    releasedImages.erase(texture.source);
+  }
+  for (const auto imageIdx : releasedImages) {
+    auto &image = model.images[imageIdx];
+    std::vector<unsigned char>().swap(image.image);
+    image.as_is = false;
+  }
+  return stats;
+}
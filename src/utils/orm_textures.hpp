@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <tiny_gltf.h>
+
+// Occlusion, roughness and metallic (ORM) in one texture. glTF lets occlusion
+// share the red channel of the metallic-roughness image (roughness in green,
+// metalness in blue), but exporters often write them to separate images,
+// which costs a texture fetch and a texture binding per material.
+//
+// packOcclusionTextures() rewrites the materials of a model so that all of
+// them read occlusion from the red channel of their metallic-roughness
+// texture, which shaders compiled with ORM_TEXTURES rely on. Each pair of
+// distinct occlusion and metallic-roughness images gets a new image, merged
+// on the CPU before textures are created.
+
+struct OrmPackingStats
+{
+  size_t packedMaterialCount = 0; // Moved to a merged image
+  size_t sharedMaterialCount = 0; // Already reading one image
+  size_t packedImageCount = 0;    // Merged images appended to the model
+  size_t droppedOcclusionCount = 0;
+};
+
+// Materials whose occlusion and metallic-roughness images are distinct get a
+// new texture, with the sampler of the metallic-roughness texture, of a new
+// image holding occlusion in red (bilinearly resampled if the sizes differ)
+// and metallic-roughness in green and blue, black without a metallic-roughness
+// texture like the fallback of the shaders. Materials without occlusion get
+// an occlusion strength of 0, since their metallic-roughness texel is not
+// white. KTX2 images and images that fail to decode cannot be merged: those
+// materials lose their occlusion. Images no texture reads anymore are
+// released. Images left encoded by the loader are decoded for the merge, and
+// stay encoded in the model.
+OrmPackingStats packOcclusionTextures(tinygltf::Model &model);
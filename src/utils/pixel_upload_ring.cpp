@@ -0,0 +1,155 @@
+#include "pixel_upload_ring.hpp"
+
+#include <stdexcept>
+
+namespace
+{
+
+// glTex*Image require the offset to be a multiple of the pixel type size, and
+// workers copy faster into aligned memory
+const size_t regionAlignment = 64;
+
+size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool isSignaled(GLsync fence, GLbitfield flags, GLuint64 timeout)
+{
+  const auto status = glClientWaitSync(fence, flags, timeout);
+  return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+} // namespace
+
+PixelUploadRing::PixelUploadRing(size_t capacity) : m_nCapacity(capacity)
+{
+  const GLbitfield flags =
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &m_bufferObject);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_bufferObject);
+  glBufferStorage(GL_PIXEL_UNPACK_BUFFER, m_nCapacity, nullptr, flags);
+  m_pMapped = (unsigned char *)glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, m_nCapacity, flags);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (!m_pMapped) {
+    glDeleteBuffers(1, &m_bufferObject);
+    throw std::runtime_error("Unable to map pixel upload buffer");
+  }
+}
+
+PixelUploadRing::~PixelUploadRing()
+{
+  for (auto &allocation : m_allocations) {
+    if (allocation.fence) {
+      glClientWaitSync(
+          allocation.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+      glDeleteSync(allocation.fence);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_bufferObject);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glDeleteBuffers(1, &m_bufferObject);
+}
+
+unsigned char *PixelUploadRing::tryAllocate(
+    size_t size, PixelUploadRegion &region)
+{
+  if (size == 0) {
+    return nullptr;
+  }
+  const auto alignedSize = alignUp(size, regionAlignment);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  size_t offset;
+  if (m_allocations.empty()) {
+    if (alignedSize > m_nCapacity) {
+      return nullptr;
+    }
+    offset = 0;
+  } else {
+    // Head and tail are only equal when the ring is empty, hence the strict
+    // comparisons against the tail
+    const auto tail = m_allocations.front().offset;
+    if (m_nHead >= tail) {
+      if (m_nCapacity - m_nHead >= alignedSize) {
+        offset = m_nHead;
+      } else if (tail > alignedSize) {
+        offset = 0; // Wrap around
+      } else {
+        return nullptr;
+      }
+    } else if (tail - m_nHead > alignedSize) {
+      offset = m_nHead;
+    } else {
+      return nullptr;
+    }
+  }
+
+  m_allocations.push_back({offset, alignedSize, false, nullptr});
+  m_nHead = offset + alignedSize;
+  region.offset = offset;
+  region.size = size;
+  return m_pMapped + offset;
+}
+
+void PixelUploadRing::bind() const
+{
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_bufferObject);
+}
+
+void PixelUploadRing::unbind() const
+{
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void PixelUploadRing::release(const PixelUploadRegion &region)
+{
+  const auto fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto &allocation : m_allocations) {
+    if (allocation.offset == region.offset && !allocation.released) {
+      allocation.released = true;
+      allocation.fence = fence;
+      return;
+    }
+  }
+  glDeleteSync(fence); // Unknown region
+}
+
+void PixelUploadRing::retire(bool waitForOldest)
+{
+  if (waitForOldest) {
+    GLsync oldest = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      for (const auto &allocation : m_allocations) {
+        if (allocation.fence) {
+          oldest = allocation.fence;
+          break;
+        }
+      }
+    }
+    // Only the GL thread deletes fences, oldest stays valid while unlocked
+    if (oldest) {
+      isSignaled(oldest, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto &allocation : m_allocations) {
+    if (allocation.fence && isSignaled(allocation.fence, 0, 0)) {
+      glDeleteSync(allocation.fence);
+      allocation.fence = nullptr;
+    }
+  }
+  while (!m_allocations.empty() && m_allocations.front().released &&
+         !m_allocations.front().fence) {
+    m_allocations.pop_front();
+  }
+  if (m_allocations.empty()) {
+    m_nHead = 0;
+  }
+}
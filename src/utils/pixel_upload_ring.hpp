@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <glad/glad.h>
+#include <mutex>
+
+// Region of a PixelUploadRing holding the pixels of one upload
+struct PixelUploadRegion
+{
+  size_t offset = 0;
+  size_t size = 0; // 0 when the pixels are not in the ring
+
+  bool empty() const { return size == 0; }
+};
+
+// Persistently mapped GL_PIXEL_UNPACK_BUFFER used as a ring of staging memory
+// for texture uploads. Any thread can reserve a region and write pixels into
+// it; the GL thread then issues glTex*Image calls reading from it, which only
+// queue a DMA instead of copying client memory synchronously, and releases
+// the region. A fence per region tells when the GPU is done reading it.
+//
+// Construction, release(), retire() and destruction must happen on the thread
+// owning the GL context.
+class PixelUploadRing
+{
+public:
+  explicit PixelUploadRing(size_t capacity);
+
+  ~PixelUploadRing();
+
+  PixelUploadRing(const PixelUploadRing &) = delete;
+
+  PixelUploadRing &operator=(const PixelUploadRing &) = delete;
+
+  size_t capacity() const { return m_nCapacity; }
+
+  // Thread safe. Reserve size bytes and return where to write them, or
+  // nullptr if the ring is too full. It never waits for the GPU.
+  unsigned char *tryAllocate(size_t size, PixelUploadRegion &region);
+
+  // Bind the ring to GL_PIXEL_UNPACK_BUFFER. While it is bound, the pixel
+  // pointer of glTex*Image calls is an offset in the ring.
+  void bind() const;
+
+  void unbind() const;
+
+  // Called once all upload commands reading region are issued
+  void release(const PixelUploadRegion &region);
+
+  // Free the regions the GPU has finished reading. With waitForOldest, block
+  // until the oldest released region can be freed.
+  void retire(bool waitForOldest = false);
+
+private:
+  struct Allocation
+  {
+    size_t offset;
+    size_t size;
+    bool released;
+    GLsync fence; // Set by release()
+  };
+
+  GLuint m_bufferObject = 0;
+  unsigned char *m_pMapped = nullptr;
+  size_t m_nCapacity = 0;
+
+  std::mutex m_mutex;
+  std::deque<Allocation> m_allocations; // In allocation order
+  size_t m_nHead = 0;                   // Where the next allocation starts
+};
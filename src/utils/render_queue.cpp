@@ -0,0 +1,105 @@
+#include "render_queue.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+const int depthShift = 0;
+const int vertexArrayShift = depthShift + sortKeyDepthBits;
+const int materialShift = vertexArrayShift + sortKeyVertexArrayBits;
+const int programShift = materialShift + sortKeyMaterialBits;
+
+uint64_t field(uint32_t value, int bits, int shift)
+{
+  const auto maxValue = (uint64_t(1) << bits) - 1;
+  return std::min(uint64_t(value), maxValue) << shift;
+}
+
+} // namespace
+
+uint64_t makeSortKey(
+    uint32_t program, uint32_t material, uint32_t vertexArray, float depth)
+{
+  const auto depthSteps = float((1 << sortKeyDepthBits) - 1);
+  const auto quantizedDepth =
+      uint32_t(std::lround(std::min(std::max(depth, 0.f), 1.f) * depthSteps));
+  return field(program, sortKeyProgramBits, programShift) |
+         field(material, sortKeyMaterialBits, materialShift) |
+         field(vertexArray, sortKeyVertexArrayBits, vertexArrayShift) |
+         field(quantizedDepth, sortKeyDepthBits, depthShift);
+}
+
+void radixSortDrawItems(
+    std::vector<DrawItem> &items, std::vector<DrawItem> &scratch)
+{
+  if (items.size() < 2) {
+    return;
+  }
+  // Bits set in some keys and not in others
+  auto allOnes = ~uint64_t(0);
+  uint64_t anyOnes = 0;
+  for (const auto &item : items) {
+    allOnes &= item.key;
+    anyOnes |= item.key;
+  }
+  const auto varyingBits = allOnes ^ anyOnes;
+
+  scratch.resize(items.size());
+  for (int shift = 0; shift < 64; shift += 8) {
+    if (((varyingBits >> shift) & 0xFF) == 0) {
+      continue;
+    }
+    size_t offsets[256] = {};
+    for (const auto &item : items) {
+      ++offsets[(item.key >> shift) & 0xFF];
+    }
+    size_t offset = 0;
+    for (auto &count : offsets) {
+      const auto bucketSize = count;
+      count = offset;
+      offset += bucketSize;
+    }
+    for (const auto &item : items) {
+      scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+    }
+    items.swap(scratch);
+  }
+}
+
+DrawStats &DrawStats::operator+=(const DrawStats &other)
+{
+  drawCalls += other.drawCalls;
+  materialChanges += other.materialChanges;
+  vertexArrayChanges += other.vertexArrayChanges;
+  matrixChanges += other.matrixChanges;
+  return *this;
+}
+
+DrawStats countStateChanges(
+    const std::vector<DrawItem> &items, bool instanced)
+{
+  DrawStats stats;
+  const DrawItem *previous = nullptr;
+  for (const auto &item : items) {
+    if (instanced && previous && item.primitive == previous->primitive) {
+      previous = &item;
+      continue;
+    }
+    ++stats.drawCalls;
+    if (!previous || item.material != previous->material) {
+      ++stats.materialChanges;
+    }
+    // Each primitive has its own vertex array
+    if (!previous || item.primitive != previous->primitive) {
+      ++stats.vertexArrayChanges;
+    }
+    if (!instanced && (!previous || item.nodeEntry != previous->nodeEntry ||
+                          item.instance != previous->instance)) {
+      ++stats.matrixChanges;
+    }
+    previous = &item;
+  }
+  return stats;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Draws of a pass collected as items with a 64 bits sort key, sorted so that
+// consecutive draws share as much GL state as possible. From the most to the
+// least significant bits, keys hold the program, the material, the vertex
+// array, then the depth of the draw front to back, so that draws sharing the
+// rest of their state hide what later ones would shade. Fields are clamped, so
+// keys only order items: state changes compare the items themselves.
+
+struct DrawItem
+{
+  uint64_t key;
+  uint32_t nodeEntry; // See NodeTable
+  uint32_t primitive; // Among all primitives, in the order of their VAOs
+  uint32_t instance;  // See NodeTable::instanceWorldMatrix()
+  int32_t material;   // Of the primitive, -1 if none
+};
+
+// Bits of each field of sort keys
+const int sortKeyProgramBits = 8;
+const int sortKeyMaterialBits = 20;
+const int sortKeyVertexArrayBits = 20;
+const int sortKeyDepthBits = 16;
+
+// Values too large for their field are clamped, depth is clamped to [0, 1]
+uint64_t makeSortKey(
+    uint32_t program, uint32_t material, uint32_t vertexArray, float depth);
+
+// Stable least significant digit radix sort of items by key, 8 bits per pass.
+// Passes over bytes all keys share are skipped. scratch is used as the second
+// buffer of the passes.
+void radixSortDrawItems(
+    std::vector<DrawItem> &items, std::vector<DrawItem> &scratch);
+
+// GL state changed by drawing items in a given order
+struct DrawStats
+{
+  size_t drawCalls = 0;
+  size_t materialChanges = 0;    // Uniforms and textures of a material
+  size_t vertexArrayChanges = 0; // glBindVertexArray()
+  size_t matrixChanges = 0;      // Matrices of a node
+
+  DrawStats &operator+=(const DrawStats &other);
+};
+
+// State changes of drawing items in their current order, only changing state
+// between items with different materials, primitives or nodes. With instanced, consecutive items of
+// the same primitive are one instanced draw, with matrices read from an
+// instance buffer instead of uploaded per draw.
+DrawStats countStateChanges(
+    const std::vector<DrawItem> &items, bool instanced = false);
@@ -0,0 +1,531 @@
+#include "scene_cache.hpp"
+#include "gltf.hpp"
+#include "hash.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+
+const uint32_t cacheMagic = 0x43534756; // "VGSC" little endian
+// Bump each time the layout of the cache changes
+const uint32_t cacheVersion = 2;
+// Alignment of blobs in the file, so that they can be used straight from the
+// mapping
+const size_t blobAlignment = 64;
+
+struct CacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceHash;     // Content hash of the .gltf/.glb file
+  uint64_t metadataSize;   // Metadata directly follows the header
+  uint64_t blobsOffset;    // Offset of the first blob in the file
+};
+
+// External file of a .gltf. Only checked for size and modification time,
+// hashing them would cost as much as reading them.
+struct Dependency
+{
+  std::string uri;
+  uint64_t size = 0;
+  int64_t modificationTime = 0;
+};
+
+size_t alignUp(size_t value, size_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t hashFile(const fs::path &path)
+{
+  const MappedFile file(path);
+  return hashBytes(file.data(), file.size());
+}
+
+bool statFile(const fs::path &path, Dependency &dependency)
+{
+  std::error_code error;
+  const auto size = fs::file_size(path, error);
+  if (error) {
+    return false;
+  }
+  const auto time = fs::last_write_time(path, error);
+  if (error) {
+    return false;
+  }
+  dependency.size = size;
+  dependency.modificationTime = int64_t(time.time_since_epoch().count());
+  return true;
+}
+
+bool isExternalUri(const std::string &uri)
+{
+  return !uri.empty() && uri.compare(0, 5, "data:") != 0;
+}
+
+std::vector<Dependency> collectDependencies(
+    const fs::path &gltfFile, const tinygltf::Model &model)
+{
+  std::vector<std::string> uris;
+  for (const auto &buffer : model.buffers) {
+    if (isExternalUri(buffer.uri)) {
+      uris.push_back(buffer.uri);
+    }
+  }
+  for (const auto &image : model.images) {
+    if (isExternalUri(image.uri)) {
+      uris.push_back(image.uri);
+    }
+  }
+
+  std::vector<Dependency> dependencies;
+  for (const auto &uri : uris) {
+    Dependency dependency;
+    dependency.uri = uri;
+    // Percent encoded URIs are not found and thus not tracked
+    if (statFile(gltfFile.parent_path() / uri, dependency)) {
+      dependencies.push_back(dependency);
+    }
+  }
+  return dependencies;
+}
+
+// Serialization of the parts of the model used for rendering. The same
+// transfer() functions are used to write and read, the writer does not modify
+// the values it is given.
+
+template <typename Archive> void transfer(Archive &archive, glm::vec3 &v)
+{
+  archive(v.x, v.y, v.z);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, Dependency &dependency)
+{
+  archive(dependency.uri, dependency.size, dependency.modificationTime);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Scene &scene)
+{
+  archive(scene.name, scene.nodes);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Node &node)
+{
+  // EXT_mesh_gpu_instancing is the only extension of nodes the viewer reads
+  auto instancing = getInstancingAttributes(node);
+  archive(node.name, node.mesh, node.children, node.matrix, node.rotation,
+      node.scale, node.translation, instancing);
+  if (instancing != getInstancingAttributes(node)) {
+    setInstancingAttributes(node, instancing);
+  }
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Primitive &primitive)
+{
+  archive(primitive.attributes, primitive.material, primitive.indices,
+      primitive.mode);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Mesh &mesh)
+{
+  archive(mesh.name, mesh.primitives);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Accessor &accessor)
+{
+  // minValues and maxValues of POSITION accessors are the primitive bounds
+  archive(accessor.bufferView, accessor.byteOffset, accessor.normalized,
+      accessor.componentType, accessor.count, accessor.type,
+      accessor.minValues, accessor.maxValues);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::BufferView &bufferView)
+{
+  archive(bufferView.buffer, bufferView.byteOffset, bufferView.byteLength,
+      bufferView.byteStride, bufferView.target);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::TextureInfo &info)
+{
+  archive(info.index, info.texCoord);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::NormalTextureInfo &info)
+{
+  archive(info.index, info.texCoord, info.scale);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::OcclusionTextureInfo &info)
+{
+  archive(info.index, info.texCoord, info.strength);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::PbrMetallicRoughness &pbr)
+{
+  archive(pbr.baseColorFactor, pbr.baseColorTexture, pbr.metallicFactor,
+      pbr.roughnessFactor, pbr.metallicRoughnessTexture);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Material &material)
+{
+  archive(material.name, material.emissiveFactor, material.alphaMode,
+      material.alphaCutoff, material.doubleSided,
+      material.pbrMetallicRoughness, material.normalTexture,
+      material.occlusionTexture, material.emissiveTexture);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Sampler &sampler)
+{
+  archive(sampler.minFilter, sampler.magFilter, sampler.wrapS, sampler.wrapT,
+      sampler.wrapR);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Texture &texture)
+{
+  archive(texture.sampler, texture.source);
+}
+
+// Pixels are stored as blobs, see writeSceneCache()
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Image &image)
+{
+  archive(image.name, image.width, image.height, image.component, image.bits,
+      image.pixel_type);
+}
+
+template <typename Archive>
+void transfer(Archive &archive, tinygltf::Model &model)
+{
+  archive(model.defaultScene, model.scenes, model.nodes, model.meshes,
+      model.accessors, model.bufferViews, model.materials, model.samplers,
+      model.textures, model.images);
+}
+
+class CacheWriter
+{
+public:
+  template <typename... Ts> void operator()(const Ts &... values)
+  {
+    using expand = int[];
+    (void)expand{0, (write(values), 0)...};
+  }
+
+  // Reference size bytes of data, written after the metadata
+  void blob(const unsigned char *data, size_t size)
+  {
+    write(uint64_t(m_nBlobsSize));
+    write(uint64_t(size));
+    m_blobs.push_back({data, size});
+    m_nBlobsSize = alignUp(m_nBlobsSize + size, blobAlignment);
+  }
+
+  const std::vector<unsigned char> &metadata() const { return m_metadata; }
+
+  const std::vector<BufferBytes> &blobs() const { return m_blobs; }
+
+private:
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic<T>::value> write(const T &value)
+  {
+    const auto bytes = reinterpret_cast<const unsigned char *>(&value);
+    m_metadata.insert(end(m_metadata), bytes, bytes + sizeof(T));
+  }
+
+  void write(const std::string &value)
+  {
+    write(uint64_t(value.size()));
+    m_metadata.insert(end(m_metadata), begin(value), end(value));
+  }
+
+  template <typename T> void write(const std::vector<T> &values)
+  {
+    write(uint64_t(values.size()));
+    for (auto &value : values) {
+      write(value);
+    }
+  }
+
+  template <typename K, typename V> void write(const std::map<K, V> &values)
+  {
+    write(uint64_t(values.size()));
+    for (auto &value : values) {
+      write(value.first);
+      write(value.second);
+    }
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_class<T>::value> write(const T &value)
+  {
+    transfer(*this, const_cast<T &>(value));
+  }
+
+  std::vector<unsigned char> m_metadata;
+  std::vector<BufferBytes> m_blobs;
+  size_t m_nBlobsSize = 0;
+};
+
+// Throws std::runtime_error when reading past the end of the metadata or of
+// the blobs, the cache file is then corrupted or truncated.
+class CacheReader
+{
+public:
+  CacheReader(const unsigned char *metadata, size_t metadataSize,
+      const unsigned char *blobs, size_t blobsSize) :
+      m_pData(metadata),
+      m_pEnd(metadata + metadataSize),
+      m_pBlobs(blobs),
+      m_nBlobsSize(blobsSize)
+  {
+  }
+
+  template <typename... Ts> void operator()(Ts &... values)
+  {
+    using expand = int[];
+    (void)expand{0, (read(values), 0)...};
+  }
+
+  BufferBytes blob()
+  {
+    uint64_t offset, size;
+    read(offset);
+    read(size);
+    if (offset > m_nBlobsSize || size > m_nBlobsSize - offset) {
+      throw std::runtime_error("Blob out of cache file");
+    }
+    return {m_pBlobs + offset, size_t(size)};
+  }
+
+private:
+  void readBytes(void *out, size_t size)
+  {
+    if (size > size_t(m_pEnd - m_pData)) {
+      throw std::runtime_error("Truncated cache metadata");
+    }
+    std::memcpy(out, m_pData, size);
+    m_pData += size;
+  }
+
+  // Sizes read from the file are checked before allocating anything
+  size_t readSize()
+  {
+    uint64_t size;
+    read(size);
+    if (size > uint64_t(m_pEnd - m_pData)) {
+      throw std::runtime_error("Truncated cache metadata");
+    }
+    return size_t(size);
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_arithmetic<T>::value> read(T &value)
+  {
+    readBytes(&value, sizeof(T));
+  }
+
+  void read(std::string &value)
+  {
+    value.resize(readSize());
+    readBytes(&value[0], value.size());
+  }
+
+  template <typename T> void read(std::vector<T> &values)
+  {
+    values.resize(readSize());
+    for (auto &value : values) {
+      read(value);
+    }
+  }
+
+  template <typename K, typename V> void read(std::map<K, V> &values)
+  {
+    const auto size = readSize();
+    values.clear();
+    for (size_t i = 0; i < size; ++i) {
+      K key;
+      read(key);
+      read(values[key]);
+    }
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_class<T>::value> read(T &value)
+  {
+    transfer(*this, value);
+  }
+
+  const unsigned char *m_pData;
+  const unsigned char *m_pEnd;
+  const unsigned char *m_pBlobs;
+  size_t m_nBlobsSize;
+};
+
+} // namespace
+
+fs::path sceneCachePath(
+    const fs::path &cacheDirectory, const fs::path &gltfFile)
+{
+  // Files with the same name in different directories get different caches
+  const auto absolutePath = fs::absolute(gltfFile).string();
+  const auto pathHash = hashBytes(
+      reinterpret_cast<const unsigned char *>(absolutePath.data()),
+      absolutePath.size());
+  char suffix[32];
+  std::snprintf(suffix, sizeof(suffix), "-%016llx.scenecache",
+      (unsigned long long)pathHash);
+  return cacheDirectory / (gltfFile.filename().string() + suffix);
+}
+
+bool loadSceneCache(const fs::path &cacheFile, const fs::path &gltfFile,
+    tinygltf::Model &model, GltfBuffers &buffers, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax)
+{
+  std::error_code error;
+  if (!fs::exists(cacheFile, error)) {
+    return false;
+  }
+
+  try {
+    MappedFile cache(cacheFile);
+
+    CacheHeader header;
+    if (cache.size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, cache.data(), sizeof(header));
+    if (header.magic != cacheMagic || header.version != cacheVersion ||
+        header.metadataSize > cache.size() - sizeof(header) ||
+        header.blobsOffset > cache.size()) {
+      return false;
+    }
+    if (header.sourceHash != hashFile(gltfFile)) {
+      return false;
+    }
+
+    CacheReader reader(cache.data() + sizeof(header),
+        size_t(header.metadataSize), cache.data() + header.blobsOffset,
+        cache.size() - size_t(header.blobsOffset));
+
+    std::vector<Dependency> dependencies;
+    reader(dependencies);
+    for (const auto &dependency : dependencies) {
+      Dependency current;
+      if (!statFile(gltfFile.parent_path() / dependency.uri, current) ||
+          current.size != dependency.size ||
+          current.modificationTime != dependency.modificationTime) {
+        return false;
+      }
+    }
+
+    tinygltf::Model cachedModel;
+    GltfBuffers cachedBuffers;
+    glm::vec3 cachedBboxMin, cachedBboxMax;
+    uint64_t bufferCount;
+    reader(cachedBboxMin, cachedBboxMax, cachedModel, bufferCount);
+    for (uint64_t i = 0; i < bufferCount; ++i) {
+      cachedBuffers.bytes.push_back(reader.blob());
+    }
+    cachedModel.buffers.resize(cachedBuffers.bytes.size());
+    // Image pixels are modified in place by later stages, so they are copied
+    // out of the mapping, whose pages are dropped right away so that the
+    // cache is not held twice in memory
+    for (auto &image : cachedModel.images) {
+      const auto pixels = reader.blob();
+      image.image.assign(pixels.data, pixels.data + pixels.size);
+      cache.evict(pixels.data, pixels.size);
+    }
+    cachedBuffers.mappedFiles.push_back(std::move(cache));
+
+    model = std::move(cachedModel);
+    buffers = std::move(cachedBuffers);
+    bboxMin = cachedBboxMin;
+    bboxMax = cachedBboxMax;
+  } catch (const std::exception &e) {
+    std::cerr << "Ignoring scene cache " << cacheFile << ": " << e.what()
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool writeSceneCache(const fs::path &cacheFile, const fs::path &gltfFile,
+    const tinygltf::Model &model, const std::vector<BufferBytes> &buffers,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax)
+{
+  CacheHeader header;
+  try {
+    header.sourceHash = hashFile(gltfFile);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return false;
+  }
+
+  CacheWriter writer;
+  writer(collectDependencies(gltfFile, model), bboxMin, bboxMax, model,
+      uint64_t(buffers.size()));
+  for (const auto &buffer : buffers) {
+    writer.blob(buffer.data, buffer.size);
+  }
+  for (const auto &image : model.images) {
+    writer.blob(image.image.data(), image.image.size());
+  }
+
+  header.magic = cacheMagic;
+  header.version = cacheVersion;
+  header.metadataSize = writer.metadata().size();
+  header.blobsOffset =
+      alignUp(sizeof(header) + writer.metadata().size(), blobAlignment);
+
+  std::error_code error;
+  fs::create_directories(cacheFile.parent_path(), error);
+
+  // Write to a temporary file and then rename it, so that a crash never
+  // leaves a partial cache file behind
+  auto temporaryFile = cacheFile;
+  temporaryFile += ".tmp";
+  {
+    std::ofstream out(temporaryFile.string(), std::ios::binary);
+    const char padding[blobAlignment] = {};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(writer.metadata().data()),
+        writer.metadata().size());
+    out.write(padding, header.blobsOffset - sizeof(header) -
+                           writer.metadata().size());
+    for (const auto &blob : writer.blobs()) {
+      out.write(reinterpret_cast<const char *>(blob.data), blob.size);
+      out.write(padding, alignUp(blob.size, blobAlignment) - blob.size);
+    }
+    if (!out) {
+      out.close();
+      fs::remove(temporaryFile, error);
+      return false;
+    }
+  }
+  fs::rename(temporaryFile, cacheFile, error);
+
+  return !error;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "filesystem.hpp"
+#include "gltf_loader.hpp"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+
+// On-disk cache of a loaded scene, in the layout the renderer consumes:
+// buffers and decoded images (with their mip chain, see mipmaps.hpp) are
+// stored as raw blobs, next to a compact binary encoding of the parts of the
+// glTF document used for rendering (no JSON) and the scene bounds. A cache
+// file is mapped on later loads so that tinygltf, image decoding, mip chain
+// generation and computeSceneBounds() are skipped.
+//
+// A cache file is only used if the content hash of the .gltf/.glb file it
+// was built from is unchanged, and if its external files (.bin, images) have
+// the same size and modification time.
+
+// Path of the cache file of gltfFile in cacheDirectory
+fs::path sceneCachePath(
+    const fs::path &cacheDirectory, const fs::path &gltfFile);
+
+// Load model from cacheFile if it is up to date with gltfFile. On success
+// model.buffers and model.images are described but their data is in buffers
+// (mapped from cacheFile) and in model.images[i].image (copied from the
+// mapping) respectively.
+bool loadSceneCache(const fs::path &cacheFile, const fs::path &gltfFile,
+    tinygltf::Model &model, GltfBuffers &buffers, glm::vec3 &bboxMin,
+    glm::vec3 &bboxMax);
+
+// Write the cache file of gltfFile. Images of model must be decoded. Return
+// false if the file cannot be written, in which case it is left untouched.
+bool writeSceneCache(const fs::path &cacheFile, const fs::path &gltfFile,
+    const tinygltf::Model &model, const std::vector<BufferBytes> &buffers,
+    const glm::vec3 &bboxMin, const glm::vec3 &bboxMax);
@@ -9,6 +9,7 @@
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 class GLShader
 {
@@ -92,12 +93,38 @@ GLShader compileShader(GLenum type, StringType &&src)
   return shader;
 }
 
+// Source with a #define line for each of defines, inserted after the
+// #version line, to compile variants of a shader
+inline std::string addShaderDefines(
+    std::string source, const std::vector<std::string> &defines)
+{
+  if (defines.empty()) {
+    return source;
+  }
+  std::string lines;
+  for (const auto &define : defines) {
+    lines += "#define " + define + "\n";
+  }
+  const auto version = source.find("#version");
+  const auto versionEnd =
+      version == std::string::npos ? version : source.find('\n', version);
+  if (version == std::string::npos) {
+    source.insert(0, lines);
+  } else if (versionEnd == std::string::npos) {
+    source += "\n" + lines;
+  } else {
+    source.insert(versionEnd + 1, lines);
+  }
+  return source;
+}
+
 // Load and compile a shader according to the following naming convention:
 // *.vs.glsl -> vertex shader
 // *.fs.glsl -> fragment shader
 // *.gs.glsl -> geometry shader
 // *.cs.glsl -> compute shader
-inline GLShader loadShader(const fs::path &shaderPath)
+inline GLShader loadShader(const fs::path &shaderPath,
+    const std::vector<std::string> &defines = {})
 {
   static auto extToShaderType =
       std::unordered_map<std::string, std::pair<GLenum, std::string>>(
@@ -117,7 +144,7 @@ inline GLShader loadShader(const fs::path &shaderPath)
             << "\n";
 
   GLShader shader{(*it).second.first};
-  shader.setSource(loadShaderSource(shaderPath));
+  shader.setSource(addShaderDefines(loadShaderSource(shaderPath), defines));
   shader.compile();
   if (!shader.getCompileStatus()) {
     std::cerr << "Shader compilation error:" << shader.getInfoLog()
@@ -243,11 +270,12 @@ template <typename CSrc> GLProgram buildComputeProgram(CSrc &&src)
   ;
 }
 
-inline GLProgram compileProgram(std::vector<fs::path> shaderPaths)
+inline GLProgram compileProgram(std::vector<fs::path> shaderPaths,
+    const std::vector<std::string> &defines = {})
 {
   GLProgram program;
   for (const auto &path : shaderPaths) {
-    auto shader = loadShader(path);
+    auto shader = loadShader(path, defines);
     program.attachShader(shader);
   }
   program.link();
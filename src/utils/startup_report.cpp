@@ -0,0 +1,132 @@
+#include "startup_report.hpp"
+#include "memory_usage.hpp"
+
+#include <fstream>
+#include <json.hpp>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+
+using clock = std::chrono::steady_clock;
+
+double toMs(clock::duration d)
+{
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// User + system time of all threads of the process
+double processCpuSeconds()
+{
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+    return 0;
+  }
+  const auto toSeconds = [](const FILETIME &time) {
+    ULARGE_INTEGER value;
+    value.LowPart = time.dwLowDateTime;
+    value.HighPart = time.dwHighDateTime;
+    return value.QuadPart * 1e-7; // 100 ns units
+  };
+  return toSeconds(kernel) + toSeconds(user);
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  const auto toSeconds = [](const timeval &time) {
+    return time.tv_sec + time.tv_usec * 1e-6;
+  };
+  return toSeconds(usage.ru_utime) + toSeconds(usage.ru_stime);
+#endif
+}
+
+} // namespace
+
+StartupReport::Phase::Phase(const StartupReport *report, std::string name) :
+    m_pReport(report && report->enabled() ? report : nullptr),
+    m_name(std::move(name)),
+    m_start(clock::now()),
+    m_startCpuSeconds(m_pReport ? processCpuSeconds() : 0)
+{
+}
+
+StartupReport::Phase::Phase(Phase &&rvalue) :
+    m_pReport(rvalue.m_pReport),
+    m_name(std::move(rvalue.m_name)),
+    m_start(rvalue.m_start),
+    m_startCpuSeconds(rvalue.m_startCpuSeconds),
+    m_nBytes(rvalue.m_nBytes)
+{
+  rvalue.m_pReport = nullptr;
+}
+
+StartupReport::Phase::~Phase() { end(); }
+
+StartupReport::Phase &StartupReport::Phase::operator=(Phase &&rvalue)
+{
+  if (this != &rvalue) {
+    end();
+    m_pReport = rvalue.m_pReport;
+    m_name = std::move(rvalue.m_name);
+    m_start = rvalue.m_start;
+    m_startCpuSeconds = rvalue.m_startCpuSeconds;
+    m_nBytes = rvalue.m_nBytes;
+    rvalue.m_pReport = nullptr;
+  }
+  return *this;
+}
+
+void StartupReport::Phase::end()
+{
+  if (!m_pReport) {
+    return;
+  }
+  const auto now = clock::now();
+  m_pReport->add({m_name, toMs(m_start - m_pReport->m_start),
+      toMs(now - m_start), 1000. * (processCpuSeconds() - m_startCpuSeconds),
+      m_nBytes});
+  m_pReport = nullptr;
+}
+
+StartupReport::StartupReport(bool enabled) :
+    m_bEnabled(enabled),
+    m_start(clock::now())
+{
+}
+
+void StartupReport::add(Record record) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_records.emplace_back(std::move(record));
+}
+
+bool StartupReport::write(const fs::path &path) const
+{
+  nlohmann::json phases = nlohmann::json::array();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto &record : m_records) {
+      phases.push_back({{"name", record.name}, {"start_ms", record.startMs},
+          {"wall_ms", record.wallMs}, {"cpu_ms", record.cpuMs},
+          {"bytes", record.bytes}});
+    }
+  }
+
+  const nlohmann::json report = {{"version", 1},
+      {"total_ms", toMs(clock::now() - m_start)},
+      {"peak_resident_bytes", peakResidentMemory()}, {"phases", phases}};
+
+  std::ofstream out(path.string());
+  out << report.dump(2) << std::endl;
+  return bool(out);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Wall time, CPU time and bytes processed by each phase of the startup of
+// the viewer, written as JSON to track startup regressions. Phases can be
+// timed from any thread, and may overlap (e.g. progressive loading).
+//
+// CPU time is the one of the whole process during the phase, so it includes
+// worker threads and exceeds wall time when they run in parallel.
+class StartupReport
+{
+public:
+  // Measure a phase until end() is called or the object is destroyed
+  class Phase
+  {
+  public:
+    // Measures nothing
+    Phase() = default;
+
+    Phase(const StartupReport *report, std::string name);
+
+    Phase(Phase &&rvalue);
+
+    ~Phase();
+
+    Phase(const Phase &) = delete;
+
+    Phase &operator=(const Phase &) = delete;
+
+    // End the current phase and take over rvalue
+    Phase &operator=(Phase &&rvalue);
+
+    void addBytes(uint64_t bytes) { m_nBytes += bytes; }
+
+    void end();
+
+  private:
+    const StartupReport *m_pReport = nullptr; // nullptr once ended or disabled
+    std::string m_name;
+    std::chrono::steady_clock::time_point m_start;
+    double m_startCpuSeconds = 0;
+    uint64_t m_nBytes = 0;
+  };
+
+  // A disabled report measures nothing
+  explicit StartupReport(bool enabled = false);
+
+  bool enabled() const { return m_bEnabled; }
+
+  Phase phase(std::string name) const { return Phase(this, std::move(name)); }
+
+  // Write all phases ended so far, with start times relative to the creation
+  // of the report
+  bool write(const fs::path &path) const;
+
+private:
+  struct Record
+  {
+    std::string name;
+    double startMs;
+    double wallMs;
+    double cpuMs;
+    uint64_t bytes;
+  };
+
+  void add(Record record) const;
+
+  bool m_bEnabled;
+  std::chrono::steady_clock::time_point m_start;
+  mutable std::mutex m_mutex;
+  mutable std::vector<Record> m_records;
+};
@@ -0,0 +1,176 @@
+#include "texture_budget.hpp"
+#include "gltf.hpp"
+#include "image_decoders.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+
+namespace
+{
+
+// World space size of the surfaces each image is read on: the largest
+// diagonal of the bounds of the drawn primitives whose material uses it
+std::vector<float> imageExtents(const tinygltf::Model &model)
+{
+  std::vector<float> extents(model.images.size(), 0.f);
+  const auto addTexture = [&](int textureIdx, float extent) {
+    if (textureIdx < 0 || textureIdx >= int(model.textures.size())) {
+      return;
+    }
+    const auto source = model.textures[textureIdx].source;
+    if (source >= 0) {
+      extents[source] = std::max(extents[source], extent);
+    }
+  };
+
+  const std::function<void(int, const glm::mat4 &)> visitNode =
+      [&](int nodeIdx, const glm::mat4 &parentMatrix) {
+        const auto &node = model.nodes[nodeIdx];
+        const auto modelMatrix = getLocalToWorldMatrix(node, parentMatrix);
+        if (node.mesh >= 0) {
+          for (const auto &primitive : model.meshes[node.mesh].primitives) {
+            const auto position = primitive.attributes.find("POSITION");
+            if (primitive.material < 0 ||
+                position == end(primitive.attributes)) {
+              continue;
+            }
+            const auto &accessor = model.accessors[position->second];
+            if (accessor.minValues.size() < 3 ||
+                accessor.maxValues.size() < 3) {
+              continue;
+            }
+            glm::vec3 bboxMin(FLT_MAX);
+            glm::vec3 bboxMax(-FLT_MAX);
+            for (int corner = 0; corner < 8; ++corner) {
+              const glm::vec4 local(
+                  (corner & 1 ? accessor.maxValues : accessor.minValues)[0],
+                  (corner & 2 ? accessor.maxValues : accessor.minValues)[1],
+                  (corner & 4 ? accessor.maxValues : accessor.minValues)[2],
+                  1);
+              const auto world = glm::vec3(modelMatrix * local);
+              bboxMin = glm::min(bboxMin, world);
+              bboxMax = glm::max(bboxMax, world);
+            }
+            const auto extent = glm::length(bboxMax - bboxMin);
+
+            const auto &material = model.materials[primitive.material];
+            const auto &pbrMetallicRoughness = material.pbrMetallicRoughness;
+            for (const auto textureIdx :
+                {pbrMetallicRoughness.baseColorTexture.index,
+                    pbrMetallicRoughness.metallicRoughnessTexture.index,
+                    material.normalTexture.index,
+                    material.occlusionTexture.index,
+                    material.emissiveTexture.index}) {
+              addTexture(textureIdx, extent);
+            }
+          }
+        }
+        for (const auto childNodeIdx : node.children) {
+          visitNode(childNodeIdx, modelMatrix);
+        }
+      };
+
+  // Only the default scene is drawn
+  if (model.defaultScene >= 0) {
+    for (const auto nodeIdx : model.scenes[model.defaultScene].nodes) {
+      visitNode(nodeIdx, glm::mat4(1));
+    }
+  }
+  return extents;
+}
+
+} // namespace
+
+std::vector<TextureSize> chooseTextureSizes(const tinygltf::Model &model,
+    const std::vector<int> &imageSources, int maxTextureSize,
+    size_t budgetBytes, double bytesPerPixel)
+{
+  std::vector<TextureSize> sizes(model.images.size());
+  // Times each image is halved
+  std::vector<int> halvings(model.images.size(), 0);
+  const auto largestSide = [&](size_t imageIdx) {
+    const auto &size = sizes[imageIdx];
+    return std::max(std::max(size.width >> halvings[imageIdx], 1),
+        std::max(size.height >> halvings[imageIdx], 1));
+  };
+  const auto textureBytes = [&](size_t imageIdx, int halvingCount) {
+    const auto &size = sizes[imageIdx];
+    const auto width = std::max(size.width >> halvingCount, 1);
+    const auto height = std::max(size.height >> halvingCount, 1);
+    return double(width) * height * bytesPerPixel * 4. / 3.;
+  };
+
+  double totalBytes = 0;
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (imageSources[i] != int(i)) {
+      continue;
+    }
+    // Images left encoded for the decoding workers only have their bytes
+    const auto &image = model.images[i];
+    auto &size = sizes[i];
+    if (image.as_is) {
+      if (!readImageSize(image.image.data(), image.image.size(), size.width,
+              size.height)) {
+        size = TextureSize();
+        continue;
+      }
+    } else {
+      size.width = std::max(image.width, 0);
+      size.height = std::max(image.height, 0);
+    }
+    while (maxTextureSize > 0 && largestSide(i) > maxTextureSize &&
+           largestSide(i) > 1) {
+      ++halvings[i];
+    }
+    totalBytes += textureBytes(i, halvings[i]);
+  }
+
+  if (budgetBytes > 0 && totalBytes > double(budgetBytes)) {
+    auto extents = imageExtents(model);
+    for (size_t i = 0; i < model.images.size(); ++i) {
+      if (imageSources[i] >= 0) {
+        extents[imageSources[i]] =
+            std::max(extents[imageSources[i]], extents[i]);
+      }
+    }
+    // Texels per world unit, highest first
+    const auto density = [&](size_t imageIdx) {
+      return extents[imageIdx] > 0
+                 ? largestSide(imageIdx) / extents[imageIdx]
+                 : std::numeric_limits<float>::max();
+    };
+    std::priority_queue<std::pair<float, size_t>> candidates;
+    for (size_t i = 0; i < model.images.size(); ++i) {
+      if (imageSources[i] == int(i) && sizes[i].width > 0) {
+        candidates.emplace(density(i), i);
+      }
+    }
+    while (totalBytes > double(budgetBytes) && !candidates.empty()) {
+      const auto imageIdx = candidates.top().second;
+      candidates.pop();
+      if (largestSide(imageIdx) / 2 < minBudgetTextureSize) {
+        continue;
+      }
+      totalBytes -= textureBytes(imageIdx, halvings[imageIdx]) -
+                    textureBytes(imageIdx, halvings[imageIdx] + 1);
+      ++halvings[imageIdx];
+      candidates.emplace(density(imageIdx), imageIdx);
+    }
+  }
+
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (imageSources[i] == int(i) && halvings[i] > 0) {
+      sizes[i].maxSize = largestSide(i);
+    }
+  }
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (imageSources[i] >= 0 && imageSources[i] != int(i)) {
+      sizes[i] = sizes[imageSources[i]];
+    }
+  }
+  return sizes;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Resolution of the textures of a scene, capped and fitted to a video memory
+// budget before images are decoded, so that the decoding workers downsample
+// them (see downscaleImage()) instead of uploading what the GPU cannot afford.
+//
+// When the budget is exceeded, the images with the most texels per world unit
+// of the surfaces they cover are halved first: they are the least likely to
+// be seen at their full resolution. Images no drawn node uses go first.
+
+struct TextureSize
+{
+  int width = 0; // Before downscaling, 0 when unknown
+  int height = 0;
+  int maxSize = 0; // Largest side once downscaled, 0 to keep the image
+};
+
+// Images are never downscaled below this size to fit the budget
+const int minBudgetTextureSize = 64;
+
+// One element per image of model. Only unique images (imageSources[i] == i,
+// see uniqueImages()) count against budgetBytes, duplicates get the size of
+// their source. maxTextureSize and budgetBytes are ignored when 0. Texels
+// take bytesPerPixel, plus a third for their mip chain.
+std::vector<TextureSize> chooseTextureSizes(const tinygltf::Model &model,
+    const std::vector<int> &imageSources, int maxTextureSize,
+    size_t budgetBytes, double bytesPerPixel);
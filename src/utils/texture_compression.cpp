@@ -0,0 +1,1009 @@
+#include "texture_compression.hpp"
+#include "hash.hpp"
+#include "mipmaps.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESSION_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+const uint32_t cacheMagic = 0x58544356; // "VCTX" little endian
+// Bump each time the layout of cache files or the output of the encoder
+// changes
+const uint32_t cacheVersion = 2;
+
+struct CacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t format;
+  int32_t sourceChannels[2];
+  uint32_t levelCount; // CacheLevel elements directly follow the header
+};
+
+struct CacheLevel
+{
+  int32_t width;
+  int32_t height;
+  uint64_t size;
+};
+
+// Pixels of a 4x4 block, one array of 16 values per channel so that 4 pixels
+// are processed at once with SSE2
+struct Block
+{
+  alignas(16) float channels[4][16];
+};
+
+void loadBlock(const unsigned char *rgba, int width, int height, int blockX,
+    int blockY, Block &block)
+{
+  for (int y = 0; y < 4; ++y) {
+    const auto pixelY = std::min(4 * blockY + y, height - 1);
+    for (int x = 0; x < 4; ++x) {
+      const auto pixelX = std::min(4 * blockX + x, width - 1);
+      const auto pixel = rgba + 4 * (size_t(pixelY) * width + pixelX);
+      for (int c = 0; c < 4; ++c) {
+        block.channels[c][4 * y + x] = pixel[c];
+      }
+    }
+  }
+}
+
+float clampByte(float value) { return std::min(std::max(value, 0.f), 255.f); }
+
+// Index of the closest entry of palette for each pixel of block, over its
+// first channelCount channels. Return the sum of squared errors.
+float selectIndices(const Block &block, int channelCount,
+    const float (*palette)[4], int paletteSize, uint8_t indices[16])
+{
+  float error = 0;
+#ifdef TEXTURE_COMPRESSION_USE_SSE2
+  for (int i = 0; i < 16; i += 4) {
+    auto bestError = _mm_set1_ps(FLT_MAX);
+    auto bestIndex = _mm_setzero_si128();
+    for (int p = 0; p < paletteSize; ++p) {
+      auto entryError = _mm_setzero_ps();
+      for (int c = 0; c < channelCount; ++c) {
+        const auto d = _mm_sub_ps(
+            _mm_load_ps(&block.channels[c][i]), _mm_set1_ps(palette[p][c]));
+        entryError = _mm_add_ps(entryError, _mm_mul_ps(d, d));
+      }
+      const auto closer =
+          _mm_castps_si128(_mm_cmplt_ps(entryError, bestError));
+      bestError = _mm_min_ps(entryError, bestError);
+      bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)),
+          _mm_andnot_si128(closer, bestIndex));
+    }
+    alignas(16) float errors[4];
+    alignas(16) int32_t bestIndices[4];
+    _mm_store_ps(errors, bestError);
+    _mm_store_si128((__m128i *)bestIndices, bestIndex);
+    for (int k = 0; k < 4; ++k) {
+      indices[i + k] = uint8_t(bestIndices[k]);
+      error += errors[k];
+    }
+  }
+#else
+  for (int i = 0; i < 16; ++i) {
+    auto bestError = FLT_MAX;
+    for (int p = 0; p < paletteSize; ++p) {
+      float entryError = 0;
+      for (int c = 0; c < channelCount; ++c) {
+        const auto d = block.channels[c][i] - palette[p][c];
+        entryError += d * d;
+      }
+      if (entryError < bestError) {
+        bestError = entryError;
+        indices[i] = uint8_t(p);
+      }
+    }
+    error += bestError;
+  }
+#endif
+  return error;
+}
+
+// Endpoints of the segment covering the pixels of block along their principal
+// axis, over its first channelCount channels
+void principalEndpoints(
+    const Block &block, int channelCount, float e0[4], float e1[4])
+{
+  float mean[4] = {}, axis[4] = {};
+  for (int c = 0; c < channelCount; ++c) {
+    float minValue = 255, maxValue = 0;
+    for (int i = 0; i < 16; ++i) {
+      mean[c] += block.channels[c][i];
+      minValue = std::min(minValue, block.channels[c][i]);
+      maxValue = std::max(maxValue, block.channels[c][i]);
+    }
+    mean[c] /= 16;
+    // The diagonal of the bounding box is a good start for power iterations
+    axis[c] = maxValue - minValue;
+  }
+
+  float covariance[4][4] = {};
+  for (int i = 0; i < 16; ++i) {
+    for (int a = 0; a < channelCount; ++a) {
+      for (int b = a; b < channelCount; ++b) {
+        covariance[a][b] += (block.channels[a][i] - mean[a]) *
+                            (block.channels[b][i] - mean[b]);
+      }
+    }
+  }
+  for (int a = 0; a < channelCount; ++a) {
+    for (int b = 0; b < a; ++b) {
+      covariance[a][b] = covariance[b][a];
+    }
+  }
+
+  for (int iteration = 0; iteration < 8; ++iteration) {
+    float next[4] = {};
+    float norm = 0;
+    for (int a = 0; a < channelCount; ++a) {
+      for (int b = 0; b < channelCount; ++b) {
+        next[a] += covariance[a][b] * axis[b];
+      }
+      norm = std::max(norm, std::abs(next[a]));
+    }
+    if (norm == 0) {
+      break;
+    }
+    for (int c = 0; c < channelCount; ++c) {
+      axis[c] = next[c] / norm;
+    }
+  }
+
+  float axisLength2 = 0;
+  for (int c = 0; c < channelCount; ++c) {
+    axisLength2 += axis[c] * axis[c];
+  }
+  float minT = 0, maxT = 0;
+  if (axisLength2 > 0) {
+    minT = FLT_MAX;
+    maxT = -FLT_MAX;
+    for (int i = 0; i < 16; ++i) {
+      float t = 0;
+      for (int c = 0; c < channelCount; ++c) {
+        t += (block.channels[c][i] - mean[c]) * axis[c];
+      }
+      minT = std::min(minT, t / axisLength2);
+      maxT = std::max(maxT, t / axisLength2);
+    }
+  }
+  for (int c = 0; c < 4; ++c) {
+    e0[c] = clampByte(mean[c] + minT * axis[c]);
+    e1[c] = clampByte(mean[c] + maxT * axis[c]);
+  }
+}
+
+// Least squares endpoints of the pixels of block, each pixel i being
+// interpolated at weights[i] from e0 to e1. Return false if they are not
+// defined (all weights equal).
+bool fitEndpoints(const Block &block, int channelCount,
+    const float weights[16], float e0[4], float e1[4])
+{
+  float a = 0, b = 0, c = 0;
+  float d0[4] = {}, d1[4] = {};
+  for (int i = 0; i < 16; ++i) {
+    const auto t = weights[i], s = 1 - t;
+    a += s * s;
+    b += s * t;
+    c += t * t;
+    for (int k = 0; k < channelCount; ++k) {
+      d0[k] += s * block.channels[k][i];
+      d1[k] += t * block.channels[k][i];
+    }
+  }
+  const auto determinant = a * c - b * b;
+  if (std::abs(determinant) < 1e-6f) {
+    return false;
+  }
+  for (int k = 0; k < channelCount; ++k) {
+    e0[k] = clampByte((c * d0[k] - b * d1[k]) / determinant);
+    e1[k] = clampByte((a * d1[k] - b * d0[k]) / determinant);
+  }
+  return true;
+}
+
+// Encode block with endpoints refined from their first estimate.
+// encode(e0, e1, candidate) quantizes the endpoints to candidate and returns
+// its error; weightsOf(candidate, weights) gives the interpolation weight of
+// each pixel.
+template <typename Candidate, typename Encode, typename WeightsOf>
+Candidate refineEndpoints(const Block &block, int channelCount, float e0[4],
+    float e1[4], const Encode &encode, const WeightsOf &weightsOf)
+{
+  Candidate best;
+  auto bestError = encode(e0, e1, best);
+  for (int iteration = 0; iteration < 2 && bestError > 0; ++iteration) {
+    float weights[16];
+    weightsOf(best, weights);
+    if (!fitEndpoints(block, channelCount, weights, e0, e1)) {
+      break;
+    }
+    Candidate candidate;
+    const auto error = encode(e0, e1, candidate);
+    if (error >= bestError) {
+      break;
+    }
+    best = candidate;
+    bestError = error;
+  }
+  return best;
+}
+
+void writeLittleEndian(uint64_t value, int byteCount, unsigned char *out)
+{
+  for (int i = 0; i < byteCount; ++i) {
+    out[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+uint64_t readLittleEndian(const unsigned char *in, int byteCount)
+{
+  uint64_t value = 0;
+  for (int i = 0; i < byteCount; ++i) {
+    value |= uint64_t(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+// BC1: two RGB565 endpoints and 2 bits per pixel selecting one of them or one
+// of the two colors in between. Only the 4 colors mode is produced, the one
+// where the first endpoint is the greatest.
+
+uint16_t packRgb565(const float color[4])
+{
+  const auto r = unsigned(std::lround(color[0] * 31 / 255));
+  const auto g = unsigned(std::lround(color[1] * 63 / 255));
+  const auto b = unsigned(std::lround(color[2] * 31 / 255));
+  return uint16_t((r << 11) | (g << 5) | b);
+}
+
+void unpackRgb565(unsigned packed, int color[4])
+{
+  const auto r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+  color[0] = int((r << 3) | (r >> 2));
+  color[1] = int((g << 2) | (g >> 4));
+  color[2] = int((b << 3) | (b >> 2));
+  color[3] = 255;
+}
+
+void bc1Palette(unsigned color0, unsigned color1, int palette[4][4])
+{
+  unpackRgb565(color0, palette[0]);
+  unpackRgb565(color1, palette[1]);
+  for (int c = 0; c < 4; ++c) {
+    if (color0 > color1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0; // Transparent black
+    }
+  }
+}
+
+struct Bc1Candidate
+{
+  uint16_t color0, color1;
+  uint8_t indices[16];
+};
+
+void encodeBC1(const Block &block, unsigned char *out)
+{
+  const auto encode = [&](const float e0[4], const float e1[4],
+                          Bc1Candidate &candidate) {
+    candidate.color0 = packRgb565(e0);
+    candidate.color1 = packRgb565(e1);
+    if (candidate.color0 < candidate.color1) {
+      std::swap(candidate.color0, candidate.color1);
+    }
+    int palette[4][4];
+    bc1Palette(candidate.color0, candidate.color1, palette);
+    float floatPalette[4][4];
+    for (int p = 0; p < 4; ++p) {
+      for (int c = 0; c < 4; ++c) {
+        floatPalette[p][c] = float(palette[p][c]);
+      }
+    }
+    // Equal endpoints select the 3 colors mode, where index 3 is black: only
+    // use the endpoint then
+    return selectIndices(block, 3, floatPalette,
+        candidate.color0 == candidate.color1 ? 1 : 4, candidate.indices);
+  };
+  const auto weightsOf = [](const Bc1Candidate &candidate, float weights[16]) {
+    static const float indexWeights[4] = {0, 1, 1 / 3.f, 2 / 3.f};
+    for (int i = 0; i < 16; ++i) {
+      weights[i] = indexWeights[candidate.indices[i]];
+    }
+  };
+
+  float e0[4], e1[4];
+  principalEndpoints(block, 3, e0, e1);
+  const auto best = refineEndpoints<Bc1Candidate>(
+      block, 3, e0, e1, encode, weightsOf);
+
+  uint64_t indexBits = 0;
+  for (int i = 0; i < 16; ++i) {
+    indexBits |= uint64_t(best.indices[i]) << (2 * i);
+  }
+  writeLittleEndian(best.color0, 2, out);
+  writeLittleEndian(best.color1, 2, out + 2);
+  writeLittleEndian(indexBits, 4, out + 4);
+}
+
+void decodeBC1(const unsigned char *in, unsigned char rgba[16][4])
+{
+  int palette[4][4];
+  bc1Palette(unsigned(readLittleEndian(in, 2)),
+      unsigned(readLittleEndian(in + 2, 2)), palette);
+  const auto indexBits = readLittleEndian(in + 4, 4);
+  for (int i = 0; i < 16; ++i) {
+    const auto index = (indexBits >> (2 * i)) & 3;
+    for (int c = 0; c < 4; ++c) {
+      rgba[i][c] = (unsigned char)palette[index][c];
+    }
+  }
+}
+
+// BC4: two 8-bit endpoints and 3 bits per pixel selecting one of them or one
+// of the 6 values in between. Only the 8 values mode is produced, the one
+// where the first endpoint is the greatest.
+
+void bc4Palette(int value0, int value1, int palette[8])
+{
+  palette[0] = value0;
+  palette[1] = value1;
+  if (value0 > value1) {
+    for (int k = 1; k < 7; ++k) {
+      palette[k + 1] = ((7 - k) * value0 + k * value1) / 7;
+    }
+  } else {
+    for (int k = 1; k < 5; ++k) {
+      palette[k + 1] = ((5 - k) * value0 + k * value1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+struct Bc4Candidate
+{
+  uint8_t value0, value1;
+  uint8_t indices[16];
+};
+
+// Encode the first channel of block
+void encodeBC4(const Block &block, unsigned char *out)
+{
+  const auto encode = [&](const float e0[4], const float e1[4],
+                          Bc4Candidate &candidate) {
+    candidate.value0 = uint8_t(std::lround(e0[0]));
+    candidate.value1 = uint8_t(std::lround(e1[0]));
+    if (candidate.value0 < candidate.value1) {
+      std::swap(candidate.value0, candidate.value1);
+    }
+    int palette[8];
+    bc4Palette(candidate.value0, candidate.value1, palette);
+    float floatPalette[8][4];
+    for (int p = 0; p < 8; ++p) {
+      floatPalette[p][0] = float(palette[p]);
+    }
+    // Equal endpoints select the 6 values mode, only use the endpoint then
+    return selectIndices(block, 1, floatPalette,
+        candidate.value0 == candidate.value1 ? 1 : 8, candidate.indices);
+  };
+  const auto weightsOf = [](const Bc4Candidate &candidate, float weights[16]) {
+    for (int i = 0; i < 16; ++i) {
+      const auto index = candidate.indices[i];
+      weights[i] = index < 2 ? float(index) : (index - 1) / 7.f;
+    }
+  };
+
+  float e0[4] = {}, e1[4] = {};
+  principalEndpoints(block, 1, e0, e1);
+  const auto best = refineEndpoints<Bc4Candidate>(
+      block, 1, e0, e1, encode, weightsOf);
+
+  uint64_t indexBits = 0;
+  for (int i = 0; i < 16; ++i) {
+    indexBits |= uint64_t(best.indices[i]) << (3 * i);
+  }
+  out[0] = best.value0;
+  out[1] = best.value1;
+  writeLittleEndian(indexBits, 6, out + 2);
+}
+
+void decodeBC4(const unsigned char *in, unsigned char values[16])
+{
+  int palette[8];
+  bc4Palette(in[0], in[1], palette);
+  const auto indexBits = readLittleEndian(in + 2, 6);
+  for (int i = 0; i < 16; ++i) {
+    values[i] = (unsigned char)palette[(indexBits >> (3 * i)) & 7];
+  }
+}
+
+// BC7 mode 6: a single pair of RGBA endpoints, 7 bits per channel plus one
+// shared low bit (p-bit) per endpoint, and 4 bits per pixel selecting one of
+// 16 interpolated colors. The index of the first pixel has an implicit 0 high
+// bit.
+
+const int bc7Weights[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+void quantizeBC7Endpoint(const float endpoint[4], uint8_t values[4], int &pBit)
+{
+  auto bestError = FLT_MAX;
+  for (int p = 0; p < 2; ++p) {
+    uint8_t candidate[4];
+    float error = 0;
+    for (int c = 0; c < 4; ++c) {
+      const auto v = std::min(
+          std::max(std::lround((endpoint[c] - p) / 2), long(0)), long(127));
+      candidate[c] = uint8_t(v);
+      const auto d = float(2 * v + p) - endpoint[c];
+      error += d * d;
+    }
+    if (error < bestError) {
+      bestError = error;
+      pBit = p;
+      std::memcpy(values, candidate, 4);
+    }
+  }
+}
+
+void bc7Palette(const uint8_t values0[4], int pBit0, const uint8_t values1[4],
+    int pBit1, int palette[16][4])
+{
+  for (int c = 0; c < 4; ++c) {
+    const auto a = 2 * values0[c] + pBit0, b = 2 * values1[c] + pBit1;
+    for (int k = 0; k < 16; ++k) {
+      palette[k][c] =
+          ((64 - bc7Weights[k]) * a + bc7Weights[k] * b + 32) >> 6;
+    }
+  }
+}
+
+struct Bc7Candidate
+{
+  uint8_t values[2][4];
+  int pBits[2];
+  uint8_t indices[16];
+};
+
+// Little endian stream of bits, as BC7 blocks are laid out
+class BitWriter
+{
+public:
+  explicit BitWriter(unsigned char *out) : m_pOut(out)
+  {
+    std::memset(out, 0, 16);
+  }
+
+  void write(unsigned value, int bitCount)
+  {
+    for (int i = 0; i < bitCount; ++i, ++m_nPosition) {
+      if ((value >> i) & 1) {
+        m_pOut[m_nPosition / 8] |= (unsigned char)(1 << (m_nPosition % 8));
+      }
+    }
+  }
+
+private:
+  unsigned char *m_pOut;
+  int m_nPosition = 0;
+};
+
+class BitReader
+{
+public:
+  explicit BitReader(const unsigned char *in) : m_pIn(in) {}
+
+  unsigned read(int bitCount)
+  {
+    unsigned value = 0;
+    for (int i = 0; i < bitCount; ++i, ++m_nPosition) {
+      value |= unsigned((m_pIn[m_nPosition / 8] >> (m_nPosition % 8)) & 1)
+               << i;
+    }
+    return value;
+  }
+
+private:
+  const unsigned char *m_pIn;
+  int m_nPosition = 0;
+};
+
+void encodeBC7(const Block &block, unsigned char *out)
+{
+  const auto encode = [&](const float e0[4], const float e1[4],
+                          Bc7Candidate &candidate) {
+    quantizeBC7Endpoint(e0, candidate.values[0], candidate.pBits[0]);
+    quantizeBC7Endpoint(e1, candidate.values[1], candidate.pBits[1]);
+    int palette[16][4];
+    bc7Palette(candidate.values[0], candidate.pBits[0], candidate.values[1],
+        candidate.pBits[1], palette);
+    float floatPalette[16][4];
+    for (int p = 0; p < 16; ++p) {
+      for (int c = 0; c < 4; ++c) {
+        floatPalette[p][c] = float(palette[p][c]);
+      }
+    }
+    return selectIndices(block, 4, floatPalette, 16, candidate.indices);
+  };
+  const auto weightsOf = [](const Bc7Candidate &candidate, float weights[16]) {
+    for (int i = 0; i < 16; ++i) {
+      weights[i] = bc7Weights[candidate.indices[i]] / 64.f;
+    }
+  };
+
+  float e0[4], e1[4];
+  principalEndpoints(block, 4, e0, e1);
+  auto best = refineEndpoints<Bc7Candidate>(
+      block, 4, e0, e1, encode, weightsOf);
+
+  // The high bit of the first index is implicitly 0, swap the endpoints if
+  // it is set
+  if (best.indices[0] >= 8) {
+    std::swap(best.values[0], best.values[1]);
+    std::swap(best.pBits[0], best.pBits[1]);
+    for (auto &index : best.indices) {
+      index = uint8_t(15 - index);
+    }
+  }
+
+  BitWriter writer(out);
+  writer.write(1 << 6, 7); // Mode 6
+  for (int c = 0; c < 4; ++c) {
+    writer.write(best.values[0][c], 7);
+    writer.write(best.values[1][c], 7);
+  }
+  writer.write(unsigned(best.pBits[0]), 1);
+  writer.write(unsigned(best.pBits[1]), 1);
+  writer.write(best.indices[0], 3);
+  for (int i = 1; i < 16; ++i) {
+    writer.write(best.indices[i], 4);
+  }
+}
+
+// Blocks of other modes than 6 decode to transparent black
+void decodeBC7(const unsigned char *in, unsigned char rgba[16][4])
+{
+  BitReader reader(in);
+  if (reader.read(7) != 1 << 6) {
+    std::memset(rgba, 0, 16 * 4);
+    return;
+  }
+  uint8_t values[2][4];
+  for (int c = 0; c < 4; ++c) {
+    values[0][c] = uint8_t(reader.read(7));
+    values[1][c] = uint8_t(reader.read(7));
+  }
+  const auto pBit0 = int(reader.read(1));
+  const auto pBit1 = int(reader.read(1));
+  int palette[16][4];
+  bc7Palette(values[0], pBit0, values[1], pBit1, palette);
+  for (int i = 0; i < 16; ++i) {
+    const auto index = reader.read(i == 0 ? 3 : 4);
+    for (int c = 0; c < 4; ++c) {
+      rgba[i][c] = (unsigned char)palette[index][c];
+    }
+  }
+}
+
+// Block with the given channels of block moved to its first channels
+Block selectChannels(const Block &block, const int *channels, int count)
+{
+  Block selected;
+  for (int c = 0; c < count; ++c) {
+    std::memcpy(selected.channels[c], block.channels[channels[c]],
+        sizeof(selected.channels[c]));
+  }
+  return selected;
+}
+
+bool isMipmapFilter(int filter)
+{
+  return filter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_NEAREST ||
+         filter == TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR ||
+         filter == TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_NEAREST ||
+         filter == TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR;
+}
+
+} // namespace
+
+const char *blockFormatName(BlockFormat format)
+{
+  switch (format) {
+  case BlockFormat::BC1:
+    return "BC1";
+  case BlockFormat::BC4:
+    return "BC4";
+  case BlockFormat::BC5:
+    return "BC5";
+  case BlockFormat::BC7:
+    return "BC7";
+  }
+  return "unknown";
+}
+
+size_t blockBytes(BlockFormat format)
+{
+  return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+size_t compressedLevelSize(BlockFormat format, int width, int height)
+{
+  return size_t((width + 3) / 4) * size_t((height + 3) / 4) *
+         blockBytes(format);
+}
+
+BlockEncoding chooseBlockEncoding(
+    unsigned usedChannels, bool hasTransparentPixels, bool bc1Supported)
+{
+  BlockEncoding encoding;
+  if (hasTransparentPixels && (usedChannels & ChannelAlpha)) {
+    encoding.format = BlockFormat::BC7;
+    return encoding;
+  }
+
+  int colorChannels[3];
+  int colorChannelCount = 0;
+  for (int c = 0; c < 3; ++c) {
+    if (usedChannels & (1u << c)) {
+      colorChannels[colorChannelCount++] = c;
+    }
+  }
+  if (colorChannelCount == 1) {
+    encoding.format = BlockFormat::BC4;
+    encoding.sourceChannels[0] = colorChannels[0];
+  } else if (colorChannelCount == 2) {
+    // Twice the bits of BC1 for two channels, and no crosstalk between them
+    // (e.g. roughness and metalness)
+    encoding.format = BlockFormat::BC5;
+    encoding.sourceChannels[0] = colorChannels[0];
+    encoding.sourceChannels[1] = colorChannels[1];
+  } else {
+    encoding.format = bc1Supported ? BlockFormat::BC1 : BlockFormat::BC7;
+  }
+  return encoding;
+}
+
+bool hasTransparentPixels(const unsigned char *rgba, size_t pixelCount)
+{
+  for (size_t i = 0; i < pixelCount; ++i) {
+    if (rgba[4 * i + 3] != 255) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<ImageUsage> imageUsages(const tinygltf::Model &model)
+{
+  std::vector<ImageUsage> usages(model.images.size());
+  const auto use = [&](int textureIdx, unsigned channels) {
+    if (textureIdx < 0 || size_t(textureIdx) >= model.textures.size()) {
+      return;
+    }
+    const auto source = model.textures[textureIdx].source;
+    if (source >= 0 && size_t(source) < usages.size()) {
+      usages[source].channels |= channels;
+    }
+  };
+  const auto rgb = ChannelRed | ChannelGreen | ChannelBlue;
+  for (const auto &material : model.materials) {
+    const auto &pbr = material.pbrMetallicRoughness;
+    // Alpha of opaque materials is ignored
+    use(pbr.baseColorTexture.index,
+        material.alphaMode == "OPAQUE" ? rgb : unsigned(AllChannels));
+    // Roughness in green, metalness in blue
+    use(pbr.metallicRoughnessTexture.index, ChannelGreen | ChannelBlue);
+    use(material.occlusionTexture.index, ChannelRed);
+    use(material.emissiveTexture.index, rgb);
+  }
+
+  // Color is stored in sRGB
+  for (const auto &material : model.materials) {
+    for (const auto textureIdx :
+        {material.pbrMetallicRoughness.baseColorTexture.index,
+            material.emissiveTexture.index}) {
+      if (textureIdx >= 0 && size_t(textureIdx) < model.textures.size()) {
+        const auto source = model.textures[textureIdx].source;
+        if (source >= 0 && size_t(source) < usages.size()) {
+          usages[source].srgb = true;
+        }
+      }
+    }
+  }
+
+  // Samplers without a minification filter get a mipmap one, images only
+  // referenced by textures with a non mipmap filter need no mip chain
+  std::vector<bool> mipmapsUnused(model.images.size(), true);
+  for (const auto &texture : model.textures) {
+    if (texture.source < 0 || size_t(texture.source) >= usages.size()) {
+      continue;
+    }
+    const auto minFilter = texture.sampler >= 0
+                               ? model.samplers[texture.sampler].minFilter
+                               : -1;
+    if (minFilter == -1 || isMipmapFilter(minFilter)) {
+      mipmapsUnused[texture.source] = false;
+    }
+  }
+
+  for (size_t i = 0; i < usages.size(); ++i) {
+    if (usages[i].channels == 0) {
+      usages[i].channels = AllChannels;
+    }
+    usages[i].mipmaps = !mipmapsUnused[i];
+  }
+  return usages;
+}
+
+std::vector<int> uniqueImages(
+    const tinygltf::Model &model, std::vector<ImageUsage> &usages)
+{
+  std::vector<bool> referenced(model.images.size(), false);
+  for (const auto &texture : model.textures) {
+    if (texture.source >= 0 && size_t(texture.source) < referenced.size()) {
+      referenced[texture.source] = true;
+    }
+  }
+
+  // Unique images by hash, compared byte per byte on collisions
+  std::unordered_map<uint64_t, std::vector<int>> imagesByHash;
+  std::vector<int> sources(model.images.size(), -1);
+  for (size_t i = 0; i < model.images.size(); ++i) {
+    if (!referenced[i]) {
+      continue;
+    }
+    sources[i] = int(i);
+    const auto &image = model.images[i];
+    if (image.image.empty()) {
+      continue; // Not loaded, nothing to compare
+    }
+    const uint64_t key[] = {
+        hashBytes(image.image.data(), image.image.size()),
+        uint64_t(image.width), uint64_t(image.height), uint64_t(image.bits),
+        uint64_t(usages[i].srgb)};
+    auto &candidates = imagesByHash[hashBytes(
+        reinterpret_cast<const unsigned char *>(key), sizeof(key))];
+    for (const auto candidate : candidates) {
+      const auto &other = model.images[candidate];
+      if (other.width == image.width && other.height == image.height &&
+          other.bits == image.bits &&
+          usages[candidate].srgb == usages[i].srgb &&
+          other.image == image.image) {
+        sources[i] = candidate;
+        auto &usage = usages[candidate];
+        usage.channels |= usages[i].channels;
+        usage.mipmaps = usage.mipmaps || usages[i].mipmaps;
+        break;
+      }
+    }
+    if (sources[i] == int(i)) {
+      candidates.push_back(int(i));
+    }
+  }
+  return sources;
+}
+
+void compressBlocks(const unsigned char *rgba, int width, int height,
+    const BlockEncoding &encoding, unsigned char *blocks)
+{
+  const auto blockSize = blockBytes(encoding.format);
+  const auto blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+  Block block;
+  for (int y = 0; y < blocksY; ++y) {
+    for (int x = 0; x < blocksX; ++x) {
+      loadBlock(rgba, width, height, x, y, block);
+      switch (encoding.format) {
+      case BlockFormat::BC1:
+        encodeBC1(block, blocks);
+        break;
+      case BlockFormat::BC4:
+        encodeBC4(selectChannels(block, encoding.sourceChannels, 1), blocks);
+        break;
+      case BlockFormat::BC5:
+        encodeBC4(selectChannels(block, encoding.sourceChannels, 1), blocks);
+        encodeBC4(
+            selectChannels(block, encoding.sourceChannels + 1, 1), blocks + 8);
+        break;
+      case BlockFormat::BC7:
+        encodeBC7(block, blocks);
+        break;
+      }
+      blocks += blockSize;
+    }
+  }
+}
+
+void decompressBlocks(const unsigned char *blocks, int width, int height,
+    const BlockEncoding &encoding, unsigned char *rgba)
+{
+  const auto blockSize = blockBytes(encoding.format);
+  const auto blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+  unsigned char decoded[16][4];
+  for (int y = 0; y < blocksY; ++y) {
+    for (int x = 0; x < blocksX; ++x) {
+      switch (encoding.format) {
+      case BlockFormat::BC1:
+        decodeBC1(blocks, decoded);
+        break;
+      case BlockFormat::BC4:
+      case BlockFormat::BC5: {
+        for (int i = 0; i < 16; ++i) {
+          decoded[i][0] = decoded[i][1] = decoded[i][2] = 0;
+          decoded[i][3] = 255;
+        }
+        const auto channelCount = encoding.format == BlockFormat::BC4 ? 1 : 2;
+        for (int k = 0; k < channelCount; ++k) {
+          unsigned char values[16];
+          decodeBC4(blocks + 8 * k, values);
+          for (int i = 0; i < 16; ++i) {
+            decoded[i][encoding.sourceChannels[k]] = values[i];
+          }
+        }
+        break;
+      }
+      case BlockFormat::BC7:
+        decodeBC7(blocks, decoded);
+        break;
+      }
+      blocks += blockSize;
+
+      for (int py = 0; py < 4 && 4 * y + py < height; ++py) {
+        for (int px = 0; px < 4 && 4 * x + px < width; ++px) {
+          std::memcpy(
+              rgba + 4 * (size_t(4 * y + py) * width + 4 * x + px),
+              decoded[4 * py + px], 4);
+        }
+      }
+    }
+  }
+}
+
+CompressedTexture compressTexture(const unsigned char *rgba, int width,
+    int height, int levelCount, const BlockEncoding &encoding)
+{
+  CompressedTexture texture;
+  texture.encoding = encoding;
+  for (const auto &level : mipChainLayout(width, height, 4, levelCount)) {
+    const auto size =
+        compressedLevelSize(encoding.format, level.width, level.height);
+    const auto offset = texture.data.size();
+    texture.data.resize(offset + size);
+    compressBlocks(rgba + level.offset, level.width, level.height, encoding,
+        texture.data.data() + offset);
+    texture.levels.push_back({level.width, level.height, offset, size});
+  }
+  return texture;
+}
+
+fs::path compressedTexturePath(const fs::path &cacheDirectory,
+    const unsigned char *rgba, int width, int height, int levelCount,
+    const BlockEncoding &encoding)
+{
+  const auto levels = mipChainLayout(width, height, 4, levelCount);
+  const uint64_t key[] = {
+      hashBytes(rgba, levels.back().offset + levels.back().size),
+      uint64_t(width), uint64_t(height), uint64_t(levelCount),
+      uint64_t(encoding.format), uint64_t(encoding.sourceChannels[0]),
+      uint64_t(encoding.sourceChannels[1]), cacheVersion};
+  const auto hash =
+      hashBytes(reinterpret_cast<const unsigned char *>(key), sizeof(key));
+  char name[64];
+  std::snprintf(name, sizeof(name), "%016llx-%s.texcache",
+      (unsigned long long)hash, blockFormatName(encoding.format));
+  return cacheDirectory / name;
+}
+
+bool loadCompressedTexture(const fs::path &file, CompressedTexture &texture)
+{
+  std::ifstream in(file.string(), std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  CacheHeader header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != cacheMagic || header.version != cacheVersion ||
+      header.levelCount == 0 || header.levelCount > 32) {
+    return false;
+  }
+
+  CompressedTexture loaded;
+  loaded.encoding.format = BlockFormat(header.format);
+  if (std::string(blockFormatName(loaded.encoding.format)) == "unknown") {
+    return false;
+  }
+  for (int c = 0; c < 2; ++c) {
+    if (header.sourceChannels[c] < 0 || header.sourceChannels[c] > 3) {
+      return false;
+    }
+    loaded.encoding.sourceChannels[c] = header.sourceChannels[c];
+  }
+
+  size_t dataSize = 0;
+  for (uint32_t i = 0; i < header.levelCount; ++i) {
+    CacheLevel level;
+    if (!in.read(reinterpret_cast<char *>(&level), sizeof(level)) ||
+        level.width <= 0 || level.height <= 0 ||
+        level.size != compressedLevelSize(
+                          loaded.encoding.format, level.width, level.height)) {
+      return false;
+    }
+    loaded.levels.push_back(
+        {level.width, level.height, dataSize, size_t(level.size)});
+    dataSize += size_t(level.size);
+  }
+
+  loaded.data.resize(dataSize);
+  if (!in.read(reinterpret_cast<char *>(loaded.data.data()), dataSize)) {
+    return false;
+  }
+  texture = std::move(loaded);
+  return true;
+}
+
+bool writeCompressedTexture(
+    const fs::path &file, const CompressedTexture &texture)
+{
+  CacheHeader header;
+  header.magic = cacheMagic;
+  header.version = cacheVersion;
+  header.format = uint32_t(texture.encoding.format);
+  header.sourceChannels[0] = texture.encoding.sourceChannels[0];
+  header.sourceChannels[1] = texture.encoding.sourceChannels[1];
+  header.levelCount = uint32_t(texture.levels.size());
+
+  std::error_code error;
+  fs::create_directories(file.parent_path(), error);
+
+  // Write to a temporary file and then rename it, so that a crash never leaves
+  // a partial file behind. Identical images may be written by several threads
+  // at once, each gets its own temporary file.
+  auto temporaryFile = file;
+  temporaryFile += "." +
+                   std::to_string(std::hash<std::thread::id>()(
+                       std::this_thread::get_id())) +
+                   ".tmp";
+  {
+    std::ofstream out(temporaryFile.string(), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &level : texture.levels) {
+      const CacheLevel cacheLevel = {
+          level.width, level.height, uint64_t(level.size)};
+      out.write(
+          reinterpret_cast<const char *>(&cacheLevel), sizeof(cacheLevel));
+    }
+    out.write(reinterpret_cast<const char *>(texture.data.data()),
+        texture.data.size());
+    if (!out) {
+      out.close();
+      fs::remove(temporaryFile, error);
+      return false;
+    }
+  }
+  fs::rename(temporaryFile, file, error);
+
+  return !error;
+}
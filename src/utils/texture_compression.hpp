@@ -0,0 +1,127 @@
+#pragma once
+
+#include "filesystem.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Block compression of RGBA8 images to the BCn formats GPUs sample directly,
+// at a fraction of the memory and bandwidth of GL_RGBA8: each 4x4 block of
+// pixels is encoded in 8 (BC1, BC4) or 16 (BC5, BC7) bytes.
+//
+// Encoding is much slower than decoding an image, so compressed textures are
+// meant to be cached on disk (see compressedTexturePath()).
+
+enum class BlockFormat : uint32_t
+{
+  BC1 = 1, // RGB, 4 bits per pixel
+  BC4 = 4, // One channel, 4 bits per pixel
+  BC5 = 5, // Two channels, 8 bits per pixel
+  BC7 = 7  // RGBA, 8 bits per pixel. Only mode 6 is produced.
+};
+
+const char *blockFormatName(BlockFormat format);
+
+// Bytes of one 4x4 block
+size_t blockBytes(BlockFormat format);
+
+// Bytes of a compressed width x height image, partial blocks included
+size_t compressedLevelSize(BlockFormat format, int width, int height);
+
+// Channels of an image, as bits
+enum ImageChannel : unsigned
+{
+  ChannelRed = 1,
+  ChannelGreen = 2,
+  ChannelBlue = 4,
+  ChannelAlpha = 8,
+  AllChannels = 15
+};
+
+// How an image is stored in blocks
+struct BlockEncoding
+{
+  BlockFormat format = BlockFormat::BC7;
+  // Channels of the image (0 to 3 for red to alpha) stored in the red and
+  // green channels of BC4 (red only) and BC5 blocks
+  int sourceChannels[2] = {0, 1};
+};
+
+// Encoding keeping the channels an image is read from, among usedChannels.
+// Alpha is only kept if the image has transparent pixels. Opaque color goes to
+// BC1 if bc1Supported, one or two channels to BC4 or BC5, the rest to BC7.
+BlockEncoding chooseBlockEncoding(
+    unsigned usedChannels, bool hasTransparentPixels, bool bc1Supported);
+
+bool hasTransparentPixels(const unsigned char *rgba, size_t pixelCount);
+
+// How the materials of a model read an image
+struct ImageUsage
+{
+  unsigned channels = 0; // ImageChannel bits
+  bool mipmaps = false;  // Sampled by a texture with a mipmap filter
+  bool srgb = false;     // Read as color (base color or emissive)
+  int maxSize = 0;       // Largest side once downscaled, 0 to keep its size
+};
+
+// One element per image of model. Images only referenced by textures the
+// renderer ignores (normal maps) get all channels. Textures without a
+// minification filter are sampled with mipmaps.
+std::vector<ImageUsage> imageUsages(const tinygltf::Model &model);
+
+// For each image of model, the image its texture object is created from:
+// itself, or the first image with the same bytes (encoded or decoded) and the
+// same color space, whose element of usages gets the channels and mipmaps of
+// the duplicate. -1 for images no texture references.
+std::vector<int> uniqueImages(
+    const tinygltf::Model &model, std::vector<ImageUsage> &usages);
+
+// A compressed image with its mip levels
+struct CompressedTexture
+{
+  struct Level
+  {
+    int width;
+    int height;
+    size_t offset; // In data
+    size_t size;
+  };
+
+  BlockEncoding encoding;
+  std::vector<Level> levels;      // Largest first
+  std::vector<unsigned char> data; // All levels, one after the other
+
+  bool empty() const { return levels.empty(); }
+};
+
+// Compress width x height RGBA8 pixels to compressedLevelSize() bytes of
+// blocks. Pixels past the edges of the image are clamped.
+void compressBlocks(const unsigned char *rgba, int width, int height,
+    const BlockEncoding &encoding, unsigned char *blocks);
+
+// Inverse of compressBlocks(), to measure the quality of the encoder. Missing
+// channels of BC4 and BC5 are set to 0, alpha to 255.
+void decompressBlocks(const unsigned char *blocks, int width, int height,
+    const BlockEncoding &encoding, unsigned char *rgba);
+
+// Compress the levelCount first levels of the mip chain of an RGBA8 image,
+// laid out in rgba as mipChainLayout() describes
+CompressedTexture compressTexture(const unsigned char *rgba, int width,
+    int height, int levelCount, const BlockEncoding &encoding);
+
+// Cache file of the compressed texture of the levelCount first levels of the
+// mip chain rgba in cacheDirectory. The name is a hash of the pixels and of
+// how they are compressed, so that edited images get a new file.
+fs::path compressedTexturePath(const fs::path &cacheDirectory,
+    const unsigned char *rgba, int width, int height, int levelCount,
+    const BlockEncoding &encoding);
+
+// Return false if file does not exist or is not a valid cache file
+bool loadCompressedTexture(const fs::path &file, CompressedTexture &texture);
+
+// Return false if the file cannot be written, in which case it is left
+// untouched
+bool writeCompressedTexture(
+    const fs::path &file, const CompressedTexture &texture);
@@ -0,0 +1,46 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+  threadCount = std::max(threadCount, size_t(1));
+  for (size_t i = 0; i < threadCount; ++i) {
+    m_threads.emplace_back([this]() { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_condition.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+size_t ThreadPool::defaultThreadCount()
+{
+  // hardware_concurrency() is allowed to return 0 when it cannot tell
+  return std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+}
+
+void ThreadPool::workerLoop()
+{
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [&]() { return m_stopping || !m_tasks.empty(); });
+      if (m_tasks.empty()) {
+        return; // Stopping and nothing left to do
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
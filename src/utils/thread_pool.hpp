@@ -0,0 +1,56 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads consuming a FIFO queue of tasks
+class ThreadPool
+{
+public:
+  // Default to one thread per hardware core
+  explicit ThreadPool(size_t threadCount = defaultThreadCount());
+
+  // Wait for queued tasks to complete, then join all threads
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t threadCount() const { return m_threads.size(); }
+
+  // Queue f() for execution on a worker thread. The returned future holds its
+  // result, or the exception it has thrown.
+  template <typename Function>
+  auto submit(Function &&f) -> std::future<decltype(f())>
+  {
+    using Result = decltype(f());
+    // std::function requires copyable callables, packaged_task is move-only
+    const auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::forward<Function>(f));
+    auto future = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.emplace_back([task]() { (*task)(); });
+    }
+    m_condition.notify_one();
+    return future;
+  }
+
+  static size_t defaultThreadCount();
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> m_threads;
+  std::deque<std::function<void()>> m_tasks;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_stopping = false;
+};
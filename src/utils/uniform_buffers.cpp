@@ -0,0 +1,155 @@
+#include "uniform_buffers.hpp"
+
+#include "node_table.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// Binding points of the blocks, the material buffer and the draws of
+// MultiDrawScene being at shader storage bindings 0 and 1
+const GLuint frameBinding = 0;
+const GLuint objectBinding = 2;
+// Vertex buffer binding of the draw indices, after the instance attributes
+const GLuint drawBinding = 4;
+const GLuint drawIndicesLocation = 10;
+
+// Element of the Objects block (std430 layout)
+struct GpuObject
+{
+  float modelMatrix[16];
+  float normalMatrix[16]; // Of the upper 3x3 of modelMatrix, in a mat4
+};
+
+static_assert(sizeof(FrameUniforms) == 160, "Frame block is 160 bytes");
+static_assert(offsetof(FrameUniforms, lightIntensity) == 144,
+    "Frame block members follow std140 offsets");
+
+} // namespace
+
+UniformBuffers::UniformBuffers(const NodeTable &nodes)
+{
+  m_firstObjects.assign(nodes.size(), 0);
+  for (const auto entry : nodes.meshEntries()) {
+    m_firstObjects[entry] = uint32_t(m_nObjectCount);
+    m_nObjectCount += nodes.instanceCount(entry);
+  }
+
+  glGenBuffers(1, &m_frameBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, m_frameBuffer);
+  glBufferStorage(GL_UNIFORM_BUFFER, GLsizeiptr(sizeof(FrameUniforms)),
+      nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  // Not empty, since binding an empty buffer is an error
+  glGenBuffers(1, &m_objectBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER,
+      GLsizeiptr(std::max(m_nObjectCount, size_t(1)) * sizeof(GpuObject)),
+      nullptr, GL_DYNAMIC_STORAGE_BIT);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  updateObjects(nodes);
+
+  glGenBuffers(1, &m_drawBuffer);
+}
+
+UniformBuffers::~UniformBuffers()
+{
+  glDeleteBuffers(1, &m_frameBuffer);
+  glDeleteBuffers(1, &m_objectBuffer);
+  glDeleteBuffers(1, &m_drawBuffer);
+}
+
+std::vector<std::string> UniformBuffers::shaderDefines()
+{
+  return {"UNIFORM_BUFFERS"};
+}
+
+void UniformBuffers::setupVertexArray()
+{
+  glVertexAttribIFormat(drawIndicesLocation, 2, GL_INT, 0);
+  glVertexAttribBinding(drawIndicesLocation, drawBinding);
+  glVertexBindingDivisor(drawBinding, 1);
+}
+
+void UniformBuffers::enableVertexArray(bool enable)
+{
+  if (enable) {
+    glEnableVertexAttribArray(drawIndicesLocation);
+  } else {
+    glDisableVertexAttribArray(drawIndicesLocation);
+  }
+}
+
+void UniformBuffers::setupProgram(GLuint program) const
+{
+  const auto frameBlock = glGetUniformBlockIndex(program, "Frame");
+  if (frameBlock != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program, frameBlock, frameBinding);
+  }
+  const auto objectBlock =
+      glGetProgramResourceIndex(program, GL_SHADER_STORAGE_BLOCK, "Objects");
+  if (objectBlock != GL_INVALID_INDEX) {
+    glShaderStorageBlockBinding(program, objectBlock, objectBinding);
+  }
+}
+
+void UniformBuffers::updateFrame(const FrameUniforms &frame)
+{
+  glBindBuffer(GL_UNIFORM_BUFFER, m_frameBuffer);
+  glBufferSubData(
+      GL_UNIFORM_BUFFER, 0, GLsizeiptr(sizeof(FrameUniforms)), &frame);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void UniformBuffers::updateObjects(const NodeTable &nodes)
+{
+  if (!m_nObjectCount) {
+    return;
+  }
+  std::vector<GpuObject> objects(m_nObjectCount);
+  for (const auto entry : nodes.meshEntries()) {
+    for (size_t instance = 0; instance < nodes.instanceCount(entry);
+         ++instance) {
+      const auto &modelMatrix = nodes.instanceWorldMatrix(entry, instance);
+      const auto normalMatrix =
+          glm::mat4(glm::transpose(glm::inverse(glm::mat3(modelMatrix))));
+      auto &object = objects[m_firstObjects[entry] + instance];
+      std::memcpy(object.modelMatrix, &modelMatrix[0][0], sizeof(glm::mat4));
+      std::memcpy(object.normalMatrix, &normalMatrix[0][0], sizeof(glm::mat4));
+    }
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_objectBuffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+      GLsizeiptr(objects.size() * sizeof(GpuObject)), objects.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void UniformBuffers::uploadDraws(const std::vector<DrawIndices> &draws)
+{
+  // Orphan the storage read by the draws of the previous pass
+  glBindBuffer(GL_ARRAY_BUFFER, m_drawBuffer);
+  glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(draws.size() * sizeof(DrawIndices)),
+      draws.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void UniformBuffers::bind() const
+{
+  glBindBufferBase(GL_UNIFORM_BUFFER, frameBinding, m_frameBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, objectBinding, m_objectBuffer);
+}
+
+void UniformBuffers::bindDraws(size_t firstDraw) const
+{
+  glBindVertexBuffer(drawBinding, m_drawBuffer,
+      GLintptr(firstDraw * sizeof(DrawIndices)), GLsizei(sizeof(DrawIndices)));
+}
+
+void UniformBuffers::unbind() const
+{
+  glBindBufferBase(GL_UNIFORM_BUFFER, frameBinding, 0);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, objectBinding, 0);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+class NodeTable;
+
+// Values of the Frame uniform block (std140 layout), the same for every draw
+// of a frame
+struct FrameUniforms
+{
+  glm::mat4 viewMatrix;
+  glm::mat4 projMatrix;
+  glm::vec4 lightDirection; // In view space, w is ignored
+  glm::vec3 lightIntensity;
+  int32_t applyOcclusion;
+};
+
+// Object (see UniformBuffers::objectIndex()) and material (see MaterialTable)
+// of a draw, read by the shaders from a per instance vertex attribute
+struct DrawIndices
+{
+  int32_t object;
+  int32_t material;
+};
+
+// Per frame and per object shader inputs kept in buffers, so that draws only
+// change textures and vertex arrays instead of uploading uniforms:
+// - the camera and light of the frame, in the Frame uniform block,
+// - the model and normal matrices of each node instance, in the Objects shader
+//   storage block, only written when world matrices change,
+// - the object and material of each draw of a pass, uploaded at once and read
+//   as a per instance attribute, so that runs of draws of the same primitive
+//   are also drawn instanced.
+// Materials themselves are read from a MaterialTable.
+//
+// All member functions must be called on the thread owning the GL context.
+class UniformBuffers
+{
+public:
+  // Objects of the instances of the mesh entries of nodes
+  explicit UniformBuffers(const NodeTable &nodes);
+
+  ~UniformBuffers();
+
+  UniformBuffers(const UniformBuffers &) = delete;
+
+  UniformBuffers &operator=(const UniformBuffers &) = delete;
+
+  // UNIFORM_BUFFERS
+  static std::vector<std::string> shaderDefines();
+
+  // Set the format of the draw indices attribute (location 10) of the bound
+  // vertex array, read from what bindDraws() binds. It is left disabled.
+  static void setupVertexArray();
+
+  // Enable the draw indices attribute of the bound vertex array for the draws
+  // of UNIFORM_BUFFERS programs, which call bindDraws(), or disable it for the
+  // other programs
+  static void enableVertexArray(bool enable);
+
+  // Connect the Frame and Objects blocks of program to what bind() binds
+  void setupProgram(GLuint program) const;
+
+  size_t objectCount() const { return m_nObjectCount; }
+
+  // Object of an instance of a mesh entry of NodeTable
+  int32_t objectIndex(size_t entry, size_t instance) const
+  {
+    return int32_t(m_firstObjects[entry] + instance);
+  }
+
+  void updateFrame(const FrameUniforms &frame);
+
+  // Upload the world matrices of nodes again, once they changed
+  void updateObjects(const NodeTable &nodes);
+
+  // Replace the draws of the previous pass
+  void uploadDraws(const std::vector<DrawIndices> &draws);
+
+  void bind() const;
+
+  // Instance 0 of the next draws reads draw firstDraw
+  void bindDraws(size_t firstDraw) const;
+
+  void unbind() const;
+
+private:
+  GLuint m_frameBuffer = 0;
+  GLuint m_objectBuffer = 0;
+  GLuint m_drawBuffer = 0;
+  std::vector<uint32_t> m_firstObjects; // Indexed by NodeTable entry
+  size_t m_nObjectCount = 0;
+};
@@ -0,0 +1,525 @@
+#include "virtual_textures.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+
+const uint32_t noTile = UINT32_MAX;
+
+// Tiles left for requested pages besides the mip tails
+const size_t minimumFreeTiles = 64;
+
+// Texture units of bind()
+enum VirtualTextureUnit
+{
+  PageCacheUnit,
+  PageTableUnit,
+  LevelTableUnit,
+  ImageTableUnit
+};
+
+int pagesAlong(int size)
+{
+  return (size + VirtualTextureCache::pageSize - 1) /
+         VirtualTextureCache::pageSize;
+}
+
+int wrap(int coordinate, int size)
+{
+  const auto wrapped = coordinate % size;
+  return wrapped < 0 ? wrapped + size : wrapped;
+}
+
+// Buffer texture of count values of format, filled with values
+void createBufferTexture(GLuint &bufferObject, GLuint &textureObject,
+    GLenum format, const std::vector<uint32_t> &values)
+{
+  glGenBuffers(1, &bufferObject);
+  glBindBuffer(GL_TEXTURE_BUFFER, bufferObject);
+  // Empty buffers cannot back a texture
+  const std::vector<uint32_t> empty(4, 0);
+  const auto &data = values.empty() ? empty : values;
+  glBufferData(GL_TEXTURE_BUFFER, data.size() * sizeof(uint32_t), data.data(),
+      GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glGenTextures(1, &textureObject);
+  glBindTexture(GL_TEXTURE_BUFFER, textureObject);
+  glTexBuffer(GL_TEXTURE_BUFFER, format, bufferObject);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+bool isSignaled(GLsync fence)
+{
+  const auto status = glClientWaitSync(fence, 0, 0);
+  return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+}
+
+} // namespace
+
+VirtualTextureCache::VirtualTextureCache(
+    size_t budgetBytes, size_t maxImages)
+{
+  GLint maxTextureSize = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+  const auto maxSide = size_t(maxTextureSize / tileSize);
+  const auto tileBytes = size_t(tileSize) * tileSize * 4;
+  auto tiles = budgetBytes / tileBytes;
+  if (tiles < maxImages + minimumFreeTiles) {
+    tiles = maxImages + minimumFreeTiles;
+    std::clog << "Virtual texture budget raised to "
+              << tiles * tileBytes / (1024 * 1024)
+              << " MB, to hold the mip tail of every image" << std::endl;
+  }
+  tiles = std::min(tiles, maxSide * maxSide);
+
+  m_nCacheColumns = int(std::min(tiles, maxSide));
+  const auto rows = GLsizei(tiles / m_nCacheColumns);
+  glGenTextures(1, &m_cacheTexture);
+  glBindTexture(GL_TEXTURE_2D, m_cacheTexture);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, m_nCacheColumns * tileSize,
+      rows * tileSize);
+  // Levels are selected by the shaders, and filtering stays in a tile thanks
+  // to its border
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_tilePages.assign(size_t(m_nCacheColumns) * rows, noTile);
+  for (auto tile = uint32_t(m_tilePages.size()); tile-- > 0;) {
+    m_freeTiles.push_back(tile);
+  }
+  for (auto &readback : m_readbacks) {
+    glGenBuffers(1, &readback.bufferObject);
+  }
+}
+
+VirtualTextureCache::~VirtualTextureCache()
+{
+  for (auto &readback : m_readbacks) {
+    if (readback.fence) {
+      glDeleteSync(readback.fence);
+    }
+    glDeleteBuffers(1, &readback.bufferObject);
+  }
+  glDeleteFramebuffers(1, &m_feedbackFramebuffer);
+  glDeleteTextures(1, &m_feedbackTexture);
+  glDeleteRenderbuffers(1, &m_feedbackDepth);
+  glDeleteTextures(1, &m_imageTexture);
+  glDeleteBuffers(1, &m_imageBuffer);
+  glDeleteTextures(1, &m_levelTexture);
+  glDeleteBuffers(1, &m_levelBuffer);
+  glDeleteTextures(1, &m_pageTableTexture);
+  glDeleteBuffers(1, &m_pageTableBuffer);
+  glDeleteTextures(1, &m_cacheTexture);
+}
+
+int VirtualTextureCache::addImage(const tinygltf::Image &image)
+{
+  if (image.width <= 0 || image.height <= 0 || image.component != 4 ||
+      image.bits != 8 ||
+      storedMipLevelCount(image) != mipLevelCount(image.width, image.height)) {
+    return -1;
+  }
+
+  Image virtualImage;
+  virtualImage.pixels = image.image;
+  virtualImage.levels = mipChainLayout(image.width, image.height, 4,
+      mipLevelCount(image.width, image.height));
+  virtualImage.tailLevel = -1;
+  virtualImage.dirty = false;
+  auto pageCount = m_pageTiles.size();
+  for (size_t i = 0; i < virtualImage.levels.size(); ++i) {
+    const auto &level = virtualImage.levels[i];
+    const auto pages =
+        size_t(pagesAlong(level.width)) * pagesAlong(level.height);
+    if (pages == 1 && virtualImage.tailLevel < 0) {
+      virtualImage.tailLevel = int(i);
+    }
+    virtualImage.firstPage.push_back(uint32_t(pageCount));
+    pageCount += pages;
+  }
+  m_pageTiles.resize(pageCount, noTile);
+  m_pageLru.resize(pageCount, m_lru.end());
+  m_pageLastUse.resize(pageCount, 0);
+
+  m_images.push_back(std::move(virtualImage));
+  return int(m_images.size() - 1);
+}
+
+void VirtualTextureCache::finishImages()
+{
+  std::vector<uint32_t> levelTable;
+  std::vector<uint32_t> imageTable;
+  for (const auto &image : m_images) {
+    imageTable.push_back(uint32_t(image.levels[0].width));
+    imageTable.push_back(uint32_t(image.levels[0].height));
+    imageTable.push_back(uint32_t(image.levels.size()));
+    imageTable.push_back(uint32_t(levelTable.size()));
+    levelTable.insert(
+        end(levelTable), begin(image.firstPage), end(image.firstPage));
+  }
+  createBufferTexture(m_levelBuffer, m_levelTexture, GL_R32UI, levelTable);
+  createBufferTexture(m_imageBuffer, m_imageTexture, GL_RGBA32UI, imageTable);
+
+  // Mip tails are never evicted, so that every page has a fallback
+  m_pageTable.assign(2 * m_pageTiles.size(), 0);
+  for (uint32_t i = 0; i < m_images.size(); ++i) {
+    const auto &image = m_images[i];
+    const auto page = image.firstPage[image.tailLevel];
+    const auto tile = m_freeTiles.back();
+    m_freeTiles.pop_back();
+    loadPage(page, tile);
+    m_pageTiles[page] = tile;
+    m_tilePages[tile] = page;
+    ++m_nResidentPages;
+    updatePageTable(i);
+    m_images[i].dirty = false;
+  }
+  createBufferTexture(
+      m_pageTableBuffer, m_pageTableTexture, GL_RG32UI, m_pageTable);
+}
+
+VirtualTextureCache::PageAddress VirtualTextureCache::pageAddress(
+    uint32_t page) const
+{
+  const auto image = std::upper_bound(begin(m_images), end(m_images), page,
+                         [](uint32_t page, const Image &image) {
+                           return page < image.firstPage[0];
+                         }) -
+                     1;
+  const auto level =
+      std::upper_bound(begin(image->firstPage), end(image->firstPage), page) -
+      begin(image->firstPage) - 1;
+  const auto index = int(page - image->firstPage[level]);
+  const auto pagesX = pagesAlong(image->levels[level].width);
+  return {uint32_t(image - begin(m_images)), int(level), index % pagesX,
+      index / pagesX};
+}
+
+uint32_t VirtualTextureCache::parentPage(const PageAddress &address) const
+{
+  const auto &image = m_images[address.image];
+  const auto &parent = image.levels[address.level + 1];
+  const auto pagesX = pagesAlong(parent.width);
+  const auto pagesY = pagesAlong(parent.height);
+  return image.firstPage[address.level + 1] +
+         std::min(address.y / 2, pagesY - 1) * pagesX +
+         std::min(address.x / 2, pagesX - 1);
+}
+
+void VirtualTextureCache::setupProgram(GLuint program) const
+{
+  const struct
+  {
+    const char *name;
+    GLint unit;
+  } samplers[] = {{"uPageCache", PageCacheUnit},
+      {"uPageTable", PageTableUnit}, {"uVirtualLevels", LevelTableUnit},
+      {"uVirtualImages", ImageTableUnit}};
+  for (const auto &sampler : samplers) {
+    const auto location = glGetUniformLocation(program, sampler.name);
+    if (location >= 0) {
+      glProgramUniform1i(program, location, sampler.unit);
+    }
+  }
+}
+
+void VirtualTextureCache::bind() const
+{
+  glActiveTexture(GL_TEXTURE0 + PageCacheUnit);
+  glBindTexture(GL_TEXTURE_2D, m_cacheTexture);
+  glBindSampler(PageCacheUnit, 0);
+  glActiveTexture(GL_TEXTURE0 + PageTableUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, m_pageTableTexture);
+  glActiveTexture(GL_TEXTURE0 + LevelTableUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, m_levelTexture);
+  glActiveTexture(GL_TEXTURE0 + ImageTableUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, m_imageTexture);
+}
+
+void VirtualTextureCache::unbind() const
+{
+  for (const auto unit : {PageTableUnit, LevelTableUnit, ImageTableUnit}) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+  glActiveTexture(GL_TEXTURE0 + PageCacheUnit);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTextureCache::beginFeedback(
+    GLsizei windowWidth, GLsizei windowHeight)
+{
+  const auto width = std::max(windowWidth / feedbackScale, 1);
+  const auto height = std::max(windowHeight / feedbackScale, 1);
+  if (width != m_nFeedbackWidth || height != m_nFeedbackHeight) {
+    glDeleteFramebuffers(1, &m_feedbackFramebuffer);
+    glDeleteTextures(1, &m_feedbackTexture);
+    glDeleteRenderbuffers(1, &m_feedbackDepth);
+
+    // Image index + 1 (0 where no virtual texture is sampled), and level and
+    // coordinates of the page
+    glGenTextures(1, &m_feedbackTexture);
+    glBindTexture(GL_TEXTURE_2D, m_feedbackTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenRenderbuffers(1, &m_feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_feedbackDepth);
+    glRenderbufferStorage(
+        GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_feedbackFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+        m_feedbackTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_RENDERBUFFER, m_feedbackDepth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cerr << "Virtual texture feedback framebuffer is not complete"
+                << std::endl;
+    }
+    m_nFeedbackWidth = width;
+    m_nFeedbackHeight = height;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, m_feedbackFramebuffer);
+  glViewport(0, 0, width, height);
+  const GLuint noPage[4] = {0, 0, 0, 0};
+  glClearBufferuiv(GL_COLOR, 0, noPage);
+  glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTextureCache::endFeedback()
+{
+  // A readback never consumed by update() is dropped
+  auto &readback = m_readbacks[m_nNextReadback];
+  if (readback.fence) {
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.bufferObject);
+  if (readback.width != m_nFeedbackWidth ||
+      readback.height != m_nFeedbackHeight) {
+    glBufferData(GL_PIXEL_PACK_BUFFER,
+        size_t(m_nFeedbackWidth) * m_nFeedbackHeight * 2 * sizeof(uint32_t),
+        nullptr, GL_STREAM_READ);
+    readback.width = m_nFeedbackWidth;
+    readback.height = m_nFeedbackHeight;
+  }
+  // Only queues the copy into the buffer, mapped once the fence is signaled
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glReadPixels(0, 0, m_nFeedbackWidth, m_nFeedbackHeight, GL_RG_INTEGER,
+      GL_UNSIGNED_INT, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  m_nNextReadback = (m_nNextReadback + 1) % readbackCount;
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VirtualTextureCache::update(size_t maxLoads)
+{
+  // From the oldest readback, keep the last one the GPU is done with
+  Readback *ready = nullptr;
+  for (size_t i = 0; i < readbackCount; ++i) {
+    auto &readback = m_readbacks[(m_nNextReadback + i) % readbackCount];
+    if (!readback.fence || !isSignaled(readback.fence)) {
+      continue;
+    }
+    if (ready) {
+      glDeleteSync(ready->fence);
+      ready->fence = nullptr;
+    }
+    ready = &readback;
+  }
+  if (ready) {
+    const auto pixelCount = size_t(ready->width) * ready->height;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ready->bufferObject);
+    const auto feedback = (const uint32_t *)glMapBufferRange(
+        GL_PIXEL_PACK_BUFFER, 0, pixelCount * 2 * sizeof(uint32_t),
+        GL_MAP_READ_BIT);
+    if (feedback) {
+      requestPages(feedback, pixelCount);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteSync(ready->fence);
+    ready->fence = nullptr;
+  }
+
+  m_nLoadedPages = 0;
+  while (!m_pendingPages.empty() && m_nLoadedPages < maxLoads) {
+    const auto page = m_pendingPages.back();
+    m_pendingPages.pop_back();
+    if (m_pageTiles[page] != noTile) {
+      continue;
+    }
+
+    uint32_t tile = noTile;
+    if (!m_freeTiles.empty()) {
+      tile = m_freeTiles.back();
+      m_freeTiles.pop_back();
+    } else if (!m_lru.empty() && m_pageLastUse[m_lru.back()] != m_nFrame) {
+      const auto evicted = m_lru.back();
+      m_lru.pop_back();
+      tile = m_pageTiles[evicted];
+      m_pageTiles[evicted] = noTile;
+      m_pageLru[evicted] = m_lru.end();
+      m_images[pageAddress(evicted).image].dirty = true;
+      --m_nResidentPages;
+    } else {
+      // Every tile holds a page of the last feedback: the budget is too small
+      // for the view, finer pages wait for the next feedback
+      m_pendingPages.clear();
+      break;
+    }
+
+    loadPage(page, tile);
+    m_pageTiles[page] = tile;
+    m_tilePages[tile] = page;
+    m_lru.push_front(page);
+    m_pageLru[page] = m_lru.begin();
+    m_images[pageAddress(page).image].dirty = true;
+    ++m_nResidentPages;
+    ++m_nLoadedPages;
+  }
+
+  glBindBuffer(GL_TEXTURE_BUFFER, m_pageTableBuffer);
+  for (uint32_t i = 0; i < m_images.size(); ++i) {
+    auto &image = m_images[i];
+    if (!image.dirty) {
+      continue;
+    }
+    updatePageTable(i);
+    const auto first = image.firstPage[0];
+    const auto last = i + 1 < m_images.size() ? m_images[i + 1].firstPage[0]
+                                              : uint32_t(m_pageTiles.size());
+    glBufferSubData(GL_TEXTURE_BUFFER, 2 * first * sizeof(uint32_t),
+        2 * (last - first) * sizeof(uint32_t), &m_pageTable[2 * first]);
+    image.dirty = false;
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void VirtualTextureCache::requestPages(
+    const uint32_t *feedback, size_t pixelCount)
+{
+  m_requests.clear();
+  for (size_t i = 0; i < pixelCount; ++i) {
+    const auto imageIdx = feedback[2 * i];
+    if (imageIdx == 0 || imageIdx > m_images.size()) {
+      continue;
+    }
+    const auto &image = m_images[imageIdx - 1];
+    const auto packed = feedback[2 * i + 1];
+    const auto level = std::min(int(packed >> 24), image.tailLevel);
+    const auto x = int(packed & 0xFFFu);
+    const auto y = int((packed >> 12) & 0xFFFu);
+    const auto pagesX = pagesAlong(image.levels[level].width);
+    const auto pagesY = pagesAlong(image.levels[level].height);
+    if (level == image.tailLevel) {
+      m_requests.push_back(image.firstPage[level]);
+    } else if (x < pagesX && y < pagesY) {
+      m_requests.push_back(image.firstPage[level] + y * pagesX + x);
+    }
+  }
+  std::sort(begin(m_requests), end(m_requests));
+  m_requests.erase(
+      std::unique(begin(m_requests), end(m_requests)), end(m_requests));
+  m_nRequestedPages = m_requests.size();
+
+  // Requested pages and the coarser ones covering them, which are their
+  // fallback while they are not loaded
+  ++m_nFrame;
+  std::vector<std::pair<int, uint32_t>> missing; // Level and page
+  for (const auto request : m_requests) {
+    auto page = uint32_t(request);
+    while (m_pageLastUse[page] != m_nFrame) {
+      m_pageLastUse[page] = m_nFrame;
+      const auto address = pageAddress(page);
+      if (m_pageTiles[page] == noTile) {
+        missing.emplace_back(address.level, page);
+      } else if (m_pageLru[page] != m_lru.end()) {
+        m_lru.splice(begin(m_lru), m_lru, m_pageLru[page]);
+      }
+      if (address.level >= m_images[address.image].tailLevel) {
+        break;
+      }
+      page = parentPage(address);
+    }
+  }
+
+  // Loaded from the back: coarsest levels first
+  std::sort(begin(missing), end(missing));
+  m_pendingPages.clear();
+  for (const auto &page : missing) {
+    m_pendingPages.push_back(page.second);
+  }
+}
+
+void VirtualTextureCache::loadPage(uint32_t page, uint32_t tile)
+{
+  const auto address = pageAddress(page);
+  const auto &image = m_images[address.image];
+  const auto &level = image.levels[address.level];
+  const auto texels = image.pixels.data() + level.offset;
+
+  // Texels past the edges of the level wrap around, as with GL_REPEAT
+  m_tileTexels.resize(size_t(tileSize) * tileSize * 4);
+  const auto originX = address.x * pageSize - 1;
+  const auto originY = address.y * pageSize - 1;
+  for (int y = 0; y < tileSize; ++y) {
+    const auto row =
+        texels + size_t(wrap(originY + y, level.height)) * level.width * 4;
+    auto out = m_tileTexels.data() + size_t(y) * tileSize * 4;
+    for (int x = 0; x < tileSize; ++x) {
+      std::memcpy(out + 4 * x, row + 4 * wrap(originX + x, level.width), 4);
+    }
+  }
+
+  glBindTexture(GL_TEXTURE_2D, m_cacheTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, int(tile % m_nCacheColumns) * tileSize,
+      int(tile / m_nCacheColumns) * tileSize, tileSize, tileSize, GL_RGBA,
+      GL_UNSIGNED_BYTE, m_tileTexels.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTextureCache::updatePageTable(uint32_t imageIdx)
+{
+  const auto &image = m_images[imageIdx];
+  // From the mip tail, which is always resident, to the first level: pages
+  // that are not resident use the entry of their parent
+  for (auto level = image.tailLevel; level >= 0; --level) {
+    const auto pagesX = pagesAlong(image.levels[level].width);
+    const auto pagesY = pagesAlong(image.levels[level].height);
+    for (int y = 0; y < pagesY; ++y) {
+      for (int x = 0; x < pagesX; ++x) {
+        const auto page = image.firstPage[level] + y * pagesX + x;
+        const auto tile = m_pageTiles[page];
+        auto entry = &m_pageTable[2 * size_t(page)];
+        if (tile != noTile) {
+          entry[0] = (tile % m_nCacheColumns) |
+                     (tile / m_nCacheColumns) << 12 | uint32_t(level) << 24;
+          entry[1] = uint32_t(x) | uint32_t(y) << 16;
+        } else {
+          const auto parent = parentPage({imageIdx, level, x, y});
+          entry[0] = m_pageTable[2 * size_t(parent)];
+          entry[1] = m_pageTable[2 * size_t(parent) + 1];
+        }
+      }
+    }
+  }
+  // Levels past the mip tail sample it
+  const auto tail = 2 * size_t(image.firstPage[image.tailLevel]);
+  for (auto level = size_t(image.tailLevel) + 1; level < image.levels.size();
+       ++level) {
+    const auto page = 2 * size_t(image.firstPage[level]);
+    m_pageTable[page] = m_pageTable[tail];
+    m_pageTable[page + 1] = m_pageTable[tail + 1];
+  }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include "mipmaps.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <glad/glad.h>
+#include <list>
+#include <tiny_gltf.h>
+#include <vector>
+
+// Virtual texturing: the mip chains of images stay in client memory, split in
+// pages of pageSize x pageSize texels, and only the pages the camera needs are
+// resident in the tiles of a single atlas texture (the page cache) whose size
+// is fixed by a memory budget, whatever the size of the scene.
+//
+// Each frame, a low resolution feedback pass (virtual_texture_feedback.fs)
+// writes the page each pixel samples. Its result is read back asynchronously
+// a few frames later by update(), which loads missing pages (coarser ones
+// first) into free tiles or into the least recently used ones. The page table
+// (a buffer texture) gives shaders the tile of each page, or the one of the
+// closest coarser resident page covering it, so that pages never requested or
+// not loaded yet are sampled from a blurrier level. The coarsest page of each
+// image (its mip tail) is always resident.
+//
+// Shaders sample virtual images with virtualTexel() of the material shaders,
+// reading the textures bound by bind(). All member functions must be called
+// on the thread owning the GL context.
+class VirtualTextureCache
+{
+public:
+  static const int pageSize = 128;
+  // Tiles have a border of one texel around their page for bilinear filtering
+  static const int tileSize = pageSize + 2;
+  // Resolution divisor of the feedback pass
+  static const int feedbackScale = 8;
+
+  // Page cache of about budgetBytes, at least the mip tail of maxImages images
+  VirtualTextureCache(size_t budgetBytes, size_t maxImages);
+
+  ~VirtualTextureCache();
+
+  VirtualTextureCache(const VirtualTextureCache &) = delete;
+
+  VirtualTextureCache &operator=(const VirtualTextureCache &) = delete;
+
+  // Copy the pixels of image, RGBA8 with its full mip chain (see
+  // generateMipChain()), and return its index in the shaders, or -1 if image
+  // cannot be virtualized
+  int addImage(const tinygltf::Image &image);
+
+  // Once all images are added, create the page table and load their mip tails
+  void finishImages();
+
+  size_t imageCount() const { return m_images.size(); }
+
+  size_t pageCount() const { return m_pageTiles.size(); }
+
+  size_t tileCount() const { return m_tilePages.size(); }
+
+  size_t residentPageCount() const { return m_nResidentPages; }
+
+  size_t cacheBytes() const { return tileCount() * tileSize * tileSize * 4; }
+
+  // Pages requested by the last feedback read back, and loaded since then
+  size_t requestedPageCount() const { return m_nRequestedPages; }
+
+  size_t loadedPageCount() const { return m_nLoadedPages; }
+
+  // Connect the samplers of program to what bind() binds
+  void setupProgram(GLuint program) const;
+
+  // Bind the page cache and the tables to the first texture units
+  void bind() const;
+
+  void unbind() const;
+
+  // Bind and clear the feedback framebuffer, sized after the window
+  void beginFeedback(GLsizei windowWidth, GLsizei windowHeight);
+
+  // Start reading back the feedback of this frame, and bind the default
+  // framebuffer
+  void endFeedback();
+
+  // Read the most recent feedback the GPU is done with, and load up to
+  // maxLoads of the pages it requests
+  void update(size_t maxLoads);
+
+private:
+  struct Image
+  {
+    std::vector<unsigned char> pixels; // Mip chain
+    std::vector<MipLevel> levels;    // Layout of the chain in pixels
+    int tailLevel;                   // First level held by a single page
+    std::vector<uint32_t> firstPage; // Global index, per level
+    bool dirty;                      // Its page table entries changed
+  };
+
+  struct Readback
+  {
+    GLuint bufferObject = 0;
+    GLsync fence = nullptr;
+    GLsizei width = 0;
+    GLsizei height = 0;
+  };
+
+  // Page of a level of an image
+  struct PageAddress
+  {
+    uint32_t image;
+    int level;
+    int x;
+    int y;
+  };
+
+  PageAddress pageAddress(uint32_t page) const;
+
+  // Page of the next level covering the same texels
+  uint32_t parentPage(const PageAddress &address) const;
+
+  void requestPages(const uint32_t *feedback, size_t pixelCount);
+
+  // Copy the texels of page, and its border, into tile
+  void loadPage(uint32_t page, uint32_t tile);
+
+  void updatePageTable(uint32_t image);
+
+  std::vector<Image> m_images;
+
+  GLuint m_cacheTexture = 0;
+  int m_nCacheColumns = 0; // Tiles per row of the atlas
+  std::vector<uint32_t> m_tilePages; // Page of each tile, or UINT32_MAX
+  std::vector<uint32_t> m_freeTiles;
+
+  // Per page, its tile or UINT32_MAX, and its place in m_lru when resident
+  std::vector<uint32_t> m_pageTiles;
+  std::vector<std::list<uint32_t>::iterator> m_pageLru;
+  std::vector<uint64_t> m_pageLastUse; // Frame of the last request
+  std::list<uint32_t> m_lru; // Evictable resident pages, most recent first
+  size_t m_nResidentPages = 0;
+
+  // Buffer textures read by the shaders
+  GLuint m_pageTableBuffer = 0;
+  GLuint m_pageTableTexture = 0; // RG32UI per page
+  GLuint m_levelBuffer = 0;
+  GLuint m_levelTexture = 0; // R32UI first page of each level of each image
+  GLuint m_imageBuffer = 0;
+  GLuint m_imageTexture = 0; // RGBA32UI width, height, levels, first level
+  std::vector<uint32_t> m_pageTable; // Client copy, 2 values per page
+
+  GLuint m_feedbackFramebuffer = 0;
+  GLuint m_feedbackTexture = 0;
+  GLuint m_feedbackDepth = 0;
+  GLsizei m_nFeedbackWidth = 0;
+  GLsizei m_nFeedbackHeight = 0;
+  static const size_t readbackCount = 3;
+  Readback m_readbacks[readbackCount];
+  size_t m_nNextReadback = 0;
+  std::vector<uint32_t> m_requests; // Sorted requested pages, reused
+
+  uint64_t m_nFrame = 0;
+  size_t m_nRequestedPages = 0;
+  size_t m_nLoadedPages = 0;
+  std::vector<uint32_t> m_pendingPages; // Requested, not resident yet
+  std::vector<unsigned char> m_tileTexels;
+};